@@ -1,3 +1,3 @@
 @echo off
-clang main.c src/cisp.c src/map.c src/console.c -o cisp.exe -O0 -gfull -g3 -Wall -Wno-switch -Wno-microsoft-enum-forward-reference -Wno-unused-variable -Wno-unused-function
+clang main.c src/cisp.c src/map.c src/console.c src/code.c src/opt.c src/ir.c src/vm.c src/rc.c src/gc.c src/list.c src/native.c src/lib.c src/sched.c src/co.c src/stats.c src/prof.c -o cisp.exe -O0 -gfull -g3 -Wall -Wno-switch -Wno-microsoft-enum-forward-reference -Wno-unused-variable -Wno-unused-function
 @echo on
\ No newline at end of file
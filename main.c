@@ -1,32 +1,311 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "src/cisp.h"
 #include "src/console.h"
+#include "src/lib.h"
+
+// prints the result of running code in ctx or the runtime errors. names is the context that compiled the code
+static int report(cs_Context* ctx, cs_Context* names, cs_Value result)
+{
+    if (ctx->error_count > 0) {
+        for (u32 i = 0; i < ctx->error_count; i++) {
+            printf("ERROR: %s\n", cs_get_error_string_at(ctx, i));
+        }
+        return -1;
+    }
+    cs_Writer w = cs_writer_init(stdout);
+    cs_print_value(names, &w, result);
+    cs_write(&w, "\n", 1);
+    cs_writer_free(&w);
+    return 0;
+}
+
+// runs the code and prints the result or the runtime errors
+static int run(cs_Context* ctx, cs_Code* code)
+{
+    return report(ctx, ctx, cs_run(ctx, code));
+}
+
+// like run, sampling it into file.folded with --profile
+static int run_profiled(cs_Context* ctx, cs_Code* code, char* path)
+{
+    cs_Profile profile;
+    cs_profile_start(ctx, &profile);
+    cs_Value result = cs_run(ctx, code);
+    cs_profile_stop(ctx);
+
+    char* profile_path = cs_profile_path(path);
+    FILE* f;
+    if (fopen_s(&f, profile_path, "w") != 0) {
+        log_warn("The profile could not be written to \"%s\".", profile_path);
+    } else {
+        cs_Writer w = cs_writer_init(f);
+        cs_profile_write(&profile, &w);
+        cs_writer_free(&w);
+        fclose(f);
+        log_info("%u samples written to \"%s\".", profile.sample_count, profile_path);
+    }
+    free(profile_path);
+    cs_profile_free(&profile);
+    return report(ctx, ctx, result);
+}
+
+static char* read_file(char* path, u32* len)
+{
+    FILE* f;
+    errno_t err = fopen_s(&f, path, "r");
+    if (err != 0) {
+        log_fatal("Datei \"%s\" konnte nicht geöffnet werden.", path);
+        return null;
+    }
+    fseek(f, 0, SEEK_END);
+    u32 file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* content = cs_malloc(file_size+1);
+    u32 real_size = fread_s(content, file_size, 1, file_size, f);
+    content[real_size] = 0;
+    fclose(f);
+    *len = real_size;
+    return content;
+}
+
+// --pgo-gen writes what the code counted into file.pgo
+static void write_counts(cs_BlockCounts* counts, char* path)
+{
+    char* counts_path = cs_counts_path(path);
+    FILE* f;
+    if (fopen_s(&f, counts_path, "w") != 0) {
+        log_warn("The block counts could not be written to \"%s\".", counts_path);
+    } else {
+        cs_Writer w = cs_writer_init(f);
+        cs_counts_write(counts, &w);
+        cs_writer_free(&w);
+        fclose(f);
+    }
+    free(counts_path);
+}
+
+// the counts --pgo-gen wrote for this source into file.pgo, false if there are none
+static bool read_counts(cs_BlockCounts* counts, char* path, char* content, u32 len)
+{
+    char* counts_path = cs_counts_path(path);
+    FILE* f;
+    if (fopen_s(&f, counts_path, "r") != 0) {
+        log_warn("There are no block counts at \"%s\", run with --pgo-gen first.", counts_path);
+        free(counts_path);
+        return false;
+    }
+    fclose(f);
+    u32 data_len;
+    char* data = read_file(counts_path, &data_len);
+    bool ok = data != null && cs_counts_read(counts, data, fnv1a(content, content + len));
+    if (data != null && !ok) log_warn("The block counts at \"%s\" are broken or for another version of the source.", counts_path);
+    free(data);
+    free(counts_path);
+    return ok;
+}
+
+// runs the file's code like --profile says and writes the counts of --pgo-gen
+static int run_file(cs_Context* ctx, cs_Code* code, char* path, bool profile)
+{
+    int status = profile ? run_profiled(ctx, code, path) : run(ctx, code);
+    if (ctx->counts != null) write_counts(ctx->counts, path);
+    return status;
+}
+
+// reuses the compiled code of the last run if the source didn't change, null if it has errors.
+// collecting stats and compiling with or for block counts always compiles, counting code isn't cached
+static cs_Code* load_or_compile(cs_Context* ctx, char* path, char* content, u32 len, bool dump_ir)
+{
+    char* code_path = cs_code_path(path);
+    bool compile = dump_ir || ctx->stats != null || ctx->counts != null || ctx->pgo != null;
+    cs_Code* code = compile ? null : cs_code_load(code_path, content, len);
+    if (code != null && ((code->flags & CS_CODE_RC) != 0) != (ctx->memory == CS_MEMORY_RC)) {
+        // cached for the other memory mode
+        cs_code_free(code);
+        code = null;
+    }
+    if (code == null) {
+        code = cs_compile_file(ctx, content, len);
+        for (u32 i = 0; i < ctx->error_count; i++) {
+            printf("ERROR: %s\n", cs_get_error_string_at(ctx, i));
+        }
+        if (code != null && dump_ir) {
+            cs_Writer w = cs_writer_init(stdout);
+            cs_ir_dump(ctx, &w);
+            cs_writer_free(&w);
+        }
+        if (code != null && !(code->flags & CS_CODE_COUNTED) && !cs_code_write(code, code_path)) {
+            log_warn("Compiled code could not be cached at \"%s\".", code_path);
+        }
+    }
+    return code;
+}
+
+// every file runs copies times, all of them at once as isolates on jobs worker threads.
+// the isolates of a file share its code
+static int run_isolates(char** paths, u32 path_count, u32 copies, cs_Memory memory, u32 jobs)
+{
+    u32 count = path_count * copies;
+    cs_Context* contexts = cs_malloc(sizeof(cs_Context) * count);
+    cs_Isolate* isolates = cs_calloc(count, sizeof(cs_Isolate));
+    for (u32 i = 0; i < path_count; i++) {
+        u32 len;
+        char* content = read_file(paths[i], &len);
+        if (content == null) return -1;
+        for (u32 j = i * copies; j < (i + 1) * copies; j++) {
+            contexts[j] = cs_init();
+            contexts[j].memory = memory;
+            contexts[j].jobs = jobs;
+            cs_lib_open(&contexts[j]);
+        }
+        cs_Code* code = load_or_compile(&contexts[i * copies], paths[i], content, len, false);
+        if (code == null) return -1;
+        for (u32 j = i * copies; j < (i + 1) * copies; j++) {
+            isolates[j] = (cs_Isolate) { .c = &contexts[j], .code = code };
+        }
+    }
+
+    cs_Isolates* pool = cs_isolates_init(jobs);
+    for (u32 i = 0; i < count; i++) cs_isolate_spawn(pool, &isolates[i]);
+    cs_isolates_wait(pool);
+    int status = 0;
+    for (u32 i = 0; i < count; i++) {
+        if (report(isolates[i].c, &contexts[i / copies * copies], isolates[i].result) != 0) status = -1;
+        cs_futures_free(isolates[i].c);
+        cs_loop_free(isolates[i].c);
+    }
+    cs_isolates_free(pool);
+    return status;
+}
+
+// --stats prints them readably, --stats-json writes them into a file
+static void write_stats(cs_Context* ctx, bool print, char* json_path)
+{
+    if (print) {
+        cs_Writer w = cs_writer_init(stderr);
+        cs_stats_print(ctx, &w);
+        cs_writer_free(&w);
+    }
+    if (json_path != null) {
+        FILE* f;
+        if (fopen_s(&f, json_path, "w") != 0) {
+            log_warn("Stats could not be written to \"%s\".", json_path);
+            return;
+        }
+        cs_Writer w = cs_writer_init(f);
+        cs_stats_json(ctx, &w);
+        cs_writer_free(&w);
+        fclose(f);
+    }
+}
 
 int main(int argc, char** argv) {
     init_console();
-    if (argc == 2) {
+    // [--dump-ir] [--load-ir] [--gc] [--jobs n] [--isolates n] [--stats] [--stats-json path] [--profile] [--pgo-gen] [--pgo] [file..]
+    bool dump_ir = false; bool load_ir = false;
+    bool stats = false; char* stats_json = null;
+    bool profile = false;
+    bool pgo_gen = false; bool pgo = false;
+    cs_Memory memory = CS_MEMORY_RC;
+    u32 jobs = 0;
+    u32 copies = 1;
+    char** paths = cs_malloc(sizeof(char*) * argc);
+    u32 path_count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dump-ir") == 0) dump_ir = true;
+        else if (strcmp(argv[i], "--load-ir") == 0) load_ir = true;
+        else if (strcmp(argv[i], "--gc") == 0) memory = CS_MEMORY_GC;
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) jobs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--isolates") == 0 && i + 1 < argc) copies = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--stats") == 0) stats = true;
+        else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc) stats_json = argv[++i];
+        else if (strcmp(argv[i], "--profile") == 0) profile = true;
+        else if (strcmp(argv[i], "--pgo-gen") == 0) pgo_gen = true;
+        else if (strcmp(argv[i], "--pgo") == 0) pgo = true;
+        else paths[path_count++] = argv[i];
+    }
+    if (copies == 0) copies = 1;
+    char* path = path_count > 0 ? paths[path_count-1] : null;
+
+    if (path_count > 1 || (copies > 1 && path_count > 0)) {
+        // [--isolates n] file.. => run every file n times at once, on a pool of --jobs threads
+        return run_isolates(paths, path_count, copies, memory, jobs);
+    }
+
+    if (path != null) {
         // [file] => run file and exit
-        FILE* f;
-        errno_t err = fopen_s(&f, argv[1], "r");
-        if (err != 0) {
-            log_fatal("Datei \"%s\" konnte nicht geöffnet werden.");
-            return -1;
-        }
-        fseek(f, 0, SEEK_END);
-        u32 file_size = ftell(f);
-        fseek(f, 0, SEEK_SET);
-        char* content = malloc(file_size+1);
-        u32 real_size = fread_s(content, file_size, 1, file_size, f);
-        content[real_size] = 0;
+        u32 len;
+        char* content = read_file(path, &len);
+        if (content == null) return -1;
 
         cs_Context ctx = cs_init();
-        cs_Code* result = cs_compile_file(&ctx, content, real_size);
-        if (ctx.err != CS_OK) {
-            printf("ERROR: %s", cs_get_error_string(&ctx));
+        ctx.memory = memory;
+        ctx.jobs = jobs;
+        cs_Stats stats_data = {0};
+        if (stats || stats_json != null) ctx.stats = &stats_data;
+        cs_BlockCounts counts = { .source_hash = fnv1a(content, content + len) };
+        if (pgo_gen) ctx.counts = &counts;
+        cs_BlockCounts pgo_counts;
+        if (pgo && read_counts(&pgo_counts, path, content, len)) ctx.pgo = &pgo_counts;
+        cs_lib_open(&ctx);
+        if (load_ir) {
+            // [--load-ir file] => skip the front end and continue with the ir in file
+            if (!cs_ir_load(&ctx, content, len)) {
+                printf("ERROR: %s\n", cs_get_error_string(&ctx));
+                return -1;
+            }
+            if (dump_ir) {
+                cs_Writer w = cs_writer_init(stdout);
+                cs_ir_dump(&ctx, &w);
+                cs_writer_free(&w);
+            }
+            cs_Code* code = cs_lower(&ctx, ctx.entry_fn_id);
+            write_stats(&ctx, stats, stats_json);
+            return run_file(&ctx, code, path, profile);
+        }
+
+        cs_Code* code = load_or_compile(&ctx, path, content, len, dump_ir);
+        write_stats(&ctx, stats, stats_json);
+        if (code == null) return -1;
+        return run_file(&ctx, code, path, profile);
+    }
+    // [] => run as repl
+    cs_Context ctx = cs_init();
+    ctx.memory = memory;
+    ctx.jobs = jobs;
+    cs_lib_open(&ctx);
+    cs_repl_init(&ctx);
+    u32 input_cap = 1024; u32 input_len = 0;
+    char* input = cs_malloc(input_cap);
+    char line[1024];
+    printf("> ");
+    while (fgets(line, sizeof(line), stdin) != null) {
+        u32 line_len = strlen(line);
+        while (input_len + line_len + 1 > input_cap) {
+            input_cap *= 2;
+            input = cs_realloc(input, input_cap);
+        }
+        memcpy(input + input_len, line, line_len + 1);
+        input_len += line_len;
+
+        // keep reading until every form of the input is closed
+        bool complete = true;
+        char* cur = input; char* end = input + input_len;
+        while (cur < end && complete) {
+            cur = cs_scan_form(cur, end, &complete);
+            if (cur < end) cur++;
         }
-        return 0;
+        if (!complete) {
+            printf(".. ");
+            continue;
+        }
+
+        report(&ctx, &ctx, cs_repl_eval(&ctx, input, input_len));
+        input_len = 0;
+        printf("> ");
     }
-// [] => run as repl
+    return 0;
 }
\ No newline at end of file
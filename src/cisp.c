@@ -15,7 +15,16 @@ const u32 returnbb_hash = 0xb3e6dde1;
 const cs_SSAVar ssavar_invalid = ssavar(0, _CS_INVALID, 0);
 const cs_SSAVar ssavar_call = ssavar(0, _CS_CALL, 0);
 const cs_SSAVar ssavar_return = ssavar(0, _CS_RETURN, 0);
-char buf[256];
+
+u32 cs_ensure_cap(void** data, u32 element_size, u32* cur_cap, u32 wanted_cap);
+
+// functions and blocks a parse job makes have ids from here on until they are merged, see PARALLEL PARSING
+#define CS_JOB_ID_BASE 0x40000000u
+static cs_Context* parse_job_parent(cs_ParseJob* job);
+static cs_Local* parse_job_lookup(cs_ParseJob* job, u32 hash);
+static u16* parse_job_versions(cs_ParseJob* job, u32 hash);
+static bool parse_job_foreign(cs_ParseJob* job, cs_FunctionBody* fb);
+static void parse_job_defer(cs_ParseJob* job, cs_FunctionBody* fb, cs_BasicBlock* site, cs_CallArgs* args);
 
 //#region keywords
 const u32 k_fn = 0x6322e9d5;
@@ -44,60 +53,100 @@ const u32 k_let = 0x506b03fa;
 const u32 k_quote = 0xb2887bd7;
 //#endregion keywords
 
+// records the start offset of every line, so that positions can be resolved with a binary search
+void cs_index_lines(cs_Context* c)
+{
+    if (c->line_starts == null) {
+        c->line_cap = 64;
+        c->line_starts = cs_malloc(sizeof(u32) * c->line_cap);
+    }
+    c->line_count = 0;
+    u32 offset = 0;
+    while (true) {
+        c->line_count += 1;
+        if (c->line_count > c->line_cap) {
+            c->line_cap *= 2;
+            c->line_starts = cs_realloc(c->line_starts, sizeof(u32) * c->line_cap);
+        }
+        c->line_starts[c->line_count-1] = offset;
+
+        char* nl = memchr(c->start + offset, '\n', c->len - offset);
+        if (nl == null) break;
+        offset = (u32)(nl - c->start) + 1;
+    }
+}
+
+// resolves a byte offset into the source to a 1-based line and column
+void cs_source_pos(cs_Context* c, u32 offset, u32* line, u32* col)
+{
+    u32 lo = 0; u32 hi = c->line_count;
+    while (hi - lo > 1) {
+        u32 mid = lo + (hi - lo) / 2;
+        if (c->line_starts[mid] <= offset) lo = mid;
+        else hi = mid;
+    }
+    *line = lo + 1;
+    *col = offset - c->line_starts[lo] + 1;
+}
+
 void cs_error(cs_Context* c, cs_Error error) {
-    c->err = error;
     if (c == null) return;
-    // calculate line and col
-    u32 index = (u64)c->cur - (u64)c->start;
+    // only the first error of a top-level form is reported, everything after it is most likely a follow-up error
+    if (c->form_had_error) return;
+    c->form_had_error = true;
+
     u32 line = 1; u32 col = 1;
-    char* cur = c->start;
-    while (true) {
-        if (*cur == 0) break;
-        if (((u64)cur - (u64)c->start) == index) { break; }
-        if (*cur == '\r') {
-            cur += 2;
-            line++;
-            col = 1;
-            continue;
-        }
-        if (*cur == '\n') {
-            cur++;
-            line++;
-            col = 1;
-            continue;
-        }
-        col++; cur++;
+    if (c->line_count > 0) {
+        cs_source_pos(c, (u32)(c->cur - c->start), &line, &col);
+    }
+    if (c->err == CS_OK) {
+        c->err = error;
+        c->err_col = col; c->err_line = line;
     }
-    c->err_col = col; c->err_line = line;
+
+    c->error_count += 1;
+    c->error_cap = cs_ensure_cap((void**)&c->errors, sizeof(cs_ErrorInfo), &c->error_cap, c->error_count);
+    c->errors[c->error_count-1] = (cs_ErrorInfo) {
+        .err = error, .line = line, .col = col,
+    };
     // TODO: print callstack
 }
 
 /* ==== POOL ALLOCATOR ==== */
+// threads every element of a bucket onto the freelist
+static void pool_thread_bucket(cs_Pool* p, void* mem)
+{
+    u32 count = (CS_POOL_MEM_SIZE - 8) / p->element_size;
+    char* cur = pool_data((char*)mem);
+    for (u32 i = 0; i < count - 1; i++) {
+        *(void**)cur = cur + p->element_size;
+        cur += p->element_size;
+    }
+    *(void**)cur = p->freelist;
+    p->freelist = (void**)pool_data((char*)mem);
+}
+
 cs_Pool cs_pool_init(u32 element_size)
 {
     cs_Pool result;
     result.element_size = element_size;
-    result.mem = malloc(CS_POOL_MEM_SIZE);
+    result.bucket_count = 1;
+    result.mem = cs_malloc(CS_POOL_MEM_SIZE);
     pool_next(result.mem) = null;
-    
-    result.freelist = pool_data(result.mem);
-    char* cur = (char*)result.freelist;
-    char* end = (char*)result.mem + CS_POOL_MEM_SIZE;
-    while ((u64)cur < (u64)end) {
-        *(void**)cur = cur + element_size;
-        cur += element_size;
-    }
-    void** last = (void**)(end - element_size);
-    *last = 0;
+    result.freelist = null;
+    pool_thread_bucket(&result, result.mem);
     return result;
 }
 
 void* cs_pool_alloc(cs_Pool* p)
 {
     if (p->freelist == null) {
-        // TODO: allocate new bucket
-        log_fatal("OUT OF MEMORY!");
-        exit(-1);
+        // buckets are chained through their first word
+        void* mem = cs_malloc(CS_POOL_MEM_SIZE);
+        p->bucket_count += 1;
+        pool_next(mem) = p->mem;
+        p->mem = mem;
+        pool_thread_bucket(p, mem);
     }
     void* result = p->freelist;
     p->freelist = freelist_next(p->freelist);
@@ -107,41 +156,29 @@ void* cs_pool_alloc(cs_Pool* p)
 // frees an element from the pool
 void cs_pool_free(cs_Pool* p, void** ptr)
 {
-    if ((u64)ptr < (u64)p->freelist) {
-        *ptr = p->freelist;
-        p->freelist = ptr;
-        return;
-    }
-    void** cur = p->freelist;
-    void** last = null;
-    while ((u64)cur < (u64)ptr) {
-        last = cur;
-        cur = freelist_next(cur);
-    }
-    *last = ptr;
-    *ptr = cur;
-    return;
+    *ptr = p->freelist;
+    p->freelist = ptr;
 }
 
 // resets the pool
 void cs_pool_clear(cs_Pool* p) {
-    p->freelist = pool_data(p->mem);
-    u64 cur = (u64)p->freelist;
-    u64 end = (u64)cur + CS_POOL_MEM_SIZE;
-    while (cur < end) {
-        *(void**)cur = (void*) (cur + p->element_size);
-        cur += p->element_size;
+    p->freelist = null;
+    for (void* mem = p->mem; mem != null; mem = pool_next(mem)) {
+        pool_thread_bucket(p, mem);
     }
-    void** last = (void**)(end - p->element_size);
-    *last = 0;
 }
 
 // frees the pool
 void cs_pool_release(cs_Pool* p) {
-    // TODO: support multiple buckets
-    free(p->mem);
+    void* mem = p->mem;
+    while (mem != null) {
+        void* next = pool_next(mem);
+        free(mem);
+        mem = next;
+    }
+    p->mem = null;
     // indicates that the pool was freed (or never initialized)
-    p->element_size = 0; p->freelist = null;
+    p->element_size = 0; p->freelist = null; p->bucket_count = 0;
 }
 
 /* ==== ARENA ==== */
@@ -149,68 +186,90 @@ cs_Arena arena_init(void)
 {
     cs_Arena result;
     result.buck_count = 1;
-    result.buckets = malloc(sizeof(cs_ArenaBucket));
+    result.used = 0; result.peak = 0;
+    result.buckets = cs_malloc(sizeof(cs_ArenaBucket));
     result.buckets->last_alloc = 0;
     result.buckets->used = 0; 
-    result.buckets->data = malloc(DEFAULT_ARENA_BUCKET_SIZE);
-    if (result.buckets->data == null) {
-        log_fatal("Not enough memory!");
-        exit(-1);
-    }
+    result.buckets->data = cs_malloc(DEFAULT_ARENA_BUCKET_SIZE);
     return result;
 }
 
 void* arena_alloc(cs_Arena* a, u32 size) 
 {
     cs_ArenaBucket* b = &a->buckets[a->buck_count-1];
-    if ((u64)b->used + (u64)size >= DEFAULT_ARENA_BUCKET_SIZE) { 
-        log_fatal("Arena too smol :(");
-        exit(-1);
+    if ((u64)b->used + (u64)size > DEFAULT_ARENA_BUCKET_SIZE) { 
+        if (size > DEFAULT_ARENA_BUCKET_SIZE) {
+            log_fatal("Arena too smol :(");
+            exit(-1);
+        }
+        // elements never straddle two buckets, so arena_get can index them by bucket
+        a->buck_count += 1;
+        a->buckets = cs_realloc(a->buckets, sizeof(cs_ArenaBucket) * a->buck_count);
+        b = &a->buckets[a->buck_count-1];
+        b->used = 0; b->last_alloc = 0;
+        b->data = cs_malloc(DEFAULT_ARENA_BUCKET_SIZE);
     }
     void* result = advance_ptr(b->data, b->used);
     b->used += size;
     b->last_alloc = size;
+    a->used += size;
+    if (a->used > a->peak) a->peak = a->used;
     return result;
 }
 
 void* arena_get(cs_Arena* a, u32 index, u32 element_size)
 {
-    u32 off = index * element_size;
-    u32 buck_id = off / DEFAULT_ARENA_BUCKET_SIZE;
+    u32 per_bucket = DEFAULT_ARENA_BUCKET_SIZE / element_size;
+    u32 buck_id = index / per_bucket;
+    if (buck_id >= a->buck_count) return null;
     cs_ArenaBucket* b = &a->buckets[buck_id];
 
-    return advance_ptr(b->data, off % DEFAULT_ARENA_BUCKET_SIZE);
+    return advance_ptr(b->data, (index % per_bucket) * element_size);
 }
 
 void arena_free_last(cs_Arena *a)
 {
     cs_ArenaBucket* b = &a->buckets[a->buck_count-1];
     b->used -= b->last_alloc;
+    a->used -= b->last_alloc;
     b->last_alloc = 0;
 }
 
+// gives back everything a has, it has to be initialized again to be used
+void arena_free(cs_Arena* a)
+{
+    for (int i = 0; i < a->buck_count; i++) {
+        free(a->buckets[i].data);
+    }
+    free(a->buckets);
+    a->buckets = null;
+    a->buck_count = 0;
+    a->used = 0;
+}
+
 void arena_clear(cs_Arena *a) 
 {
     for (int i = 1; i < a->buck_count; i++) {
-        cs_ArenaBucket* b = &a->buckets[i];
-        free(b->data);
-        free(b);
-        a->buck_count--;
+        free(a->buckets[i].data);
     }
+    a->buck_count = 1;
     a->buckets->last_alloc = 0; 
     a->buckets->used = 0;
+    a->used = 0;
 }
 
 /* ==== STR ==== */
 cs_Str* cs_str_init(u32 len) {   
-    cs_Str* result = malloc(sizeof(cs_Str) + len);
+    cs_Str* result = cs_malloc(sizeof(cs_Str) + len);
+    result->hash = 0;
     result->size = len;
     return result;
 }
 
 cs_Str* cs_make_str(char* data, u32 len)
 {
-    cs_Str* result = malloc(sizeof(cs_Str) + len + 1);
+    cs_Str* result = cs_malloc(sizeof(cs_Str) + len + 1);
+    result->hash = 0;
     result->size = len;
     memcpy_s(result->data, len+1, data, len);
     result->data[len] = 0;
@@ -222,7 +281,7 @@ cs_StrBuilder cs_strbuilder_init(u32 cap)
     cs_StrBuilder result;
     result.cap = cap;
     result.len = 0;
-    result.data = malloc(cap);
+    result.data = cs_malloc(cap);
     memset(result.data, 0, cap);
     return result;
 }
@@ -232,7 +291,7 @@ void cs_strbuilder_appendc(cs_StrBuilder* b, char c)
     b->len++;
     if (b->len > b->cap) {
         b->cap *= 2;
-        b->data = realloc(b->data, b->cap);
+        b->data = cs_realloc(b->data, b->cap);
     }
     b->data[b->len-1] = c;
 }
@@ -245,7 +304,7 @@ void cs_strbuilder_appends(cs_StrBuilder* b, char* c, u32 len)
     while (b->len > b->cap) {
         b->cap *= 2;
     }
-    b->data = realloc(b->data, b->cap);
+    b->data = cs_realloc(b->data, b->cap);
 
     memcpy(cur, c, len);
 }
@@ -267,25 +326,35 @@ cs_Str* cs_strbuilder_finish(cs_StrBuilder* b)
 
 cs_Object* cs_make_object(cs_Context* c) 
 {
+    if (c->memory == CS_MEMORY_GC) return cs_gc_alloc(c);
     cs_Object* result = cs_pool_alloc(&c->obj_pool);
     memset(result, 0, sizeof(cs_Object));
+    result->rc = 1;
     return result;
 }
 
 u32 cs_ensure_cap(void** data, u32 element_size, u32* cur_cap, u32 wanted_cap)
 {
+    if (*data == null) {
+        if (*cur_cap < 4) *cur_cap = 4;
+        *data = cs_malloc(element_size * (*cur_cap));
+    }
     while (wanted_cap >= *cur_cap) {
         *cur_cap = (*cur_cap) * 1.75;
-        *data = realloc(*data, element_size * (*cur_cap));
+        *data = cs_realloc(*data, element_size * (*cur_cap));
     }
     return *cur_cap;
 }
 
 cs_Function* cs_get_fn(cs_Context* c, u32 id)
 {
+    if (c->job != null) {
+        if (id < CS_JOB_ID_BASE) return cs_get_fn(parse_job_parent(c->job), id);
+        id -= CS_JOB_ID_BASE;
+    }
     const u32 fns_per_bucket = (u32)DEFAULT_ARENA_BUCKET_SIZE / sizeof(cs_Function);
     u32 bucket_num = id / fns_per_bucket;
-    if (bucket_num > c->functions.buck_count) {
+    if (bucket_num >= c->functions.buck_count) {
         log_fatal("Invalid function id: %u (bucket nr: %u)", id, bucket_num);
         exit(-1);
     }
@@ -297,19 +366,23 @@ cs_Function* cs_get_fn(cs_Context* c, u32 id)
 
 cs_FunctionBody* cs_fn_get_variant(cs_Function* fn, u8 arg_count)
 {
-    cs_FunctionBody* cur = fn->variants;
-    for (int i = 0; i < fn->variant_count; i++) {
-        if (cur->arg_count == arg_count) return cur;
-        cur = &cur[i];
-    }
-    return null;
+    if (arg_count > FUNCTION_MAX_ARGS || fn->by_arity[arg_count] == 0) return null;
+    return &fn->variants[fn->by_arity[arg_count] - 1];
 }
 
-cs_FunctionBody* cs_fn_add_variant(cs_Context* c, cs_Function* fn)
+// arg_count is the one of cs_FunctionBody, negative for natives
+cs_FunctionBody* cs_fn_add_variant(cs_Context* c, cs_Function* fn, i8 arg_count)
 {
     fn->variant_count += 1;
-    fn->variants = realloc(fn->variants, fn->variant_count * sizeof(cs_FunctionBody));
-    return &fn->variants[fn->variant_count-1];
+    fn->variants = cs_realloc(fn->variants, fn->variant_count * sizeof(cs_FunctionBody));
+    cs_FunctionBody* result = &fn->variants[fn->variant_count-1];
+    memset(result, 0, sizeof(cs_FunctionBody));
+    result->fn_id = fn->id;
+    result->arg_count = arg_count;
+    // the first variant of an arity is the one calls get
+    u32 arity = cs_fb_arity(result);
+    if (arity <= FUNCTION_MAX_ARGS && fn->by_arity[arity] == 0) fn->by_arity[arity] = fn->variant_count;
+    return result;
 }
 
 cs_Function* cs_make_fn(cs_Context* c, u32* fn_id)
@@ -318,8 +391,11 @@ cs_Function* cs_make_fn(cs_Context* c, u32* fn_id)
     if (fn_id) {
         *fn_id = c->cur_fn_id;
     }
+    result->id = c->cur_fn_id;
     c->cur_fn_id += 1;
     result->variant_count = 0; result->variants = null;
+    memset(result->by_arity, 0, sizeof(result->by_arity));
+    result->title = null;
     return result;
 }
 
@@ -332,41 +408,32 @@ cs_BasicBlock* cs_make_bb(cs_Context* c)
         exit(-1);
     }
     memset(result, 0, sizeof(cs_BasicBlock));
-    result->instrs = malloc(sizeof(cs_SSAIns) * DEFAULT_BB_INS_START_CAP);
-    if (result->instrs == null) {
-        log_fatal("OUT OF MEMORY!");
-        exit(-1);
-    }
+    result->instrs = cs_malloc(sizeof(cs_SSAIns) * DEFAULT_BB_INS_START_CAP);
     result->instr_cap = DEFAULT_BB_INS_START_CAP; 
     result->phis_head.dest = ssavar_invalid;
+    if (c->start != null && c->line_count > 0 && c->cur >= c->start && c->cur <= c->start + c->len) {
+        u32 col;
+        cs_source_pos(c, (u32)(c->cur - c->start), &result->line, &col);
+    }
+    result->id = c->cur_bb_id;
     c->cur_bb_id += 1;
     return result;
 }
 
+cs_BasicBlock* cs_get_bb(cs_Context* c, u32 id)
+{
+    if (c->job != null) {
+        if (id < CS_JOB_ID_BASE) return cs_get_bb(parse_job_parent(c->job), id);
+        id -= CS_JOB_ID_BASE;
+    }
+    return arena_get(&c->bbs, id, sizeof(cs_BasicBlock));
+}
+
 // define var to be at the next instruction in the current basic block
 void ssa_def_var(cs_Context* c, cs_SSAVar var, i32 phi_index)
 {
-    u32 bb_id = 0;
-    cs_ArenaBucket* cur_buck = &c->bbs.buckets[c->bbs.buck_count-1];
     cs_BasicBlock* cur_bb = c->cur_bb;
-    cs_BasicBlock* newest_bb = arena_get(&c->bbs, c->cur_bb_id-1, sizeof(cs_BasicBlock));
-    if (newest_bb != cur_bb) {
-        u32 bbs_per_bucket = (DEFAULT_ARENA_BUCKET_SIZE / sizeof(cs_BasicBlock));
-        u32 bb_id = (c->bbs.buck_count-1) * bbs_per_bucket;
-        while ((u64)cur_buck >= (u64)c->bbs.buckets) {
-            if ((u64)cur_bb >= (u64)cur_buck->data && (u64)cur_bb < (u64)advance_ptr(cur_buck->data, DEFAULT_ARENA_BUCKET_SIZE)) 
-                {
-                    break;
-                } 
-    
-            cur_buck = advance_ptr(cur_buck, -sizeof(cs_ArenaBucket));
-            bb_id -= bbs_per_bucket;
-        }
-        u32 bb_offset = (u64)cur_bb - (u64)cur_buck->data;
-        bb_id -= (bb_offset / sizeof(cs_BasicBlock)) - 1;
-    } else {
-        bb_id = c->cur_bb_id-1;
-    }
+    u32 bb_id = cur_bb->id;
 
     u32 hash = fnv1a((char*)&var.hash, advance_ptr((char*)&var.hash, sizeof(u32)));
     cs_SSADef* def = cs_hm_seth(&c->ssa_defs, hash);
@@ -383,17 +450,32 @@ cs_SSADef* ssa_get_def(cs_Context* c, cs_SSAVar var)
 {
     u32 hash = fnv1a((char*)&var.hash, advance_ptr((char*)&var.hash, sizeof(u32)));
     cs_SSADef* def = cs_hm_geth(&c->ssa_defs, hash);
+    // what a parse job didn't define itself is from before its defn
+    if (def == null && c->job != null) return ssa_get_def(parse_job_parent(c->job), var);
     return def;
 }
 
 cs_SSAIns* ssa_get_ins(cs_Context* c, u32 bb_id, u32 instr_id)
 {
-    cs_BasicBlock* bb = arena_get(&c->bbs, bb_id, sizeof(cs_BasicBlock));
+    cs_BasicBlock* bb = cs_get_bb(c, bb_id);
     if (bb == null) return null;
-    if (instr_id > bb->instr_count) return null;
+    if (instr_id >= bb->instr_count) return null;
     return &bb->instrs[instr_id];
 }
 
+// false for instructions whose operands are constants or that keep their operands somewhere else (calls)
+bool cs_ins_uses_vars(cs_OpKind op)
+{
+    switch (op) {
+        case CS_LOADI: case CS_LOADF: case CS_LOADS: case CS_LOADK: case CS_LOADSYM:
+        case CS_LOADFUN: case CS_LOADTRUE: case CS_LOADFALSE: case CS_LOADNIL:
+        case CS_SCOPE_PUSH: case CS_SCOPE_POP: case CS_CALL: case CS_CALLC: case CS_DYNCALL:
+        case CS_SET_LOCAL: case CS_GET_LOCAL:
+            return false;
+        default: return true;
+    }
+}
+
 cs_SSAVar ssa_new_temp(cs_Context* c, cs_ObjectType type) 
 {
     cs_SSAVar result = ssavar(tempvar_hash, type, c->cur_temp_id++);
@@ -407,24 +489,25 @@ void cs_bb_add_phi(cs_BasicBlock* bb, cs_SSAVar dest, cs_SSAVar phi_option)
     while (!ssa_invalid(cur->dest)) {
         if (ssa_eq(cur->dest, dest)) {
             cur->option_count += 1;
-            cur->options = realloc(cur->options, cur->option_count * sizeof(cs_SSAVar));
+            cur->options = cs_realloc(cur->options, cur->option_count * sizeof(cs_SSAVar));
             cur->options[cur->option_count-1] = phi_option;
             return;
         }
         cur = cur->next;
     }
-    cur->next = malloc(sizeof(cs_SSAPhi));
+    cur->next = cs_malloc(sizeof(cs_SSAPhi));
     cur->next->dest = ssavar_invalid;
+    cur->next->options = null; cur->next->option_count = 0;
     cur->dest = dest;
     cur->option_count = 1;
-    cur->options = realloc(cur->options, cur->option_count * sizeof(cs_SSAVar));
+    cur->options = cs_realloc(cur->options, cur->option_count * sizeof(cs_SSAVar));
     cur->options[0] = phi_option;
 }
 
 void cs_bb_add_pred(cs_BasicBlock* bb, cs_BasicBlock* pred)
 {
     if (bb->preds_start == null) {
-        bb->preds_start = malloc(sizeof(cs_BasicBlockNode));
+        bb->preds_start = cs_malloc(sizeof(cs_BasicBlockNode));
         bb->preds_start->head = pred; bb->preds_start->tail = null;
         return;
     }
@@ -432,7 +515,7 @@ void cs_bb_add_pred(cs_BasicBlock* bb, cs_BasicBlock* pred)
     cs_BasicBlockNode* cur = bb->preds_start;
     while (true) {
         if (cur->tail == null) {
-            cur->tail = malloc(sizeof(cs_BasicBlockNode));
+            cur->tail = cs_malloc(sizeof(cs_BasicBlockNode));
             cur->tail->head = pred; cur->tail->tail = null;
             return;
         } 
@@ -462,6 +545,65 @@ void cs_bb_call(cs_BasicBlock* from, cs_FunctionBody* variant)
     cs_bb_add_pred(variant->entry, from);
 }
 
+// collects the blocks control can continue with inside of the same function.
+// calls continue at their return address, since the callee is a different function
+u32 cs_bb_successors(cs_BasicBlock* bb, cs_BasicBlock* out[2])
+{
+    if (ssa_eq(bb->jump_cond, ssavar_return)) return 0;
+    if (ssa_eq(bb->jump_cond, ssavar_call)) {
+        out[0] = bb->return_address;
+        return 1;
+    }
+    u32 count = 0;
+    if (bb->a != null) out[count++] = bb->a;
+    if (!ssa_invalid(bb->jump_cond) && bb->b != null) out[count++] = bb->b;
+    return count;
+}
+
+// adds the arguments of a call site as options to the argument phis of the callee
+void cs_bb_add_call_args(cs_FunctionBody* variant, cs_CallArgs* args)
+{
+    cs_SSAPhi* cur = &variant->entry->phis_head;
+    for (int i = 0; i < args->count; i++) {
+        cur->option_count++;
+        cur->options = cs_realloc(cur->options, cur->option_count * sizeof(cs_SSAVar));
+        cur->options[cur->option_count-1] = args->vars[i];
+        cur = cur->next;
+    }
+}
+
+void cs_bb_replace_pred(cs_BasicBlock* bb, cs_BasicBlock* old_pred, cs_BasicBlock* new_pred)
+{
+    for (cs_BasicBlockNode* cur = bb->preds_start; cur != null; cur = cur->tail) {
+        if (cur->head == old_pred) cur->head = new_pred;
+    }
+}
+
+// moves every static call site of old_fn over to the variant of new_fn with the same arity, 
+// so that callers don't have to be recompiled when a function is redefined
+static void cs_fn_redefine(cs_Function* old_fn, cs_Function* new_fn)
+{
+    for (int v = 0; v < old_fn->variant_count; v++) {
+        cs_FunctionBody* old_fb = &old_fn->variants[v];
+        if (old_fb->arg_count < 0) continue;
+        cs_FunctionBody* new_fb = cs_fn_get_variant(new_fn, old_fb->arg_count);
+        if (new_fb == null) continue;
+
+        for (cs_BasicBlockNode* n = old_fb->entry->preds_start; n != null; n = n->tail) {
+            cs_BasicBlock* site = n->head;
+            if (!ssa_eq(site->jump_cond, ssavar_call) || site->a != old_fb->entry) continue;
+            cs_SSAIns* call = &site->instrs[site->instr_count-1];
+            if (call->op != CS_CALL) continue;
+
+            call->a_as.fn_ = new_fb;
+            cs_bb_call(site, new_fb);
+            cs_bb_add_call_args(new_fb, call->b_as.args_);
+            cs_bb_replace_pred(site->return_address, old_fb->return_bb, new_fb->return_bb);
+            new_fb->calls += 1;
+        }
+    }
+}
+
 cs_ComScope* cs_comscope_push(cs_Context* c)
 {
     cs_ComScope* result = arena_alloc(&c->comscopes, sizeof(cs_ComScope));
@@ -477,6 +619,12 @@ void cs_comscope_pop(cs_Context* c)
     c->cur_scope = advance_ptr(c->cur_scope, -sizeof(cs_ComScope));
 }
 
+// true if the current scope is the outermost one, which lives as long as the context
+static bool cs_comscope_is_root(cs_Context* c)
+{
+    return (u64)c->cur_scope == (u64)c->comscopes.buckets->data;
+}
+
 cs_Local* cs_comscope_lookup(cs_Context* c, u32 hash)
 {
     cs_ComScope* cur = c->cur_scope;
@@ -486,6 +634,7 @@ cs_Local* cs_comscope_lookup(cs_Context* c, u32 hash)
         if (result != null) return result;
         cur = advance_ptr(cur, -sizeof(cs_ComScope));
     }
+    if (c->job != null) return parse_job_lookup(c->job, hash);
     return null;
 }
 
@@ -521,15 +670,13 @@ cs_Context cs_init()
     result.obj_pool = cs_pool_init(sizeof(cs_Object));
     result.comscopes = arena_init();
     result.ssa_defs = cs_hm_init(sizeof(cs_SSADef));
+    result.versions = cs_hm_init(sizeof(u16));
+    result.symbol_names = cs_hm_init(sizeof(cs_Str*));
+    result.native_names = cs_hm_init(sizeof(u32));
     cs_comscope_push(&result);
     return result;
 }
 
-void cs_cfunc(cs_Context* c, void* fn, i8 arg_count)
-{
-    // TODO: cfunc
-}
-
 #define cs_emit(c, dest, op, a, b) _cs_emit((c), (dest), (op), insarg((a)), insarg((b)))
 void _cs_emit(cs_Context* c, cs_SSAVar dest, cs_OpKind op, union ins_arg a, union ins_arg b)
 {
@@ -544,22 +691,6 @@ void _cs_emit(cs_Context* c, cs_SSAVar dest, cs_OpKind op, union ins_arg a, unio
     };
 }
 
-void cs_obj_settype(cs_Object *obj, cs_ObjectType type)
-{
-    obj->car = (void*)(((u64)type << 56) | ((u64)obj->car & CS_OBJECT_INV_TYPE_MASK));
-    if (type == CS_LIST) {
-        obj->car = (void*)((u64)obj->car & CS_OBJECT_INV_LIST_MASK); // set last bit to 0
-    } else {
-        obj->car = (void*) ((u64)obj->car | 0b1); // set last bit to 1
-    }
-}
-
-u16 cs_obj_gettype(cs_Object *obj)
-{
-    if (((u64)obj->car & 1) == 0) return CS_LIST;
-    return ((u64)obj->car & CS_OBJECT_TYPE_MASK) >> CS_OBJECT_TYPE_OFFSET;
-}
-
 static inline bool is_whitespace(char c) {
     if (c == ' ' || c == '\t' || c == '\r' || c == '\n') return true;
     return false;
@@ -593,6 +724,7 @@ static bool is_disallowed_symbol_char(char c)
         case '}':
         case '\\':
         case ':':
+        case '\0':
             return true;
         
         default: return false;
@@ -628,15 +760,56 @@ static cs_SSAVar cs_parse_expr(cs_Context* c);
 static cs_SSAVar gen_while(cs_Context* c);
 static cs_SSAVar gen_function(cs_Context* c);
 
-// (+|-)?[0-9]+ (\.[0-9]+)? (e(+|-)[0-9]+)?
+// powers of ten that are exactly representable as a double
+static const double exact_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+#define EXACT_POW10_MAX 22
+#define MAX_EXACT_MANTISSA (1ull << 53)
+#define MAX_NUMBER_LITERAL_LEN 128
+
+// converts mantissa * 10^exp10 to the nearest double. 
+// start..end is the source span of the literal (without sign), which is used when the fast paths can't guarantee exact rounding
+static double parse_float_span(char* start, char* end, u64 mantissa, i32 exp10, bool truncated)
+{
+    if (mantissa == 0 && !truncated) return 0.0;
+
+    if (!truncated && mantissa <= MAX_EXACT_MANTISSA) {
+        // both mantissa and 10^exp10 are exact, so a single multiplication or division rounds correctly
+        double val = (double)mantissa;
+        if (exp10 >= 0 && exp10 <= EXACT_POW10_MAX) return val * exact_pow10[exp10];
+        if (exp10 < 0 && -exp10 <= EXACT_POW10_MAX) return val / exact_pow10[-exp10];
+
+        // 123e25 => 123000e22: shift the surplus exponent into the mantissa while it stays exact
+        if (exp10 > EXACT_POW10_MAX && exp10 <= EXACT_POW10_MAX + 15) {
+            u64 shifted = mantissa;
+            for (i32 i = EXACT_POW10_MAX; i < exp10; i++) {
+                shifted *= 10;
+                if (shifted > MAX_EXACT_MANTISSA) break;
+            }
+            if (shifted <= MAX_EXACT_MANTISSA) return (double)shifted * exact_pow10[EXACT_POW10_MAX];
+        }
+    }
+
+    // slow path: the c runtime's strtod rounds correctly, but needs a terminated copy of the span
+    char small[MAX_NUMBER_LITERAL_LEN];
+    u64 len = (u64)end - (u64)start;
+    char* tmp = len < MAX_NUMBER_LITERAL_LEN ? small : cs_malloc(len + 1);
+    memcpy(tmp, start, len);
+    tmp[len] = 0;
+    double result = strtod(tmp, null);
+    if (tmp != small) free(tmp);
+    return result;
+}
+
+// (+|-)?[0-9]+ (\.[0-9]+)? (e(+|-)?[0-9]+)?
 static cs_SSAVar gen_number(cs_Context* c) 
 {
-    i64 int_val = 0;
-    double float_val = 0;
     bool is_neg = false;
     bool is_float = false;
     if (cur() == '+') advance();
-    if (cur() == '-') {
+    else if (cur() == '-') {
         is_neg = true;
         advance();
     }
@@ -644,69 +817,86 @@ static cs_SSAVar gen_number(cs_Context* c)
     if (cur() < '0' || cur() > '9') {
         return ssavar_invalid;
     }
+    char* span_start = c->cur;
 
+    // collect up to 19 significant digits, the rest only shifts the exponent
+    u64 mantissa = 0;
+    i32 exp10 = 0;
+    bool truncated = false;
     do {
-        int_val *= 10;
-        int_val += cur() - '0'; 
+        u32 digit = cur() - '0';
+        if (mantissa <= (UINT64_MAX - digit) / 10) {
+            mantissa = mantissa * 10 + digit;
+        } else {
+            truncated |= digit != 0;
+            exp10++;
+        }
         advance();
     } while (cur() >= '0' && cur() <= '9');
 
     if (cur() == '.') {
         advance();
-        float_val = (double)int_val;
         is_float = true;
         if (cur() == 'e') {
             cs_error(c, CS_EXPONENT_AFTER_COMMA);
             return ssavar_invalid;
         }
 
-        u64 decimals = 0; u32 count = 0;
         while (cur() >= '0' && cur() <= '9') {
-           decimals *= 10;
-           decimals += cur() - '0'; 
-           count++;
-           advance();
+            u32 digit = cur() - '0';
+            if (mantissa <= (UINT64_MAX - digit) / 10) {
+                mantissa = mantissa * 10 + digit;
+                exp10--;
+            } else {
+                truncated |= digit != 0;
+            }
+            advance();
         }
-        double frac = (double)decimals / pow(10, count);
-        float_val += frac;
     }
 
-    // (e(+|-)[0-9]+)?
-     if (cur() == 'e') {
+    // (e(+|-)?[0-9]+)?
+    if (cur() == 'e') {
         advance();
-        bool div;
+        bool exp_neg = false;
         if (cur() == '+') advance();
-        if (cur() == '-') { div = true; advance(); }
-        u64 exponent = 0;
-        while (cur() >= '0' && cur() <= '9') {
-           exponent *= 10;
-           exponent += cur() - '0'; 
-           advance();
+        else if (cur() == '-') { exp_neg = true; advance(); }
+        if (cur() < '0' || cur() > '9') {
+            cs_error(c, CS_MALFORMED_NUMBER);
+            return ssavar_invalid;
         }
-
-        if (is_float) {
-            if (div) {
-                float_val /= pow(10, exponent);
-            } else {
-                float_val *= pow(10, exponent);
-            }
-        } else {
-            if (div) {
-                int_val /= pow(10, exponent);
-            } else {
-                int_val *= pow(10, exponent);
-            }
+        i32 exponent = 0;
+        while (cur() >= '0' && cur() <= '9') {
+            // saturate, anything this large is 0 or inf anyway
+            if (exponent < 100000) exponent = exponent * 10 + (cur() - '0');
+            advance();
         }
+        // a negative exponent can't be represented by an int
+        if (exp_neg) is_float = true;
+        exp10 += exp_neg ? -exponent : exponent;
     }
+    char* span_end = c->cur;
     
     cs_SSAVar dest;
     if (is_float) {
+        double float_val = parse_float_span(span_start, span_end, mantissa, exp10, truncated);
+        if (is_neg) float_val = -float_val;
         dest = ssa_new_temp(c, CS_ATOM_FLOAT);
-        if (is_neg) float_val *= -1;
         cs_emit(c, dest, CS_LOADF, float_val, 0ll);
     } else {
+        // ints have to be exact, so every step is overflow checked
+        u64 limit = is_neg ? (u64)INT64_MAX + 1 : (u64)INT64_MAX;
+        bool overflow = truncated || mantissa > limit;
+        for (i32 i = 0; i < exp10 && !overflow; i++) {
+            if (mantissa > limit / 10) overflow = true;
+            else mantissa *= 10;
+        }
+        if (overflow) {
+            c->cur = span_start;
+            cs_error(c, CS_INT_OVERFLOW);
+            return ssavar_invalid;
+        }
+        i64 int_val = is_neg ? (i64)(0 - mantissa) : (i64)mantissa;
         dest = ssa_new_temp(c, CS_ATOM_INT);
-        if (is_neg) int_val *= -1;
         cs_emit(c, dest, CS_LOADI, int_val, 0ll);
     }
     return dest;
@@ -720,7 +910,8 @@ static cs_SSAVar gen_str_lit(cs_Context* c)
     while (true) {
         if (cur() == 0) {
             cs_error(c, CS_UNEXPECTED_EOF);
-            exit(-1);
+            free(sb.data);
+            return ssavar_invalid;
         }
         if (cur() == end_char) break;
         if (cur() == '\\') {
@@ -735,15 +926,18 @@ static cs_SSAVar gen_str_lit(cs_Context* c)
                 case 'r':  { val = 0x0D; } break;
                 case 't':  { val = 0x09; } break;
                 case 'v':  { val = 0x0B; } break;
-                case '\'': { val = 0x5C; } break;
-                case '\"': { val = 0x27; } break;
+                case '\\': { val = 0x5C; } break;
+                case '\'': { val = 0x27; } break;
+                case '\"': { val = 0x22; } break;
                 case '\?': { val = 0x3F; } break;
                 default: {
                     cs_error(c, CS_INVALID_ESCAPE_CHAR);
-                    exit(-1);
+                    free(sb.data);
+                    return ssavar_invalid;
                 } break;
             }
             cs_strbuilder_appendc(&sb, val);
+            advance();
             continue;
         }
         cs_strbuilder_appendc(&sb, cur());
@@ -756,6 +950,14 @@ static cs_SSAVar gen_str_lit(cs_Context* c)
     return dest;
 }
 
+// the name hash was parsed from, a parse job also knows the ones of its context
+static cs_Str* symbol_name(cs_Context* c, u32 hash)
+{
+    cs_Str** name = cs_hm_geth(&c->symbol_names, hash);
+    if (name == null && c->job != null) return symbol_name(parse_job_parent(c->job), hash);
+    return name != null ? *name : null;
+}
+
 static u32 parse_symbol(cs_Context* c)
 {
     char* start = c->cur;
@@ -771,6 +973,9 @@ static u32 parse_symbol(cs_Context* c)
         cs_error(c, CS_ENTRY_RESERVED);
         return 0;
     }
+    if (symbol_name(c, hash) == null) {
+        *(cs_Str**)cs_hm_seth(&c->symbol_names, hash) = cs_make_str(start, (u32)(end - start));
+    }
     return hash;
 }
 
@@ -779,6 +984,13 @@ static cs_SSAVar gen_symbol(cs_Context* c)
     u32 hash = parse_symbol(c);
     cs_Local* loc = cs_comscope_lookup(c, hash);
     if (loc == null) {
+        // natives can be shadowed by anything, so they are looked up last
+        cs_Native* native = cs_native_find(c, hash);
+        if (native != null) {
+            cs_SSAVar dest = ssa_new_temp(c, CS_ANON_FUNC);
+            cs_emit(c, dest, CS_LOADFUN, (i64)native->fn_id, 0ll);
+            return dest;
+        }
         cs_error(c, CS_SYMBOL_NOT_FOUND);
         return ssavar_invalid;
     } else {
@@ -788,9 +1000,10 @@ static cs_SSAVar gen_symbol(cs_Context* c)
 
 static cs_SSAVar gen_keyword(cs_Context* c)
 {
+    advance(); // skip ':'
     u32 hash = parse_symbol(c);
     cs_SSAVar dest = ssa_new_temp(c, CS_ATOM_KEYWORD);
-    cs_emit(c, dest, CS_LOADK, reinterpret(hash, i64), 0ll); 
+    cs_emit(c, dest, CS_LOADK, (i64)hash, 0ll);
     return dest;
 }
 
@@ -807,7 +1020,7 @@ static cs_SSAVar gen_atom(cs_Context* c)
         case '-': {
             char* cur_start = c->cur;
             cs_SSAVar res = gen_number(c);
-            if (ssa_invalid(res)) { 
+            if (ssa_invalid(res) && c->err == CS_OK) { 
                 c->cur = cur_start;
                 return gen_symbol(c);
             }
@@ -850,12 +1063,123 @@ static cs_SSAVar gen_atom(cs_Context* c)
     }
 }
 
-static void cs_add_preds_for_fn(cs_Context* c, cs_BasicBlock* cur, cs_BasicBlock* last_bb, cs_SSAVar result_dest)
+// rebinding: a let inside of an if or while only holds on the paths through it, so where control flow joins again
+// the variable gets a phi of the versions the paths left it at
+
+// the version a new binding of hash gets, unique even among bindings whose scope is gone
+static u16 next_version(cs_Context* c, u32 hash, cs_Local* loc)
+{
+    u16 version = loc != null ? loc->version + 1 : 0;
+    u16* last = cs_hm_geth(&c->versions, hash);
+    if (last == null && c->job != null) last = parse_job_versions(c->job, hash);
+    if (last != null && *last >= version) version = *last + 1;
+    *(u16*)cs_hm_seth(&c->versions, hash) = version;
+    return version;
+}
+
+// remembers what hash was bound to before a let or defn binds it again
+static void note_rebind(cs_Context* c, u32 hash, cs_Local* loc)
+{
+    if (c->branch_depth == 0) return;
+    c->rebind_count += 1;
+    cs_ensure_cap((void**)&c->rebinds, sizeof(cs_Rebind), &c->rebind_cap, c->rebind_count);
+    c->rebinds[c->rebind_count-1] = (cs_Rebind) {
+        .hash = hash,
+        .old = loc != null ? *loc : (cs_Local) {0},
+        .declared = loc == null,
+    };
+}
+
+static u32 rebinds_begin(cs_Context* c)
+{
+    c->branch_depth += 1;
+    return c->rebind_count;
+}
+
+static void rebinds_end(cs_Context* c)
+{
+    c->branch_depth -= 1;
+    if (c->branch_depth == 0) c->rebind_count = 0;
+}
+
+// the first rebinding of every variable in rebinds[start..end], which has the binding from before them
+static cs_Rebind* rebound_vars(cs_Context* c, u32 start, u32 end, u32* count)
+{
+    cs_Rebind* result = cs_malloc(sizeof(cs_Rebind) * (end - start) + 1);
+    *count = 0;
+    for (u32 i = start; i < end; i++) {
+        bool seen = false;
+        for (u32 j = 0; j < *count && !seen; j++) seen = result[j].hash == c->rebinds[i].hash;
+        if (!seen) result[(*count)++] = c->rebinds[i];
+    }
+    return result;
+}
+
+// a new version for hash, which the current scope binds it to
+static cs_SSAVar rebind_var(cs_Context* c, u32 hash)
+{
+    cs_SSAVar dest = ssavar(hash, CS_ATOM_VAR, next_version(c, hash, cs_comscope_lookup(c, hash)));
+    cs_comscope_set(c->cur_scope, dest);
+    return dest;
+}
+
+// defines dest by a phi in bb, which joins the versions a and b of it
+static void join_var(cs_Context* c, cs_BasicBlock* bb, cs_SSAVar dest, u16 a, u16 b)
+{
+    u32 index = 0;
+    for (cs_SSAPhi* p = &bb->phis_head; !ssa_invalid(p->dest); p = p->next) index++;
+    cs_bb_add_phi(bb, dest, ssavar(dest.hash, CS_ATOM_SYMBOL, a));
+    cs_bb_add_phi(bb, dest, ssavar(dest.hash, CS_ATOM_SYMBOL, b));
+
+    cs_BasicBlock* cur_bb = c->cur_bb;
+    c->cur_bb = bb;
+    ssa_def_var(c, dest, index);
+    c->cur_bb = cur_bb;
+}
+
+static void rename_var(cs_SSAVar* v, cs_SSAVar from, cs_SSAVar to)
+{
+    if (v->hash == from.hash && v->version == from.version) v->version = to.version;
+}
+
+// makes every use of from in bb a use of to
+static void rename_uses(cs_BasicBlock* bb, cs_SSAVar from, cs_SSAVar to)
+{
+    for (cs_SSAPhi* p = &bb->phis_head; !ssa_invalid(p->dest); p = p->next) {
+        for (int o = 0; o < p->option_count; o++) rename_var(&p->options[o], from, to);
+    }
+    for (u32 i = 0; i < bb->instr_count; i++) {
+        cs_SSAIns* ins = &bb->instrs[i];
+        if (ins->op == CS_CALL || ins->op == CS_CALLC || ins->op == CS_DYNCALL) {
+            if (ins->op == CS_DYNCALL) rename_var(&ins->a_as.var, from, to);
+            for (int a = 0; a < ins->b_as.args_->count; a++) rename_var(&ins->b_as.args_->vars[a], from, to);
+        } else if (cs_ins_uses_vars(ins->op)) {
+            rename_var(&ins->a_as.var, from, to);
+            rename_var(&ins->b_as.var, from, to);
+        }
+    }
+    rename_var(&bb->jump_cond, from, to);
+}
+
+// returns the function a symbol is statically bound to, or null if it has to be dispatched dynamically
+static cs_Function* cs_lookup_static_fn(cs_Context* c, cs_SSAVar var)
+{
+    cs_SSADef* def = ssa_get_def(c, var);
+    if (def == null || def->bb_id < 0) return null;
+    cs_SSAIns* ins = ssa_get_ins(c, def->bb_id, def->instr_id);
+    if (ins == null || ins->op != CS_LOADFUN) return null;
+    return cs_get_fn(c, reinterpret(ins->a_as.int_, u32));
+}
+
+static void add_preds_from(cs_Context* c, cs_BasicBlock* cur, cs_BasicBlock* last_bb, cs_SSAVar result_dest)
 {
     if (cur == last_bb) {
         cur->visited = true;
         return;
     }
+    // blocks are only walked once, both to not go around loops forever and to not redo the blocks after an if
+    if (cur->walk == c->cur_walk) return;
+    cur->walk = c->cur_walk;
     if ((cur->a == null && cur->b == null)) {
         log_debug("hi");
         if (cur->instr_count > 0) {
@@ -886,7 +1210,7 @@ static void cs_add_preds_for_fn(cs_Context* c, cs_BasicBlock* cur, cs_BasicBlock
         cs_BasicBlock* fn_end = cur->b;
         cs_bb_add_pred(return_bb, fn_end);
         cur = return_bb;
-        return cs_add_preds_for_fn(c, cur, last_bb, result_dest);
+        return add_preds_from(c, cur, last_bb, result_dest);
     }
     
     if (cur->a == cur || cur->b == cur) {
@@ -897,14 +1221,21 @@ static void cs_add_preds_for_fn(cs_Context* c, cs_BasicBlock* cur, cs_BasicBlock
     }
     if (cur->a != null) {
         cur->visited = true;
-        cs_add_preds_for_fn(c, cur->a, last_bb, result_dest);
+        add_preds_from(c, cur->a, last_bb, result_dest);
     } 
     if (cur->b != null) {
         cur->visited = true;
-        cs_add_preds_for_fn(c, cur->b, last_bb, result_dest);
+        add_preds_from(c, cur->b, last_bb, result_dest);
     }
 }
 
+// links every block reachable from first that doesn't jump anywhere to last_bb
+static void cs_add_preds_for_fn(cs_Context* c, cs_BasicBlock* first, cs_BasicBlock* last_bb, cs_SSAVar result_dest)
+{
+    c->cur_walk += 1;
+    add_preds_from(c, first, last_bb, result_dest);
+}
+
 static cs_SSAVar gen_do(cs_Context* c)
 {
     bool had_branch = false;
@@ -913,76 +1244,97 @@ static cs_SSAVar gen_do(cs_Context* c)
     cs_SSAVar last_res = ssavar_invalid;
     while (cur() != ')') {
         last_res = cs_parse_expr(c);
+        check_ssavar(last_res);
         skip_whitespace(c);
     }
+    advance();
     
     if (initial_bb != c->cur_bb) {
         // add preds for return bb, else we don't even need one
         cs_BasicBlock* return_bb = cs_make_bb(c);
-        u32 len = snprintf(buf, 256, "%s.do_end#%d", initial_bb->label->data, c->cur_bb_id);
-        return_bb->label = cs_make_str(buf, len);
+        u32 len = snprintf(c->label_buf, 256, "%s.do_end#%d", initial_bb->label->data, c->cur_bb_id);
+        return_bb->label = cs_make_str(c->label_buf, len);
         c->cur_bb = return_bb;
         
         cs_SSAVar result_dest = ssa_new_temp(c, CS_TYPECOUNT);
         cs_add_preds_for_fn(c, initial_bb, return_bb, result_dest);
-        return result_dest;
+        return last_res;
     } else {
         // no need for a return bb
         return last_res;
     }
 }
 
+// binds hash to fn in the current scope, redefined is the function it was bound to in the same scope before
+static bool declare_function(cs_Context* c, u32 hash, cs_Function* fn, cs_Function** redefined)
+{
+    cs_SSAVar result = ssavar(hash, CS_FUNC, 0);
+    // declare function in scope
+    cs_Local* loc = cs_comscope_lookup(c, hash);
+    note_rebind(c, hash, loc);
+    result.version = next_version(c, hash, loc);
+    if (loc != null) {
+        // redefinitions in the same scope take over the call sites of the old function
+        if (loc->type == CS_FUNC && cs_hm_geth(&c->cur_scope->locals, hash) != null) {
+            *redefined = cs_lookup_static_fn(c, ssavar(hash, CS_FUNC, loc->version));
+            if (c->repl_globals.data != null) cs_repl_share_global(c, result, ssavar(hash, CS_FUNC, loc->version));
+        }
+    }
+    if (cs_comscope_is_root(c)) c->bindings_changed = true;
+    cs_Str* name = symbol_name(c, hash);
+    if (name != null) fn->title = name;
+    ssa_def_var(c, result, -1);
+    cs_emit(c, result, CS_LOADFUN, (i64)fn->id, 0ll);
+    return cs_comscope_set(c->cur_scope, result);
+}
+
+static u32 parse_function_body(cs_Context* c, cs_Function* fn, cs_Function* redefined_fn);
+
 static u32 parse_function(cs_Context* c, u32 hash)
 {
     skip_whitespace(c);   
     
-    cs_BasicBlock* initial_bb = c->cur_bb;
+    cs_Function* fn = cs_make_fn(c, null);
+    cs_Function* redefined_fn = null;
+    if (hash != 0 && !declare_function(c, hash, fn, &redefined_fn)) return 0;
+    return parse_function_body(c, fn, redefined_fn);
+}
 
-    u32 fn_id = 0;
-    cs_Function* fn = cs_make_fn(c, &fn_id);
-    cs_FunctionBody* fb = cs_fn_add_variant(c, fn);
-    fb->arg_count = 0;
-    fb->args = null;
+// the arguments and body of fn, after its name
+static u32 parse_function_body(cs_Context* c, cs_Function* fn, cs_Function* redefined_fn)
+{
+    cs_BasicBlock* initial_bb = c->cur_bb;
+    u32 fn_id = fn->id;
+    i8 arg_count = 0;
+    u32* args = null;
     u32 arg_buf[INT8_MAX] = {0};
-    fb->calls = 0;
-
-    if (hash != 0) {
-        cs_SSAVar result = ssavar(hash, CS_FUNC, 0);
-        // declare function in scope
-        cs_Local* loc = cs_comscope_lookup(c, hash);
-        if (loc != null) {
-            // upgrade version of existing variable
-            result.version = loc->version + 1;
-        }
-        ssa_def_var(c, result, -1);
-        cs_emit(c, result, CS_LOADFUN, (i64)fn_id, 0ll);
-        or_return(cs_comscope_set(c->cur_scope, result),
-            0);
-    }
 
     // parse arguments
     if (cur() == '[') {
         advance();
         while (cur() != ']') {
-            arg_buf[fb->arg_count] = parse_symbol(c);
-            fb->arg_count++;
+            arg_buf[arg_count] = parse_symbol(c);
+            arg_count++;
             skip_whitespace(c);
         }
         advance();
-        fb->args = malloc(sizeof(u32) * fb->arg_count);
-        memcpy_s(fb->args, sizeof(u32) * fb->arg_count, arg_buf, sizeof(u32) * fb->arg_count);
+        args = cs_malloc(sizeof(u32) * arg_count);
+        memcpy_s(args, sizeof(u32) * arg_count, arg_buf, sizeof(u32) * arg_count);
     }
+    cs_FunctionBody* fb = cs_fn_add_variant(c, fn, arg_count);
+    fb->args = args;
+    fb->calls = 0;
 
     fb->entry = cs_make_bb(c);
     cs_BasicBlock* entry = fb->entry;
-    u32 len = snprintf(buf, 20, "fn_%d.entry", fn_id);
-    entry->label = cs_make_str(buf, len);
+    u32 len = snprintf(c->label_buf, 20, "fn_%d.entry", fn_id);
+    entry->label = cs_make_str(c->label_buf, len);
     
     cs_comscope_push(c);
     // construct phis for arguments
     c->cur_bb = entry;
     cs_SSAPhi* cur_phi = &entry->phis_head;
-    cs_SSAPhi* phi_pool = malloc(sizeof(cs_SSAPhi) * fb->arg_count);
+    cs_SSAPhi* phi_pool = cs_malloc(sizeof(cs_SSAPhi) * fb->arg_count);
     for (int i = 0; i < fb->arg_count; i++) {
         cur_phi->option_count = 0; cur_phi->options = null;
         cur_phi->dest = ssavar(fb->args[i], CS_ATOM_VAR, 0ll);
@@ -998,8 +1350,8 @@ static u32 parse_function(cs_Context* c, u32 hash)
     // last bb where we catch all possible return paths
     // we create the last bb first, because a recursive function might depend on it
     cs_BasicBlock* last_bb = cs_make_bb(c);
-    len = snprintf(buf, 256, "fn_%d.return", fn_id);
-    last_bb->label = cs_make_str(buf, len);
+    len = snprintf(c->label_buf, 256, "fn_%d.return", fn_id);
+    last_bb->label = cs_make_str(c->label_buf, len);
     last_bb->jump_cond = ssavar_return;
     fb->return_bb = last_bb;
     fb->return_val = ssa_new_temp(c, CS_ATOM_VAR);
@@ -1007,9 +1359,10 @@ static u32 parse_function(cs_Context* c, u32 hash)
     cs_emit(c, ssavar_invalid, CS_SCOPE_PUSH, ssavar_invalid, ssavar_invalid);
 
     // parse & generate body
+    cs_SSAVar body_res = ssavar_invalid;
     while (cur() != ')') {
-        cs_SSAVar res = cs_parse_expr(c);
-        if (ssa_invalid(res)) {
+        body_res = cs_parse_expr(c);
+        if (ssa_invalid(body_res)) {
             return 0;
         }
         skip_whitespace(c);
@@ -1026,14 +1379,22 @@ static u32 parse_function(cs_Context* c, u32 hash)
         entry->jump_cond = ssavar_return;
         entry->a = null;
         fb->return_bb = entry;
-        if (entry->instr_count > 0) {
-            cs_SSAVar last_res = entry->instrs[entry->instr_count-1].dest;
-            fb->return_val = last_res;
-        }
         cs_emit(c, ssavar_invalid, CS_SCOPE_POP, ssavar_invalid, ssavar_invalid);
     }
+    // the value of the last expression flows into the return block, which might not be an instruction (e.g. an argument)
+    fb->return_val = body_res;
 
     cs_comscope_pop(c);
+    if (redefined_fn != null) {
+        cs_fn_redefine(redefined_fn, fn);
+        // the code the repl already lowered is repointed when it lowers the new function
+        if (c->repl_globals.data != null) {
+            c->repl_redefined_count += 2;
+            cs_ensure_cap((void**)&c->repl_redefined, sizeof(u32), &c->repl_redefined_cap, c->repl_redefined_count);
+            c->repl_redefined[c->repl_redefined_count-2] = redefined_fn->id;
+            c->repl_redefined[c->repl_redefined_count-1] = fn_id;
+        }
+    }
 
     c->cur_bb = initial_bb;
     return fn_id;
@@ -1044,50 +1405,105 @@ static cs_SSAVar gen_function(cs_Context* c)
     u32 fn_id = parse_function(c, 0ll);
     if (fn_id == 0) return ssavar_invalid;
     cs_SSAVar dest = ssa_new_temp(c, CS_ANON_FUNC);
-    dest.hash = fn_id;
+    cs_emit(c, dest, CS_LOADFUN, (i64)fn_id, 0ll);
     return dest;
 }
 
 static cs_SSAVar gen_while(cs_Context* c) 
 {
     skip_whitespace(c);
+    u32 rebinds_start = rebinds_begin(c);
+    u32 first_fn = c->cur_fn_id;
     cs_BasicBlock* bb_check_cond = cs_make_bb(c);
     cs_bb_unconditional_jump(c->cur_bb, bb_check_cond);
     cs_BasicBlock* initial_bb = c->cur_bb;
-    u32 len = snprintf(buf, 256, "%s.while_cond#%d", initial_bb->label->data, c->cur_bb_id); 
-    bb_check_cond->label = cs_make_str(buf, len);
+    u32 len = snprintf(c->label_buf, 256, "%s.while_cond#%d", initial_bb->label->data, c->cur_bb_id); 
+    bb_check_cond->label = cs_make_str(c->label_buf, len);
     
     c->cur_bb = bb_check_cond;
     cs_SSAVar cond = cs_parse_expr(c);
     check_ssavar(cond);
     cs_BasicBlock* bb_check_cond_end = c->cur_bb;
 
+    // the loop is left after the condition, with the versions it bound
+    u32 cond_count;
+    cs_Rebind* cond_vars = rebound_vars(c, rebinds_start, c->rebind_count, &cond_count);
+    u16* exit_versions = cs_malloc(sizeof(u16) * cond_count + 1);
+    for (u32 i = 0; i < cond_count; i++) {
+        cs_Local* loc = cs_comscope_lookup(c, cond_vars[i].hash);
+        exit_versions[i] = loc != null ? loc->version : 0;
+    }
+
     cs_BasicBlock* while_body = cs_make_bb(c);
-    len = snprintf(buf, 256, "%s.while_body#%d", initial_bb->label->data, c->cur_bb_id);
-    buf[len] = 0;
-    while_body->label = cs_make_str(buf, len);
+    len = snprintf(c->label_buf, 256, "%s.while_body#%d", initial_bb->label->data, c->cur_bb_id);
+    c->label_buf[len] = 0;
+    while_body->label = cs_make_str(c->label_buf, len);
 
     cs_BasicBlock* bb_end = cs_make_bb(c);
-    len = snprintf(buf, 256, "%s.while_end#%d", initial_bb->label->data, c->cur_bb_id);
-    buf[len] = 0;
-    bb_end->label = cs_make_str(buf, len);
+    len = snprintf(c->label_buf, 256, "%s.while_end#%d", initial_bb->label->data, c->cur_bb_id);
+    c->label_buf[len] = 0;
+    bb_end->label = cs_make_str(c->label_buf, len);
 
     c->cur_bb = while_body;
     cs_bb_conditional_jump(bb_check_cond_end, while_body, bb_end, cond);
     while (cur() != ')') {
-        cs_parse_expr(c);
+        cs_SSAVar res = cs_parse_expr(c);
+        if (ssa_invalid(res)) {
+            free(cond_vars); free(exit_versions);
+            return ssavar_invalid;
+        }
         skip_whitespace(c);
     }
     advance();
     cs_BasicBlock* while_body_end = c->cur_bb;
     cs_bb_unconditional_jump(while_body_end, bb_check_cond);
 
+    // a variable rebound in the loop is a phi in the condition, of the version from before the loop and
+    // the one the body leaves it at. the loop was generated with the old version, so its uses are renamed
+    u32 count;
+    cs_Rebind* vars = rebound_vars(c, rebinds_start, c->rebind_count, &count);
+    for (u32 i = 0; i < count; i++) {
+        if (vars[i].declared) continue;
+        u32 hash = vars[i].hash;
+        cs_SSAVar before = ssavar(hash, CS_ATOM_SYMBOL, vars[i].old.version);
+        u16 latch = cs_comscope_lookup(c, hash)->version;
+        if (latch == before.version) continue;
+
+        cs_SSAVar phi = rebind_var(c, hash);
+        for (u32 id = bb_check_cond->id; id < c->cur_bb_id; id++) {
+            rename_uses(cs_get_bb(c, id), before, phi);
+        }
+        for (u32 id = first_fn; id < c->cur_fn_id; id++) {
+            cs_Function* fn = cs_get_fn(c, id);
+            for (int v = 0; v < fn->variant_count; v++) rename_var(&fn->variants[v].return_val, before, phi);
+        }
+        join_var(c, bb_check_cond, phi, before.version, latch);
+
+        u16 exit = phi.version;
+        for (u32 k = 0; k < cond_count; k++) {
+            if (cond_vars[k].hash == hash && exit_versions[k] != before.version) exit = exit_versions[k];
+        }
+        cs_comscope_set(c->cur_scope, ssavar(hash, CS_ATOM_VAR, exit));
+    }
+    free(vars); free(cond_vars); free(exit_versions);
+    rebinds_end(c);
+
     c->cur_bb = bb_end;
     cs_SSAVar dest = ssa_new_temp(c, CS_ATOM_NIL);
     cs_emit(c, dest, CS_LOADNIL, ssavar_invalid, ssavar_invalid);
     return dest;
 }
 
+// the phi of an if only knows which branch a value came from by where it is defined, so a variable from
+// before the if is copied into the branch
+static cs_SSAVar if_branch_result(cs_Context* c, cs_SSAVar v)
+{
+    if (v.hash == tempvar_hash) return v;
+    cs_SSAVar copy = ssa_new_temp(c, v.type == CS_ATOM_SYMBOL ? CS_ATOM_VAR : v.type);
+    cs_emit(c, copy, CS_MOV, v, ssavar_invalid);
+    return copy;
+}
+
 static cs_SSAVar gen_if(cs_Context* c)
 {
     cs_BasicBlock* initial_bb = c->cur_bb;
@@ -1095,27 +1511,43 @@ static cs_SSAVar gen_if(cs_Context* c)
     check_ssavar(cond);
 
     cs_BasicBlock* true_branch = cs_make_bb(c);
-    u32 len = snprintf(buf, 256, "%s.if_true#%d", initial_bb->label->data, c->cur_bb_id);
-    true_branch->label = cs_make_str(buf, len);
+    u32 len = snprintf(c->label_buf, 256, "%s.if_true#%d", initial_bb->label->data, c->cur_bb_id);
+    true_branch->label = cs_make_str(c->label_buf, len);
 
     cs_BasicBlock* false_branch = cs_make_bb(c);
-    len = snprintf(buf, 256, "%s.if_false#%d", initial_bb->label->data, c->cur_bb_id);
-    false_branch->label = cs_make_str(buf, len);
+    len = snprintf(c->label_buf, 256, "%s.if_false#%d", initial_bb->label->data, c->cur_bb_id);
+    false_branch->label = cs_make_str(c->label_buf, len);
 
     cs_BasicBlock* if_end = cs_make_bb(c);
-    len = snprintf(buf, 256, "%s.if_end#%d", initial_bb->label->data, c->cur_bb_id);
-    if_end->label = cs_make_str(buf, len);
+    len = snprintf(c->label_buf, 256, "%s.if_end#%d", initial_bb->label->data, c->cur_bb_id);
+    if_end->label = cs_make_str(c->label_buf, len);
 
     cs_bb_conditional_jump(c->cur_bb, true_branch, false_branch, cond);
 
+    u32 rebinds_start = rebinds_begin(c);
     c->cur_bb = true_branch;
     cs_SSAVar return1 = cs_parse_expr(c);
     check_ssavar(return1);
+    return1 = if_branch_result(c, return1);
     cs_bb_unconditional_jump(c->cur_bb, if_end);
 
+    // the false branch starts with the bindings from before the if again
+    u32 true_count;
+    cs_Rebind* true_vars = rebound_vars(c, rebinds_start, c->rebind_count, &true_count);
+    u16* true_versions = cs_malloc(sizeof(u16) * true_count + 1);
+    for (u32 i = 0; i < true_count; i++) {
+        true_versions[i] = cs_comscope_lookup(c, true_vars[i].hash)->version;
+        cs_Local old = true_vars[i].old;
+        if (!true_vars[i].declared) cs_comscope_set(c->cur_scope, ssavar(true_vars[i].hash, old.type, old.version));
+    }
+
     c->cur_bb = false_branch;
     cs_SSAVar return2 = cs_parse_expr(c);
-    check_ssavar(return2);
+    if (ssa_invalid(return2)) {
+        free(true_vars); free(true_versions);
+        return ssavar_invalid;
+    }
+    return2 = if_branch_result(c, return2);
     cs_bb_unconditional_jump(c->cur_bb, if_end);
 
     skip_whitespace(c);
@@ -1126,6 +1558,22 @@ static cs_SSAVar gen_if(cs_Context* c)
     }
 
     c->cur_bb = if_end;
+    u32 count;
+    cs_Rebind* vars = rebound_vars(c, rebinds_start, c->rebind_count, &count);
+    for (u32 i = 0; i < count; i++) {
+        u32 hash = vars[i].hash;
+        i32 on_true = vars[i].declared ? -1 : vars[i].old.version;
+        for (u32 k = 0; k < true_count; k++) {
+            if (true_vars[k].hash == hash) on_true = true_versions[k];
+        }
+        u16 on_false = cs_comscope_lookup(c, hash)->version;
+        // declared in the false branch only, there is nothing to join it with
+        if (on_true < 0 || on_true == on_false) continue;
+        join_var(c, if_end, rebind_var(c, hash), on_true, on_false);
+    }
+    free(vars); free(true_vars); free(true_versions);
+    rebinds_end(c);
+
     cs_SSAVar return_val = ssa_new_temp(c, CS_ATOM_VAR);
     cs_bb_add_phi(if_end, return_val, return1);
     cs_bb_add_phi(if_end, return_val, return2);
@@ -1142,28 +1590,40 @@ cs_SSAVar gen_let(cs_Context* c)
         u32 hash = parse_symbol(c);
         if (hash == 0) return ssavar_invalid;
         cs_SSAVar val = cs_parse_expr(c);
+        check_ssavar(val);
+        skip_whitespace(c);
+        if (cur() != ')') {
+            cs_error(c, CS_MISSING_PAREN);
+            return ssavar_invalid;
+        }
+        advance();
+        skip_whitespace(c);
 
-        // mark new version of variable
-        cs_Local* loc = cs_comscope_lookup(c, hash);
-        if (loc == null) {
-            // version 0 if variable does not already exist
-            cs_SSAVar new = ssavar(hash, val.type, 0);
-            or_return(cs_comscope_set(c->cur_scope, new),
-                ssavar_invalid);
-            last = new;
-        } else {
-            // upgrade version of existing variable
-            cs_SSAVar new = ssavar(hash, val.type, loc->version + 1);
-            or_return(cs_comscope_set(c->cur_scope, new),
-                ssavar_invalid);
-            last = new;
+        if (cs_comscope_is_root(c)) {
+            // forms compiled against the old binding are stale now
+            c->binding_epoch += 1;
+            c->bindings_changed = true;
         }
+
+        // mark new version of variable, version 0 if variable does not already exist
+        cs_Local* loc = cs_comscope_lookup(c, hash);
+        note_rebind(c, hash, loc);
+        last = ssavar(hash, val.type, next_version(c, hash, loc));
+        or_return(cs_comscope_set(c->cur_scope, last),
+            ssavar_invalid);
         
         if (ssa_invalid(last)) {
             log_fatal("failed to set var");
             return ssavar_invalid;
         }
+        ssa_def_var(c, last, -1);
+        cs_emit(c, last, CS_MOV, val, 0ll);
     }
+    if (cur() != ')') {
+        cs_error(c, CS_MISSING_PAREN);
+        return ssavar_invalid;
+    }
+    advance();
     return last;
 }
 
@@ -1185,29 +1645,79 @@ cs_SSAVar gen_binop(cs_Context* c, cs_OpKind op)
     }
     advance();
 
-    cs_SSAVar result = ssa_new_temp(c, CS_ATOM_VAR);
+    // adding anything to a string either concatenates or fails, the lowering fuses those chains
+    bool str = op == CS_ADDV && (arg_a.type == CS_ATOM_STR || arg_b.type == CS_ATOM_STR);
+    cs_SSAVar result = ssa_new_temp(c, str ? CS_ATOM_STR : CS_ATOM_VAR);
     // TODO: typechecking?
 
     cs_emit(c, result, op, arg_a, arg_b);
     return result;
 }
 
+cs_SSAVar gen_unop(cs_Context* c, cs_OpKind op)
+{
+    cs_SSAVar arg = cs_parse_expr(c);
+    check_ssavar(arg);
+    skip_whitespace(c);
+    if (cur() != ')') {
+        cs_error(c, CS_TOO_MANY_ARGUMENTS);
+        return ssavar_invalid;
+    }
+    advance();
+
+    cs_SSAVar result = ssa_new_temp(c, CS_ATOM_VAR);
+    cs_emit(c, result, op, arg, ssavar_invalid);
+    return result;
+}
+
 cs_SSAVar gen_quote(cs_Context* c)
 {
     return ssavar_invalid;
 }
 
-cs_SSAVar gen_dyncall(cs_Context* c)
+// parses the arguments of a call up to the closing paren
+static cs_CallArgs* parse_call_args(cs_Context* c)
 {
-    todo(dynamic_dispatch);
-    return ssavar_invalid;
+    u8 arg_count = 0;
+    cs_SSAVar args[FUNCTION_MAX_ARGS] = {0};
+    while (cur() != ')') {
+        cs_SSAVar arg = cs_parse_expr(c);
+        if (ssa_invalid(arg)) return null;
+        args[arg_count] = arg;
+        arg_count += 1;
+        if (arg_count == 32) {
+            cs_error(c, CS_TOO_MANY_ARGUMENTS);
+            return null;
+        }
+        skip_whitespace(c);
+    }
+    advance();
+
+    cs_CallArgs* call_args = cs_malloc(sizeof(cs_CallArgs) + sizeof(cs_SSAVar) * arg_count);
+    call_args->count = arg_count;
+    memcpy(call_args->vars, args, sizeof(cs_SSAVar) * arg_count);
+    return call_args;
+}
+
+// the callee is only known at runtime, the vm resolves it through the inline cache of the call site.
+// the callee is not part of the cfg, so the call doesn't end the block
+cs_SSAVar gen_dyncall(cs_Context* c, cs_SSAVar callee)
+{
+    cs_CallArgs* call_args = parse_call_args(c);
+    if (call_args == null) return ssavar_invalid;
+    cs_SSAVar result = ssa_new_temp(c, CS_ATOM_VAR);
+    cs_emit(c, result, CS_DYNCALL, callee, call_args);
+    return result;
 }
 
 cs_SSAVar cs_parse_expr(cs_Context* c)
 {
     cs_SSAVar dest = ssavar_invalid;
     skip_whitespace(c);
-    if (cur() == 0) return ssavar_invalid;
+    if (cur() == 0) {
+        cs_error(c, CS_UNEXPECTED_EOF);
+        return ssavar_invalid;
+    }
     
     if (cur() == '(') {
         advance();
@@ -1248,8 +1758,8 @@ cs_SSAVar cs_parse_expr(cs_Context* c)
             case k_geq   : { return gen_binop(c, CS_GEQV); } break;
             case k_leq   : { return gen_binop(c, CS_LEQV); } break;
             case k_eq    : { return gen_binop(c, CS_EQV); } break;
-            case k_getcar: { return gen_binop(c, CS_GETCAR); } break;
-            case k_getcdr: { return gen_binop(c, CS_GETCDR); } break;
+            case k_getcar: { return gen_unop(c, CS_GETCAR); } break;
+            case k_getcdr: { return gen_unop(c, CS_GETCDR); } break;
             case k_setcar: { return gen_binop(c, CS_SETCAR); } break;
             case k_setcdr: { return gen_binop(c, CS_SETCDR); } break;
             case k_cons  : { return gen_binop(c, CS_CONS); } break;
@@ -1260,10 +1770,12 @@ cs_SSAVar cs_parse_expr(cs_Context* c)
 
         // function to call
         cs_Function* fn = null;
-        if (fn_name.type == CS_ANON_FUNC) {
+        cs_SSAIns* last = c->cur_bb->instr_count > 0 ? &c->cur_bb->instrs[c->cur_bb->instr_count-1] : null;
+        if (fn_name.type == CS_ANON_FUNC && last != null && last->op == CS_LOADFUN && ssa_eq(last->dest, fn_name)) {
             // function was created just for calling it
             c->cur_bb->instr_count--; // remove last instruction, since we statically add the call
-            fn = cs_get_fn(c, fn_name.hash);
+            cs_SSAIns last_ins = c->cur_bb->instrs[c->cur_bb->instr_count];
+            fn = cs_get_fn(c, reinterpret(last_ins.a_as.int_, u32));
         } else if (fn_name.type == CS_FUNC){
             // extract fn_id from the last instruction
             cs_SSAIns last_ins = c->cur_bb->instrs[c->cur_bb->instr_count-1];
@@ -1287,7 +1799,7 @@ cs_SSAVar cs_parse_expr(cs_Context* c)
                 }
                 if (def->bb_id < 0) {
                     // definition is a phi, dispatch dynamically
-                    return gen_dyncall(c);
+                    return gen_dyncall(c, fn_name);
                 }
 
                 cs_SSAIns* ins = ssa_get_ins(c, def->bb_id, def->instr_id);
@@ -1299,28 +1811,21 @@ cs_SSAVar cs_parse_expr(cs_Context* c)
                 u32 fn_id = reinterpret(ins->a_as.int_, u32);
                 fn = cs_get_fn(c, fn_id);
             } else {
-                return gen_dyncall(c);
+                return gen_dyncall(c, fn_name);
             }
-        } else {
+        } else if ((fn_name.type >= CS_ATOM_INT && fn_name.type <= CS_ATOM_NIL)
+            || fn_name.type == CS_ATOM_KEYWORD || fn_name.type == CS_LIST) {
             cs_error(c, CS_VAL_NOT_CALLABLE);
             return ssavar_invalid;
+        } else {
+            // the result of some expression, e.g. (if c f g)
+            return gen_dyncall(c, fn_name);
         }
 
         // evaluate arguments
-        u8 arg_count = 0;
-        cs_SSAVar args[FUNCTION_MAX_ARGS] = {0};
-        while (cur() != ')') {
-            cs_SSAVar arg = cs_parse_expr(c);
-            check_ssavar(arg);
-            args[arg_count] = arg;
-            arg_count += 1;
-            if (arg_count == 32) {
-                cs_error(c, CS_TOO_MANY_ARGUMENTS);
-                return ssavar_invalid;
-            }
-            skip_whitespace(c);
-        }
-        advance();
+        cs_CallArgs* call_args = parse_call_args(c);
+        if (call_args == null) return ssavar_invalid;
+        u8 arg_count = call_args->count;
 
         // find corresponding variant based on the number of arguments
         cs_FunctionBody* fn_variant = cs_fn_get_variant(fn, arg_count);
@@ -1328,29 +1833,40 @@ cs_SSAVar cs_parse_expr(cs_Context* c)
             cs_error(c, CS_INVALID_NUMBER_OF_ARGUMENTS);
             return ssavar_invalid;
         }
-        fn_variant->calls += 1;
+        // a parse job leaves the functions of its context alone until it is merged
+        bool deferred = c->job != null && parse_job_foreign(c->job, fn_variant);
+        if (!deferred) fn_variant->calls += 1;
 
         // statically dispatch the function
-        cs_bb_call(c->cur_bb, fn_variant);
-
-        cs_BasicBlock* fn_entry = fn_variant->entry;
-        cs_SSAPhi* cur = &fn_entry->phis_head;
-        // update phis
-        for (int i = 0; i < arg_count; i++) {
-            cur->option_count++;
-            cur->options = realloc(cur->options, cur->option_count * sizeof(cs_SSAVar));
-            cur->options[cur->option_count-1] = args[i];
-            cur = cur->next;
+        if (fn_variant->arg_count < 0) {
+            // natives return right away, so the call doesn't end the block
+            cs_Native* native = &c->natives[fn_variant->code_id];
+            cs_ObjectType type = CS_ATOM_VAR;
+            if (!native->boxed && native->result == 'i') type = CS_ATOM_INT;
+            if (!native->boxed && native->result == 'd') type = CS_ATOM_FLOAT;
+            if (!native->boxed && native->result == 's') type = CS_ATOM_STR;
+            cs_SSAVar result = ssa_new_temp(c, type);
+            cs_emit(c, result, CS_CALLC, fn_variant, call_args);
+            if (deferred) parse_job_defer(c->job, fn_variant, null, null);
+            return result;
+        }
+        // the call gets its own result, since the return value of the callee is shared by all call sites
+        cs_SSAVar result = ssa_new_temp(c, fn_variant->return_val.type);
+        cs_emit(c, result, CS_CALL, fn_variant, call_args);
+        if (deferred) {
+            parse_job_defer(c->job, fn_variant, c->cur_bb, call_args);
+            c->cur_bb->a = fn_variant->entry;
+            c->cur_bb->b = fn_variant->return_bb;
+            c->cur_bb->jump_cond = ssavar_call;
+        } else {
+            cs_bb_call(c->cur_bb, fn_variant);
+            cs_bb_add_call_args(fn_variant, call_args);
         }
         
         cs_BasicBlock* return_bb = cs_make_bb(c);
         cs_bb_add_pred(return_bb, fn_variant->return_bb);
-        u32 len = snprintf(buf, 256, "%s.return_to#%d", c->cur_bb->label->data, c->cur_bb_id);
-        return_bb->label = cs_make_str(buf, len);
-
-        /*cs_SSAVar result = ssa_new_temp(c, fn_variant->return_val.type);
-        cs_bb_add_phi(return_bb, result, fn_variant->return_val);*/
-        cs_SSAVar result = fn_variant->return_val;
+        u32 len = snprintf(c->label_buf, 256, "%s.return_to#%d", c->cur_bb->label->data, c->cur_bb_id);
+        return_bb->label = cs_make_str(c->label_buf, len);
 
         // return address
         c->cur_bb->return_address = return_bb;
@@ -1365,337 +1881,762 @@ cs_SSAVar cs_parse_expr(cs_Context* c)
     return dest;
 }
 
+/* ==== PARALLEL PARSING ==== */
+// the defns that follow each other at the top-level are a batch. each is declared right away, its body is
+// parsed later by a parse job, on any of the threads of the batch and into a context of its own.
+// a job sees what was bound before its defn through the context it was made for, which doesn't change while
+// the batch is parsed. the functions it calls there only get the call once it is merged, in the order of the
+// defns, and so do the ids of the blocks and functions it made, so the ssa is the same on any number of threads
+
+#define CS_BB_MOVED 0xffffffffu // id of a block of a job once it is merged, a points to where it went
+
+typedef struct {
+    cs_FunctionBody* fb;
+    cs_BasicBlock* site;    // null for natives
+    cs_CallArgs* args;
+} cs_ParseCall;
+
+typedef struct {
+    u32 hash;
+    i32 last;   // version of the context before the job bound it, -1 if it was never bound
+    u16 shift;  // added to the versions the job gave it, once it is merged
+} cs_VersionBase;
+
+typedef struct cs_ParseBatch cs_ParseBatch;
+
+struct cs_ParseJob {
+    cs_Context c;
+    cs_ParseBatch* batch;
+    u32 index;              // the defns after it in the batch aren't bound yet for it
+    u32 fn_id;
+    char* body; char* end;  // from after the name of the defn to after its closing paren
+    cs_ParseCall* calls; u32 call_count, call_cap;
+    cs_HMap version_base;   // hash => cs_VersionBase of every name the job bound
+    bool done;
+};
+
+struct cs_ParseBatch {
+    cs_Context* c;
+    cs_ParseJob** jobs; u32 job_count, job_cap;
+    cs_HMap names;  // hash => u32 index of the job of the defn
+    u32 next;       // job the next free thread parses
+};
+
+static cs_Context* parse_job_parent(cs_ParseJob* job)
+{
+    return job->batch->c;
+}
+
+static cs_Local* parse_job_lookup(cs_ParseJob* job, u32 hash)
+{
+    u32* index = cs_hm_geth(&job->batch->names, hash);
+    if (index != null && *index > job->index) return null;
+    return cs_comscope_lookup(parse_job_parent(job), hash);
+}
+
+static u16* parse_job_versions(cs_ParseJob* job, u32 hash)
+{
+    u16* last = cs_hm_geth(&parse_job_parent(job)->versions, hash);
+    cs_VersionBase* base = cs_hm_seth(&job->version_base, hash);
+    base->hash = hash;
+    base->last = last != null ? *last : -1;
+    return last;
+}
+
+// true if fb is a function of the context, which the job mustn't change
+static bool parse_job_foreign(cs_ParseJob* job, cs_FunctionBody* fb)
+{
+    return fb->fn_id < CS_JOB_ID_BASE && fb->fn_id != job->fn_id;
+}
+
+static void parse_job_defer(cs_ParseJob* job, cs_FunctionBody* fb, cs_BasicBlock* site, cs_CallArgs* args)
+{
+    job->call_count += 1;
+    cs_ensure_cap((void**)&job->calls, sizeof(cs_ParseCall), &job->call_cap, job->call_count);
+    job->calls[job->call_count-1] = (cs_ParseCall) { .fb = fb, .site = site, .args = args };
+}
+
+// declares the defn at c->cur and adds its body to the batch, false if it has to be parsed right away.
+// that are redefinitions, which take over the call sites of the old function, and forms that aren't closed
+static bool parse_batch_add(cs_ParseBatch* b, cs_SSAVar* result)
+{
+    cs_Context* c = b->c;
+    char* form_start = c->cur;
+    bool complete;
+    char* form_end = cs_scan_form(form_start, c->start + c->len, &complete);
+    if (!complete || cur() != '(') return false;
+
+    advance();
+    skip_whitespace(c);
+    char* keyword = c->cur;
+    while (!is_disallowed_symbol_char(cur())) advance();
+    bool is_defn = fnv1a(keyword, c->cur) == k_defn;
+    skip_whitespace(c);
+    char* name = c->cur;
+    while (!is_disallowed_symbol_char(cur())) advance();
+    u32 hash = fnv1a(name, c->cur);
+    if (!is_defn || name == c->cur || hash == tempvar_hash || hash == entrysym_hash
+        || cs_comscope_lookup(c, hash) != null) {
+        c->cur = form_start;
+        return false;
+    }
+
+    c->cur = keyword;
+    parse_symbol(c);
+    skip_whitespace(c);
+    parse_symbol(c);
+    skip_whitespace(c);
+    cs_Function* fn = cs_make_fn(c, null);
+    cs_Function* redefined = null;
+    declare_function(c, hash, fn, &redefined);
+    *result = ssa_new_temp(c, CS_ATOM_NIL);
+    cs_emit(c, *result, CS_LOADNIL, ssavar_invalid, ssavar_invalid);
+
+    cs_ParseJob* job = cs_calloc(1, sizeof(cs_ParseJob));
+    job->batch = b;
+    job->index = b->job_count;
+    job->fn_id = fn->id;
+    job->body = c->cur; job->end = form_end;
+    b->job_count += 1;
+    cs_ensure_cap((void**)&b->jobs, sizeof(cs_ParseJob*), &b->job_cap, b->job_count);
+    b->jobs[job->index] = job;
+    *(u32*)cs_hm_seth(&b->names, hash) = job->index;
+    c->cur = form_end;
+    return true;
+}
+
+// waits for the jobs before it whose defns the body of job names, it might call them
+static void parse_job_wait(cs_ParseJob* job)
+{
+    cs_ParseBatch* b = job->batch;
+    char* cur = job->body;
+    while (cur < job->end) {
+        if (*cur == ';') {
+            while (cur < job->end && *cur != '\n') cur++;
+            continue;
+        }
+        if (*cur == '"') {
+            cur++;
+            while (cur < job->end && *cur != '"') {
+                if (*cur == '\\') cur++;
+                cur++;
+            }
+            cur++;
+            continue;
+        }
+        if (is_disallowed_symbol_char(*cur)) {
+            cur++;
+            continue;
+        }
+        char* start = cur;
+        while (cur < job->end && !is_disallowed_symbol_char(*cur)) cur++;
+        u32* index = cs_hm_geth(&b->names, fnv1a(start, cur));
+        if (index == null || *index >= job->index) continue;
+        // it was taken before this one, so the thread that has it doesn't wait for this one
+        cs_ParseJob* dep = b->jobs[*index];
+        u32 spins = 0;
+        while (!__atomic_load_n(&dep->done, __ATOMIC_ACQUIRE)) cs_backoff(&spins);
+    }
+}
+
+static void parse_job_run(cs_ParseJob* job)
+{
+    cs_Context* parent = parse_job_parent(job);
+    parse_job_wait(job);
+
+    cs_Context* c = &job->c;
+    u64* counter = cs_count_allocs(&c->alloc_count);
+    c->job = job;
+    c->functions = arena_init();
+    c->bbs = arena_init();
+    c->comscopes = arena_init();
+    c->ssa_defs = cs_hm_init(sizeof(cs_SSADef));
+    c->versions = cs_hm_init(sizeof(u16));
+    c->symbol_names = cs_hm_init(sizeof(cs_Str*));
+    job->version_base = cs_hm_init(sizeof(cs_VersionBase));
+    c->natives = parent->natives; c->native_count = parent->native_count;
+    c->native_names = parent->native_names;
+    c->start = parent->start; c->len = parent->len;
+    c->line_starts = parent->line_starts; c->line_count = parent->line_count;
+    c->cur_fn_id = CS_JOB_ID_BASE; c->cur_bb_id = CS_JOB_ID_BASE;
+    // stands in for the root scope, lookups that get past it continue in the context
+    cs_comscope_push(c);
+
+    c->cur = job->body;
+    u32 fn_id = parse_function_body(c, cs_get_fn(parent, job->fn_id), null);
+    if (fn_id != 0 && c->cur != job->end) cs_error(c, CS_UNEXPECTED_CHAR);
+    cs_count_allocs(counter);
+    __atomic_store_n(&job->done, true, __ATOMIC_RELEASE);
+}
+
+static void parse_jobs(void* arg)
+{
+    cs_ParseBatch* b = arg;
+    while (true) {
+        u32 i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+        if (i >= b->job_count) break;
+        parse_job_run(b->jobs[i]);
+    }
+}
+
+static cs_BasicBlock* merged_bb(cs_BasicBlock* bb)
+{
+    if (bb != null && bb->id == CS_BB_MOVED) return bb->a;
+    return bb;
+}
+
+static void merge_var(cs_ParseJob* job, u64 temp_base, cs_SSAVar* v)
+{
+    if (v->hash == 0) return;
+    if (v->hash == tempvar_hash) {
+        v->version = (u16)(v->version + temp_base);
+        return;
+    }
+    cs_VersionBase* base = cs_hm_geth(&job->version_base, v->hash);
+    if (base != null && (i32)v->version > base->last) v->version += base->shift;
+}
+
+// the ids of the job in a label, after fn_ or #, become the ones they were merged with
+static cs_Str* merge_label(cs_Context* c, cs_Str* label, u32 fn_base, u32 bb_base)
+{
+    if (label == null) return null;
+    u32 len = 0;
+    bool changed = false;
+    for (u32 i = 0; i < label->size && len < sizeof(c->label_buf) - 1;) {
+        if (label->data[i] < '0' || label->data[i] > '9') {
+            c->label_buf[len++] = label->data[i++];
+            continue;
+        }
+        u32 start = i;
+        u64 id = 0;
+        while (i < label->size && label->data[i] >= '0' && label->data[i] <= '9') id = id * 10 + (label->data[i++] - '0');
+        if (id >= CS_JOB_ID_BASE) {
+            u32 base = start > 0 && label->data[start-1] == '#' ? bb_base : fn_base;
+            len += snprintf(c->label_buf + len, sizeof(c->label_buf) - len, "%u", (u32)(id - CS_JOB_ID_BASE) + base);
+            changed = true;
+        } else {
+            u32 digits = i - start;
+            if (digits > sizeof(c->label_buf) - 1 - len) digits = sizeof(c->label_buf) - 1 - len;
+            memcpy(c->label_buf + len, label->data + start, digits);
+            len += digits;
+        }
+    }
+    if (!changed) return label;
+    free(label);
+    return cs_make_str(c->label_buf, len);
+}
+
+static void merge_fn(cs_ParseJob* job, u64 temp_base, cs_Function* fn)
+{
+    for (int v = 0; v < fn->variant_count; v++) {
+        cs_FunctionBody* fb = &fn->variants[v];
+        fb->entry = merged_bb(fb->entry);
+        fb->return_bb = merged_bb(fb->return_bb);
+        merge_var(job, temp_base, &fb->return_val);
+    }
+}
+
+// moves what job parsed into c, as if it was parsed there after everything before it
+static void parse_job_merge(cs_Context* c, cs_ParseJob* job)
+{
+    cs_Context* w = &job->c;
+    u32 fn_base = c->cur_fn_id;
+    u32 bb_base = c->cur_bb_id;
+    u64 temp_base = c->cur_temp_id;
+    c->cur_temp_id += w->cur_temp_id;
+    c->alloc_count += w->alloc_count;
+
+    // the names the job bound get versions after the ones they got in c by now
+    for (u32 i = 0; i < job->version_base.data_cap; i++) {
+        cs_HMap_bucket* bucket = advance_ptr(job->version_base.data, i * job->version_base.element_size);
+        if (bucket->psl == 255) continue;
+        cs_VersionBase* base = (cs_VersionBase*)bucket->data;
+        u16* last = cs_hm_geth(&c->versions, base->hash);
+        base->shift = (u16)((last != null ? (i32)*last : -1) - base->last);
+        u16 job_last = *(u16*)cs_hm_geth(&w->versions, base->hash);
+        *(u16*)cs_hm_seth(&c->versions, base->hash) = job_last + base->shift;
+    }
+
+    u32 bb_count = w->cur_bb_id - CS_JOB_ID_BASE;
+    for (u32 i = 0; i < bb_count; i++) {
+        cs_BasicBlock* old = arena_get(&w->bbs, i, sizeof(cs_BasicBlock));
+        cs_BasicBlock* bb = arena_alloc(&c->bbs, sizeof(cs_BasicBlock));
+        *bb = *old;
+        bb->id = c->cur_bb_id++;
+        bb->walk = 0;
+        old->id = CS_BB_MOVED;
+        old->a = bb;
+    }
+    u32 fn_count = w->cur_fn_id - CS_JOB_ID_BASE;
+    for (u32 i = 0; i < fn_count; i++) {
+        cs_Function* fn = arena_alloc(&c->functions, sizeof(cs_Function));
+        *fn = *(cs_Function*)arena_get(&w->functions, i, sizeof(cs_Function));
+        fn->id = c->cur_fn_id++;
+        for (int v = 0; v < fn->variant_count; v++) fn->variants[v].fn_id = fn->id;
+        merge_fn(job, temp_base, fn);
+    }
+    merge_fn(job, temp_base, cs_get_fn(c, job->fn_id));
+
+    for (u32 id = bb_base; id < c->cur_bb_id; id++) {
+        cs_BasicBlock* bb = arena_get(&c->bbs, id, sizeof(cs_BasicBlock));
+        bb->a = merged_bb(bb->a);
+        bb->b = merged_bb(bb->b);
+        bb->return_address = merged_bb(bb->return_address);
+        for (cs_BasicBlockNode* n = bb->preds_start; n != null; n = n->tail) n->head = merged_bb(n->head);
+        bb->label = merge_label(c, bb->label, fn_base, bb_base);
+
+        for (cs_SSAPhi* p = &bb->phis_head; !ssa_invalid(p->dest); p = p->next) {
+            merge_var(job, temp_base, &p->dest);
+            for (int o = 0; o < p->option_count; o++) merge_var(job, temp_base, &p->options[o]);
+        }
+        for (u32 i = 0; i < bb->instr_count; i++) {
+            cs_SSAIns* ins = &bb->instrs[i];
+            merge_var(job, temp_base, &ins->dest);
+            if (ins->op == CS_CALL || ins->op == CS_CALLC || ins->op == CS_DYNCALL) {
+                if (ins->op == CS_DYNCALL) merge_var(job, temp_base, &ins->a_as.var);
+                for (int a = 0; a < ins->b_as.args_->count; a++) merge_var(job, temp_base, &ins->b_as.args_->vars[a]);
+            } else if (cs_ins_uses_vars(ins->op)) {
+                merge_var(job, temp_base, &ins->a_as.var);
+                merge_var(job, temp_base, &ins->b_as.var);
+            } else if (ins->op == CS_LOADFUN && ins->a_as.int_ >= CS_JOB_ID_BASE) {
+                ins->a_as.int_ = fn_base + (ins->a_as.int_ - CS_JOB_ID_BASE);
+            }
+        }
+        merge_var(job, temp_base, &bb->jump_cond);
+    }
+
+    // names both the job and c found only keep the string of c
+    for (u32 i = 0; i < w->symbol_names.data_cap; i++) {
+        cs_HMap_bucket* bucket = advance_ptr(w->symbol_names.data, i * w->symbol_names.element_size);
+        if (bucket->psl == 255) continue;
+        cs_Str* name = *(cs_Str**)bucket->data;
+        u32 hash = fnv1a((char*)name->data, (char*)name->data + name->size);
+        cs_Str** have = cs_hm_geth(&c->symbol_names, hash);
+        if (have == null) {
+            *(cs_Str**)cs_hm_seth(&c->symbol_names, hash) = name;
+            continue;
+        }
+        for (u32 id = fn_base; id < c->cur_fn_id; id++) {
+            cs_Function* fn = cs_get_fn(c, id);
+            if (fn->title == name) fn->title = *have;
+        }
+        free(name);
+    }
+
+    for (u32 i = 0; i < w->error_count; i++) {
+        c->error_count += 1;
+        c->error_cap = cs_ensure_cap((void**)&c->errors, sizeof(cs_ErrorInfo), &c->error_cap, c->error_count);
+        c->errors[c->error_count-1] = w->errors[i];
+    }
+    if (c->err == CS_OK && w->err != CS_OK) {
+        c->err = w->err;
+        c->err_line = w->err_line; c->err_col = w->err_col;
+    }
+
+    for (u32 i = 0; i < job->call_count; i++) {
+        cs_ParseCall* call = &job->calls[i];
+        call->fb->calls += 1;
+        if (call->site == null) continue;
+        cs_bb_add_pred(call->fb->entry, merged_bb(call->site));
+        cs_bb_add_call_args(call->fb, call->args);
+    }
+}
+
+static void parse_job_free(cs_ParseJob* job)
+{
+    cs_Context* w = &job->c;
+    while ((u64)w->cur_scope >= (u64)w->comscopes.buckets->data) cs_comscope_pop(w);
+    arena_free(&w->comscopes);
+    arena_free(&w->functions);
+    arena_free(&w->bbs);
+    cs_hm_free(&w->ssa_defs);
+    cs_hm_free(&w->versions);
+    cs_hm_free(&w->symbol_names);
+    cs_hm_free(&job->version_base);
+    free(w->errors);
+    free(w->rebinds);
+    free(job->calls);
+    free(job);
+}
+
+// parses the bodies of the batch, the calling thread parses some too
+static void parse_batch_flush(cs_ParseBatch* b)
+{
+    if (b->job_count == 0) return;
+    u32 thread_count = b->c->jobs != 0 ? b->c->jobs : cs_core_count();
+    if (thread_count > b->job_count) thread_count = b->job_count;
+    if (thread_count > 64) thread_count = 64;
+    cs_Thread threads[64];
+    u32 started = 0;
+    for (; started + 1 < thread_count; started++) {
+        if (!cs_thread_start(&threads[started], parse_jobs, b)) break;
+    }
+    parse_jobs(b);
+    for (u32 i = 0; i < started; i++) cs_thread_join(threads[i]);
+
+    // the blocks of a job are forwarded to where they went until the whole batch is merged
+    for (u32 i = 0; i < b->job_count; i++) parse_job_merge(b->c, b->jobs[i]);
+    for (u32 i = 0; i < b->job_count; i++) parse_job_free(b->jobs[i]);
+    b->job_count = 0;
+    b->next = 0;
+    cs_hm_free(&b->names);
+    b->names = cs_hm_init(sizeof(u32));
+}
+
+// continues after the broken form that started at form_start. its parens are counted, skipping strings
+// and comments, so a nested line starting with '(' isn't taken for the next form. if they are never closed,
+// the next line that starts with '(' after the error is most likely where the next top-level form begins
+static void cs_skip_to_next_form(cs_Context* c, char* form_start)
+{
+    bool complete;
+    char* form_end = cs_scan_form(form_start, c->start + c->len, &complete);
+    if (complete && form_end >= c->cur) {
+        c->cur = form_end;
+        return;
+    }
+    u32 line, col;
+    cs_source_pos(c, (u32)(c->cur - c->start), &line, &col);
+    // line is 1-based, so it already is the index of the following line
+    for (u32 i = line; i < c->line_count; i++) {
+        char* line_start = c->start + c->line_starts[i];
+        if (*line_start == '(') {
+            c->cur = line_start;
+            return;
+        }
+    }
+    c->cur = c->start + c->len;
+}
+
 // NOTE: RESETS LAST USED OBJECT POOL (if you reuse your context)
 void cs_parse_cstr(cs_Context* c, char* content, u32 len)
 {
     if (len == 0) len = strlen(content);
+    u64* counter = cs_count_allocs(&c->alloc_count);
     c->start = content;
     c->cur = c->start; c->len = len;
     c->cur_temp_id = 0;
+    c->error_count = 0;
+    cs_index_lines(c);
     // pool hopefully initalized at this point
     cs_pool_clear(&c->obj_pool);
 
     cs_BasicBlock* entry = cs_make_bb(c);
     entry->label = make_str("entry");
     c->cur_bb = entry;
-    // NOTE: entry_fn is expected to be the first function in the arena
-    cs_Function* entry_fn = cs_make_fn(c, null);
+    cs_Function* entry_fn = cs_make_fn(c, &c->entry_fn_id);
     entry_fn->title = entry->label;
     
-    cs_FunctionBody* fb = cs_fn_add_variant(c, entry_fn);
-    fb->arg_count = 0; fb->args = null; 
+    cs_FunctionBody* fb = cs_fn_add_variant(c, entry_fn, 0);
+    fb->args = null; 
     fb->entry = entry; 
     fb->calls = 1; fb->return_val = ssavar_invalid;
 
-    cs_SSAVar result;
-    do {
+    cs_ParseBatch batch = { .c = c, .names = cs_hm_init(sizeof(u32)) };
+    while (true) {
+        skip_whitespace(c);
+        if (cur() == 0) break;
+
+        cs_BasicBlock* form_bb = c->cur_bb;
+        cs_ComScope* form_scope = c->cur_scope;
+        char* form_start = c->cur;
+        c->form_had_error = false;
+
+        cs_SSAVar result;
+        if (parse_batch_add(&batch, &result)) {
+            fb->return_val = result;
+            continue;
+        }
+        // everything else sees the defns before it like they were parsed in order
+        parse_batch_flush(&batch);
         result = cs_parse_expr(c);
-    } while (!ssa_invalid(result));
+        if (!ssa_invalid(result)) {
+            fb->return_val = result;
+            continue;
+        }
+        if (!c->form_had_error) break; // nothing we know how to parse
 
-    c->cur_bb->jump_cond = ssavar_return;
+        // throw away whatever the broken form left behind and continue with the next one
+        while (c->cur_scope != form_scope) {
+            cs_comscope_pop(c);
+        }
+        c->branch_depth = 0; c->rebind_count = 0;
+        c->cur_bb = form_bb;
+        cs_skip_to_next_form(c, form_start);
+    }
+    parse_batch_flush(&batch);
+    cs_hm_free(&batch.names);
+    free(batch.jobs);
+    c->form_had_error = false;
 
-    return;
-}
-
-void cs_serialize_object(cs_Object* o)
-{
-    if (o == null) return;
-    cs_ObjectType type = cs_obj_gettype(o);
-    switch (type) {
-        case CS_ATOM_INT: printf("%lld ", (i64)o->cdr); break;
-        case CS_ATOM_FLOAT: printf("%lf ", reinterpret(o->cdr, double)); break;
-        case CS_ATOM_STR: printf("\"%s\" ", cstr((cs_Str*)o->cdr)); break;
-        case CS_ATOM_TRUE: printf("true "); break;
-        case CS_ATOM_FALSE: printf("false "); break;
-        case CS_ATOM_NIL: printf("nil "); break;
-        case CS_ATOM_KEYWORD: printf("keyword:#%llu ", (u64)o->cdr); break;
-        case CS_ATOM_SYMBOL: printf("symbol:#%llu ", (u64)o->cdr); break;
-        case CS_LIST: {
-            printf("(");
-            while(o) {
-                cs_serialize_object(o->car);
-                o = o->cdr;
+    c->cur_bb->jump_cond = ssavar_return;
+    fb->return_bb = c->cur_bb;
+    cs_count_allocs(counter);
+}
+
+/* ==== REPL ==== */
+// returns the end of the top-level form starting at cur, skipping over strings and comments.
+// complete is false if the input ends before the form is closed
+char* cs_scan_form(char* cur, char* end, bool* complete)
+{
+    i32 depth = 0;
+    *complete = true;
+    while (cur < end && *cur != 0) {
+        switch (*cur) {
+            case ';': {
+                while (cur < end && *cur != '\n') cur++;
+                continue;
             }
-            printf(")");
-        } break;
-        default: printf("invalid!"); break;
+            case '"': {
+                cur++;
+                while (cur < end && *cur != '"') {
+                    if (*cur == '\\') cur++;
+                    cur++;
+                }
+                if (cur >= end) {
+                    *complete = false;
+                    return end;
+                }
+                cur++;
+                if (depth == 0) return cur;
+                continue;
+            }
+            case '(': case '[': case '{': depth++; break;
+            case ')': case ']': case '}': {
+                depth--;
+                if (depth <= 0) return cur + 1;
+            } break;
+            default: {
+                if (depth == 0 && is_whitespace(*cur)) return cur;
+            } break;
+        }
+        cur++;
     }
+    *complete = depth <= 0;
+    return cur;
 }
 
-void cs_serialize_bb(cs_BasicBlock* bb) {
-    bb->visited = true;
-    printf("\n%s (", bb->label->data);
+void cs_repl_init(cs_Context* c)
+{
+    c->form_cache = cs_hm_init(sizeof(cs_ReplForm));
+    c->binding_epoch = 0;
+    c->repl_form_count = 0;
+    c->repl_globals = cs_hm_init(sizeof(u32));
+    c->repl_global_count = 0;
+}
 
-    // print preds
-    cs_BasicBlockNode* cur_node = bb->preds_start;
-    while (cur_node != null) {
-        printf("%s and ", cur_node->head->label->data);
-        cur_node = cur_node->tail;
+// compiles a single top-level form into its own function, false if it has an error.
+// forms that don't define anything at the top-level are cached, so entering them again doesn't recompile them
+static bool cs_repl_compile_form(cs_Context* c, char* src, u32 len, cs_ReplForm* form)
+{
+    u32 key = fnv1a(src, src + len) ^ (c->binding_epoch * 0x9e3779b1);
+    cs_ReplForm* cached = cs_hm_geth(&c->form_cache, key);
+    if (cached != null && cached->len == len && memcmp(cached->src, src, len) == 0) {
+        *form = *cached;
+        return true;
     }
-    printf("):\n");
 
-    // print phis
-    cs_SSAPhi* cur_phi = &bb->phis_head;
-    while (!ssa_invalid(cur_phi->dest)) {
-        if (cur_phi->dest.hash == tempvar_hash) {
-            printf("PHI __temp.%u = ", cur_phi->dest.version);
-        } else {
-            printf("PHI %u.%u = ", cur_phi->dest.hash, cur_phi->dest.version);
+    c->start = src; c->cur = src; c->len = len;
+    cs_index_lines(c);
+    c->form_had_error = false;
+    c->bindings_changed = false;
+    cs_ComScope* form_scope = c->cur_scope;
+    // a broken form must not leave bindings behind
+    cs_HMap* root = &((cs_ComScope*)c->comscopes.buckets->data)->locals;
+    cs_HMap saved = *root;
+    saved.data = cs_malloc(root->element_size * root->data_cap);
+    memcpy(saved.data, root->data, root->element_size * root->data_cap);
+    u32 first_fn = c->cur_fn_id;
+    u32 redefined_count = c->repl_redefined_count;
+
+    u32 fn_id;
+    cs_Function* fn = cs_make_fn(c, &fn_id);
+    cs_FunctionBody* fb = cs_fn_add_variant(c, fn, 0);
+    fb->args = null; fb->calls = 1;
+    fb->entry = cs_make_bb(c);
+    u32 label_len = snprintf(c->label_buf, 256, "repl#%u", c->repl_form_count++);
+    fb->entry->label = cs_make_str(c->label_buf, label_len);
+    fn->title = fb->entry->label;
+    c->cur_bb = fb->entry;
+
+    cs_SSAVar result = cs_parse_expr(c);
+    if (ssa_invalid(result)) {
+        if (!c->form_had_error) cs_error(c, CS_UNEXPECTED_CHAR);
+        while (c->cur_scope != form_scope) {
+            cs_comscope_pop(c);
         }
-        for (int i = 0; i < cur_phi->option_count; i++) {
-            cs_SSAVar opt = cur_phi->options[i];
-            if (opt.hash == tempvar_hash) {
-                printf("__temp.%u or ", opt.version);
-            } else printf("%u.%u ", opt.hash, opt.version);
+        c->branch_depth = 0; c->rebind_count = 0;
+        cs_hm_free(root);
+        *root = saved;
+        // the functions it started are never lowered
+        for (u32 id = first_fn; id < c->cur_fn_id; id++) {
+            cs_Function* broken = cs_get_fn(c, id);
+            for (int v = 0; v < broken->variant_count; v++) broken->variants[v].entry = null;
         }
-        printf("\n");
-        cur_phi = cur_phi->next;
+        c->repl_redefined_count = redefined_count;
+        return false;
     }
-    
-    // print instructions
-    for (u32 i = 0; i < bb->instr_count; i++) {
-        cs_SSAIns* ins = &bb->instrs[i];
-        if (ins->dest.hash == tempvar_hash) {
-            printf("__temp.%d = ", ins->dest.version); 
-        } else {
-            printf("%u.%d = ", ins->dest.hash, ins->dest.version);
-        }
-        printf("%s ", cs_OpKindStrings[ins->op]);
-        switch (ins->op) {
-        case CS_REF_RETAIN:
-        case CS_REF_RELEASE:
-        case CS_GETCAR:
-        case CS_GETCDR:
-        case CS_NOT: 
-        {
-            printf("%s\n", ins->a_as.int_ == 0 ? "false" : "true");
-        } break;
-
-        
-        case CS_LOADI:
-        {
-            printf("%lld\n", ins->a_as.int_);
-        } break;
-        case CS_LOADF:
-        {
-            printf("%lf\n", ins->a_as.double_);
-        } break;
-
-        case CS_LOADS:
-        {
-            printf("%s\n", ins->a_as.str_->data);
-        } break;
-
-        case CS_LOADSYM:
-        case CS_LOADK:
-        case CS_LOADFUN:
-        {
-            printf("%u\n", reinterpret(ins->a_as.int_, u32));
-        } break;
-
-        case CS_LOADFALSE:
-        {
-            printf("true\n");
-        } break;
-        case CS_LOADTRUE:
-        {
-            printf("false\n");
-        } break;
-
-        case CS_LOADNIL:
-        {
-            printf("nil\n");
-        } break;
-
-        case CS_SETCAR:
-        case CS_SETCDR:
-        case CS_CONS:
-        {
-            printf("#%d.%d #%d.%d\n", ins->a_as.var.hash, ins->a_as.var.version, ins->b_as.var.hash, ins->b_as.var.version);
-        } break;
+    cs_hm_free(&saved);
+    c->cur_bb->jump_cond = ssavar_return;
+    fb->return_bb = c->cur_bb;
+    fb->return_val = result;
+
+    *form = (cs_ReplForm) {
+        .src = src, .len = len,
+        .fn_id = fn_id,
+        .first_bb = fb->entry->id, .bb_count = c->cur_bb_id - fb->entry->id,
+        .result = result,
+    };
+    if (c->bindings_changed) return true;
 
-        case CS_SET_LOCAL:
-        {
-            printf("%u %llu\n", reinterpret(ins->a_as.int_, u32), (u64)ins->b_as.bb_);
-        } break;
+    cs_ReplForm* entry = cs_hm_seth(&c->form_cache, key);
+    *entry = *form;
+    entry->src = cs_malloc(len);
+    memcpy(entry->src, src, len);
+    return true;
+}
 
-        case CS_GET_LOCAL:
-        {
-            printf("%u\n", reinterpret(ins->a_as.int_, u32));
-        } break;
+static void repl_keep_if_bound(cs_Context* c, cs_HMap* root, cs_SSAVar v)
+{
+    if (ssa_invalid(v)) return;
+    cs_Local* local = cs_hm_geth(root, v.hash);
+    if (local != null && local->version == v.version) cs_repl_keep_global(c, v);
+}
 
-        case CS_SCOPE_PUSH:
-        case CS_SCOPE_POP:
-            /*todo(serialize_scope_push); */ printf("\n"); break;
-        
-        case CS_ADDS: {
-            printf("\"%s\" \"%s\"", ins->a_as.str_->data, ins->b_as.str_->data);
-        } break;
-        
-        case CS_ADDI:
-        case CS_SUBI:
-        case CS_MULI:
-        case CS_DIVI:
-        case CS_MODI:
-        case CS_ANDI:
-        case CS_ORI:
-        case CS_RSHIFTI:
-        case CS_LSHIFTI:
-        case CS_GTI:
-        case CS_LTI:
-        case CS_GEQI:
-        case CS_LEQI:
-        case CS_EQI: {
-            printf("%lld %lld\n", ins->a_as.int_, ins->b_as.int_);
-        } break;
+// what form binds in the root scope becomes a global, so the forms after it can read it
+static void repl_keep_bindings(cs_Context* c, cs_ReplForm* form)
+{
+    cs_HMap* root = &((cs_ComScope*)c->comscopes.buckets->data)->locals;
+    for (u32 id = form->first_bb; id < form->first_bb + form->bb_count; id++) {
+        cs_BasicBlock* bb = arena_get(&c->bbs, id, sizeof(cs_BasicBlock));
+        for (cs_SSAPhi* p = &bb->phis_head; !ssa_invalid(p->dest); p = p->next) repl_keep_if_bound(c, root, p->dest);
+        for (u32 i = 0; i < bb->instr_count; i++) repl_keep_if_bound(c, root, bb->instrs[i].dest);
+    }
+}
 
-        case CS_ADDV:
-        case CS_SUBV:
-        case CS_MULV:
-        case CS_DIVV:
-        case CS_MODV:
-        case CS_ANDV:
-        case CS_ORV:
-        case CS_RSHIFTV:
-        case CS_LSHIFTV:
-        case CS_GTV:
-        case CS_LTV:
-        case CS_GEQV:
-        case CS_LEQV:
-        case CS_EQV: {
-            if (ins->a_as.var.hash == tempvar_hash) {
-                printf("__temp.%u ", ins->a_as.var.version);
-            } else {
-                printf("%u.%u ", ins->a_as.var.hash, ins->b_as.var.version);
-            }
-            if (ins->b_as.var.hash == tempvar_hash) {
-                printf("__temp.%u\n", ins->b_as.var.version);
-            } else {
-                printf("%u.%u\n", ins->b_as.var.hash, ins->b_as.var.version);
-            }
-        } break;
-       
-        case CS_ADDVI:
-        case CS_SUBVI:
-        case CS_MULVI:
-        case CS_DIVVI:
-        case CS_MODVI:
-        case CS_ANDVI:
-        case CS_ORVI:
-        case CS_RSHIFTVI:
-        case CS_LSHIFTVI:
-        case CS_GTVI:
-        case CS_LTVI:
-        case CS_GEQVI:
-        case CS_LEQVI:
-        case CS_EQVI: {
-            if (ins->a_as.var.hash == tempvar_hash) {
-                printf("__temp.%u ", ins->a_as.var.version);
-            } else {
-                printf("%u.%u ", ins->a_as.var.hash, ins->b_as.var.version);
-            }
-            printf("%lld\n", ins->b_as.int_);
-        } break;
+// runs form, appending what was compiled since the last input to the code first
+static cs_Value repl_run(cs_Context* c, cs_ReplForm* form)
+{
+    if (c->repl_code == null || c->repl_lowered_fns != c->cur_fn_id) cs_repl_lower(c, form->fn_id);
+    c->repl_code->entry_fn = cs_get_fn(c, form->fn_id)->variants[0].code_id;
+    return cs_run(c, c->repl_code);
+}
 
-        case CS_ADDF:
-        case CS_SUBF:
-        case CS_MULF:
-        case CS_DIVF:
-        case CS_GTF:
-        case CS_LTF:
-        case CS_GEQF:
-        case CS_LEQF:
-        case CS_EQF: {
-            printf("%lf %lf\n", ins->a_as.double_, ins->b_as.double_);
-        } break;
+// compiles and runs every top-level form in src on top of the definitions and values of all previous inputs.
+// returns the value of the last one, stops at the first form with an error
+cs_Value cs_repl_eval(cs_Context* c, char* src, u32 len)
+{
+    if (len == 0) len = strlen(src);
+    char* end = src + len;
+    c->err = CS_OK;
+    c->error_count = 0;
 
-        case CS_ADDVF:
-        case CS_SUBVF:
-        case CS_MULVF:
-        case CS_DIVVF:
-        case CS_GTVF:
-        case CS_LTVF:
-        case CS_GEQVF:
-        case CS_LEQVF:
-        case CS_EQVF: {
-            if (ins->a_as.var.hash == tempvar_hash) {
-                printf("__temp.%u ", ins->a_as.var.version);
-            } else {
-                printf("%u.%u ", ins->a_as.var.hash, ins->b_as.var.version);
-            }
-            printf("%lf\n", ins->b_as.double_);
-        } break;
+    u64* counter = cs_count_allocs(&c->alloc_count);
+    cs_Value result = CS_NIL;
+    char* cur = src;
+    while (true) {
+        while (cur < end && (is_whitespace(*cur) || *cur == ';')) {
+            if (*cur == ';') {
+                while (cur < end && *cur != '\n') cur++;
+            } else cur++;
+        }
+        if (cur >= end || *cur == 0) break;
 
-        case CS_CALL:
-          break;
+        bool complete;
+        char* form_end = cs_scan_form(cur, end, &complete);
+        cs_ReplForm form;
+        bool ok = cs_repl_compile_form(c, cur, (u32)(form_end - cur), &form);
+        cur = form_end;
+        if (!ok) break;
 
-        default:
-          break;
-        }
-    }
-    u8* a_label = bb->a != null ? bb->a->label->data : null;
-    u8* b_label = bb->b != null ? bb->b->label->data : null;
-    if (ssa_invalid(bb->jump_cond)) {
-        printf("BR true %s\n", a_label);
-    } else if (ssa_eq(bb->jump_cond, ssavar_call)) {
-        printf("RETURN_TO: %s\n", bb->return_address->label->data);
-        printf("CALL %s\n", a_label);
-    } else if (ssa_eq(bb->jump_cond, ssavar_return)) {
-        printf("RETURN\n");
-    } else {
-        if (bb->jump_cond.hash == tempvar_hash) {
-            printf("BR __temp.%u %s %s\n", bb->jump_cond.version, a_label, b_label);
-        } else {
-            printf("BR %u.%u %s %s\n", bb->jump_cond.hash, bb->jump_cond.version, a_label, b_label);
-        }
+        repl_keep_bindings(c, &form);
+        result = repl_run(c, &form);
+        if (c->error_count > 0) break;
     }
+    c->form_had_error = false;
+    cs_count_allocs(counter);
+    return result;
 }
 
-cs_Object* cs_eval(cs_Context* c, cs_Code* code)
+// everything the repl kept across inputs, the context compiles like before afterwards
+void cs_repl_free(cs_Context* c)
 {
-    // TODO: evaluation
-    if (code == null) printf("<empty>\n");
-    todo(eval);
-    return null;
+    for (u32 i = 0; i < c->form_cache.data_cap; i++) {
+        cs_HMap_bucket* bucket = advance_ptr(c->form_cache.data, i * c->form_cache.element_size);
+        if (bucket->psl != 255) free(((cs_ReplForm*)bucket->data)->src);
+    }
+    cs_hm_free(&c->form_cache);
+    cs_hm_free(&c->repl_globals);
+    cs_code_free(c->repl_code);
+    free(c->repl_redefined);
+    c->form_cache.data = null;
+    c->repl_globals.data = null;
+    c->repl_code = null;
+    c->repl_redefined = null;
+    c->repl_redefined_count = c->repl_redefined_cap = 0;
 }
 
 cs_Code* cs_compile_file(cs_Context* c, char* content, u32 len)
 {
+    cs_StatsMark mark = cs_stats_begin(c);
     cs_parse_cstr(c, content, len);
+    cs_stats_end(c, CS_PHASE_PARSE, mark);
     if (c->err != CS_OK) {
         log_debug("had error, no serialization!");
         return null;
     }
-    // todo
-    for (int i = 0; i < c->cur_bb_id; i++) {
-        cs_BasicBlock* bb = arena_get(&c->bbs, i, sizeof(cs_BasicBlock));
-        cs_serialize_bb(bb);
+    u32 source_hash = fnv1a(content, content + c->len);
+    cs_Code* code = cs_lower(c, c->entry_fn_id);
+    code->source_hash = source_hash;
+    code->source_len = c->len;
+    return code;
+}
+
+static char* cs_error_msg(cs_Error err)
+{
+    switch (err) {
+        case CS_OK                         : return "Success";
+        case CS_EXPONENT_AFTER_COMMA       : return "Invalid exponent after comma. Remove the comma or provide decimal places before the comma at %d:%d";
+        case CS_MALFORMED_NUMBER           : return "Missing digits after exponent at %d:%d";
+        case CS_INT_OVERFLOW               : return "Integer literal does not fit into 64 bits at %d:%d";
+        case CS_INVALID_ESCAPE_CHAR        : return "Invalid Escape character at %d:%d";
+        case CS_UNEXPECTED_EOF             : return "Unexpected End of Input at %d:%d";
+        case CS_UNEXPECTED_CHAR            : return "Unexpected character at %d:%d";
+        case CS_MISSING_PAREN              : return "Missing ')' at %d:%d";
+        case CS_TEMP_RESERVED              : return "Symbol '__temp' is reserved by the compiler. (%d:%d)";
+        case CS_ENTRY_RESERVED             : return "Symbol '__entry' is reserved by the compiler. (%d:%d)";
+        case CS_OUT_OF_MEM                 : return "Out of memory at %d:%d";
+        case CS_FN_NOT_ALLOWED_HERE        : return "Function definition is not allowed here at %d:%d";
+        case CS_WHILE_NOT_ALLOWED_HERE     : return "While-loop is not allowed here at %d:%d";
+        case CS_VAL_NOT_CALLABLE           : return "Value is not callable at %d:%d";
+        case CS_SYMBOL_NOT_FOUND           : return "Symbol could not be found at %d:%d";
+        case CS_INVALID_NUMBER_OF_ARGUMENTS: return "Invalid number of arguments at %d:%d";
+        case CS_TOO_MANY_ARGUMENTS         : return "Too many arguments for function at %d:%d";
+        case CS_MALFORMED_IR               : return "Malformed IR at %d:%d";
+        // runtime errors have no position
+        case CS_TYPE_ERROR                 : return "Wrong type of value";
+        case CS_DIV_BY_ZERO                : return "Division by zero";
+        case CS_INDEX_OUT_OF_RANGE         : return "Index out of range";
+        case CS_STACK_OVERFLOW             : return "Stack overflow";
+        case CS_UNKNOWN_OP                 : return "Unknown instruction";
+        case CS_NO_ISOLATE                 : return "Channels can only be used by isolates";
+        case CS_IO_ERROR                   : return "Input or output failed";
+        case CS_DEADLOCK                   : return "Every coroutine is waiting";
+        case CS_NO_COROUTINES              : return "Futures can't spawn coroutines";
+             default                       : return "!Invalid Error! at %d:%d";
     }
-    return null;
 }
 
-char err_buf[512];
 char* cs_get_error_string(cs_Context* c)
 {
-    char* msg = null;
-    switch (c->err) {
-        case CS_OK                         : { msg = "Success"; break; }
-        case CS_EXPONENT_AFTER_COMMA       : { msg = "Invalid exponent after comma. Remove the comma or provide decimal places before the comma at %d:%d"; break; }
-        case CS_INVALID_ESCAPE_CHAR        : { msg = "Invalid Escape character at %d:%d"; break; }
-        case CS_UNEXPECTED_EOF             : { msg = "Unexpected End of Input at %d:%d"; break; }
-        case CS_UNEXPECTED_CHAR            : { msg = "Unexpected character at %d:%d"; break; }
-        case CS_MISSING_PAREN              : { msg = "Missing ')' at %d:%d"; break; }
-        case CS_TEMP_RESERVED              : { msg = "Symbol '__temp' is reserved by the compiler. (%d:%d)"; break; }
-        case CS_ENTRY_RESERVED             : { msg = "Symbol '__entry' is reserved by the compiler. (%d:%d)"; break; }
-        case CS_OUT_OF_MEM                 : { msg = "Out of memory at %d:%d"; break; }
-        case CS_FN_NOT_ALLOWED_HERE        : { msg = "Function definition is not allowed here at %d:%d"; break; }
-        case CS_WHILE_NOT_ALLOWED_HERE     : { msg = "While-loop is not allowed here at %d:%d"; break; }
-        case CS_VAL_NOT_CALLABLE           : { msg = "Value is not callable at %d:%d"; break; }
-        case CS_SYMBOL_NOT_FOUND           : { msg = "Symbol could not be found at %d:%d"; break; }
-        case CS_INVALID_NUMBER_OF_ARGUMENTS: { msg = "Invalid number of arguments at %d:%d"; break; }
-        case CS_TOO_MANY_ARGUMENTS         : { msg = "Too many arguments for function at %d:%d"; break; }
-             default                       : { msg = "!Invalid Error! at %d:%d"; break; }
-    }
-    snprintf(err_buf, 512, msg, c->err_line, c->err_col);
-    return err_buf;
-}
\ No newline at end of file
+    snprintf(c->err_buf, sizeof(c->err_buf), cs_error_msg(c->err), c->err_line, c->err_col);
+    return c->err_buf;
+}
+
+// returns the message of the index-th error collected during the last compilation
+char* cs_get_error_string_at(cs_Context* c, u32 index)
+{
+    if (index >= c->error_count) return null;
+    cs_ErrorInfo* e = &c->errors[index];
+    snprintf(c->err_buf, sizeof(c->err_buf), cs_error_msg(e->err), e->line, e->col);
+    return c->err_buf;
+}
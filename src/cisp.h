@@ -27,10 +27,33 @@ typedef struct cs_SSADef cs_SSADef;
 typedef struct cs_SSAIns cs_SSAIns;
 typedef struct cs_SSAPhi cs_SSAPhi;
 typedef struct cs_Code cs_Code;
+typedef struct cs_ErrorInfo cs_ErrorInfo;
+typedef struct cs_CallArgs cs_CallArgs;
+typedef struct cs_ReplForm cs_ReplForm;
+typedef struct cs_ParseJob cs_ParseJob;
+typedef struct cs_VMFrame cs_VMFrame;
+typedef struct cs_ListChunk cs_ListChunk;
+typedef struct cs_Rope cs_Rope;
+typedef struct cs_Vector cs_Vector;
+typedef struct cs_Native cs_Native;
+typedef struct cs_Rebind cs_Rebind;
+typedef struct cs_CallCache cs_CallCache;
+typedef struct cs_CallTarget cs_CallTarget;
+typedef struct cs_Channel cs_Channel;
+typedef struct cs_Isolates cs_Isolates;
+typedef struct cs_Futures cs_Futures;
+typedef struct cs_Worker cs_Worker;
+typedef struct cs_Task cs_Task;
+typedef struct cs_Coroutine cs_Coroutine;
+typedef struct cs_Profile cs_Profile;
+typedef struct cs_BlockCounts cs_BlockCounts;
+typedef struct cs_EventLoop cs_EventLoop;
+typedef struct cs_Stats cs_Stats;
 
 typedef enum cs_Error cs_Error;
 typedef enum cs_ObjectType cs_ObjectType;
 typedef enum cs_OpKind cs_OpKind;
+typedef enum cs_Memory cs_Memory;
 
 #ifndef CS_POOL_MEM_SIZE
 #define CS_POOL_MEM_SIZE 4096
@@ -40,6 +63,8 @@ enum cs_Error {
     CS_OK,
     CS_PARSER_ERRORS_START,
     CS_EXPONENT_AFTER_COMMA,
+    CS_MALFORMED_NUMBER,
+    CS_INT_OVERFLOW,
     CS_INVALID_ESCAPE_CHAR,
     CS_UNEXPECTED_EOF,
     CS_UNEXPECTED_CHAR,
@@ -53,9 +78,20 @@ enum cs_Error {
     CS_INVALID_NUMBER_OF_ARGUMENTS,
     CS_TOO_MANY_ARGUMENTS,
     CS_WRONG_ARGUMENT_TYPE,
+    CS_MALFORMED_IR,
 
     CS_RUNTIME_ERRORS_START,
     CS_OUT_OF_MEM,
+    CS_TYPE_ERROR,
+    CS_DIV_BY_ZERO,
+    CS_INDEX_OUT_OF_RANGE,
+    CS_STACK_OVERFLOW,
+    CS_UNKNOWN_OP,
+    CS_NO_ISOLATE,
+    CS_IO_ERROR,
+    CS_DEADLOCK,
+    CS_NO_COROUTINES,
+    CS_SUSPENDED,   // not an error: a coroutine or isolate stopped in a native and continues later, see cs_vm_resume
 
     CS_COUNT,
 }; 
@@ -79,9 +115,11 @@ enum cs_ObjectType {
     CS_ATOM_KEYWORD,
 
     CS_LIST,
+    CS_VECTOR,
     CS_FUNC,    //cdr ^= cs_Function*
     CS_ANON_FUNC,
     CS_CFUNC,   // cdr ^= cs_Function*
+    CS_FUTURE,
 
     // used only for bytecode
     CS_REG,     // cdr ^= reg index
@@ -90,34 +128,159 @@ enum cs_ObjectType {
     CS_TYPECOUNT,
 };
 
-#define CS_OBJECT_TYPE_OFFSET 56
-#define CS_OBJECT_TYPE_MASK 0xFF00000000000000
-#define CS_OBJECT_INV_TYPE_MASK 0x00FFFFFFFFFFFFFF
-#define CS_OBJECT_REFCOUNT_MASK 0x00FFFFFFFF000000
-#define CS_OBJECT_INV_LIST_MASK 0xFFFFFFFFFFFFFFFE
+/* ==== VALUE ==== */
+// values are nan-boxed into 64 bits: doubles are stored as they are (nans get canonicalized),
+// everything else lives in the negative quiet nan space as a 16 bit tag and a 48 bit payload.
+//      0xFFF9 int (48 bit, sign extended)
+//      0xFFFA nil, false, true
+//      0xFFFB symbol (hash)
+//      0xFFFC keyword (hash)
+//      0xFFFD function (fn_id)
+//      0xFFFE heap reference, the kind is stored in the low 3 bits of the pointer
+// only lists, strings, vectors and integers that don't fit into 48 bits are allocated.
+typedef u64 cs_Value;
+
+#define CS_VAL_TAG_SHIFT 48
+#define CS_VAL_PAYLOAD_MASK 0x0000FFFFFFFFFFFFull
+#define CS_VAL_TAG_INT  0xFFF9ull
+#define CS_VAL_TAG_MISC 0xFFFAull
+#define CS_VAL_TAG_SYM  0xFFFBull
+#define CS_VAL_TAG_KW   0xFFFCull
+#define CS_VAL_TAG_FN   0xFFFDull
+#define CS_VAL_TAG_PTR  0xFFFEull
+#define CS_VAL_CANONICAL_NAN 0x7FF8000000000000ull
+
+#define CS_PTR_LIST  0  // cs_Object*
+#define CS_PTR_STR   1  // cs_Str* of the code or a symbol name, never freed
+#define CS_PTR_INT   2  // cs_Object* with the i64 in car
+#define CS_PTR_CHUNK 3  // cs_ListChunk*, the slot index is stored in bits 3-5
+#define CS_PTR_FWD   4  // cs_Object* that replaced a chunk slot, never seen outside of a chunk
+#define CS_PTR_ROPE  5  // cs_Rope*, a string made while the code runs
+#define CS_PTR_VEC   6  // cs_Vector*
+#define CS_PTR_FUTURE 7 // cs_Task*
+#define CS_PTR_KIND_MASK 7ull
+
+#define CS_INT_MIN (-(1ll << 47))
+#define CS_INT_MAX ((1ll << 47) - 1)
+
+#define CS_NIL   ((CS_VAL_TAG_MISC << CS_VAL_TAG_SHIFT) | 0)
+#define CS_FALSE ((CS_VAL_TAG_MISC << CS_VAL_TAG_SHIFT) | 1)
+#define CS_TRUE  ((CS_VAL_TAG_MISC << CS_VAL_TAG_SHIFT) | 2)
+
+#define val_tag(v) ((u64)(v) >> CS_VAL_TAG_SHIFT)
+#define val_make(tag, payload) (((tag) << CS_VAL_TAG_SHIFT) | ((u64)(payload) & CS_VAL_PAYLOAD_MASK))
+#define val_payload(v) ((u64)(v) & CS_VAL_PAYLOAD_MASK)
+#define val_is_double(v) (val_tag(v) < CS_VAL_TAG_INT)
+#define val_is_int(v) (val_tag(v) == CS_VAL_TAG_INT)
+#define val_is_ptr(v) (val_tag(v) == CS_VAL_TAG_PTR)
+#define val_is_kind(v, kind) (val_is_ptr(v) && ((v) & CS_PTR_KIND_MASK) == (kind))
+#define val_is_cell(v) val_is_kind(v, CS_PTR_LIST)
+#define val_is_chunk(v) val_is_kind(v, CS_PTR_CHUNK)
+#define val_is_list(v) (val_is_cell(v) || val_is_chunk(v))
+#define val_is_str(v) val_is_kind(v, CS_PTR_STR)
+#define val_is_rope(v) val_is_kind(v, CS_PTR_ROPE)
+#define val_is_text(v) (val_is_str(v) || val_is_rope(v))
+#define val_is_vec(v) val_is_kind(v, CS_PTR_VEC)
+#define val_is_future(v) val_is_kind(v, CS_PTR_FUTURE)
+#define val_is_obj(v) (val_is_ptr(v) && !val_is_text(v) && !val_is_vec(v) && !val_is_future(v)) // lives in the pool or the nursery
+#define val_is_fn(v) (val_tag(v) == CS_VAL_TAG_FN)
+#define val_truthy(v) ((v) != CS_NIL && (v) != CS_FALSE)
+
+#define val_from_int(i) val_make(CS_VAL_TAG_INT, (i))
+#define val_from_bool(b) ((b) ? CS_TRUE : CS_FALSE)
+#define val_from_ptr(p, kind) ((CS_VAL_TAG_PTR << CS_VAL_TAG_SHIFT) | (u64)(p) | (kind))
+#define val_as_int(v) (((i64)((u64)(v) << 16)) >> 16)
+#define val_as_ptr(v) ((void*)(val_payload(v) & ~CS_PTR_KIND_MASK))
+#define val_as_obj(v) ((cs_Object*)val_as_ptr(v))
+#define val_as_str(v) ((cs_Str*)val_as_ptr(v))
+#define val_as_rope(v) ((cs_Rope*)val_as_ptr(v))
+#define val_as_vec(v) ((cs_Vector*)val_as_ptr(v))
+#define val_as_task(v) ((cs_Task*)val_as_ptr(v))
+#define val_from_chunk(chunk, slot) val_from_ptr((u64)(chunk) | ((u64)(slot) << 3), CS_PTR_CHUNK)
+#define val_as_chunk(v) ((cs_ListChunk*)(val_payload(v) & ~(u64)(CS_CHUNK_SIZE - 1)))
+#define val_chunk_slot(v) ((u32)((v) >> 3) & 7)
+
+// a cons cell, the only object that lives in cs_Context.obj_pool.
+// car comes first, it holds the freelist link while the cell is free
 struct cs_Object {
-    // lowest bit decides if object is an atom
-    // 0b1 => atom
-    // 0b0 => list
-
-    //  when obj is atom:
-    //      car: 0xTTCCCCCCCCRRRR01
-    //          T => type (8 bits)
-    //          C => refcount (32 bits)
-    //          R => reserved
-    //      cdr: 
-    //          int, float: value 
-    //          string, cfunc: pointer to string
-    //          symbol, keyword: hash 
-    //          func: fn_id
-    //          cfunc: fn_ptr
-    // when obj is list:
-    //      car: 0xPPPPPPPPPPPPPPPP
-    //          P => pointer to object
-    //  	cdr: 0xRRRRRRRRRRRRRRRR
-    //          R => pointer to rest of list
-    struct cs_Object* car;
-    struct cs_Object* cdr;
+    cs_Value car;
+    cs_Value cdr;
+    u32 rc;     // references held by registers, globals and other cells
+    u32 flags;  // CS_OBJ_*
+};
+
+// every string made while the code runs. a flat one has no children and its string right behind it.
+// the others are the result of concatenating two longer strings: appending to a string in a loop would
+// copy everything built so far on every step, a rope only copies once it is read.
+// they are freed like vectors: by counting references, in gc mode every one is in cs_Context.texts
+// and the ones a major collection didn't mark are freed
+#define CS_ROPE_MIN 64 // shorter results are copied right away
+
+struct cs_Rope {
+    cs_Value left, right; // strings or ropes, nil if the rope is flat
+    u32 size;
+    u32 rc;
+    u32 flags;            // CS_OBJ_*
+    cs_Str* flat;         // the whole string once it was needed
+};
+
+// unboxed ints or floats in one allocation. they hold no references, so the collectors never look inside.
+// with reference counting they are freed like cells, in gc mode every vector is in cs_Context.vectors and
+// the ones a major collection didn't mark are freed
+#define CS_VEC_INT   0
+#define CS_VEC_FLOAT 1
+
+struct cs_Vector {
+    u32 rc;
+    u16 flags;  // CS_OBJ_MARKED
+    u8 kind;    // CS_VEC_*
+    u8 pad;
+    u32 count;
+    u32 pad2;
+    u64 data[]; // i64 or double
+};
+
+#define vec_ints(vec) ((i64*)(vec)->data)
+#define vec_floats(vec) ((double*)(vec)->data)
+
+// lists are cdr-coded: consecutive elements share a chunk and the cdr of a slot is the next slot.
+// chunks are filled from the back, consing onto the first used slot of a chunk takes the one before it.
+// a chunk is aligned to its size, so a list can point at any of its slots
+#define CS_CHUNK_SIZE 64
+#define CS_CHUNK_SLOTS 6
+
+struct cs_ListChunk {
+    cs_Value tail;  // cdr of the last slot, the freelist link while the chunk is free
+    u32 rc;
+    u16 flags;      // CS_OBJ_*
+    u8 front;       // first used slot
+    u8 pad;
+    cs_Value slots[CS_CHUNK_SLOTS];
+};
+
+// chunks come from buckets of their own, the first chunk of a bucket holds the link to the next one
+#define CS_CHUNK_BUCKET_SIZE (64 * 1024)
+#define CS_CHUNK_BUCKET_COUNT (CS_CHUNK_BUCKET_SIZE / CS_CHUNK_SIZE - 1)
+#define chunk_bucket_next(bucket) (((void**)(bucket))[0])
+#define chunk_bucket_data(bucket) ((cs_ListChunk*)(bucket) + 1)
+
+// cs_Object.flags, cs_ListChunk.flags
+#define CS_OBJ_BOXED_INT  1  // car is an i64, not a value
+#define CS_OBJ_MARKED     2
+#define CS_OBJ_FORWARDED  4  // copied out of the nursery, car (tail for chunks) holds the copy
+#define CS_OBJ_REMEMBERED 8  // old object in cs_Context.remembered
+#define CS_OBJ_FREE       16 // only set during a major collection
+
+// how unreachable objects are freed, can be chosen per context before anything is compiled
+enum cs_Memory {
+    CS_MEMORY_RC,   // reference counting, the ops are placed by cs_code_insert_rc
+    CS_MEMORY_GC,   // generational: a bump allocated nursery and a mark-sweep old space in obj_pool.
+                    // cs_code_insert_rc only clears dead registers, so the vm's registers are precise roots
+};
+
+struct cs_ErrorInfo {
+    cs_Error err;
+    u32 line, col;
 };
 
 struct cs_Context {
@@ -125,34 +288,131 @@ struct cs_Context {
     char* cur; 
     char* start;
     u32 len;
+    u32* line_starts; // byte offset of every line in start
+    u32 line_count, line_cap;
+
+    // first error, kept for cs_get_error_string
     cs_Error err;
     u32 err_col, err_line;
+    char err_buf[512];  // what cs_get_error_string returns
+    // every error of the last compilation, at most one per top-level form
+    cs_ErrorInfo* errors;
+    u32 error_count, error_cap;
+    bool form_had_error;
 
     cs_Arena functions;  // TODO: maybe another datastructure?
     u32 cur_fn_id;
+    u32 entry_fn_id;     // of the last compiled file or loaded ir, natives can come before it
+    u32 jobs;            // threads defns are parsed and lowered on and futures run on, 0 for one per core
 
     cs_Arena bbs;
     u32 cur_bb_id;
 
     cs_Arena comscopes;
     cs_HMap ssa_defs; // ssa_var => (u32 bb_index, u32 instr_index)
+    cs_HMap symbol_names; // hash => cs_Str*, so that the ir can be printed with names
     cs_ComScope* cur_scope;
     cs_BasicBlock* cur_bb;
+    u32 cur_walk;
+    char label_buf[256]; // labels of new basic blocks are formatted in here
+    cs_ParseJob* job;    // set in the contexts the bodies of defns are parsed in, see PARALLEL PARSING in cisp.c
 
     u64 cur_temp_id;
+    cs_HMap versions;       // hash => u16 last version any binding of the name got
+    cs_Rebind* rebinds; u32 rebind_count, rebind_cap; // only recorded inside of branches and loops
+    u32 branch_depth;
+
+    // repl
+    cs_HMap form_cache;     // hash of source ^ binding_epoch => cs_ReplForm
+    u32 binding_epoch;      // bumped whenever a top-level value binding changes
+    bool bindings_changed;  // set if the current form defined something at the top-level
+    u32 repl_form_count;
+    cs_HMap repl_globals;   // var key => u32 index in globals, the same in every lowering of the repl
+    u32 repl_global_count;
+    cs_Code* repl_code;     // every input is appended to it
+    u32 repl_lowered_fns;   // cur_fn_id when it was last appended to
+    u32* repl_redefined; u32 repl_redefined_count, repl_redefined_cap; // old and new fn id of the redefinitions since
 
-    // vm 
-    cs_Object regs[16]; 
+    // vm
+    cs_Value* stack; u32 stack_cap;     // registers of every active frame
+    cs_VMFrame* frames; u32 frame_cap;
+    cs_Value* globals; u32 global_count;
+    cs_ListChunk* reuse_chunk;  // freed by a CS_REF_RELEASE for the CS_CONS that follows it
+    u32 stack_top;          // registers in use, the roots of the gc together with the globals
+    cs_Code* code;          // what cs_run executes, natives call back into it
+    u32 frame_count;        // frames of cs_run when it called the current native
+    bool rc;                // the running code counts references
+    // inline caches of the running code. they live here and not in cs_Code, so that the code is only read
+    // while running and any number of contexts can share it
+    cs_CallCache* caches; u32 cache_cap;    // one per CS_DYNCALL
+    cs_CallTarget* megamorphic;             // CS_IC_SHARED_SIZE entries, allocated by the first megamorphic site
+    cs_Isolates* isolates;  // the pool the context runs on as an isolate, null otherwise
+    cs_Channel* blocked;    // the channel an isolate was suspended at, it waits for room in it if blocked_send
+    bool blocked_send;
+    cs_Futures* futures;    // the threads futures run on, started by the first one
+    cs_Worker* worker;      // set in the contexts of those threads
+    cs_Task** tasks; u32 task_count, task_cap; // futures made in gc mode or by a worker, see sched.c
+    cs_EventLoop* loop;     // the coroutines and what they wait for, made by the first one that waits
+    u32 call_depth;         // of cs_call, a coroutine can only be suspended in the code it was started with
+    cs_Stats* stats;        // what compiling took, collected if set by --stats
+    u64 alloc_count;        // allocations made while working for the context, see cs_count_allocs
+    cs_Profile* profile;    // samples of the running code, taken if set by --profile
+    cs_BlockCounts* counts; // counted by the code lowered while it is set, by --pgo-gen
+    cs_BlockCounts* pgo;    // guide lowering if set, by --pgo
+
+    // gc
+    cs_Memory memory;
+    u8* nursery; u8* nursery_top; u8* nursery_end;
+    cs_Value* remembered; u32 remembered_count, remembered_cap; // old objects that point into the nursery
+    cs_Value* gc_work; u32 gc_work_count, gc_work_cap;          // objects whose fields are still to be visited
+    cs_Vector** vectors; u32 vector_count, vector_cap;         // every vector, they are malloced (also in workers)
+    cs_Rope** texts; u32 text_count, text_cap;                 // every string made at run time, like vectors
+    u32 old_count;      // cells in obj_pool and chunks
+
+    // list chunks
+    void* chunk_buckets;
+    cs_ListChunk* chunk_freelist;
+    u32 next_major;     // old_count that triggers the next major collection
+
+    // native functions, compiled code refers to them by index so they have to be registered in the same order
+    cs_Native* natives; u32 native_count, native_cap;
+    cs_HMap native_names;   // hash of the name => u32 index in natives
 };
 
 cs_Context cs_init();
-cs_Object* cs_run(cs_Context* c, cs_Code* code);
+cs_Value cs_run(cs_Context* c, cs_Code* code);
+cs_Value cs_run_resume(cs_Context* c);
+cs_Value cs_runtime_error(cs_Context* c, cs_Error error);
 cs_Code* cs_compile_file(cs_Context* c, char* content, u32 len);
 char* cs_get_error_string(cs_Context* c);
-void cs_cfunc(cs_Context* c, void* fn, i8 arg_count);
+void cs_repl_init(cs_Context* c);
+cs_Value cs_repl_eval(cs_Context* c, char* src, u32 len);
+void cs_repl_free(cs_Context* c);
+char* cs_scan_form(char* cur, char* end, bool* complete);
+char* cs_get_error_string_at(cs_Context* c, u32 index);
+void cs_source_pos(cs_Context* c, u32 offset, u32* line, u32* col);
+void cs_index_lines(cs_Context* c);
+void cs_error(cs_Context* c, cs_Error error);
+cs_Function* cs_get_fn(cs_Context* c, u32 id);
+cs_Function* cs_make_fn(cs_Context* c, u32* fn_id);
+cs_FunctionBody* cs_fn_add_variant(cs_Context* c, cs_Function* fn, i8 arg_count);
+cs_FunctionBody* cs_fn_get_variant(cs_Function* fn, u8 arg_count);
+cs_BasicBlock* cs_make_bb(cs_Context* c);
+cs_BasicBlock* cs_get_bb(cs_Context* c, u32 id);
+void cs_bb_add_pred(cs_BasicBlock* bb, cs_BasicBlock* pred);
+u32 cs_ensure_cap(void** data, u32 element_size, u32* cur_cap, u32 wanted_cap);
+u32 cs_bb_successors(cs_BasicBlock* bb, cs_BasicBlock* out[2]);
 cs_Object* cs_make_object(cs_Context* c);
-void cs_obj_settype(cs_Object* obj, cs_ObjectType type);
-u16 cs_obj_gettype(cs_Object *obj);
+cs_Value cs_val_double(double d);
+double cs_val_as_double(cs_Value v);
+cs_Value cs_val_int(cs_Context* c, i64 i);
+bool cs_val_to_i64(cs_Value v, i64* out);
+cs_ObjectType cs_val_type(cs_Value v);
+void cs_val_retain(cs_Value v);
+void cs_val_release(cs_Context* c, cs_Value v);
+cs_Str* cs_val_as_str(cs_Value v);
+cs_Rope* cs_text_adopt(cs_Context* c, cs_Str* str);
+void cs_text_free(cs_Context* c, cs_Rope* rope);
 
 /* ==== VM ==== */
 
@@ -223,6 +483,8 @@ u16 cs_obj_gettype(cs_Object *obj);
     \
     X(CS_NOT) \
     X(CS_CALL) \
+    X(CS_CALLC) \
+    X(CS_DYNCALL) \
     X(CS_SCOPE_PUSH) \
     X(CS_SCOPE_POP) \
     X(CS_SET_LOCAL) \
@@ -243,11 +505,21 @@ u16 cs_obj_gettype(cs_Object *obj);
     X(CS_LOADK) \
     X(CS_REF_RETAIN) \
     X(CS_REF_RELEASE) \
+    X(CS_MOV) \
+    /* only used in cs_Code */ \
+    X(CS_CONCAT) \
+    X(CS_GETGLOBAL) \
+    X(CS_SETGLOBAL) \
+    X(CS_JMP) \
+    X(CS_BR) \
+    X(CS_RET) \
+    X(CS_COUNT_BLOCK) \
 
 #define X(val) val,
 
 enum cs_OpKind {
     CS_OPKIND_LIST
+    CS_OPKIND_COUNT
 };
 #undef X
 #define X(val) #val,
@@ -256,6 +528,8 @@ enum cs_OpKind {
 const char* cs_OpKindStrings[] = {
     CS_OPKIND_LIST
 };
+#else
+extern const char* cs_OpKindStrings[];
 #endif
 
 struct cs_Local {
@@ -268,12 +542,27 @@ struct cs_Local {
 #define ssa_invalid(s) (ssa_eq(s, ssavar_invalid))
 
 inline cs_SSAVar ssa_new_temp(cs_Context* c, cs_ObjectType type);
+void ssa_def_var(cs_Context* c, cs_SSAVar var, i32 phi_index);
+bool cs_ins_uses_vars(cs_OpKind op);
 
 struct cs_SSAVar {
     u32 hash;
     struct cs_Local;
 };
 
+extern const u32 tempvar_hash;
+extern const cs_SSAVar ssavar_invalid;
+extern const cs_SSAVar ssavar_call;
+extern const cs_SSAVar ssavar_return;
+
+// a let or defn that gave an existing variable a new version inside of an if or while. those get a phi
+// where the control flow joins again
+struct cs_Rebind {
+    u32 hash;
+    cs_Local old;   // binding before, only valid if not declared
+    bool declared;  // the variable didn't exist before
+};
+
 struct cs_SSADef {
     i32 bb_id; // if bb_id is negative, then |bb_id+1| is the bb index, then instr_id is the index of the phi node, where the value is defined in
     u32 instr_id;
@@ -288,13 +577,22 @@ struct cs_SSAIns {
         i64 int_;
         cs_Str* str_;
         cs_BasicBlock* bb_;
+        cs_FunctionBody* fn_;
+        cs_CallArgs* args_;
     } a_as, b_as;
     cs_OpKind op;
 };
 
+struct cs_CallArgs {
+    u8 count;
+    cs_SSAVar vars[];
+};
+
 struct cs_FunctionBody {
+    u32 fn_id;      // id of the cs_Function this is a variant of
+    u32 code_id;    // index in cs_Code.fns after lowering, index in cs_Context.natives for native functions
     u32* args;
-    i8 arg_count;   // negative for native functions
+    i8 arg_count;   // -1 - arg count for native functions
     u8 calls;       // for eventual inlining and dce
     cs_BasicBlock* return_bb;
     union {
@@ -305,9 +603,11 @@ struct cs_FunctionBody {
 };
 
 struct cs_Function {
-    cs_Str* title; // format: name_of_function" "arity
+    u32 id;
+    cs_Str* title; // the name it was defined with, null for anonymous functions
     cs_FunctionBody* variants;
     u8 variant_count;
+    u8 by_arity[FUNCTION_MAX_ARGS + 1]; // arity => index in variants + 1, 0 if there is no such variant
 };
 
 /*struct cs_Scope {
@@ -331,6 +631,7 @@ struct cs_BasicBlockNode {
 };
 
 struct cs_BasicBlock {
+    u32 id; // index in cs_Context.bbs
     cs_SSAPhi phis_head;
     cs_SSAIns* instrs;
     u32 instr_cap; u32 instr_count;
@@ -342,8 +643,634 @@ struct cs_BasicBlock {
     struct cs_BasicBlock* b;
     cs_SSAVar jump_cond; // hash == 0 if always a
     cs_Str* label;
+    u32 walk;   // last cs_Context.cur_walk that went through the block
+    u32 line;   // of the source the parser was at when it made the block, 0 if there is none
+};
+
+// a top-level form compiled by the repl, cached by its source
+struct cs_ReplForm {
+    char* src; u32 len;
+    u32 fn_id;
+    u32 first_bb, bb_count;
+    cs_SSAVar result;
+};
+
+/* ==== FLOW ==== */
+// control flow analysis of a single function for the passes that run while lowering it, see opt.c
+
+typedef struct cs_Loop cs_Loop;
+typedef struct cs_FlowGraph cs_FlowGraph;
+
+// a natural loop: the header dominates all of its blocks and is jumped back to from inside
+struct cs_Loop {
+    cs_BasicBlock* header;
+    cs_BasicBlock* preheader;   // the only block entering the loop, which jumps nowhere else. null if there is none
+    cs_BasicBlock* latch;       // the only block jumping back to the header, null if there are more
+    cs_Loop* parent;            // the innermost loop around this one
+    u32* blocks; u32 block_count; // indices into cs_FlowGraph.blocks, the header first
+};
+
+struct cs_FlowGraph {
+    cs_BasicBlock** blocks; u32 block_count; // reverse postorder, the entry first
+    u32* pred_start; u32* preds;    // the preds of block i are preds[pred_start[i]] up to preds[pred_start[i+1]]
+    u32* idom;                      // the immediate dominator of every block, the entry is its own
+    cs_Loop* loops; u32 loop_count, loop_cap; // inner loops come before the loops around them
+    cs_Loop** loop_of;              // the innermost loop of every block, null if it isn't in one
+    u32* order; u32 order_cap;      // cs_BasicBlock.id => index in blocks + 1, 0 if the block isn't in the function
+    u32* members; u32 member_count, member_cap;
+};
+
+void cs_flow_build(cs_Context* c, cs_FunctionBody* fb, cs_FlowGraph* g);
+void cs_flow_free(cs_FlowGraph* g);
+bool cs_flow_dominates(cs_FlowGraph* g, cs_BasicBlock* a, cs_BasicBlock* b);
+cs_BasicBlock* cs_flow_idom(cs_FlowGraph* g, cs_BasicBlock* bb);
+cs_BasicBlock* cs_flow_common_dominator(cs_FlowGraph* g, cs_BasicBlock* a, cs_BasicBlock* b);
+cs_Loop* cs_loop_of(cs_FlowGraph* g, cs_BasicBlock* bb);
+bool cs_loop_contains(cs_FlowGraph* g, cs_Loop* loop, cs_BasicBlock* bb);
+u32 cs_loop_depth(cs_FlowGraph* g, cs_BasicBlock* bb);
+void cs_insert_preheaders(cs_Context* c, cs_FunctionBody* fb);
+
+/* ==== CODE ==== */
+// cs_Code is the flattened, position independent form of the ssa, which gets executed and cached in .cispc files.
+// every function gets its own register file; phis are resolved by moves in the predecessors.
+
+#define CS_COMPILER_VERSION 8
+#define CS_CODE_MAGIC 0x43505343 // "CSPC"
+#define CS_CODE_FORMAT_VERSION 6
+#define CS_REG_NONE 0xFFFF
+
+// cs_Code.flags
+#define CS_CODE_RC 1    // objects are freed by the CS_REF_RETAIN / CS_REF_RELEASE in the code
+#define CS_CODE_COUNTED 2 // has CS_COUNT_BLOCK instructions, never cached
+
+typedef struct cs_CodeHeader cs_CodeHeader;
+typedef struct cs_CodeConst cs_CodeConst;
+typedef struct cs_CodeFn cs_CodeFn;
+typedef struct cs_CodeIns cs_CodeIns;
+typedef struct cs_CodeLine cs_CodeLine;
+typedef struct cs_CodeBlock cs_CodeBlock;
+
+struct cs_CodeConst {
+    u32 type;   // cs_ObjectType
+    u32 pad;
+    union {
+        i64 int_;
+        double double_;
+        u64 offset;     // strings: offset into the string section (only on disk)
+        cs_Str* str_;
+        u32 hash;       // symbols, keywords
+    };
+};
+
+struct cs_CodeFn {
+    u32 fn_id;      // id of the cs_Function this variant belongs to
+    u32 title;      // constant index of the title or ~0
+    u32 first_ins;
+    u32 ins_count;
+    u16 reg_count;
+    i8 arg_count;   // arguments are passed in the first registers
+    u8 clone;       // specialized for the argument types of some static calls, comes after the variant it copies
+};
+
+struct cs_CodeIns {
+    u16 op;     // cs_OpKind
+    u16 dest;
+    u16 a, b;   // registers, for calls and CS_CONCAT a is the number of arguments, b is the callee of CS_DYNCALL
+    u32 aux;    // constant, global, function, instruction or call cache index, reuse flag of CS_CONS
+    u32 aux2;   // false branch of CS_BR, start of the argument registers for calls and CS_CONCAT
+};
+
+// the instructions from ins on, up to the next entry, come from the source line. there is one for every
+// block that starts on a different line than the one before
+struct cs_CodeLine {
+    u32 ins;
+    u32 line;
+};
+
+// the instructions from ins on, up to the next entry, were lowered from the basic block with the id block.
+// every function has one for each of its blocks, in the order they were laid out
+struct cs_CodeBlock {
+    u32 ins;
+    u32 block;
+};
+
+// inline caches of CS_DYNCALL: a call site remembers the variants its callees resolved to.
+// up to CS_IC_SIZE different ones it stays polymorphic, after that it goes through the shared megamorphic cache
+#define CS_IC_SIZE 4
+#define CS_IC_MEGAMORPHIC 0xFF
+#define CS_IC_SHARED_SIZE 256   // entries of the megamorphic cache, a power of two
+#define CS_IC_NATIVE 0x80000000 // target is an index into cs_Context.natives instead of cs_Code.fns
+#define cs_ic_key(fn_id, arg_count) ((fn_id) << 8 | (u8)(arg_count))
+
+struct cs_CallTarget {
+    u32 key;    // cs_ic_key of the callee
+    u32 target;
+};
+
+struct cs_CallCache {
+    cs_CallTarget entries[CS_IC_SIZE];
+    u8 count;   // CS_IC_MEGAMORPHIC once it overflowed
+};
+
+// every offset is relative to the start of the file
+struct cs_CodeHeader {
+    u32 magic;
+    u16 format_version;
+    u16 compiler_version;
+    u32 source_hash;
+    u32 source_len;
+    u32 const_count, const_offset;
+    u32 fn_count, fn_offset;
+    u32 ins_count, ins_offset;
+    u32 arg_count, arg_offset;
+    u32 str_size, str_offset;
+    u32 line_count, line_offset;
+    u32 block_count, block_offset;
+    u32 global_count;
+    u32 cache_count;
+    u32 entry_fn;
+    u32 flags;
+    u32 checksum;   // fnv-1a of the sections in the order above, without the padding between them
 };
 
 struct cs_Code {
-    // todo;
-};
\ No newline at end of file
+    cs_CodeConst* consts; u32 const_count;
+    cs_CodeFn* fns; u32 fn_count;
+    cs_CodeIns* ins; u32 ins_count;
+    u16* args; u32 arg_count;       // argument registers of calls
+    u8* strs; u32 str_size;         // cs_Str's referenced by the constants
+    cs_CodeLine* lines; u32 line_count; // sorted by ins
+    cs_CodeBlock* blocks; u32 block_count; // sorted by ins
+    u32 global_count;
+    u32 cache_count;                // CS_DYNCALL sites, their caches are in cs_Context.caches
+    u32 entry_fn;
+    u32 flags;
+    u32 source_hash, source_len;
+
+    // the repl keeps appending to the same code
+    u32 const_cap, fn_cap, ins_cap, arg_cap, line_cap, block_cap;
+    u8** old_strs; u32 old_str_count; // string sections of earlier appends, values can still point into them
+
+    // backing memory when the code was loaded from a file
+    void* mapping; u64 mapping_size;
+};
+
+cs_Code* cs_lower(cs_Context* c, u32 entry_fn_id);
+void cs_repl_lower(cs_Context* c, u32 entry_fn_id);
+void cs_repl_keep_global(cs_Context* c, cs_SSAVar v);
+void cs_repl_share_global(cs_Context* c, cs_SSAVar v, cs_SSAVar old);
+void cs_code_free(cs_Code* code);
+u32 cs_code_line(cs_Code* code, u32 ins);
+u32 cs_code_block(cs_Code* code, u32 ins);
+bool cs_code_write(cs_Code* code, char* path);
+cs_Code* cs_code_load(char* path, char* source, u32 source_len);
+char* cs_code_path(char* source_path);
+void cs_code_insert_rc(cs_Code* code, cs_Memory memory, u32 first_fn);
+
+// a call that is executing, its registers are stack[base .. base + fn->reg_count]
+struct cs_VMFrame {
+    cs_CodeFn* fn;
+    cs_CodeIns* call;   // the call to continue after, null for the entry function
+    u32 base;
+};
+
+#define CS_VM_MAX_FRAMES (1 << 20)
+
+/* ==== GC ==== */
+// new objects are bump allocated in the nursery. when it is full a minor collection copies the survivors
+// into obj_pool, which is collected by mark-sweep once it has doubled since the last major collection
+
+#define CS_NURSERY_SIZE (256 * 1024)
+#define CS_GC_MAJOR_MIN 65536 // cells in obj_pool before the first major collection
+
+#define cs_in_nursery(c, obj) ((u8*)(obj) >= (c)->nursery && (u8*)(obj) < (c)->nursery_end)
+
+cs_Object* cs_gc_alloc(cs_Context* c);
+cs_ListChunk* cs_gc_alloc_chunk(cs_Context* c);
+void cs_gc_minor(cs_Context* c);
+void cs_gc_major(cs_Context* c);
+void cs_gc_write(cs_Context* c, cs_Value object, cs_Value v);
+
+/* ==== LIST ==== */
+cs_ListChunk* cs_chunk_alloc(cs_Context* c);
+cs_ListChunk* cs_make_chunk(cs_Context* c);
+void cs_chunk_free(cs_Context* c, cs_ListChunk* chunk);
+void cs_chunk_clear(cs_Context* c);
+cs_Value cs_list_car(cs_Value list);
+cs_Value cs_list_cdr(cs_Value list);
+cs_Value cs_list_cons(cs_Context* c, cs_Value* car, cs_Value* cdr);
+cs_Value cs_list_setcar(cs_Context* c, cs_Value list, cs_Value v);
+cs_Value cs_list_setcdr(cs_Context* c, cs_Value* list, cs_Value* v);
+cs_Value cs_list_from_regs(cs_Context* c, u32 first, u32 count, cs_Value tail);
+
+/* ==== VECTOR ==== */
+cs_Vector* cs_vec_make(cs_Context* c, u8 kind, u32 count);
+cs_Vector* cs_vec_adopt(cs_Context* c, cs_Vector* vec);
+void cs_vec_free(cs_Context* c, cs_Vector* vec);
+
+/* ==== NATIVE ==== */
+// c functions can be called from cisp. typed ones get their arguments unboxed and are called directly,
+// with any c signature made of these types:
+//      i   i64
+//      d   double
+//      s   cs_Str*, a returned one has to be allocated with cs_str_init and belongs to the context then
+//      v   cs_Value, returned ones have to own a reference. in gc mode the arguments are moved
+//          by any allocation, so a native has to read them before it allocates
+// the signature lists the arguments and then the result after a ':', e.g. "dd:d" for double pow(double, double).
+// everything else is called with the arguments boxed, as a cs_NativeFn
+
+#define CS_NATIVE_MAX_ARGS 4 // of typed natives
+
+typedef cs_Value (*cs_NativeFn)(cs_Context* c, cs_Value* args, u32 arg_count);
+
+struct cs_Native {
+    void* fn;
+    u32 fn_id;
+    u8 arg_count;
+    bool boxed;                     // fn is a cs_NativeFn
+    char args[CS_NATIVE_MAX_ARGS];  // signature characters
+    char result;
+};
+
+#define cs_fb_arity(fb) ((fb)->arg_count < 0 ? -1 - (fb)->arg_count : (fb)->arg_count)
+
+bool cs_cfunc(cs_Context* c, char* name, void* fn, char* signature);
+bool cs_cfunc_boxed(cs_Context* c, char* name, cs_NativeFn fn, u8 arg_count);
+cs_Native* cs_native_find(cs_Context* c, u32 hash);
+cs_Value cs_native_call(cs_Context* c, cs_Native* native, cs_Value* args);
+
+// natives that allocate or call back into cisp keep the values they still need in registers after the ones
+// of the running code, where the gc finds and moves them. they are addressed by index, because calls back
+// into cisp can grow the stack. references are only counted if c->rc is set
+u32 cs_native_regs(cs_Context* c, u32 count);
+void cs_native_regs_pop(cs_Context* c, u32 first);
+cs_Value cs_call(cs_Context* c, cs_Value fn, cs_Value* args, u32 arg_count);
+
+/* ==== THREADS ==== */
+typedef u64 cs_Thread; // HANDLE or pthread_t
+typedef void (*cs_ThreadFn)(void* arg);
+
+bool cs_thread_start(cs_Thread* thread, cs_ThreadFn fn, void* arg);
+void cs_thread_join(cs_Thread thread);
+u32 cs_core_count(void);
+void cs_backoff(u32* spins);
+
+/* ==== ISOLATES ==== */
+// contexts share nothing but the compiled code, which is only read while running. so any number of them can run
+// at the same time as isolates, each one on a single worker thread of a cs_Isolates. they only talk through
+// channels: a sent value is copied out of the heap of the sender into a cs_Message, which the receiver takes over
+
+typedef struct cs_ChannelSlot cs_ChannelSlot;
+typedef struct cs_Message cs_Message;
+typedef struct cs_MessageNode cs_MessageNode;
+typedef struct cs_Isolate cs_Isolate;
+
+#define CS_CHANNEL_CAP 256      // of the channels isolates open by using them
+#define CS_CHANNEL_TABLE 256    // channels a cs_Isolates can have, a power of two
+
+struct cs_ChannelSlot {
+    u64 seq;    // the position the slot can be sent to next, one after that once it holds data
+    void* data;
+};
+
+// a bounded queue any number of threads send to and receive from without taking a lock. every slot has a sequence
+// number, whoever moved head or tail past a slot with a compare and swap owns it until it bumps the sequence.
+// head and tail are kept on cache lines of their own, so senders and receivers don't slow each other down
+struct cs_Channel {
+    cs_ChannelSlot* slots;
+    u64 mask;           // slots - 1, the count is a power of two
+    u8 pad0[48];
+    u64 tail;           // next position to send to
+    u8 pad1[56];
+    u64 head;           // next position to receive from
+    u8 pad2[56];
+};
+
+cs_Channel* cs_channel_make(u32 cap);
+void cs_channel_free(cs_Channel* ch);
+bool cs_channel_try_send(cs_Channel* ch, void* data);
+void* cs_channel_try_recv(cs_Channel* ch);
+void cs_channel_send(cs_Channel* ch, void* data);
+void* cs_channel_recv(cs_Channel* ch);
+
+// the objects of a value, in the order they were found. they refer to each other by index: heap references
+// in car, cdr and root have the index shifted into the pointer bits
+struct cs_MessageNode {
+    u32 kind;       // CS_PTR_LIST, CS_PTR_STR, CS_PTR_INT or CS_PTR_VEC
+    cs_Value car;   // the i64 of boxed ints
+    cs_Value cdr;
+    void* data;     // the copied cs_Str or cs_Vector, the receiver takes it over
+};
+
+struct cs_Message {
+    cs_Value root;
+    cs_MessageNode* nodes; u32 node_count, node_cap;
+};
+
+cs_Message* cs_message_pack(cs_Context* c, cs_Value v);
+cs_Value cs_message_unpack(cs_Context* c, cs_Message* m);
+void cs_message_free(cs_Message* m);
+
+// a context waiting to run code, or done with it once done is set
+struct cs_Isolate {
+    cs_Context* c;
+    cs_Code* code;
+    cs_Value result;
+    bool suspended;     // cs_run stopped at a channel, the worker continues it with cs_run_resume
+    bool done;
+};
+
+struct cs_Isolates {
+    cs_Channel* queue;      // spawned isolates no worker took yet
+    cs_Thread* workers; u32 worker_count;
+    u32 pending;            // spawned isolates that aren't done
+    bool closing;
+    // channels by the hash of their name, a name is only ever set once
+    u32 channel_names[CS_CHANNEL_TABLE];
+    cs_Channel* channels[CS_CHANNEL_TABLE];
+};
+
+cs_Isolates* cs_isolates_init(u32 worker_count);
+void cs_isolate_spawn(cs_Isolates* pool, cs_Isolate* iso);
+void cs_isolates_wait(cs_Isolates* pool);
+void cs_isolates_free(cs_Isolates* pool);
+cs_Channel* cs_isolates_channel(cs_Isolates* pool, u32 name);
+
+/* ==== FUTURES ==== */
+// a future calls a function on another thread of the same context. every thread works in a context of its own,
+// a cs_Worker, which has its own registers and heap and shares the code, functions and natives with the context
+// it works for. the arguments are read by the worker where they are, so they must not be changed until the future
+// is done. workers don't count references and don't grow chunks in place, so they never write to objects they
+// didn't make. the result is copied into a cs_Message and the worker's heap is thrown away once the thread has
+// no task running anymore. a task is only done when every task it made is done, and cs_run only returns once
+// every future it started is
+
+typedef struct cs_Deque cs_Deque;
+typedef struct cs_DequeArray cs_DequeArray;
+
+#define CS_TASK_MAX_ARGS 3
+
+// cs_Task.state
+#define CS_TASK_PENDING 0
+#define CS_TASK_DONE    1
+
+struct cs_Task {
+    cs_Context* owner;      // made the task, the only one that frees it
+    cs_Value fn;
+    cs_Value args[CS_TASK_MAX_ARGS]; u8 arg_count; // for pmap the part of the list it maps over
+    u32 map_count;          // elements of the list fn is mapped over, 0 for a future
+    cs_Value* globals; u32 global_count; // as they were when the task was made
+    u32 state;              // CS_TASK_*, set by the worker once result or err is
+    cs_Message* result;
+    cs_Error err;
+    u32 rc;
+    u16 flags;              // CS_OBJ_MARKED
+    bool counted;           // the task holds references to its arguments, globals and value
+    bool unpacked;          // value holds the result in the heap of the owner
+    cs_Value value;
+};
+
+struct cs_DequeArray {
+    i64 cap;                // a power of two
+    cs_DequeArray* retired; // the smaller one before, freed with the deque
+    cs_Task* tasks[];
+};
+
+// the tasks a thread made: it pushes and takes them at the bottom, every other thread steals them from the top
+// (chase and lev). only taking the last task can race with a steal, which the compare and swap on top decides
+struct cs_Deque {
+    i64 top;
+    u8 pad0[56];
+    i64 bottom;
+    u8 pad1[56];
+    cs_DequeArray* array;
+};
+
+struct cs_Worker {
+    cs_Context c;
+    cs_Deque deque;
+    cs_Futures* pool;
+    u32 seed;       // picks the workers to steal from
+    u32 depth;      // tasks running on the stack of the thread, one waiting for a future runs others meanwhile
+};
+
+struct cs_Futures {
+    cs_Worker** workers; u32 worker_count; // the first one works on the thread of the context
+    cs_Thread* threads;
+    u32 pending;    // tasks that aren't done
+    bool closing;
+};
+
+cs_Value cs_future(cs_Context* c, cs_Value fn, cs_Value* args, u32 arg_count);
+cs_Value cs_future_deref(cs_Context* c, cs_Value future);
+void cs_future_release(cs_Context* c, cs_Task* task);
+cs_Value cs_pmap(cs_Context* c, cs_Value fn, cs_Value list);
+void cs_futures_sync(cs_Context* c);
+void cs_futures_wait(cs_Context* c);
+void cs_futures_free(cs_Context* c);
+
+/* ==== COROUTINES ==== */
+// (spawn f args..) makes a coroutine, which runs while the code that spawned it waits: in (yield), (sleep ms),
+// (join id) or one of the i/o natives. a coroutine has registers and frames of its own, so waiting only has to
+// push the frame of the native it waits in and return to the event loop, which resumes it once it can go on.
+// code that can't be suspended like that, the one cs_run started or code called back by a native like map,
+// runs the loop in place until it can go on. cs_run returns once every coroutine is done
+
+// cs_Coroutine.state
+#define CS_CO_READY   0   // in the ready queue, or about to go on if it waits in place
+#define CS_CO_RUNNING 1
+#define CS_CO_WAITING 2
+#define CS_CO_DONE    3
+
+// what cs_io_wait waits for
+#define CS_IO_READ  1
+#define CS_IO_WRITE 2
+
+#define CS_CO_MAX_ARGS 3
+
+struct cs_Coroutine {
+    cs_Value* stack; u32 stack_cap, stack_top;  // while it doesn't run, c has them otherwise
+    cs_VMFrame* frames; u32 frame_cap, frame_count;
+    u32 id;
+    u32 state;          // CS_CO_*
+    bool started;
+    bool in_place;      // waits in a loop of its own instead of being resumed
+    bool woken;         // the native it waited in is called again, and returns now
+    u32 call_depth;     // of c while it runs, waiting deeper than that can't suspend it
+    cs_Value fn; cs_Value args[CS_CO_MAX_ARGS]; u8 arg_count;
+    cs_Value result;
+    cs_Error err;
+    u32 joiners;        // id + 1 of the first coroutine waiting for it to be done, 0 for none
+    u32 next_joiner;
+};
+
+// a timer: the coroutine id sleeps until at, in ms of cs_loop_now
+typedef struct {
+    u64 at;
+    u32 id;
+} cs_Timer;
+
+// the coroutines waiting on a file descriptor, id + 1 or 0
+typedef struct {
+    u32 reader, writer;
+    u32 events;         // registered with the poller
+} cs_FdWait;
+
+struct cs_EventLoop {
+    cs_Coroutine** cos; u32 co_count, co_cap;   // by id, the first one is the code cs_run started
+    cs_Coroutine* cur;  // the one whose registers c has
+    u32* ready; u32 ready_head, ready_count, ready_cap; // a ring of ids
+    cs_Timer* timers; u32 timer_count, timer_cap;      // a min heap
+    cs_FdWait* fds; u32 fd_cap;
+    u32 fd_waiting;     // coroutines waiting on fds
+    u32 live;           // coroutines that aren't done, without the first one
+    i64 poller;         // epoll on linux
+};
+
+u32 cs_co_spawn(cs_Context* c, cs_Value fn, cs_Value* args, u32 arg_count);
+cs_Value cs_co_join(cs_Context* c, u32 id);
+cs_Value cs_co_yield(cs_Context* c);
+cs_Value cs_co_sleep(cs_Context* c, i64 ms);
+bool cs_io_wait(cs_Context* c, i64 fd, u32 events);
+void cs_loop_drain(cs_Context* c);
+void cs_loop_free(cs_Context* c);
+u64 cs_loop_now(void);
+
+// natives waiting for i/o call it again once it is possible, see cs_io_wait. only the file descriptors these
+// make don't block, connect doesn't wait for the connection and a failed one fails the first read or write
+cs_Value cs_io_read(cs_Context* c, i64 fd, i64 max);
+cs_Value cs_io_write(cs_Context* c, i64 fd, cs_Str* str);
+cs_Value cs_io_close(cs_Context* c, i64 fd);
+cs_Value cs_io_pipe(cs_Context* c);
+cs_Value cs_io_listen(cs_Context* c, cs_Str* host, i64 port);
+cs_Value cs_io_accept(cs_Context* c, i64 fd);
+cs_Value cs_io_connect(cs_Context* c, cs_Str* host, i64 port);
+cs_Value cs_io_port(cs_Context* c, i64 fd);
+
+cs_Value cs_vm_start(cs_Context* c, cs_Value fn, cs_Value* args, u32 arg_count);
+cs_Value cs_vm_resume(cs_Context* c);
+
+/* ==== IR ==== */
+// the ssa can be written as text and read back in, so passes can be run on ir files without the front end.
+// see ir.c for the format
+
+#define CS_IR_VERSION 2
+
+typedef struct cs_Writer cs_Writer;
+
+// buffered output, either into a file (FILE*) or into memory if file is null
+struct cs_Writer {
+    void* file;
+    char* data;
+    u32 len, cap;
+};
+
+cs_Writer cs_writer_init(void* file);
+void cs_writer_flush(cs_Writer* w);
+void cs_writer_free(cs_Writer* w);
+void cs_write(cs_Writer* w, char* data, u32 len);
+void cs_writef(cs_Writer* w, char* fmt, ...);
+
+void cs_ir_dump(cs_Context* c, cs_Writer* w);
+void cs_ir_dump_blocks(cs_Context* c, cs_Writer* w, u32 first_bb, u32 count);
+bool cs_ir_load(cs_Context* c, char* src, u32 len);
+void cs_print_value(cs_Context* c, cs_Writer* w, cs_Value v);
+
+/* ==== STATS ==== */
+// --stats reports the time each phase of compiling a file took and how much memory it needed. lexing is part of
+// parsing, the parser reads characters itself. functions are lowered in parallel, so the passes add up the time
+// of every thread while CS_PHASE_LOWER is the wall time of all of lowering
+typedef enum {
+    CS_PHASE_PARSE,     // source to ssa
+    CS_PHASE_PREHEADERS,
+    CS_PHASE_GLOBALS,   // finding the variables used outside of their function
+    CS_PHASE_BLOCKS,    // layout, definitions and cells of a function
+    CS_PHASE_TYPES,
+    CS_PHASE_FLOW,      // dominators and loops
+    CS_PHASE_PIN,
+    CS_PHASE_GVN,
+    CS_PHASE_CELLS,
+    CS_PHASE_LICM,
+    CS_PHASE_IV,
+    CS_PHASE_SINK,
+    CS_PHASE_CODEGEN,   // ssa to bytecode
+    CS_PHASE_LINK,      // joining the bytecode of the functions
+    CS_PHASE_RC,
+    CS_PHASE_LOWER,
+    CS_PHASE_COUNT,
+} cs_Phase;
+
+struct cs_Stats {
+    u64 ns[CS_PHASE_COUNT];
+    u64 cycles[CS_PHASE_COUNT]; // of the time stamp counter, 0 where there is none
+    // the ssa of every function and clone that was lowered
+    u64 fn_count, block_count, ins_count, phi_count, edge_count;
+    u32 code_fn_count, code_ins_count;
+};
+
+// the start of a phase, both are 0 if c doesn't collect stats
+typedef struct {
+    u64 ns, cycles;
+} cs_StatsMark;
+
+cs_StatsMark cs_stats_begin(cs_Context* c);
+void cs_stats_end(cs_Context* c, cs_Phase phase, cs_StatsMark start);
+void cs_stats_print(cs_Context* c, cs_Writer* w);
+void cs_stats_json(cs_Context* c, cs_Writer* w);
+
+/* ==== PROFILER ==== */
+// --profile samples where the code spends its time. a timer sets cs_profile_pending and the vm takes the sample
+// at the next call, jump or native call, so a sample never sees a frame half pushed
+#define CS_PROFILE_MAX_DEPTH 128    // frames of a sample, the innermost are kept
+#define CS_PROFILE_INTERVAL_US 1000
+
+extern volatile i32 cs_profile_pending;
+#define cs_profile_due(c) (__atomic_load_n(&cs_profile_pending, __ATOMIC_RELAXED) && (c)->profile != null)
+
+typedef struct {
+    u32 fn;     // index into cs_Code.fns
+    u32 line;   // of the block running in the function, of the call for the callers. 0 if unknown
+    u32 block;  // id of that block, ~0 if unknown
+} cs_ProfileFrame;
+
+// samples with the same functions, lines and blocks are counted together
+typedef struct {
+    u32 hash;
+    u32 first, depth;   // into cs_Profile.frames, the outermost frame first
+    u32 count;
+    u32 next;           // another stack with the same hash or ~0
+} cs_ProfileStack;
+
+struct cs_Profile {
+    cs_Code* code;
+    cs_HMap stacks_by_hash;  // hash => u32 index in stacks
+    cs_ProfileStack* stacks; u32 stack_count, stack_cap;
+    cs_ProfileFrame* frames; u32 frame_count, frame_cap;
+    u32 sample_count;
+    bool running;
+    cs_Thread timer;    // windows has no SIGPROF, a thread sets cs_profile_pending instead
+};
+
+void cs_profile_start(cs_Context* c, cs_Profile* profile);
+void cs_profile_stop(cs_Context* c);
+void cs_profile_sample(cs_Context* c, cs_Code* code, cs_CodeFn* fn, cs_CodeIns* ins, u32 frame_count);
+void cs_profile_write(cs_Profile* profile, cs_Writer* w);
+void cs_profile_free(cs_Profile* profile);
+char* cs_profile_path(char* source_path);
+
+// --pgo-gen lowers code that counts how often every block ran and which way its branch went, and writes the
+// counts into file.pgo. --pgo reads them back when compiling: the likelier successor of a branch is laid out
+// right after it and calls from blocks that never ran don't ask for type-specialized clones.
+// blocks are identified by their id, which only stays the same while the source does
+struct cs_BlockCounts {
+    u64* blocks;    // bb id => times the block ran
+    u64* taken;     // bb id => times its branch went to bb->a
+    u32 bb_count;
+    u32 source_hash;
+};
+
+void cs_counts_reserve(cs_BlockCounts* counts, u32 bb_count);
+void cs_counts_write(cs_BlockCounts* counts, cs_Writer* w);
+bool cs_counts_read(cs_BlockCounts* counts, char* data, u32 source_hash);
+void cs_counts_free(cs_BlockCounts* counts);
+char* cs_counts_path(char* source_path);
@@ -0,0 +1,643 @@
+// pipe2 and accept4
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include "cisp.h"
+#include "console.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#endif
+
+#define CO_POLL_EVENTS 64
+#define CO_READ_MAX (1 << 16)
+
+/* ==== EVENT LOOP ==== */
+u64 cs_loop_now(void)
+{
+#ifdef _WIN32
+    return GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000 + (u64)ts.tv_nsec / 1000000;
+#endif
+}
+
+static void* co_alloc(u64 size)
+{
+    void* result = cs_calloc(1, size);
+    return result;
+}
+
+// made on first use, the code that runs now becomes the first coroutine
+static cs_EventLoop* loop_get(cs_Context* c)
+{
+    if (c->loop != null) return c->loop;
+    cs_EventLoop* loop = co_alloc(sizeof(cs_EventLoop));
+    cs_Coroutine* main = co_alloc(sizeof(cs_Coroutine));
+    main->state = CS_CO_RUNNING;
+    main->started = true;
+    main->result = CS_NIL;
+    cs_ensure_cap((void**)&loop->cos, sizeof(cs_Coroutine*), &loop->co_cap, 1);
+    loop->cos[loop->co_count++] = main;
+    loop->cur = main;
+    loop->poller = -1;
+#ifdef __linux__
+    loop->poller = epoll_create1(EPOLL_CLOEXEC);
+#endif
+    c->loop = loop;
+    return loop;
+}
+
+static void ready_push(cs_EventLoop* loop, u32 id)
+{
+    if (loop->ready_count == loop->ready_cap) {
+        u32 cap = loop->ready_cap < 16 ? 16 : loop->ready_cap * 2;
+        u32* ready = co_alloc(sizeof(u32) * cap);
+        for (u32 i = 0; i < loop->ready_count; i++) ready[i] = loop->ready[(loop->ready_head + i) % loop->ready_cap];
+        free(loop->ready);
+        loop->ready = ready;
+        loop->ready_cap = cap;
+        loop->ready_head = 0;
+    }
+    loop->ready[(loop->ready_head + loop->ready_count) % loop->ready_cap] = id;
+    loop->ready_count += 1;
+}
+
+static u32 ready_pop(cs_EventLoop* loop)
+{
+    u32 id = loop->ready[loop->ready_head];
+    loop->ready_head = (loop->ready_head + 1) % loop->ready_cap;
+    loop->ready_count -= 1;
+    return id;
+}
+
+static void timer_push(cs_EventLoop* loop, u64 at, u32 id)
+{
+    cs_ensure_cap((void**)&loop->timers, sizeof(cs_Timer), &loop->timer_cap, loop->timer_count + 1);
+    u32 i = loop->timer_count++;
+    while (i > 0 && loop->timers[(i - 1) / 2].at > at) {
+        loop->timers[i] = loop->timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    loop->timers[i] = (cs_Timer) { .at = at, .id = id };
+}
+
+static cs_Timer timer_pop(cs_EventLoop* loop)
+{
+    cs_Timer result = loop->timers[0];
+    cs_Timer last = loop->timers[--loop->timer_count];
+    u32 i = 0;
+    while (true) {
+        u32 child = i * 2 + 1;
+        if (child >= loop->timer_count) break;
+        if (child + 1 < loop->timer_count && loop->timers[child + 1].at < loop->timers[child].at) child += 1;
+        if (loop->timers[child].at >= last.at) break;
+        loop->timers[i] = loop->timers[child];
+        i = child;
+    }
+    if (loop->timer_count > 0) loop->timers[i] = last;
+    return result;
+}
+
+// the native it waits in is called again. one waiting in place notices by itself
+static void co_wake(cs_EventLoop* loop, cs_Coroutine* co)
+{
+    if (co->state != CS_CO_WAITING) return;
+    co->state = CS_CO_READY;
+    co->woken = true;
+    if (!co->in_place) ready_push(loop, co->id);
+}
+
+// c gets the registers and frames of to
+static void co_switch(cs_Context* c, cs_EventLoop* loop, cs_Coroutine* to)
+{
+    cs_Coroutine* from = loop->cur;
+    from->stack = c->stack; from->stack_cap = c->stack_cap; from->stack_top = c->stack_top;
+    from->frames = c->frames; from->frame_cap = c->frame_cap; from->frame_count = c->frame_count;
+    c->stack = to->stack; c->stack_cap = to->stack_cap; c->stack_top = to->stack_top;
+    c->frames = to->frames; c->frame_cap = to->frame_cap; c->frame_count = to->frame_count;
+    loop->cur = to;
+}
+
+static void co_done(cs_Context* c, cs_EventLoop* loop, cs_Coroutine* co)
+{
+    co->state = CS_CO_DONE;
+    loop->live -= 1;
+    if (c->rc) {
+        cs_val_release(c, co->fn);
+        for (u32 i = 0; i < co->arg_count; i++) cs_val_release(c, co->args[i]);
+    }
+    co->fn = CS_NIL;
+    co->arg_count = 0;
+    free(co->stack); co->stack = null; co->stack_cap = 0; co->stack_top = 0;
+    free(co->frames); co->frames = null; co->frame_cap = 0; co->frame_count = 0;
+
+    u32 joiner = co->joiners;
+    co->joiners = 0;
+    while (joiner != 0) {
+        cs_Coroutine* j = loop->cos[joiner - 1];
+        joiner = j->next_joiner;
+        co_wake(loop, j);
+    }
+}
+
+// runs co until it waits or is done. an error in it stops the code that runs it too
+static void co_run(cs_Context* c, cs_EventLoop* loop, cs_Coroutine* co)
+{
+    cs_Coroutine* prev = loop->cur;
+    co_switch(c, loop, co);
+    co->state = CS_CO_RUNNING;
+    co->call_depth = c->call_depth;
+    cs_Value result;
+    if (co->started) {
+        result = cs_vm_resume(c);
+    } else {
+        co->started = true;
+        result = cs_vm_start(c, co->fn, co->args, co->arg_count);
+    }
+
+    bool done = c->err != CS_SUSPENDED;
+    if (!done) c->err = CS_OK;
+    else {
+        co->err = c->err;
+        co->result = c->err == CS_OK ? result : CS_NIL;
+    }
+    co_switch(c, loop, prev);
+    if (done) co_done(c, loop, co);
+}
+
+#ifdef __linux__
+// registers what the waiting coroutines of fd wait for with epoll
+static bool fd_update(cs_EventLoop* loop, i64 fd)
+{
+    cs_FdWait* w = &loop->fds[fd];
+    u32 events = (w->reader != 0 ? EPOLLIN : 0) | (w->writer != 0 ? EPOLLOUT : 0);
+    if (events == w->events) return true;
+    struct epoll_event ev = { .events = events, .data.fd = (int)fd };
+    int result;
+    if (events == 0) result = epoll_ctl((int)loop->poller, EPOLL_CTL_DEL, (int)fd, &ev);
+    else if (w->events == 0) {
+        result = epoll_ctl((int)loop->poller, EPOLL_CTL_ADD, (int)fd, &ev);
+        // a closed fd with the same number may still be registered
+        if (result != 0 && errno == EEXIST) result = epoll_ctl((int)loop->poller, EPOLL_CTL_MOD, (int)fd, &ev);
+    } else {
+        result = epoll_ctl((int)loop->poller, EPOLL_CTL_MOD, (int)fd, &ev);
+        // closing fd took it out of epoll
+        if (result != 0 && errno == ENOENT) result = epoll_ctl((int)loop->poller, EPOLL_CTL_ADD, (int)fd, &ev);
+    }
+    if (result != 0 && events != 0) return false;
+    w->events = events;
+    return true;
+}
+
+// wakes the coroutines waiting on fd
+static void fd_wake(cs_EventLoop* loop, i64 fd, u32 events)
+{
+    cs_FdWait* w = &loop->fds[fd];
+    if ((events & CS_IO_READ) && w->reader != 0) {
+        co_wake(loop, loop->cos[w->reader - 1]);
+        w->reader = 0;
+        loop->fd_waiting -= 1;
+    }
+    if ((events & CS_IO_WRITE) && w->writer != 0) {
+        co_wake(loop, loop->cos[w->writer - 1]);
+        w->writer = 0;
+        loop->fd_waiting -= 1;
+    }
+    fd_update(loop, fd);
+}
+#endif
+
+// wakes the coroutines whose fds are ready, waiting up to timeout ms for one, -1 for no limit
+static void loop_poll(cs_EventLoop* loop, i64 timeout)
+{
+#ifdef __linux__
+    if (loop->fd_waiting > 0) {
+        struct epoll_event events[CO_POLL_EVENTS];
+        int count = epoll_wait((int)loop->poller, events, CO_POLL_EVENTS, (int)timeout);
+        for (int i = 0; i < count; i++) {
+            u32 ready = 0;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) ready |= CS_IO_READ;
+            if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) ready |= CS_IO_WRITE;
+            fd_wake(loop, events[i].data.fd, ready);
+        }
+        return;
+    }
+#endif
+    if (timeout <= 0) return;
+#ifdef _WIN32
+    Sleep((DWORD)timeout);
+#else
+    struct timespec ts = { .tv_sec = timeout / 1000, .tv_nsec = (timeout % 1000) * 1000000 };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+#endif
+}
+
+// runs a ready coroutine, or waits for one to become ready. false if none ever will
+static bool loop_step(cs_Context* c, cs_EventLoop* loop)
+{
+    if (loop->ready_count > 0) {
+        co_run(c, loop, loop->cos[ready_pop(loop)]);
+        return true;
+    }
+    if (loop->timer_count == 0 && loop->fd_waiting == 0) return false;
+
+    i64 timeout = -1;
+    if (loop->timer_count > 0) {
+        u64 now = cs_loop_now();
+        timeout = loop->timers[0].at > now ? (i64)(loop->timers[0].at - now) : 0;
+    }
+    loop_poll(loop, timeout);
+    u64 now = cs_loop_now();
+    while (loop->timer_count > 0 && loop->timers[0].at <= now) co_wake(loop, loop->cos[timer_pop(loop).id]);
+    return true;
+}
+
+// the coroutine that runs waits for something to wake it. the one the loop runs is suspended, the native it waits
+// in returns with CS_SUSPENDED and is called again later, others run the loop until they are woken.
+// true once it is woken in place, false if the native has to return
+static bool co_wait(cs_Context* c, cs_EventLoop* loop)
+{
+    cs_Coroutine* cur = loop->cur;
+    cur->state = CS_CO_WAITING;
+    if (cur->id != 0 && c->call_depth == cur->call_depth) {
+        c->err = CS_SUSPENDED;
+        return false;
+    }
+
+    bool in_place = cur->in_place;
+    cur->in_place = true;
+    while (cur->state != CS_CO_READY && c->err == CS_OK) {
+        if (!loop_step(c, loop)) cs_runtime_error(c, CS_DEADLOCK);
+    }
+    cur->in_place = in_place;
+    cur->state = CS_CO_RUNNING;
+    cur->woken = false;
+    return c->err == CS_OK;
+}
+
+// gives up the coroutines that didn't get done, after an error stopped them
+static void loop_abandon(cs_Context* c, cs_EventLoop* loop)
+{
+    for (u32 i = 1; i < loop->co_count; i++) {
+        cs_Coroutine* co = loop->cos[i];
+        if (co->state == CS_CO_DONE) continue;
+        co->joiners = 0;
+        co->err = CS_DEADLOCK;
+        co->result = CS_NIL;
+        co_done(c, loop, co);
+    }
+    loop->ready_count = 0;
+    loop->timer_count = 0;
+#ifdef __linux__
+    for (u32 fd = 0; fd < loop->fd_cap; fd++) {
+        loop->fds[fd].reader = loop->fds[fd].writer = 0;
+        fd_update(loop, fd);
+    }
+#endif
+    loop->fd_waiting = 0;
+}
+
+// runs the coroutines until all are done, or an error stops them
+void cs_loop_drain(cs_Context* c)
+{
+    cs_EventLoop* loop = c->loop;
+    while (loop->live > 0 && c->err == CS_OK) {
+        if (!loop_step(c, loop)) cs_runtime_error(c, CS_DEADLOCK);
+    }
+    if (loop->live > 0) loop_abandon(c, loop);
+}
+
+// frees the loop once every coroutine is done, c keeps the registers of the first one
+void cs_loop_free(cs_Context* c)
+{
+    cs_EventLoop* loop = c->loop;
+    if (loop == null) return;
+    cs_loop_drain(c);
+    for (u32 i = 0; i < loop->co_count; i++) free(loop->cos[i]);
+#ifdef __linux__
+    if (loop->poller >= 0) close((int)loop->poller);
+#endif
+    free(loop->cos); free(loop->ready); free(loop->timers); free(loop->fds);
+    free(loop);
+    c->loop = null;
+}
+
+/* ==== COROUTINES ==== */
+// the id of a new coroutine calling fn, 0 if it couldn't be made. it runs once the current one waits
+u32 cs_co_spawn(cs_Context* c, cs_Value fn, cs_Value* args, u32 arg_count)
+{
+    if (c->worker != null) {
+        cs_runtime_error(c, CS_NO_COROUTINES);
+        return 0;
+    }
+    if (!val_is_fn(fn)) {
+        cs_runtime_error(c, CS_VAL_NOT_CALLABLE);
+        return 0;
+    }
+    cs_EventLoop* loop = loop_get(c);
+    cs_Coroutine* co = co_alloc(sizeof(cs_Coroutine));
+    co->id = loop->co_count;
+    co->state = CS_CO_READY;
+    co->fn = fn;
+    co->arg_count = (u8)arg_count;
+    for (u32 i = 0; i < arg_count; i++) {
+        co->args[i] = args[i];
+        if (c->rc) cs_val_retain(args[i]);
+    }
+    co->result = CS_NIL;
+    cs_ensure_cap((void**)&loop->cos, sizeof(cs_Coroutine*), &loop->co_cap, loop->co_count + 1);
+    loop->cos[loop->co_count++] = co;
+    loop->live += 1;
+    ready_push(loop, co->id);
+    return co->id;
+}
+
+// waits until the coroutine id is done and returns its result
+cs_Value cs_co_join(cs_Context* c, u32 id)
+{
+    cs_EventLoop* loop = c->loop;
+    if (loop == null || id == 0 || id >= loop->co_count) return cs_runtime_error(c, CS_INDEX_OUT_OF_RANGE);
+    cs_Coroutine* co = loop->cos[id];
+    cs_Coroutine* cur = loop->cur;
+    if (co == cur) return cs_runtime_error(c, CS_DEADLOCK);
+    while (co->state != CS_CO_DONE) {
+        cur->next_joiner = co->joiners;
+        co->joiners = cur->id + 1;
+        if (!co_wait(c, loop)) return CS_NIL;
+    }
+    cur->woken = false;
+    if (co->err != CS_OK) return cs_runtime_error(c, co->err);
+    if (c->rc) cs_val_retain(co->result);
+    return co->result;
+}
+
+// lets the coroutines that are ready run before going on
+cs_Value cs_co_yield(cs_Context* c)
+{
+    cs_EventLoop* loop = c->loop;
+    if (loop == null) return CS_NIL;
+    cs_Coroutine* cur = loop->cur;
+    if (cur->woken) {
+        cur->woken = false;
+        return CS_NIL;
+    }
+    if (cur->id != 0 && c->call_depth == cur->call_depth) {
+        cur->state = CS_CO_READY;
+        cur->woken = true;
+        ready_push(loop, cur->id);
+        c->err = CS_SUSPENDED;
+        return CS_NIL;
+    }
+
+    // in place every coroutine ready now gets one turn
+    loop_poll(loop, 0);
+    bool in_place = cur->in_place;
+    cur->in_place = true;
+    for (u32 n = loop->ready_count; n > 0 && loop->ready_count > 0 && c->err == CS_OK; n--) loop_step(c, loop);
+    cur->in_place = in_place;
+    return CS_NIL;
+}
+
+cs_Value cs_co_sleep(cs_Context* c, i64 ms)
+{
+    cs_EventLoop* loop = loop_get(c);
+    cs_Coroutine* cur = loop->cur;
+    if (cur->woken) {
+        cur->woken = false;
+        return CS_NIL;
+    }
+    timer_push(loop, cs_loop_now() + (ms > 0 ? (u64)ms : 0), cur->id);
+    co_wait(c, loop);
+    return CS_NIL;
+}
+
+/* ==== I/O ==== */
+// waits until fd is ready for events, one of CS_IO_*. false if the native has to return right away with c->err
+// set, which is CS_SUSPENDED if the coroutine was suspended and the native is called again once fd is ready.
+// there can be one coroutine reading and one writing a fd at a time
+bool cs_io_wait(cs_Context* c, i64 fd, u32 events)
+{
+#ifdef __linux__
+    cs_EventLoop* loop = loop_get(c);
+    if (fd < 0 || loop->poller < 0) {
+        cs_runtime_error(c, CS_IO_ERROR);
+        return false;
+    }
+    if (fd >= loop->fd_cap) {
+        u32 cap = loop->fd_cap;
+        cs_ensure_cap((void**)&loop->fds, sizeof(cs_FdWait), &loop->fd_cap, (u32)fd + 1);
+        memset(loop->fds + cap, 0, sizeof(cs_FdWait) * (loop->fd_cap - cap));
+    }
+    cs_FdWait* w = &loop->fds[fd];
+    u32* waiter = events == CS_IO_READ ? &w->reader : &w->writer;
+    if (*waiter != 0) {
+        cs_runtime_error(c, CS_IO_ERROR);
+        return false;
+    }
+    *waiter = loop->cur->id + 1;
+    if (!fd_update(loop, fd)) {
+        *waiter = 0;
+        cs_runtime_error(c, CS_IO_ERROR);
+        return false;
+    }
+    loop->fd_waiting += 1;
+    return co_wait(c, loop);
+#else
+    cs_runtime_error(c, CS_IO_ERROR);
+    return false;
+#endif
+}
+
+// a native that waited for i/o tries again from the start, it doesn't need to know it was woken
+static void io_begin(cs_Context* c)
+{
+    if (c->loop != null) c->loop->cur->woken = false;
+}
+
+#ifdef __linux__
+static cs_Value io_error(cs_Context* c, int fd)
+{
+    if (fd >= 0) close(fd);
+    return cs_runtime_error(c, CS_IO_ERROR);
+}
+
+// writing to a closed pipe or socket fails instead of killing the process
+static void io_setup(void)
+{
+    signal(SIGPIPE, SIG_IGN);
+}
+
+static bool io_address(cs_Str* host, i64 port, struct sockaddr_in* addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons((u16)port);
+    return port >= 0 && port <= 0xFFFF && inet_pton(AF_INET, (char*)host->data, &addr->sin_addr) == 1;
+}
+#endif
+
+// up to max bytes as a string, nil at the end of the file
+cs_Value cs_io_read(cs_Context* c, i64 fd, i64 max)
+{
+#ifdef __linux__
+    if (max > CO_READ_MAX) max = CO_READ_MAX;
+    if (max <= 0) return cs_runtime_error(c, CS_INDEX_OUT_OF_RANGE);
+    io_begin(c);
+    cs_Str* str = cs_str_init((u32)max + 1);
+    while (true) {
+        ssize_t got = read((int)fd, str->data, (size_t)max);
+        if (got > 0) {
+            str->size = (u32)got;
+            str->data[got] = 0;
+            return val_from_ptr(cs_text_adopt(c, str), CS_PTR_ROPE);
+        }
+        if (got == 0) break;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            free(str);
+            return cs_runtime_error(c, CS_IO_ERROR);
+        }
+        if (!cs_io_wait(c, fd, CS_IO_READ)) break;
+    }
+    free(str);
+    return CS_NIL;
+#else
+    return cs_runtime_error(c, CS_IO_ERROR);
+#endif
+}
+
+// the number of bytes written. it only waits while nothing could be written, since a suspended native is called
+// again from the start, so it is fewer than str has if fd took only some of them
+cs_Value cs_io_write(cs_Context* c, i64 fd, cs_Str* str)
+{
+#ifdef __linux__
+    io_begin(c);
+    u32 done = 0;
+    while (done < str->size) {
+        ssize_t put = write((int)fd, str->data + done, str->size - done);
+        if (put >= 0) {
+            done += (u32)put;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return cs_runtime_error(c, CS_IO_ERROR);
+        if (done > 0) break;
+        if (!cs_io_wait(c, fd, CS_IO_WRITE)) return CS_NIL;
+    }
+    return val_from_int(done);
+#else
+    return cs_runtime_error(c, CS_IO_ERROR);
+#endif
+}
+
+cs_Value cs_io_close(cs_Context* c, i64 fd)
+{
+#ifdef __linux__
+    // whoever waits on it fails once it tries again
+    if (c->loop != null && fd >= 0 && fd < c->loop->fd_cap) fd_wake(c->loop, fd, CS_IO_READ | CS_IO_WRITE);
+    if (close((int)fd) != 0) return cs_runtime_error(c, CS_IO_ERROR);
+    return CS_TRUE;
+#else
+    return cs_runtime_error(c, CS_IO_ERROR);
+#endif
+}
+
+// the list (read-fd write-fd)
+cs_Value cs_io_pipe(cs_Context* c)
+{
+#ifdef __linux__
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0) return cs_runtime_error(c, CS_IO_ERROR);
+    io_setup();
+    u32 first = cs_native_regs(c, 2);
+    c->stack[first] = val_from_int(fds[0]);
+    c->stack[first + 1] = val_from_int(fds[1]);
+    cs_Value result = cs_list_from_regs(c, first, 2, CS_NIL);
+    cs_native_regs_pop(c, first);
+    return result;
+#else
+    return cs_runtime_error(c, CS_IO_ERROR);
+#endif
+}
+
+// a tcp socket accepting connections on host, an ipv4 address, port 0 picks a free one
+cs_Value cs_io_listen(cs_Context* c, cs_Str* host, i64 port)
+{
+#ifdef __linux__
+    struct sockaddr_in addr;
+    if (!io_address(host, port, &addr)) return cs_runtime_error(c, CS_IO_ERROR);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return io_error(c, fd);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) return io_error(c, fd);
+    io_setup();
+    return val_from_int(fd);
+#else
+    return cs_runtime_error(c, CS_IO_ERROR);
+#endif
+}
+
+// the fd of the next connection to the listening socket fd
+cs_Value cs_io_accept(cs_Context* c, i64 fd)
+{
+#ifdef __linux__
+    io_begin(c);
+    while (true) {
+        int conn = accept4((int)fd, null, null, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (conn >= 0) return val_from_int(conn);
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return cs_runtime_error(c, CS_IO_ERROR);
+        if (!cs_io_wait(c, fd, CS_IO_READ)) return CS_NIL;
+    }
+#else
+    return cs_runtime_error(c, CS_IO_ERROR);
+#endif
+}
+
+cs_Value cs_io_connect(cs_Context* c, cs_Str* host, i64 port)
+{
+#ifdef __linux__
+    struct sockaddr_in addr;
+    if (!io_address(host, port, &addr)) return cs_runtime_error(c, CS_IO_ERROR);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return io_error(c, fd);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS) return io_error(c, fd);
+    io_setup();
+    return val_from_int(fd);
+#else
+    return cs_runtime_error(c, CS_IO_ERROR);
+#endif
+}
+
+// the local port of the socket fd, for listening on port 0
+cs_Value cs_io_port(cs_Context* c, i64 fd)
+{
+#ifdef __linux__
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname((int)fd, (struct sockaddr*)&addr, &len) != 0) return cs_runtime_error(c, CS_IO_ERROR);
+    return val_from_int(ntohs(addr.sin_port));
+#else
+    return cs_runtime_error(c, CS_IO_ERROR);
+#endif
+}
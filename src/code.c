@@ -0,0 +1,2254 @@
+#include "cisp.h"
+#include "console.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define CODE_ALIGN 8
+#define align_up(val, to) (((val) + (to) - 1) & ~((to) - 1))
+
+// an instruction lowered at the end of another block, only if it didn't move on from there
+typedef struct {
+    cs_SSAIns* ins;
+    cs_BasicBlock* to;
+} cs_Hoist;
+
+// a cons cell of the current function, see SCALAR REPLACEMENT
+typedef struct {
+    cs_SSAIns* cons;
+    bool escapes;   // something else than car and cdr reads it
+} cs_Cell;
+
+// base * factor, kept up to date by adding step * factor whenever the base induction variable changes by step
+typedef struct {
+    cs_Loop* loop;
+    cs_SSAVar base, step, factor;
+    bool down;  // base is decreased
+    u16 reg, step_reg;
+} cs_DerivedIv;
+
+// a variant lowered for the argument types of some call sites
+typedef struct {
+    cs_FunctionBody* fb;
+    u8 arg_types[FUNCTION_MAX_ARGS];
+    u32 code_id;
+} cs_Clone;
+
+// a variant or clone lowered into a cs_Code of its own, see PARALLEL LOWERING
+#define CLONE_PENDING (1u << 31) // calls to a clone that was asked for, the rest is its index in requests
+
+typedef struct {
+    cs_FunctionBody* fb;
+    cs_Str* title;
+    cs_Clone clone; bool is_clone;
+    u32 code_id;
+    cs_Code code;
+    cs_CodeFn out;
+    cs_Clone* requests; u32 request_count, request_cap; // clones its calls asked for
+} cs_LoweredFn;
+
+typedef struct {
+    cs_Context* c;
+    cs_LoweredFn* job;
+
+    // output
+    cs_Code* code;
+    u32 const_cap, fn_cap, ins_cap, arg_cap, str_cap, line_cap, code_block_cap;
+    u32 first_const;    // the ones before are the repl's earlier appends, in string sections that don't move
+    cs_HMap const_map;  // key of the constant => u32 index
+    cs_HMap globals;    // key of the ssa var => u32 global index
+
+    // current function
+    cs_HMap regs;       // key of the ssa var => u16 register
+    cs_HMap def_blocks; // key of the ssa var => cs_BasicBlock*
+    u16 reg_count;
+    cs_BasicBlock** blocks; u32 block_count, block_cap;
+    u32* block_index;   // bb id => index in blocks + 1
+    u32* block_start;   // index in blocks => first instruction
+    u32* mark; u32 mark_gen; // bb id => generation it was last visited in
+    cs_BasicBlock* cur_block; // the instructions are lowered into
+    bool* fused; u32 fused_cap; // instruction of the current block => folded into a later CS_CONCAT
+    cs_HMap types;      // key of the ssa var => u8 cs_ObjectType it has in the current function
+    cs_Cell* cells; u32 cell_count, cell_cap;
+    cs_HMap cell_of;    // key of the ssa var holding a cons cell => u32 index in cells
+    cs_HMap fields;     // key of the ssa var loaded from a cell that is never built => cs_SSAVar it was consed from
+
+    // where instructions are lowered instead of their own block, see VALUE NUMBERING and LOOPS
+    cs_FlowGraph flow;
+    cs_HMap pinned;     // key of the ssa var => bool, true if its instruction has to stay where it is
+    cs_HMap merged;     // key => bool, other vars share the register of this one
+    cs_HMap moved;      // key of the ssa var => cs_BasicBlock* its instruction is lowered in instead, null if none
+    cs_Hoist* hoists; u32 hoist_count, hoist_cap;
+    cs_Hoist* sinks; u32 sink_count, sink_cap;
+    cs_DerivedIv* ivs; u32 iv_count, iv_cap;
+
+    // type-specialized clones, lowered after the variants they were cloned from
+    cs_Clone* clones; u32 clone_count, clone_cap;
+    cs_HMap clone_map;  // variant and argument types => u32 index in clones
+    cs_HMap clones_of;  // variant => u32 number of clones
+} cs_Lowering;
+
+// ssa vars are identified by hash and version, the type only is a hint
+static u32 var_key(cs_SSAVar v)
+{
+    u32 key[2] = { v.hash, v.version };
+    return fnv1a((char*)key, (char*)key + sizeof(key));
+}
+
+static bool is_var(cs_SSAVar v)
+{
+    return v.hash != 0 && v.type != _CS_INVALID;
+}
+
+static cs_CodeIns* emit_ins(cs_Lowering* l, cs_OpKind op, u16 dest, u16 a, u16 b)
+{
+    cs_Code* code = l->code;
+    code->ins_count += 1;
+    cs_ensure_cap((void**)&code->ins, sizeof(cs_CodeIns), &l->ins_cap, code->ins_count);
+    cs_CodeIns* ins = &code->ins[code->ins_count-1];
+    *ins = (cs_CodeIns) { .op = op, .dest = dest, .a = a, .b = b };
+    return ins;
+}
+
+// the instructions emitted from now on come from line
+static void add_line(cs_Lowering* l, u32 line, bool fn_start)
+{
+    cs_Code* code = l->code;
+    if (!fn_start && code->line_count > 0 && code->lines[code->line_count-1].line == line) return;
+    if (code->line_count > 0 && code->lines[code->line_count-1].ins == code->ins_count) code->line_count -= 1;
+    code->line_count += 1;
+    cs_ensure_cap((void**)&code->lines, sizeof(cs_CodeLine), &l->line_cap, code->line_count);
+    code->lines[code->line_count-1] = (cs_CodeLine) { .ins = code->ins_count, .line = line };
+}
+
+// the instructions emitted from now on come from bb
+static void add_block(cs_Lowering* l, cs_BasicBlock* bb)
+{
+    cs_Code* code = l->code;
+    if (code->block_count > 0 && code->blocks[code->block_count-1].ins == code->ins_count) code->block_count -= 1;
+    code->block_count += 1;
+    cs_ensure_cap((void**)&code->blocks, sizeof(cs_CodeBlock), &l->code_block_cap, code->block_count);
+    code->blocks[code->block_count-1] = (cs_CodeBlock) { .ins = code->ins_count, .block = bb->id };
+}
+
+static u32 add_const(cs_Lowering* l, cs_CodeConst k, u32 key)
+{
+    cs_Code* code = l->code;
+    u32* existing = cs_hm_geth(&l->const_map, key);
+    if (existing != null) {
+        cs_CodeConst* other = &code->consts[*existing];
+        if (other->type == k.type && other->int_ == k.int_) return *existing;
+    }
+    code->const_count += 1;
+    cs_ensure_cap((void**)&code->consts, sizeof(cs_CodeConst), &l->const_cap, code->const_count);
+    code->consts[code->const_count-1] = k;
+    if (existing == null) {
+        *(u32*)cs_hm_seth(&l->const_map, key) = code->const_count-1;
+    }
+    return code->const_count-1;
+}
+
+static u32 add_str_const(cs_Lowering* l, cs_Str* str)
+{
+    cs_Code* code = l->code;
+    u32 key = cs_str_hash(str) ^ CS_ATOM_STR;
+    u32* existing = cs_hm_geth(&l->const_map, key);
+    if (existing != null) {
+        cs_Str* other = code->consts[*existing].str_;
+        if (other->size == str->size && memcmp(other->data, str->data, str->size) == 0) return *existing;
+    }
+
+    // strings are copied into one blob, so the code can be written and mapped as a whole
+    u32 size = align_up((u32)sizeof(cs_Str) + str->size + 1, CODE_ALIGN);
+    u32 offset = code->str_size;
+    code->str_size += size;
+    u8* old_strs = code->strs;
+    cs_ensure_cap((void**)&code->strs, 1, &l->str_cap, code->str_size);
+    if (old_strs != code->strs && old_strs != null) {
+        // fix up the constants pointing into the old blob
+        for (u32 i = l->first_const; i < code->const_count; i++) {
+            if (code->consts[i].type != CS_ATOM_STR) continue;
+            code->consts[i].str_ = (cs_Str*)advance_ptr(code->strs, (u64)code->consts[i].str_ - (u64)old_strs);
+        }
+    }
+    cs_Str* copy = (cs_Str*)advance_ptr(code->strs, offset);
+    memset(copy, 0, size);
+    memcpy(copy, str, sizeof(cs_Str) + str->size + 1);
+
+    cs_CodeConst k = { .type = CS_ATOM_STR, .str_ = copy };
+    code->const_count += 1;
+    cs_ensure_cap((void**)&code->consts, sizeof(cs_CodeConst), &l->const_cap, code->const_count);
+    code->consts[code->const_count-1] = k;
+    if (existing == null) {
+        *(u32*)cs_hm_seth(&l->const_map, key) = code->const_count-1;
+    }
+    return code->const_count-1;
+}
+
+// how often bb ran according to --pgo, 0 without counts
+static u64 block_weight(cs_Lowering* l, cs_BasicBlock* bb)
+{
+    cs_BlockCounts* pgo = l->c->pgo;
+    return pgo != null && bb->id < pgo->bb_count ? pgo->blocks[bb->id] : 0;
+}
+
+// how often the branch of bb went to bb->a or bb->b
+static u64 branch_weight(cs_Lowering* l, cs_BasicBlock* bb, bool to_a)
+{
+    u64 runs = block_weight(l, bb);
+    if (runs == 0) return 0;
+    u64 taken = l->c->pgo->taken[bb->id];
+    return to_a ? taken : runs - taken;
+}
+
+// collects every block of a function in depth first order, starting with the entry.
+// with --pgo the successor a branch takes more often comes first
+static void collect_blocks(cs_Lowering* l, cs_FunctionBody* fb)
+{
+    l->block_count = 0;
+    l->mark_gen++;
+    cs_BasicBlock* stack[256];
+    u32 stack_len = 0;
+    cs_BasicBlock** stack_data = stack; u32 stack_cap = 256;
+    stack_data[stack_len++] = fb->entry;
+    l->mark[fb->entry->id] = l->mark_gen;
+    while (stack_len > 0) {
+        cs_BasicBlock* bb = stack_data[--stack_len];
+        l->block_count += 1;
+        cs_ensure_cap((void**)&l->blocks, sizeof(cs_BasicBlock*), &l->block_cap, l->block_count);
+        l->blocks[l->block_count-1] = bb;
+        l->block_index[bb->id] = l->block_count;
+
+        cs_BasicBlock* succs[2];
+        u32 succ_count = cs_bb_successors(bb, succs);
+        if (succ_count == 2 && branch_weight(l, bb, false) > branch_weight(l, bb, true)) {
+            cs_BasicBlock* hot = succs[1];
+            succs[1] = succs[0];
+            succs[0] = hot;
+        }
+        // push in reverse, so the first successor is laid out right after its predecessor
+        for (i32 i = succ_count - 1; i >= 0; i--) {
+            cs_BasicBlock* s = succs[i];
+            if (s == null || l->mark[s->id] == l->mark_gen) continue;
+            l->mark[s->id] = l->mark_gen;
+            if (stack_len == stack_cap) {
+                stack_cap *= 2;
+                if (stack_data == stack) {
+                    stack_data = cs_malloc(sizeof(cs_BasicBlock*) * stack_cap);
+                    memcpy(stack_data, stack, sizeof(stack));
+                } else stack_data = cs_realloc(stack_data, sizeof(cs_BasicBlock*) * stack_cap);
+            }
+            stack_data[stack_len++] = s;
+        }
+    }
+    if (stack_data != stack) free(stack_data);
+}
+
+static void define_var(cs_Lowering* l, cs_SSAVar v, cs_BasicBlock* bb)
+{
+    if (!is_var(v)) return;
+    u32 key = var_key(v);
+    if (cs_hm_geth(&l->regs, key) == null) {
+        *(u16*)cs_hm_seth(&l->regs, key) = l->reg_count++;
+    }
+    *(cs_BasicBlock**)cs_hm_seth(&l->def_blocks, key) = bb;
+}
+
+// registers every variable defined in the collected blocks
+static void define_vars(cs_Lowering* l, cs_FunctionBody* fb)
+{
+    cs_hm_free(&l->regs); cs_hm_free(&l->def_blocks);
+    l->regs = cs_hm_init(sizeof(u16));
+    l->def_blocks = cs_hm_init(sizeof(cs_BasicBlock*));
+    l->reg_count = 0;
+
+    // arguments are passed in the first registers
+    cs_SSAPhi* phi = &fb->entry->phis_head;
+    for (int i = 0; i < fb->arg_count; i++) {
+        define_var(l, phi->dest, fb->entry);
+        phi = phi->next;
+    }
+    for (u32 b = 0; b < l->block_count; b++) {
+        cs_BasicBlock* bb = l->blocks[b];
+        for (cs_SSAPhi* p = &bb->phis_head; !ssa_invalid(p->dest); p = p->next) {
+            define_var(l, p->dest, bb);
+        }
+        for (u32 i = 0; i < bb->instr_count; i++) {
+            define_var(l, bb->instrs[i].dest, bb);
+        }
+    }
+}
+
+// calls fn for every variable the function reads
+static void for_each_use(cs_Lowering* l, cs_FunctionBody* fb, void (*fn)(cs_Lowering* l, cs_SSAVar v))
+{
+    for (u32 b = 0; b < l->block_count; b++) {
+        cs_BasicBlock* bb = l->blocks[b];
+        if (bb != fb->entry) {
+            for (cs_SSAPhi* p = &bb->phis_head; !ssa_invalid(p->dest); p = p->next) {
+                for (int o = 0; o < p->option_count; o++) fn(l, p->options[o]);
+            }
+        }
+        for (u32 i = 0; i < bb->instr_count; i++) {
+            cs_SSAIns* ins = &bb->instrs[i];
+            if (ins->op == CS_CALL || ins->op == CS_CALLC || ins->op == CS_DYNCALL) {
+                if (ins->op == CS_DYNCALL) fn(l, ins->a_as.var);
+                for (int a = 0; a < ins->b_as.args_->count; a++) fn(l, ins->b_as.args_->vars[a]);
+            } else if (cs_ins_uses_vars(ins->op)) {
+                fn(l, ins->a_as.var);
+                fn(l, ins->b_as.var);
+            }
+        }
+        if (!ssa_invalid(bb->jump_cond) && !ssa_eq(bb->jump_cond, ssavar_call) && !ssa_eq(bb->jump_cond, ssavar_return)) {
+            fn(l, bb->jump_cond);
+        }
+    }
+    fn(l, fb->return_val);
+}
+
+static void mark_global_if_free(cs_Lowering* l, cs_SSAVar v)
+{
+    if (!is_var(v)) return;
+    u32 key = var_key(v);
+    if (cs_hm_geth(&l->regs, key) != null) return;
+    u32* global = cs_hm_geth(&l->globals, key);
+    if (global == null) {
+        *(u32*)cs_hm_seth(&l->globals, key) = l->code->global_count++;
+    }
+}
+
+static u16 reg_of(cs_Lowering* l, cs_SSAVar v)
+{
+    if (!is_var(v)) return CS_REG_NONE;
+    u16* reg = cs_hm_geth(&l->regs, var_key(v));
+    if (reg != null) return *reg;
+    // free variable, loaded from its global at the start of the function
+    reg = cs_hm_seth(&l->regs, var_key(v));
+    *reg = l->reg_count++;
+    u32* global = cs_hm_geth(&l->globals, var_key(v));
+    cs_CodeIns* ins = emit_ins(l, CS_GETGLOBAL, *reg, 0, 0);
+    ins->aux = global != null ? *global : ~0u;
+    return *reg;
+}
+
+static void preload_free_var(cs_Lowering* l, cs_SSAVar v)
+{
+    reg_of(l, v);
+}
+
+static void store_if_global(cs_Lowering* l, cs_SSAVar v)
+{
+    if (!is_var(v)) return;
+    u32* global = cs_hm_geth(&l->globals, var_key(v));
+    if (global == null) return;
+    cs_CodeIns* ins = emit_ins(l, CS_SETGLOBAL, CS_REG_NONE, reg_of(l, v), 0);
+    ins->aux = *global;
+}
+
+// true if control can flow from `from` to `to` without passing through `stop`
+static bool reaches(cs_Lowering* l, cs_BasicBlock* from, cs_BasicBlock* to, cs_BasicBlock* stop)
+{
+    if (from == to) return true;
+    l->mark_gen++;
+    cs_BasicBlock** stack = cs_malloc(sizeof(cs_BasicBlock*) * (l->block_count + 1));
+    u32 len = 0;
+    stack[len++] = from;
+    l->mark[from->id] = l->mark_gen;
+    bool found = false;
+    while (len > 0 && !found) {
+        cs_BasicBlock* bb = stack[--len];
+        cs_BasicBlock* succs[2];
+        u32 count = cs_bb_successors(bb, succs);
+        for (u32 i = 0; i < count; i++) {
+            cs_BasicBlock* s = succs[i];
+            if (s == to) { found = true; break; }
+            if (s == null || s == stop || l->mark[s->id] == l->mark_gen) continue;
+            if (l->block_index[s->id] == 0) continue; // not part of this function
+            l->mark[s->id] = l->mark_gen;
+            stack[len++] = s;
+        }
+    }
+    free(stack);
+    return found;
+}
+
+// out of ssa: a phi takes the option that was defined last on the path through pred
+static void emit_phi_moves(cs_Lowering* l, cs_BasicBlock* pred, cs_BasicBlock* succ)
+{
+    for (cs_SSAPhi* p = &succ->phis_head; !ssa_invalid(p->dest); p = p->next) {
+        cs_SSAVar best = ssavar_invalid;
+        cs_BasicBlock* best_def = null;
+        for (int o = 0; o < p->option_count; o++) {
+            cs_SSAVar opt = p->options[o];
+            if (!is_var(opt)) continue;
+            cs_BasicBlock** def = cs_hm_geth(&l->def_blocks, var_key(opt));
+            cs_BasicBlock* def_bb = def != null ? *def : l->blocks[0];
+            if (!reaches(l, def_bb, pred, succ)) continue;
+            if (best_def == null || reaches(l, best_def, def_bb, succ)) {
+                best = opt; best_def = def_bb;
+            }
+        }
+        if (best_def == null) continue;
+        u16 src = reg_of(l, best);
+        u16 dest = reg_of(l, p->dest);
+        if (src != dest) emit_ins(l, CS_MOV, dest, src, 0);
+    }
+}
+
+/* ==== TYPES ==== */
+// types are only hints: they pick the typed form of an op, which tries the fast path for them first
+// and falls back to the generic form for anything else
+
+#define CS_MAX_CLONES 4 // per variant, calls with other argument types use the generic body
+
+static bool is_num(cs_ObjectType t)
+{
+    return t == CS_ATOM_INT || t == CS_ATOM_FLOAT;
+}
+
+// _CS_INVALID while a variable of the function didn't get a type yet
+static cs_ObjectType type_of(cs_Lowering* l, cs_SSAVar v)
+{
+    if (!is_var(v)) return CS_ATOM_VAR;
+    u8* t = cs_hm_geth(&l->types, var_key(v));
+    if (t != null) return *t;
+    // free variables can hold anything
+    return cs_hm_geth(&l->def_blocks, var_key(v)) != null ? _CS_INVALID : CS_ATOM_VAR;
+}
+
+// joins t into the type of v, returns true if it changed
+static bool set_type(cs_Lowering* l, cs_SSAVar v, cs_ObjectType t)
+{
+    if (!is_var(v) || t == _CS_INVALID) return false;
+    u8* old = cs_hm_geth(&l->types, var_key(v));
+    if (old == null) {
+        *(u8*)cs_hm_seth(&l->types, var_key(v)) = t;
+        return true;
+    }
+    if (*old == t || *old == CS_ATOM_VAR) return false;
+    *old = CS_ATOM_VAR;
+    return true;
+}
+
+// result of arithmetic on numbers, ints overflowing 64 bits become doubles but that's rare enough
+static cs_ObjectType num_type(cs_ObjectType a, cs_ObjectType b)
+{
+    if (a == _CS_INVALID || b == _CS_INVALID) return _CS_INVALID;
+    if (a == CS_ATOM_INT && b == CS_ATOM_INT) return CS_ATOM_INT;
+    if (is_num(a) && is_num(b)) return CS_ATOM_FLOAT;
+    return CS_ATOM_VAR;
+}
+
+// the var a load, see SCALAR REPLACEMENT from a cell that is never built reads instead, null for any other instruction
+static cs_SSAVar* field_of(cs_Lowering* l, cs_SSAIns* ins)
+{
+    if ((ins->op != CS_GETCAR && ins->op != CS_GETCDR) || !is_var(ins->dest)) return null;
+    return cs_hm_geth(&l->fields, var_key(ins->dest));
+}
+
+static cs_ObjectType result_type(cs_Lowering* l, cs_SSAIns* ins)
+{
+    cs_ObjectType a, b;
+    switch (ins->op) {
+        case CS_LOADI: return CS_ATOM_INT;
+        case CS_LOADF: return CS_ATOM_FLOAT;
+        case CS_LOADS: return CS_ATOM_STR;
+        case CS_LOADK: return CS_ATOM_KEYWORD;
+        case CS_LOADNIL: return CS_ATOM_NIL;
+        case CS_MOV: return type_of(l, ins->a_as.var);
+        case CS_CONS: case CS_SETCAR: case CS_SETCDR: return CS_LIST;
+        case CS_GETCAR: case CS_GETCDR: {
+            cs_SSAVar* field = field_of(l, ins);
+            return field != null ? type_of(l, *field) : CS_ATOM_VAR;
+        }
+        // natives are typed by their signature
+        case CS_CALLC: return ins->dest.type == CS_ATOM_INT || ins->dest.type == CS_ATOM_FLOAT ? ins->dest.type : CS_ATOM_VAR;
+
+        case CS_ADDV: case CS_SUBV: case CS_MULV: case CS_DIVV: case CS_MODV: {
+            a = type_of(l, ins->a_as.var); b = type_of(l, ins->b_as.var);
+            if (ins->op == CS_ADDV && (a == CS_ATOM_STR || b == CS_ATOM_STR)) return CS_ATOM_STR;
+            return num_type(a, b);
+        }
+        case CS_ANDV: case CS_ORV: case CS_LSHIFTV: case CS_RSHIFTV: {
+            a = type_of(l, ins->a_as.var); b = type_of(l, ins->b_as.var);
+            if (a == _CS_INVALID || b == _CS_INVALID) return _CS_INVALID;
+            return a == CS_ATOM_INT && b == CS_ATOM_INT ? CS_ATOM_INT : CS_ATOM_VAR;
+        }
+        default: return CS_ATOM_VAR;
+    }
+}
+
+// types every variable of the collected blocks, given the types of the arguments (all CS_ATOM_VAR if null)
+static void infer_types(cs_Lowering* l, cs_FunctionBody* fb, u8* arg_types)
+{
+    cs_hm_free(&l->types);
+    l->types = cs_hm_init(sizeof(u8));
+    cs_SSAPhi* arg = &fb->entry->phis_head;
+    for (int i = 0; i < fb->arg_count; i++) {
+        set_type(l, arg->dest, arg_types != null ? arg_types[i] : CS_ATOM_VAR);
+        arg = arg->next;
+    }
+
+    // types only ever get more general, so this ends
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (u32 b = 0; b < l->block_count; b++) {
+            cs_BasicBlock* bb = l->blocks[b];
+            if (bb != fb->entry) {
+                for (cs_SSAPhi* p = &bb->phis_head; !ssa_invalid(p->dest); p = p->next) {
+                    for (int o = 0; o < p->option_count; o++) {
+                        changed |= set_type(l, p->dest, type_of(l, p->options[o]));
+                    }
+                }
+            }
+            for (u32 i = 0; i < bb->instr_count; i++) {
+                changed |= set_type(l, bb->instrs[i].dest, result_type(l, &bb->instrs[i]));
+            }
+        }
+    }
+}
+
+// the typed forms of a generic binop: int int, var int, float float, var float. missing ones are the op itself
+static bool typed_forms(cs_OpKind op, cs_OpKind forms[4])
+{
+#define set_forms(i, vi, f, vf) { forms[0] = i; forms[1] = vi; forms[2] = f; forms[3] = vf; return true; }
+    switch (op) {
+        case CS_ADDV: set_forms(CS_ADDI, CS_ADDVI, CS_ADDF, CS_ADDVF)
+        case CS_SUBV: set_forms(CS_SUBI, CS_SUBVI, CS_SUBF, CS_SUBVF)
+        case CS_MULV: set_forms(CS_MULI, CS_MULVI, CS_MULF, CS_MULVF)
+        case CS_DIVV: set_forms(CS_DIVI, CS_DIVVI, CS_DIVF, CS_DIVVF)
+        case CS_MODV: set_forms(CS_MODI, CS_MODVI, op, op)
+        case CS_ANDV: set_forms(CS_ANDI, CS_ANDVI, op, op)
+        case CS_ORV:  set_forms(CS_ORI, CS_ORVI, op, op)
+        case CS_LSHIFTV: set_forms(CS_LSHIFTI, CS_LSHIFTVI, op, op)
+        case CS_RSHIFTV: set_forms(CS_RSHIFTI, CS_RSHIFTVI, op, op)
+        case CS_GTV:  set_forms(CS_GTI, CS_GTVI, CS_GTF, CS_GTVF)
+        case CS_LTV:  set_forms(CS_LTI, CS_LTVI, CS_LTF, CS_LTVF)
+        case CS_GEQV: set_forms(CS_GEQI, CS_GEQVI, CS_GEQF, CS_GEQVF)
+        case CS_LEQV: set_forms(CS_LEQI, CS_LEQVI, CS_LEQF, CS_LEQVF)
+        case CS_EQV:  set_forms(CS_EQI, CS_EQVI, CS_EQF, CS_EQVF)
+        default: return false;
+    }
+#undef set_forms
+}
+
+// the op with its operands swapped, false if there is none
+static bool mirrored_op(cs_OpKind op, cs_OpKind* out)
+{
+    switch (op) {
+        case CS_ADDV: case CS_MULV: case CS_ANDV: case CS_ORV: case CS_EQV: *out = op; return true;
+        case CS_GTV: *out = CS_LTV; return true;
+        case CS_LTV: *out = CS_GTV; return true;
+        case CS_GEQV: *out = CS_LEQV; return true;
+        case CS_LEQV: *out = CS_GEQV; return true;
+        default: return false;
+    }
+}
+
+// picks the typed form of a binop, the operand with the known type is moved to the right if possible
+static cs_OpKind typed_op(cs_Lowering* l, cs_OpKind op, cs_SSAVar* a, cs_SSAVar* b)
+{
+    cs_OpKind forms[4];
+    if (!typed_forms(op, forms)) return op;
+    cs_ObjectType ta = type_of(l, *a), tb = type_of(l, *b);
+    cs_OpKind mirrored;
+    if (is_num(ta) && !is_num(tb) && mirrored_op(op, &mirrored)) {
+        cs_SSAVar tmp = *a; *a = *b; *b = tmp;
+        cs_ObjectType t = ta; ta = tb; tb = t;
+        op = mirrored;
+        typed_forms(op, forms);
+    }
+    if (ta == CS_ATOM_INT && tb == CS_ATOM_INT) return forms[0];
+    if (ta == CS_ATOM_FLOAT && tb == CS_ATOM_FLOAT) return forms[2];
+    if (tb == CS_ATOM_INT) return forms[1];
+    if (tb == CS_ATOM_FLOAT) return forms[3];
+    return op;
+}
+
+// the code function a static call links to. arguments of a known number type get a clone of the callee
+static u32 call_target(cs_Lowering* l, cs_FunctionBody* callee, cs_CallArgs* args)
+{
+    u8 types[FUNCTION_MAX_ARGS] = {0};
+    bool typed = false;
+    for (int i = 0; i < args->count; i++) {
+        cs_ObjectType t = type_of(l, args->vars[i]);
+        types[i] = is_num(t) ? t : CS_ATOM_VAR;
+        typed |= is_num(t);
+    }
+    if (!typed) return callee->code_id;
+    // a clone only pays off where it runs
+    if (l->c->pgo != null && block_weight(l, l->cur_block) == 0) return callee->code_id;
+
+    // which clone it is is only decided once the function is appended to the code, see append_lowered
+    cs_LoweredFn* job = l->job;
+    for (u32 i = 0; i < job->request_count; i++) {
+        cs_Clone* request = &job->requests[i];
+        if (request->fb == callee && memcmp(request->arg_types, types, sizeof(types)) == 0) return CLONE_PENDING | i;
+    }
+    job->request_count += 1;
+    cs_ensure_cap((void**)&job->requests, sizeof(cs_Clone), &job->request_cap, job->request_count);
+    cs_Clone* request = &job->requests[job->request_count-1];
+    request->fb = callee;
+    memcpy(request->arg_types, types, sizeof(types));
+    return CLONE_PENDING | (job->request_count-1);
+}
+
+// the code function of a clone a call asked for, it is created if it doesn't exist yet
+static u32 resolve_clone(cs_Lowering* l, cs_Clone* request)
+{
+    cs_FunctionBody* callee = request->fb;
+    struct { cs_FunctionBody* fb; u8 types[FUNCTION_MAX_ARGS]; } key = { callee };
+    memcpy(key.types, request->arg_types, sizeof(key.types));
+    u32 hash = fnv1a((char*)&key, (char*)&key + sizeof(key));
+    u32* existing = cs_hm_geth(&l->clone_map, hash);
+    if (existing != null) {
+        cs_Clone* clone = &l->clones[*existing];
+        if (clone->fb == callee && memcmp(clone->arg_types, request->arg_types, sizeof(key.types)) == 0) return clone->code_id;
+        return callee->code_id;
+    }
+    u32 fb_key = fnv1a((char*)&callee, (char*)(&callee + 1));
+    u32* count = cs_hm_geth(&l->clones_of, fb_key);
+    if (count == null) {
+        count = cs_hm_seth(&l->clones_of, fb_key);
+        *count = 0;
+    }
+    if (*count == CS_MAX_CLONES) return callee->code_id;
+    *count += 1;
+
+    // lowered in the next round
+    cs_Code* code = l->code;
+    code->fn_count += 1;
+    cs_ensure_cap((void**)&code->fns, sizeof(cs_CodeFn), &l->fn_cap, code->fn_count);
+    l->clone_count += 1;
+    cs_ensure_cap((void**)&l->clones, sizeof(cs_Clone), &l->clone_cap, l->clone_count);
+    cs_Clone* clone = &l->clones[l->clone_count-1];
+    *clone = *request;
+    clone->code_id = code->fn_count-1;
+    *(u32*)cs_hm_seth(&l->clone_map, hash) = l->clone_count-1;
+    return clone->code_id;
+}
+
+/* ==== LOOPS ==== */
+// code moves out of the loops of a function by being lowered somewhere else: invariant instructions at the end
+// of the preheader, multiples of induction variables as additions at the end of the latch.
+// moving only is safe for instructions that can't fail, which is where the types come in
+
+static bool is_temp(cs_SSAVar v)
+{
+    return is_var(v) && v.hash == tempvar_hash;
+}
+
+static cs_BasicBlock* def_block(cs_Lowering* l, cs_SSAVar v)
+{
+    cs_BasicBlock** def = cs_hm_geth(&l->def_blocks, var_key(v));
+    return def != null ? *def : null;
+}
+
+// free variables and constants are loaded before the function starts
+static bool is_invariant(cs_Lowering* l, cs_Loop* loop, cs_SSAVar v)
+{
+    if (!is_var(v)) return true;
+    cs_BasicBlock* def = def_block(l, v);
+    return def == null || !cs_loop_contains(&l->flow, loop, def);
+}
+
+// temps that only the expression they are part of reads, and which have no phi or concatenation depending on
+// their instruction staying where it is
+static bool is_movable(cs_Lowering* l, cs_SSAVar v)
+{
+    return is_temp(v) && cs_hm_geth(&l->pinned, var_key(v)) == null && cs_hm_geth(&l->globals, var_key(v)) == null;
+}
+
+// instructions that give the same result wherever they run and never fail
+static bool is_speculatable(cs_Lowering* l, cs_SSAIns* ins)
+{
+    cs_SSAVar a = ins->a_as.var, b = ins->b_as.var;
+    switch (ins->op) {
+        case CS_LOADI: case CS_LOADF: case CS_LOADS: case CS_LOADK: case CS_LOADSYM:
+        case CS_LOADFUN: case CS_LOADTRUE: case CS_LOADFALSE: case CS_LOADNIL:
+        case CS_MOV: case CS_NOT: case CS_EQV:
+            return true;
+        case CS_ADDV: case CS_SUBV: case CS_MULV: case CS_GTV: case CS_LTV: case CS_GEQV: case CS_LEQV:
+            return is_num(type_of(l, a)) && is_num(type_of(l, b));
+        // only float division can't fail on a zero
+        case CS_DIVV: case CS_MODV:
+            return is_num(type_of(l, a)) && type_of(l, b) == CS_ATOM_FLOAT;
+        default: return false;
+    }
+}
+
+// instructions whose temp can be computed once in front of the loop
+static bool is_hoistable(cs_Lowering* l, cs_Loop* loop, cs_SSAIns* ins)
+{
+    if (!is_movable(l, ins->dest) || !is_speculatable(l, ins)) return false;
+    return is_invariant(l, loop, ins->a_as.var) && is_invariant(l, loop, ins->b_as.var);
+}
+
+static void hoist(cs_Lowering* l, cs_SSAIns* ins, cs_BasicBlock* to)
+{
+    l->hoist_count += 1;
+    cs_ensure_cap((void**)&l->hoists, sizeof(cs_Hoist), &l->hoist_cap, l->hoist_count);
+    l->hoists[l->hoist_count-1] = (cs_Hoist) { ins, to };
+    *(cs_BasicBlock**)cs_hm_seth(&l->moved, var_key(ins->dest)) = to;
+    *(cs_BasicBlock**)cs_hm_seth(&l->def_blocks, var_key(ins->dest)) = to;
+}
+
+// the block an instruction is lowered in, null if it isn't lowered at all
+static cs_BasicBlock* lowered_in(cs_Lowering* l, cs_SSAIns* ins, cs_BasicBlock* bb)
+{
+    if (!is_var(ins->dest)) return bb;
+    cs_BasicBlock** moved = cs_hm_geth(&l->moved, var_key(ins->dest));
+    return moved != null ? *moved : bb;
+}
+
+// inner loops first, so an instruction can move out of several loops at once
+static void hoist_invariants(cs_Lowering* l)
+{
+    cs_FlowGraph* g = &l->flow;
+    for (u32 i = 0; i < g->loop_count; i++) {
+        cs_Loop* loop = &g->loops[i];
+        if (loop->preheader == null) continue;
+        // in reverse postorder, so the operands of an instruction move before it
+        for (u32 b = 0; b < g->block_count; b++) {
+            cs_BasicBlock* bb = g->blocks[b];
+            if (!cs_loop_contains(g, loop, bb)) continue;
+            for (u32 k = 0; k < bb->instr_count; k++) {
+                cs_SSAIns* ins = &bb->instrs[k];
+                if (lowered_in(l, ins, bb) == bb && is_hoistable(l, loop, ins)) hoist(l, ins, loop->preheader);
+            }
+            // the ones that already moved out of an inner loop in front of it
+            u32 hoist_count = l->hoist_count;
+            for (u32 h = 0; h < hoist_count; h++) {
+                cs_Hoist entry = l->hoists[h];
+                if (entry.to != bb || lowered_in(l, entry.ins, null) != bb) continue;
+                if (is_hoistable(l, loop, entry.ins)) hoist(l, entry.ins, loop->preheader);
+            }
+        }
+    }
+}
+
+static bool same_var(cs_SSAVar a, cs_SSAVar b)
+{
+    return is_var(a) && is_var(b) && a.hash == b.hash && a.version == b.version;
+}
+
+// the register of v without loading it, CS_REG_NONE for free variables
+static u16 known_reg(cs_Lowering* l, cs_SSAVar v)
+{
+    if (!is_var(v)) return CS_REG_NONE;
+    u16* reg = cs_hm_geth(&l->regs, var_key(v));
+    return reg != null ? *reg : CS_REG_NONE;
+}
+
+// vars merged by value numbering or an induction variable share their register
+static bool same_reg(cs_Lowering* l, cs_SSAVar a, cs_SSAVar b)
+{
+    u16 reg = known_reg(l, a);
+    return reg != CS_REG_NONE && reg == known_reg(l, b);
+}
+
+static bool ins_reads(cs_Lowering* l, cs_SSAIns* ins, cs_SSAVar v)
+{
+    if (ins->op == CS_CALL || ins->op == CS_CALLC || ins->op == CS_DYNCALL) {
+        if (ins->op == CS_DYNCALL && same_reg(l, ins->a_as.var, v)) return true;
+        for (int a = 0; a < ins->b_as.args_->count; a++) {
+            if (same_reg(l, ins->b_as.args_->vars[a], v)) return true;
+        }
+        return false;
+    }
+    return cs_ins_uses_vars(ins->op) && (same_reg(l, ins->a_as.var, v) || same_reg(l, ins->b_as.var, v));
+}
+
+// the instruction computing v where it was written, null if it isn't lowered there
+static cs_SSAIns* find_def(cs_Lowering* l, cs_SSAVar v, cs_BasicBlock** bb_out, u32* index_out)
+{
+    cs_BasicBlock* bb = def_block(l, v);
+    if (bb == null) return null;
+    for (u32 i = 0; i < bb->instr_count; i++) {
+        if (!same_var(bb->instrs[i].dest, v)) continue;
+        if (lowered_in(l, &bb->instrs[i], bb) != bb) return null;
+        *bb_out = bb; *index_out = i;
+        return &bb->instrs[i];
+    }
+    return null;
+}
+
+// true if nothing reads v after the instruction at index of bb, until the loop starts over
+static bool dead_after(cs_Lowering* l, cs_FunctionBody* fb, cs_Loop* loop, cs_SSAVar v, cs_BasicBlock* bb, u32 index)
+{
+    cs_FlowGraph* g = &l->flow;
+    for (u32 b = 0; b < g->block_count; b++) {
+        cs_BasicBlock* use_bb = g->blocks[b];
+        // reaching the header again starts the next iteration
+        bool after = use_bb != bb && use_bb != loop->header && reaches(l, bb, use_bb, loop->header);
+        // phis read at the end of the preds, which for bb itself is before its instructions. the header
+        // reads them at the end of the latch though
+        if ((after || use_bb == loop->header) && use_bb != fb->entry) {
+            for (cs_SSAPhi* p = &use_bb->phis_head; !ssa_invalid(p->dest); p = p->next) {
+                for (int o = 0; o < p->option_count; o++) {
+                    if (same_reg(l, p->options[o], v)) return false;
+                }
+            }
+        }
+        for (u32 i = 0; i < use_bb->instr_count; i++) {
+            if ((after || (use_bb == bb && i > index)) && ins_reads(l, &use_bb->instrs[i], v)) return false;
+        }
+        if ((after || use_bb == bb) && same_reg(l, use_bb->jump_cond, v)) return false;
+    }
+    if (same_reg(l, fb->return_val, v)) {
+        return fb->return_bb != null && fb->return_bb != bb && !reaches(l, bb, fb->return_bb, loop->header);
+    }
+    return true;
+}
+
+// v holds the value of the phi from the start of the iteration. the updated sum and next can share its
+// register, but they are one step ahead
+static bool is_base(cs_Lowering* l, cs_SSAVar v, cs_SSAVar phi, cs_SSAVar sum, cs_SSAVar next)
+{
+    return same_reg(l, v, phi) && !same_var(v, sum) && !same_var(v, next);
+}
+
+// i = phi(start, i + step) with an invariant int step. the update reuses the register of the phi
+// if the old value is dead by then, so the move at the end of the iteration goes away
+static void find_induction_vars(cs_Lowering* l, cs_FunctionBody* fb, cs_Loop* loop)
+{
+    cs_BasicBlock* latch = loop->latch;
+    for (cs_SSAPhi* p = &loop->header->phis_head; !ssa_invalid(p->dest); p = p->next) {
+        if (p->option_count != 2 || type_of(l, p->dest) != CS_ATOM_INT) continue;
+        cs_SSAVar next = ssavar_invalid;
+        for (int o = 0; o < 2; o++) {
+            if (!is_invariant(l, loop, p->options[o])) next = p->options[o];
+        }
+        if (!is_var(next) || is_invariant(l, loop, p->options[0]) == is_invariant(l, loop, p->options[1])) continue;
+
+        cs_BasicBlock* next_bb; u32 next_index;
+        cs_SSAIns* update = find_def(l, next, &next_bb, &next_index);
+        // let binds the temp of the addition with a move
+        cs_SSAVar sum = next;
+        if (update != null && update->op == CS_MOV && is_temp(update->a_as.var)) {
+            sum = update->a_as.var;
+            cs_BasicBlock* sum_bb;
+            update = find_def(l, sum, &sum_bb, &next_index);
+            if (update != null && sum_bb != next_bb) continue;
+        }
+        if (update == null || (update->op != CS_ADDV && update->op != CS_SUBV)) continue;
+        if (cs_loop_of(&l->flow, next_bb) != loop || !cs_flow_dominates(&l->flow, next_bb, latch)) continue;
+        cs_SSAVar step = update->b_as.var;
+        if (!same_reg(l, update->a_as.var, p->dest)) {
+            if (update->op != CS_ADDV || !same_reg(l, update->b_as.var, p->dest)) continue;
+            step = update->a_as.var;
+        }
+        if (!is_var(step) || !is_invariant(l, loop, step) || type_of(l, step) != CS_ATOM_INT) continue;
+
+        u16 reg = reg_of(l, p->dest);
+        // the vars merged into the sum would keep the old register
+        bool merged = cs_hm_geth(&l->merged, var_key(sum)) != null || cs_hm_geth(&l->merged, var_key(next)) != null;
+        if (!merged && dead_after(l, fb, loop, p->dest, next_bb, next_index)) {
+            *(u16*)cs_hm_geth(&l->regs, var_key(sum)) = reg;
+            *(u16*)cs_hm_geth(&l->regs, var_key(next)) = reg;
+        }
+
+        // multiplications by an invariant become additions at the end of every iteration
+        cs_FlowGraph* g = &l->flow;
+        for (u32 m = 0; m < loop->block_count; m++) {
+            cs_BasicBlock* bb = g->blocks[loop->blocks[m]];
+            for (u32 k = 0; k < bb->instr_count; k++) {
+                cs_SSAIns* ins = &bb->instrs[k];
+                if (ins->op != CS_MULV || lowered_in(l, ins, bb) == null) continue;
+                if (!is_movable(l, ins->dest) || cs_hm_geth(&l->merged, var_key(ins->dest)) != null) continue;
+                cs_SSAVar factor = ins->b_as.var;
+                if (!is_base(l, ins->a_as.var, p->dest, sum, next)) {
+                    if (!is_base(l, ins->b_as.var, p->dest, sum, next)) continue;
+                    factor = ins->a_as.var;
+                }
+                if (!is_var(factor) || !is_invariant(l, loop, factor) || type_of(l, factor) != CS_ATOM_INT) continue;
+
+                cs_DerivedIv* iv = null;
+                for (u32 d = 0; d < l->iv_count; d++) {
+                    cs_DerivedIv* other = &l->ivs[d];
+                    if (other->loop == loop && same_var(other->base, p->dest) && same_var(other->factor, factor)) iv = other;
+                }
+                if (iv == null) {
+                    l->iv_count += 1;
+                    cs_ensure_cap((void**)&l->ivs, sizeof(cs_DerivedIv), &l->iv_cap, l->iv_count);
+                    iv = &l->ivs[l->iv_count-1];
+                    *iv = (cs_DerivedIv) {
+                        .loop = loop, .base = p->dest, .step = step, .factor = factor,
+                        .down = update->op == CS_SUBV,
+                        .reg = l->reg_count++, .step_reg = l->reg_count++,
+                    };
+                }
+                *(u16*)cs_hm_seth(&l->regs, var_key(ins->dest)) = iv->reg;
+                *(cs_BasicBlock**)cs_hm_seth(&l->moved, var_key(ins->dest)) = null;
+            }
+        }
+    }
+}
+
+// the code on the edge from pred to succ, after the phi moves
+static void emit_loop_edge(cs_Lowering* l, cs_BasicBlock* pred, cs_BasicBlock* succ)
+{
+    for (u32 d = 0; d < l->iv_count; d++) {
+        cs_DerivedIv* iv = &l->ivs[d];
+        if (iv->loop->header != succ) continue;
+        if (pred == iv->loop->preheader) {
+            u16 factor = reg_of(l, iv->factor);
+            emit_ins(l, CS_MULI, iv->step_reg, reg_of(l, iv->step), factor);
+            emit_ins(l, CS_MULI, iv->reg, reg_of(l, iv->base), factor);
+        } else if (pred == iv->loop->latch) {
+            emit_ins(l, iv->down ? CS_SUBI : CS_ADDI, iv->reg, iv->reg, iv->step_reg);
+        }
+    }
+}
+
+static void lower_ins(cs_Lowering* l, cs_SSAIns* ins)
+{
+    cs_Code* code = l->code;
+    u16 dest = reg_of(l, ins->dest);
+    switch (ins->op) {
+        case CS_SCOPE_PUSH:
+        case CS_SCOPE_POP:
+            // scopes only exist at compile time
+            return;
+
+        case CS_LOADI: {
+            cs_CodeConst k = { .type = CS_ATOM_INT, .int_ = ins->a_as.int_ };
+            emit_ins(l, CS_LOADI, dest, 0, 0)->aux = add_const(l, k, fnv1a((char*)&k, (char*)(&k + 1)));
+        } break;
+        case CS_LOADF: {
+            cs_CodeConst k = { .type = CS_ATOM_FLOAT, .double_ = ins->a_as.double_ };
+            emit_ins(l, CS_LOADF, dest, 0, 0)->aux = add_const(l, k, fnv1a((char*)&k, (char*)(&k + 1)));
+        } break;
+        case CS_LOADS: {
+            emit_ins(l, CS_LOADS, dest, 0, 0)->aux = add_str_const(l, ins->a_as.str_);
+        } break;
+        case CS_LOADK:
+        case CS_LOADSYM: {
+            cs_CodeConst k = { .type = ins->op == CS_LOADK ? CS_ATOM_KEYWORD : CS_ATOM_SYMBOL };
+            k.int_ = reinterpret(ins->a_as.int_, u32);
+            emit_ins(l, ins->op, dest, 0, 0)->aux = add_const(l, k, fnv1a((char*)&k, (char*)(&k + 1)));
+        } break;
+        case CS_LOADFUN: {
+            emit_ins(l, CS_LOADFUN, dest, 0, 0)->aux = reinterpret(ins->a_as.int_, u32);
+        } break;
+        case CS_LOADTRUE:
+        case CS_LOADFALSE:
+        case CS_LOADNIL: {
+            emit_ins(l, ins->op, dest, 0, 0);
+        } break;
+
+        case CS_CALL:
+        case CS_CALLC:
+        case CS_DYNCALL: {
+            cs_CallArgs* args = ins->b_as.args_;
+            u16 arg_regs[FUNCTION_MAX_ARGS];
+            for (int i = 0; i < args->count; i++) arg_regs[i] = reg_of(l, args->vars[i]);
+
+            u32 start = code->arg_count;
+            code->arg_count += args->count;
+            cs_ensure_cap((void**)&code->args, sizeof(u16), &l->arg_cap, code->arg_count);
+            memcpy(&code->args[start], arg_regs, sizeof(u16) * args->count);
+
+            // natives are referenced by their index in cs_Context.natives, dynamic calls get their own inline cache
+            cs_CodeIns* call;
+            if (ins->op == CS_DYNCALL) {
+                call = emit_ins(l, ins->op, dest, args->count, reg_of(l, ins->a_as.var));
+                call->aux = code->cache_count++;
+            } else {
+                call = emit_ins(l, ins->op, dest, args->count, 0);
+                call->aux = ins->op == CS_CALL ? call_target(l, ins->a_as.fn_, args) : ins->a_as.fn_->code_id;
+            }
+            call->aux2 = start;
+        } break;
+
+        case CS_GETCAR:
+        case CS_GETCDR: {
+            cs_SSAVar* field = field_of(l, ins);
+            if (field == null) emit_ins(l, ins->op, dest, reg_of(l, ins->a_as.var), CS_REG_NONE);
+            else if (reg_of(l, *field) != dest) emit_ins(l, CS_MOV, dest, reg_of(l, *field), 0);
+        } break;
+
+        default: {
+            cs_SSAVar a = ins->a_as.var, b = ins->b_as.var;
+            cs_OpKind op = typed_op(l, ins->op, &a, &b);
+            u16 ra = reg_of(l, a), rb = reg_of(l, b);
+            if (op == CS_MOV && ra == dest) break;
+            // an induction variable updated in place is the left operand, which the op releases (see rc.c)
+            if (op == CS_ADDI && rb == dest) {
+                rb = ra; ra = dest;
+            }
+            emit_ins(l, op, dest, ra, rb);
+        } break;
+    }
+    store_if_global(l, ins->dest);
+}
+
+// the addition that computed the left operand of the addition at i, if it is in the same block.
+// temps are only read by the expression they are an operand of, so that one can be folded into i
+static i32 concat_inner(cs_BasicBlock* bb, u32 i)
+{
+    cs_SSAVar left = bb->instrs[i].a_as.var;
+    if (left.hash != tempvar_hash) return -1;
+    for (i32 j = (i32)i - 1; j >= 0; j--) {
+        if (!ssa_eq(bb->instrs[j].dest, left)) continue;
+        return bb->instrs[j].op == CS_ADDV ? j : -1;
+    }
+    return -1;
+}
+
+// a chain of string additions (+ (+ a b) c) becomes one CS_CONCAT, so the strings in between are never built
+static void find_concats(cs_Lowering* l, cs_BasicBlock* bb)
+{
+    cs_ensure_cap((void**)&l->fused, sizeof(bool), &l->fused_cap, bb->instr_count);
+    memset(l->fused, 0, sizeof(bool) * bb->instr_count);
+    for (i32 i = (i32)bb->instr_count - 1; i >= 0; i--) {
+        cs_SSAIns* ins = &bb->instrs[i];
+        if (l->fused[i] || ins->op != CS_ADDV || ins->dest.type != CS_ATOM_STR) continue;
+        u32 parts = 2;
+        for (i32 j = concat_inner(bb, i); j >= 0 && parts < FUNCTION_MAX_ARGS; j = concat_inner(bb, j)) {
+            l->fused[j] = true;
+            parts++;
+        }
+    }
+}
+
+static void lower_concat(cs_Lowering* l, cs_BasicBlock* bb, u32 i)
+{
+    cs_Code* code = l->code;
+    // the right operands come in backwards while going down the left operands
+    u16 parts[FUNCTION_MAX_ARGS];
+    u32 count = 0;
+    cs_SSAIns* ins = &bb->instrs[i];
+    while (true) {
+        parts[count++] = reg_of(l, ins->b_as.var);
+        i32 inner = concat_inner(bb, (u32)(ins - bb->instrs));
+        if (inner < 0 || !l->fused[inner]) break;
+        ins = &bb->instrs[inner];
+    }
+    parts[count++] = reg_of(l, ins->a_as.var);
+
+    u32 start = code->arg_count;
+    code->arg_count += count;
+    cs_ensure_cap((void**)&code->args, sizeof(u16), &l->arg_cap, code->arg_count);
+    for (u32 p = 0; p < count; p++) code->args[start + p] = parts[count - 1 - p];
+
+    cs_SSAVar dest = bb->instrs[i].dest;
+    emit_ins(l, CS_CONCAT, reg_of(l, dest), count, 0)->aux2 = start;
+    store_if_global(l, dest);
+}
+
+/* ==== VALUE NUMBERING ==== */
+// an instruction computing what a dominating one already did is dropped, its var shares the register of the
+// other one. then the pure instructions are placed again (global code motion): out of loops, see LOOPS, and
+// otherwise as late as their uses allow, e.g. into the branch of an if that is the only one needing them.
+// there are no block frequencies, the loop depth of a block stands in for how often it runs
+
+typedef struct {
+    u32 op;
+    u64 a, b;   // value numbers of the operands
+    u64 imm;    // the constant of a load
+} cs_ValueKey;
+
+typedef struct {
+    cs_ValueKey key;
+    cs_SSAIns* ins;
+    cs_BasicBlock* bb;
+} cs_NumberedValue;
+
+// merged vars share their register, so it is the value number. free variables are numbered by their key
+static u64 value_number(cs_Lowering* l, cs_SSAVar v)
+{
+    if (!is_var(v)) return 0;
+    u16 reg = known_reg(l, v);
+    return reg != CS_REG_NONE ? (u64)reg + 1 : (1ull << 32) | var_key(v);
+}
+
+static bool is_commutative(cs_Lowering* l, cs_SSAIns* ins)
+{
+    switch (ins->op) {
+        case CS_EQV: return true;
+        // adding strings isn't
+        case CS_ADDV: case CS_MULV: case CS_ANDV: case CS_ORV:
+            return is_num(type_of(l, ins->a_as.var)) && is_num(type_of(l, ins->b_as.var));
+        default: return false;
+    }
+}
+
+// false for instructions that can give something else each time, like calls and loads from lists
+static bool value_key(cs_Lowering* l, cs_SSAIns* ins, cs_ValueKey* key)
+{
+    memset(key, 0, sizeof(cs_ValueKey));
+    key->op = ins->op;
+    switch (ins->op) {
+        case CS_LOADI: case CS_LOADK: case CS_LOADSYM: case CS_LOADFUN:
+            key->imm = (u64)ins->a_as.int_;
+            return true;
+        case CS_LOADF: memcpy(&key->imm, &ins->a_as.double_, sizeof(double)); return true;
+        case CS_LOADS: key->imm = cs_str_hash(ins->a_as.str_); return true;
+        case CS_LOADTRUE: case CS_LOADFALSE: case CS_LOADNIL: return true;
+
+        case CS_NOT: case CS_EQV:
+        case CS_ADDV: case CS_SUBV: case CS_MULV: case CS_DIVV: case CS_MODV:
+        case CS_ANDV: case CS_ORV: case CS_LSHIFTV: case CS_RSHIFTV:
+        case CS_GTV: case CS_LTV: case CS_GEQV: case CS_LEQV: {
+            key->a = value_number(l, ins->a_as.var);
+            key->b = value_number(l, ins->b_as.var);
+            if (is_commutative(l, ins) && key->a > key->b) {
+                u64 tmp = key->a; key->a = key->b; key->b = tmp;
+            }
+        } return true;
+        default: return false;
+    }
+}
+
+static bool same_value(cs_NumberedValue* value, cs_ValueKey* key, cs_SSAIns* ins)
+{
+    if (memcmp(&value->key, key, sizeof(cs_ValueKey)) != 0) return false;
+    if (ins->op != CS_LOADS) return true;
+    cs_Str* a = value->ins->a_as.str_; cs_Str* b = ins->a_as.str_;
+    return a->size == b->size && memcmp(a->data, b->data, a->size) == 0;
+}
+
+// v keeps its own instruction if a phi takes it, a concatenation folds it or another function reads it
+static bool is_mergeable(cs_Lowering* l, cs_SSAVar v)
+{
+    return cs_hm_geth(&l->pinned, var_key(v)) == null && cs_hm_geth(&l->globals, var_key(v)) == null;
+}
+
+static void merge(cs_Lowering* l, cs_SSAVar v, cs_SSAVar into)
+{
+    *(u16*)cs_hm_geth(&l->regs, var_key(v)) = known_reg(l, into);
+    *(bool*)cs_hm_seth(&l->merged, var_key(into)) = true;
+    *(cs_BasicBlock**)cs_hm_seth(&l->moved, var_key(v)) = null;
+    *(cs_BasicBlock**)cs_hm_seth(&l->def_blocks, var_key(v)) = def_block(l, into);
+}
+
+// in reverse postorder the operands of an instruction are numbered before it, only phis are numbered by
+// their own register
+static void number_values(cs_Lowering* l)
+{
+    cs_FlowGraph* g = &l->flow;
+    cs_HMap values = cs_hm_init(sizeof(cs_NumberedValue));
+    for (u32 b = 0; b < g->block_count; b++) {
+        cs_BasicBlock* bb = g->blocks[b];
+        for (u32 i = 0; i < bb->instr_count; i++) {
+            cs_SSAIns* ins = &bb->instrs[i];
+            if (!is_var(ins->dest)) continue;
+            // a copy has the value it copies
+            cs_SSAVar same = ssavar_invalid;
+            if (ins->op == CS_MOV) {
+                same = ins->a_as.var;
+            } else {
+                cs_ValueKey key;
+                if (!value_key(l, ins, &key)) continue;
+                u32 hash = fnv1a((char*)&key, (char*)(&key + 1));
+                cs_NumberedValue* value = cs_hm_geth(&values, hash);
+                if (value != null && same_value(value, &key, ins) && cs_flow_dominates(g, value->bb, bb)) {
+                    same = value->ins->dest;
+                } else {
+                    bool* folded = cs_hm_geth(&l->pinned, var_key(ins->dest));
+                    // a concatenation part never gets a value of its own
+                    if (folded == null || !*folded) *(cs_NumberedValue*)cs_hm_seth(&values, hash) = (cs_NumberedValue) { key, ins, bb };
+                }
+            }
+            if (is_var(same) && def_block(l, same) != null && is_mergeable(l, ins->dest)) merge(l, ins->dest, same);
+        }
+    }
+    cs_hm_free(&values);
+}
+
+typedef struct {
+    u16 reg;
+    cs_BasicBlock* bb;
+} cs_Use;
+
+typedef struct {
+    cs_Lowering* l;
+    cs_Use* uses; u32 use_count, use_cap;
+    u32* start;     // register => index of its first use, once the uses are sorted
+    u8* defs;       // register => instructions and phis writing it, 2 stands for more
+} cs_Sinking;
+
+static void sink_use(cs_Sinking* s, cs_SSAVar v, cs_BasicBlock* bb)
+{
+    u16 reg = known_reg(s->l, v);
+    if (reg == CS_REG_NONE) return;
+    s->use_count += 1;
+    cs_ensure_cap((void**)&s->uses, sizeof(cs_Use), &s->use_cap, s->use_count);
+    s->uses[s->use_count-1] = (cs_Use) { reg, bb };
+}
+
+static void sink_def(cs_Sinking* s, cs_SSAVar v)
+{
+    u16 reg = known_reg(s->l, v);
+    if (reg != CS_REG_NONE && s->defs[reg] < 2) s->defs[reg]++;
+}
+
+// where every register is read and how often it is written, with the instructions where they are lowered
+static void collect_sink_uses(cs_Sinking* s, cs_FunctionBody* fb)
+{
+    cs_Lowering* l = s->l;
+    cs_FlowGraph* g = &l->flow;
+    for (u32 b = 0; b < g->block_count; b++) {
+        cs_BasicBlock* bb = g->blocks[b];
+        for (cs_SSAPhi* p = &bb->phis_head; !ssa_invalid(p->dest); p = p->next) sink_def(s, p->dest);
+        for (u32 i = 0; i < bb->instr_count; i++) {
+            cs_SSAIns* ins = &bb->instrs[i];
+            cs_BasicBlock* at = lowered_in(l, ins, bb);
+            if (at == null) continue;
+            sink_def(s, ins->dest);
+            if (ins->op == CS_CALL || ins->op == CS_CALLC || ins->op == CS_DYNCALL) {
+                if (ins->op == CS_DYNCALL) sink_use(s, ins->a_as.var, at);
+                for (int a = 0; a < ins->b_as.args_->count; a++) sink_use(s, ins->b_as.args_->vars[a], at);
+            } else if (field_of(l, ins) != null) {
+                sink_use(s, *field_of(l, ins), at);
+            } else if (cs_ins_uses_vars(ins->op)) {
+                sink_use(s, ins->a_as.var, at);
+                sink_use(s, ins->b_as.var, at);
+            }
+        }
+        if (!ssa_invalid(bb->jump_cond) && !ssa_eq(bb->jump_cond, ssavar_call) && !ssa_eq(bb->jump_cond, ssavar_return)) {
+            sink_use(s, bb->jump_cond, bb);
+        }
+    }
+    // returned from every block that ends the function
+    if (fb->return_bb != null) sink_use(s, fb->return_val, fb->return_bb);
+    else if (known_reg(l, fb->return_val) != CS_REG_NONE) s->defs[known_reg(l, fb->return_val)] = 2;
+    for (u32 d = 0; d < l->iv_count; d++) {
+        cs_DerivedIv* iv = &l->ivs[d];
+        sink_use(s, iv->base, iv->loop->preheader);
+        sink_use(s, iv->step, iv->loop->preheader);
+        sink_use(s, iv->factor, iv->loop->preheader);
+    }
+
+    // sorted by register
+    u32 regs = l->reg_count;
+    s->start = cs_calloc(regs + 1, sizeof(u32));
+    for (u32 u = 0; u < s->use_count; u++) s->start[s->uses[u].reg + 1]++;
+    for (u32 r = 1; r <= regs; r++) s->start[r] += s->start[r-1];
+    cs_Use* sorted = cs_malloc(sizeof(cs_Use) * (s->use_count + 1));
+    u32* fill = cs_calloc(regs + 1, sizeof(u32));
+    for (u32 u = 0; u < s->use_count; u++) {
+        u16 reg = s->uses[u].reg;
+        sorted[s->start[reg] + fill[reg]++] = s->uses[u];
+    }
+    free(fill);
+    free(s->uses);
+    s->uses = sorted;
+}
+
+static void move_use(cs_Sinking* s, cs_SSAVar v, cs_BasicBlock* from, cs_BasicBlock* to)
+{
+    u16 reg = known_reg(s->l, v);
+    if (reg == CS_REG_NONE) return;
+    for (u32 u = s->start[reg]; u < s->start[reg+1]; u++) {
+        if (s->uses[u].bb != from) continue;
+        s->uses[u].bb = to;
+        return;
+    }
+}
+
+// the block dominated by bb that runs least often and still dominates every use, the last one of those
+static cs_BasicBlock* sink_target(cs_Sinking* s, cs_BasicBlock* bb, u16 reg)
+{
+    cs_FlowGraph* g = &s->l->flow;
+    if (s->start[reg] == s->start[reg+1]) return bb;
+    cs_BasicBlock* late = s->uses[s->start[reg]].bb;
+    for (u32 u = s->start[reg] + 1; u < s->start[reg+1]; u++) late = cs_flow_common_dominator(g, late, s->uses[u].bb);
+
+    cs_BasicBlock* best = late;
+    u32 best_depth = cs_loop_depth(g, late);
+    for (cs_BasicBlock* x = late; x != bb; x = cs_flow_idom(g, x)) {
+        u32 depth = cs_loop_depth(g, x);
+        if (depth < best_depth) {
+            best = x; best_depth = depth;
+        }
+    }
+    return best_depth <= cs_loop_depth(g, bb) ? best : bb;
+}
+
+static void sink(cs_Lowering* l, cs_SSAIns* ins, cs_BasicBlock* to)
+{
+    l->sink_count += 1;
+    cs_ensure_cap((void**)&l->sinks, sizeof(cs_Hoist), &l->sink_cap, l->sink_count);
+    l->sinks[l->sink_count-1] = (cs_Hoist) { ins, to };
+    *(cs_BasicBlock**)cs_hm_seth(&l->moved, var_key(ins->dest)) = to;
+    *(cs_BasicBlock**)cs_hm_seth(&l->def_blocks, var_key(ins->dest)) = to;
+}
+
+// backwards, so an instruction only moves once everything reading it did
+static void sink_instructions(cs_Lowering* l, cs_FunctionBody* fb)
+{
+    cs_FlowGraph* g = &l->flow;
+    cs_Sinking s = { .l = l };
+    s.defs = cs_calloc(l->reg_count + 1, 1);
+    collect_sink_uses(&s, fb);
+    for (u32 b = g->block_count; b-- > 0;) {
+        cs_BasicBlock* bb = g->blocks[b];
+        for (u32 i = bb->instr_count; i-- > 0;) {
+            cs_SSAIns* ins = &bb->instrs[i];
+            if (lowered_in(l, ins, bb) != bb || !is_movable(l, ins->dest) || !is_speculatable(l, ins)) continue;
+            u16 reg = known_reg(l, ins->dest);
+            if (s.defs[reg] != 1) continue;
+            // an induction variable updated in place has another value further down
+            u16 ra = known_reg(l, ins->a_as.var), rb = known_reg(l, ins->b_as.var);
+            if ((ra != CS_REG_NONE && s.defs[ra] > 1) || (rb != CS_REG_NONE && s.defs[rb] > 1)) continue;
+
+            cs_BasicBlock* to = sink_target(&s, bb, reg);
+            if (to == bb) continue;
+            sink(l, ins, to);
+            move_use(&s, ins->a_as.var, bb, to);
+            move_use(&s, ins->b_as.var, bb, to);
+        }
+    }
+    free(s.uses); free(s.start); free(s.defs);
+}
+
+// operands of phis and concatenations have to be computed where they are
+static void pin_vars(cs_Lowering* l, cs_FunctionBody* fb)
+{
+    for (u32 b = 0; b < l->block_count; b++) {
+        cs_BasicBlock* bb = l->blocks[b];
+        if (bb != fb->entry) {
+            for (cs_SSAPhi* p = &bb->phis_head; !ssa_invalid(p->dest); p = p->next) {
+                for (int o = 0; o < p->option_count; o++) {
+                    if (is_var(p->options[o])) *(bool*)cs_hm_seth(&l->pinned, var_key(p->options[o])) = false;
+                }
+            }
+        }
+        find_concats(l, bb);
+        for (u32 i = 0; i < bb->instr_count; i++) {
+            i32 inner = bb->instrs[i].op == CS_ADDV ? concat_inner(bb, i) : -1;
+            if (l->fused[i]) *(bool*)cs_hm_seth(&l->pinned, var_key(bb->instrs[i].dest)) = true;
+            else if (inner >= 0 && l->fused[inner]) *(bool*)cs_hm_seth(&l->pinned, var_key(bb->instrs[i].dest)) = false;
+        }
+    }
+}
+
+
+/* ==== SCALAR REPLACEMENT ==== */
+// a cons cell that is only read by car and cdr of its own function is never built, the loads read the vars it
+// was consed from instead. a cell escapes as soon as anything else can see it: a call, a phi, the return value,
+// setcar and setcdr, another cons or another function. escaping cells are built like before
+
+static void escape(cs_Lowering* l, cs_SSAVar v)
+{
+    if (!is_var(v)) return;
+    u32* cell = cs_hm_geth(&l->cell_of, var_key(v));
+    if (cell != null) l->cells[*cell].escapes = true;
+}
+
+// runs before the types are inferred, so the loads get the types of the fields
+static void find_cells(cs_Lowering* l, cs_FunctionBody* fb)
+{
+    cs_hm_free(&l->cell_of); cs_hm_free(&l->fields);
+    l->cell_of = cs_hm_init(sizeof(u32));
+    l->fields = cs_hm_init(sizeof(cs_SSAVar));
+    l->cell_count = 0;
+
+    // dominators come first, so a copy of a cell is seen after the cell
+    for (u32 b = 0; b < l->block_count; b++) {
+        cs_BasicBlock* bb = l->blocks[b];
+        for (u32 i = 0; i < bb->instr_count; i++) {
+            cs_SSAIns* ins = &bb->instrs[i];
+            if (!is_var(ins->dest)) continue;
+            u32 cell;
+            if (ins->op == CS_CONS) {
+                cell = l->cell_count++;
+                cs_ensure_cap((void**)&l->cells, sizeof(cs_Cell), &l->cell_cap, l->cell_count);
+                l->cells[cell] = (cs_Cell) { ins, false };
+            } else if (ins->op == CS_MOV && cs_hm_geth(&l->cell_of, var_key(ins->a_as.var)) != null) {
+                cell = *(u32*)cs_hm_geth(&l->cell_of, var_key(ins->a_as.var));
+            } else continue;
+            *(u32*)cs_hm_seth(&l->cell_of, var_key(ins->dest)) = cell;
+            if (cs_hm_geth(&l->globals, var_key(ins->dest)) != null) l->cells[cell].escapes = true;
+        }
+    }
+    if (l->cell_count == 0) return;
+
+    for (u32 b = 0; b < l->block_count; b++) {
+        cs_BasicBlock* bb = l->blocks[b];
+        if (bb != fb->entry) {
+            for (cs_SSAPhi* p = &bb->phis_head; !ssa_invalid(p->dest); p = p->next) {
+                for (int o = 0; o < p->option_count; o++) escape(l, p->options[o]);
+            }
+        }
+        for (u32 i = 0; i < bb->instr_count; i++) {
+            cs_SSAIns* ins = &bb->instrs[i];
+            switch (ins->op) {
+                // reading the fields, or copying the cell into another var that is checked itself
+                case CS_GETCAR: case CS_GETCDR: case CS_MOV: break;
+                case CS_CALL: case CS_CALLC: case CS_DYNCALL: {
+                    if (ins->op == CS_DYNCALL) escape(l, ins->a_as.var);
+                    for (int a = 0; a < ins->b_as.args_->count; a++) escape(l, ins->b_as.args_->vars[a]);
+                } break;
+                default: {
+                    if (!cs_ins_uses_vars(ins->op)) break;
+                    escape(l, ins->a_as.var);
+                    escape(l, ins->b_as.var);
+                } break;
+            }
+        }
+        if (!ssa_eq(bb->jump_cond, ssavar_call) && !ssa_eq(bb->jump_cond, ssavar_return)) escape(l, bb->jump_cond);
+    }
+    escape(l, fb->return_val);
+
+    for (u32 b = 0; b < l->block_count; b++) {
+        cs_BasicBlock* bb = l->blocks[b];
+        for (u32 i = 0; i < bb->instr_count; i++) {
+            cs_SSAIns* ins = &bb->instrs[i];
+            if ((ins->op != CS_GETCAR && ins->op != CS_GETCDR) || !is_var(ins->dest)) continue;
+            u32* cell = cs_hm_geth(&l->cell_of, var_key(ins->a_as.var));
+            if (cell == null || l->cells[*cell].escapes) continue;
+            cs_SSAIns* cons = l->cells[*cell].cons;
+            *(cs_SSAVar*)cs_hm_seth(&l->fields, var_key(ins->dest)) = ins->op == CS_GETCAR ? cons->a_as.var : cons->b_as.var;
+        }
+    }
+}
+
+// the cells and their copies aren't lowered, the loads share the register of their field where they can
+static void replace_cells(cs_Lowering* l)
+{
+    if (l->cell_count == 0) return;
+    for (u32 b = 0; b < l->block_count; b++) {
+        cs_BasicBlock* bb = l->blocks[b];
+        for (u32 i = 0; i < bb->instr_count; i++) {
+            cs_SSAIns* ins = &bb->instrs[i];
+            if (!is_var(ins->dest)) continue;
+            u32* cell = cs_hm_geth(&l->cell_of, var_key(ins->dest));
+            if (cell != null && !l->cells[*cell].escapes) {
+                *(cs_BasicBlock**)cs_hm_seth(&l->moved, var_key(ins->dest)) = null;
+                continue;
+            }
+            cs_SSAVar* field = field_of(l, ins);
+            if (field == null) continue;
+            if (is_mergeable(l, ins->dest) && known_reg(l, *field) != CS_REG_NONE && def_block(l, *field) != null) {
+                merge(l, ins->dest, *field);
+            } else {
+                // lowered as a move, which reads the register of the field behind the back of the loop passes
+                *(bool*)cs_hm_seth(&l->merged, var_key(*field)) = true;
+            }
+        }
+    }
+}
+
+// decides where every instruction of the function is lowered, before any of them is
+static void optimize_fn(cs_Lowering* l, cs_FunctionBody* fb)
+{
+    cs_hm_free(&l->moved); cs_hm_free(&l->pinned); cs_hm_free(&l->merged);
+    l->moved = cs_hm_init(sizeof(cs_BasicBlock*));
+    l->merged = cs_hm_init(sizeof(bool));
+    l->pinned = cs_hm_init(sizeof(bool));
+    l->hoist_count = 0; l->sink_count = 0;
+    l->iv_count = 0;
+    cs_Context* c = l->c;
+    cs_StatsMark mark = cs_stats_begin(c);
+    cs_flow_build(l->c, fb, &l->flow);
+    cs_stats_end(c, CS_PHASE_FLOW, mark);
+
+    mark = cs_stats_begin(c);
+    pin_vars(l, fb);
+    cs_stats_end(c, CS_PHASE_PIN, mark);
+    mark = cs_stats_begin(c);
+    number_values(l);
+    cs_stats_end(c, CS_PHASE_GVN, mark);
+    // after the numbering, a field that repeats an earlier value already has the register of that value
+    mark = cs_stats_begin(c);
+    replace_cells(l);
+    cs_stats_end(c, CS_PHASE_CELLS, mark);
+    mark = cs_stats_begin(c);
+    hoist_invariants(l);
+    cs_stats_end(c, CS_PHASE_LICM, mark);
+    mark = cs_stats_begin(c);
+    for (u32 i = 0; i < l->flow.loop_count; i++) {
+        cs_Loop* loop = &l->flow.loops[i];
+        // the additions go on the edge back to the header
+        if (loop->preheader == null || loop->latch == null || !ssa_invalid(loop->latch->jump_cond)) continue;
+        find_induction_vars(l, fb, loop);
+    }
+    cs_stats_end(c, CS_PHASE_IV, mark);
+    mark = cs_stats_begin(c);
+    sink_instructions(l, fb);
+    cs_stats_end(c, CS_PHASE_SINK, mark);
+}
+
+// adds the ssa of the function in l->blocks to the stats
+static void count_ssa(cs_Lowering* l)
+{
+    cs_Stats* stats = l->c->stats;
+    u64 ins_count = 0, phi_count = 0, edge_count = 0;
+    for (u32 b = 0; b < l->block_count; b++) {
+        cs_BasicBlock* bb = l->blocks[b];
+        ins_count += bb->instr_count;
+        for (cs_SSAPhi* p = &bb->phis_head; !ssa_invalid(p->dest); p = p->next) phi_count += 1;
+        for (cs_BasicBlockNode* n = bb->preds_start; n != null; n = n->tail) edge_count += 1;
+    }
+    __atomic_fetch_add(&stats->fn_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->block_count, l->block_count, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->ins_count, ins_count, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->phi_count, phi_count, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->edge_count, edge_count, __ATOMIC_RELAXED);
+}
+
+// lowers fb into l->code, clones get the types of their arguments
+static cs_CodeFn lower_fn(cs_Lowering* l, cs_FunctionBody* fb, cs_Str* title, cs_Clone* clone)
+{
+    cs_Code* code = l->code;
+    cs_StatsMark mark = cs_stats_begin(l->c);
+    collect_blocks(l, fb);
+    if (l->c->stats != null) count_ssa(l);
+    define_vars(l, fb);
+    find_cells(l, fb);
+    cs_stats_end(l->c, CS_PHASE_BLOCKS, mark);
+    mark = cs_stats_begin(l->c);
+    infer_types(l, fb, clone != null ? clone->arg_types : null);
+    cs_stats_end(l->c, CS_PHASE_TYPES, mark);
+    optimize_fn(l, fb);
+
+    mark = cs_stats_begin(l->c);
+    cs_CodeFn out = {
+        .fn_id = fb->fn_id,
+        .title = title != null ? add_str_const(l, title) : ~0u,
+        .arg_count = fb->arg_count,
+        .clone = clone != null,
+        .first_ins = code->ins_count,
+    };
+
+    // load every free variable once
+    add_line(l, l->blocks[0]->line, true);
+    add_block(l, l->blocks[0]);
+    for_each_use(l, fb, preload_free_var);
+
+    l->block_start = cs_realloc(l->block_start, sizeof(u32) * (l->block_count + 1));
+    u32 fixup_start = code->ins_count;
+    for (u32 b = 0; b < l->block_count; b++) {
+        cs_BasicBlock* bb = l->blocks[b];
+        l->block_start[b] = code->ins_count;
+        l->cur_block = bb;
+        add_line(l, bb->line, false);
+        add_block(l, bb);
+
+        for (cs_SSAPhi* p = &bb->phis_head; !ssa_invalid(p->dest); p = p->next) {
+            store_if_global(l, p->dest);
+        }
+        // sunk from the blocks dominating this one, the ones sunk last come first
+        for (u32 h = l->sink_count; h-- > 0;) {
+            cs_Hoist entry = l->sinks[h];
+            if (entry.to == bb && lowered_in(l, entry.ins, null) == bb) lower_ins(l, entry.ins);
+        }
+        find_concats(l, bb);
+        for (u32 i = 0; i < bb->instr_count; i++) {
+            if (l->fused[i] || lowered_in(l, &bb->instrs[i], bb) != bb) continue;
+            i32 inner = bb->instrs[i].op == CS_ADDV ? concat_inner(bb, i) : -1;
+            if (inner >= 0 && l->fused[inner]) lower_concat(l, bb, i);
+            else lower_ins(l, &bb->instrs[i]);
+        }
+        for (u32 h = 0; h < l->hoist_count; h++) {
+            cs_Hoist entry = l->hoists[h];
+            if (entry.to == bb && lowered_in(l, entry.ins, null) == bb) lower_ins(l, entry.ins);
+        }
+
+        cs_BasicBlock* succs[2];
+        u32 succ_count = cs_bb_successors(bb, succs);
+        for (u32 s = 0; s < succ_count; s++) {
+            if (!ssa_invalid(succs[s]->phis_head.dest) && succs[s] != fb->entry) emit_phi_moves(l, bb, succs[s]);
+            emit_loop_edge(l, bb, succs[s]);
+        }
+
+        bool ret = ssa_eq(bb->jump_cond, ssavar_return) || succ_count == 0;
+        bool jmp = !ret && (ssa_eq(bb->jump_cond, ssavar_call) || ssa_invalid(bb->jump_cond));
+        if (l->c->counts != null) {
+            u16 cond = ret || jmp ? CS_REG_NONE : reg_of(l, bb->jump_cond);
+            emit_ins(l, CS_COUNT_BLOCK, CS_REG_NONE, cond, CS_REG_NONE)->aux = bb->id;
+        }
+
+        // jump targets hold block indices until every block has been placed
+        if (ret) {
+            u16 result = bb == fb->return_bb || fb->return_bb == null ? reg_of(l, fb->return_val) : CS_REG_NONE;
+            emit_ins(l, CS_RET, CS_REG_NONE, result, 0);
+        } else if (jmp) {
+            // the next block doesn't need a jump
+            u32 target = l->block_index[succs[0]->id] - 1;
+            if (target != b + 1) emit_ins(l, CS_JMP, CS_REG_NONE, 0, 0)->aux = target;
+        } else {
+            cs_CodeIns* br = emit_ins(l, CS_BR, CS_REG_NONE, reg_of(l, bb->jump_cond), 0);
+            br->aux = l->block_index[bb->a->id] - 1;
+            br->aux2 = l->block_index[bb->b->id] - 1;
+        }
+    }
+    for (u32 i = fixup_start; i < code->ins_count; i++) {
+        cs_CodeIns* ins = &code->ins[i];
+        if (ins->op == CS_JMP) ins->aux = l->block_start[ins->aux];
+        else if (ins->op == CS_BR) {
+            ins->aux = l->block_start[ins->aux];
+            ins->aux2 = l->block_start[ins->aux2];
+        }
+    }
+    for (u32 b = 0; b < l->block_count; b++) l->block_index[l->blocks[b]->id] = 0;
+
+    out.ins_count = code->ins_count - out.first_ins;
+    out.reg_count = l->reg_count;
+    cs_stats_end(l->c, CS_PHASE_CODEGEN, mark);
+    return out;
+}
+
+static void lowering_init(cs_Lowering* l, cs_Context* c)
+{
+    *l = (cs_Lowering) {0};
+    l->c = c;
+    l->const_map = cs_hm_init(sizeof(u32));
+    l->globals = cs_hm_init(sizeof(u32));
+    l->regs = cs_hm_init(sizeof(u16));
+    l->def_blocks = cs_hm_init(sizeof(cs_BasicBlock*));
+    l->types = cs_hm_init(sizeof(u8));
+    l->clone_map = cs_hm_init(sizeof(u32));
+    l->clones_of = cs_hm_init(sizeof(u32));
+    l->moved = cs_hm_init(sizeof(cs_BasicBlock*));
+    l->pinned = cs_hm_init(sizeof(bool));
+    l->merged = cs_hm_init(sizeof(bool));
+    l->cell_of = cs_hm_init(sizeof(u32));
+    l->fields = cs_hm_init(sizeof(cs_SSAVar));
+    l->block_index = cs_calloc(c->cur_bb_id + 1, sizeof(u32));
+    l->mark = cs_calloc(c->cur_bb_id + 1, sizeof(u32));
+}
+
+static void lowering_free(cs_Lowering* l)
+{
+    cs_hm_free(&l->const_map); cs_hm_free(&l->globals);
+    cs_hm_free(&l->regs); cs_hm_free(&l->def_blocks); cs_hm_free(&l->types);
+    cs_hm_free(&l->clone_map); cs_hm_free(&l->clones_of);
+    cs_hm_free(&l->moved); cs_hm_free(&l->pinned); cs_hm_free(&l->merged); cs_hm_free(&l->cell_of); cs_hm_free(&l->fields); cs_flow_free(&l->flow);
+    free(l->hoists); free(l->sinks); free(l->cells); free(l->ivs);
+    free(l->blocks); free(l->block_index); free(l->block_start); free(l->mark); free(l->fused); free(l->clones);
+}
+
+/* ==== PARALLEL LOWERING ==== */
+// lowering a function only reads the ssa, so the functions are spread over threads. each one is lowered into
+// a cs_Code of its own, which is appended to the real one afterwards in the same order lowering them one after
+// another would have. the clones that calls ask for are only created then, and lowered in the next round
+
+typedef struct {
+    cs_Lowering* main;  // only its globals are read
+    cs_LoweredFn* jobs; u32 job_count;
+    u32 next;
+    u64 alloc_count;    // of the threads, added to the context once they are done
+} cs_LowerPool;
+
+static void lower_jobs(void* arg)
+{
+    cs_LowerPool* pool = arg;
+    u64 allocs = 0;
+    u64* counter = cs_count_allocs(&allocs);
+    cs_Lowering l;
+    lowering_init(&l, pool->main->c);
+    cs_hm_free(&l.globals);
+    l.globals = pool->main->globals;
+    while (true) {
+        u32 i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (i >= pool->job_count) break;
+        cs_LoweredFn* job = &pool->jobs[i];
+        l.job = job;
+        l.code = &job->code;
+        l.const_cap = 0; l.ins_cap = 0; l.arg_cap = 0; l.str_cap = 0; l.line_cap = 0; l.code_block_cap = 0;
+        cs_hm_free(&l.const_map);
+        l.const_map = cs_hm_init(sizeof(u32));
+        job->out = lower_fn(&l, job->fb, job->title, job->is_clone ? &job->clone : null);
+    }
+    l.globals = cs_hm_init(sizeof(u32));
+    lowering_free(&l);
+    cs_count_allocs(counter);
+    __atomic_fetch_add(&pool->alloc_count, allocs, __ATOMIC_RELAXED);
+}
+
+// the calling thread lowers functions too
+static void lower_parallel(cs_Lowering* l, cs_LoweredFn* jobs, u32 job_count)
+{
+    cs_LowerPool pool = { .main = l, .jobs = jobs, .job_count = job_count };
+    u32 thread_count = l->c->jobs != 0 ? l->c->jobs : cs_core_count();
+    if (thread_count > job_count) thread_count = job_count;
+    if (thread_count > 64) thread_count = 64;
+    cs_Thread threads[64];
+    u32 started = 0;
+    for (; started + 1 < thread_count; started++) {
+        if (!cs_thread_start(&threads[started], lower_jobs, &pool)) break;
+    }
+    lower_jobs(&pool);
+    for (u32 i = 0; i < started; i++) cs_thread_join(threads[i]);
+    l->c->alloc_count += pool.alloc_count;
+}
+
+// moves the code of job to the end of l->code, renumbering what refers into its own sections
+static void append_lowered(cs_Lowering* l, cs_LoweredFn* job)
+{
+    cs_Code* code = l->code;
+    cs_Code* part = &job->code;
+    u32* consts = cs_malloc(sizeof(u32) * (part->const_count + 1));
+    u32* clones = cs_malloc(sizeof(u32) * (job->request_count + 1));
+    for (u32 i = 0; i < part->const_count; i++) {
+        cs_CodeConst k = part->consts[i];
+        consts[i] = k.type == CS_ATOM_STR ? add_str_const(l, k.str_) : add_const(l, k, fnv1a((char*)&k, (char*)(&k + 1)));
+    }
+    for (u32 i = 0; i < job->request_count; i++) clones[i] = resolve_clone(l, &job->requests[i]);
+
+    u32 ins_base = code->ins_count;
+    u32 arg_base = code->arg_count;
+    code->arg_count += part->arg_count;
+    cs_ensure_cap((void**)&code->args, sizeof(u16), &l->arg_cap, code->arg_count);
+    if (part->arg_count > 0) memcpy(&code->args[arg_base], part->args, sizeof(u16) * part->arg_count);
+    u32 cache_base = code->cache_count;
+    code->cache_count += part->cache_count;
+
+    for (u32 i = 0; i < part->ins_count; i++) {
+        cs_CodeIns* ins = emit_ins(l, CS_LOADNIL, 0, 0, 0);
+        *ins = part->ins[i];
+        switch (ins->op) {
+            case CS_LOADI: case CS_LOADF: case CS_LOADS: case CS_LOADK: case CS_LOADSYM:
+                ins->aux = consts[ins->aux];
+                break;
+            case CS_JMP: ins->aux += ins_base; break;
+            case CS_BR: ins->aux += ins_base; ins->aux2 += ins_base; break;
+            case CS_CALL: {
+                if (ins->aux & CLONE_PENDING) ins->aux = clones[ins->aux & ~CLONE_PENDING];
+                ins->aux2 += arg_base;
+            } break;
+            case CS_DYNCALL: ins->aux += cache_base; ins->aux2 += arg_base; break;
+            case CS_CALLC: case CS_CONCAT: ins->aux2 += arg_base; break;
+        }
+    }
+
+    u32 line_base = code->line_count;
+    code->line_count += part->line_count;
+    cs_ensure_cap((void**)&code->lines, sizeof(cs_CodeLine), &l->line_cap, code->line_count);
+    for (u32 i = 0; i < part->line_count; i++) {
+        code->lines[line_base + i] = (cs_CodeLine) { .ins = part->lines[i].ins + ins_base, .line = part->lines[i].line };
+    }
+    u32 block_base = code->block_count;
+    code->block_count += part->block_count;
+    cs_ensure_cap((void**)&code->blocks, sizeof(cs_CodeBlock), &l->code_block_cap, code->block_count);
+    for (u32 i = 0; i < part->block_count; i++) {
+        code->blocks[block_base + i] = (cs_CodeBlock) { .ins = part->blocks[i].ins + ins_base, .block = part->blocks[i].block };
+    }
+
+    cs_CodeFn out = job->out;
+    out.first_ins += ins_base;
+    if (out.title != ~0u) out.title = consts[out.title];
+    code->fns[job->code_id] = out;
+
+    free(consts); free(clones);
+    free(part->consts); free(part->ins); free(part->args); free(part->strs); free(part->lines); free(part->blocks);
+    free(job->requests);
+}
+
+// lowers the functions from first_fn_id on and appends them to code
+static void lower_into(cs_Context* c, cs_Code* code, u32 first_fn_id, u32 entry_fn_id)
+{
+    u64* counter = cs_count_allocs(&c->alloc_count);
+    cs_StatsMark lower_mark = cs_stats_begin(c);
+    cs_StatsMark mark = lower_mark;
+    // loops entered by a branch get a block of their own in front, for the code moved out of them
+    for (u32 id = first_fn_id; id < c->cur_fn_id; id++) {
+        cs_Function* fn = cs_get_fn(c, id);
+        for (int v = 0; v < fn->variant_count; v++) {
+            cs_FunctionBody* fb = &fn->variants[v];
+            if (fb->arg_count < 0 || fb->entry == null) continue;
+            cs_insert_preheaders(c, fb);
+        }
+    }
+    cs_stats_end(c, CS_PHASE_PREHEADERS, mark);
+    cs_Lowering l;
+    lowering_init(&l, c);
+    l.code = code;
+    l.const_cap = code->const_cap; l.fn_cap = code->fn_cap; l.ins_cap = code->ins_cap;
+    l.arg_cap = code->arg_cap; l.line_cap = code->line_cap; l.code_block_cap = code->block_cap;
+    u32 first_code_fn = code->fn_count;
+    if (code->strs != null) {
+        // values can point to the strings of what was appended before, so they stay where they are
+        code->old_str_count += 1;
+        code->old_strs = cs_realloc(code->old_strs, sizeof(u8*) * code->old_str_count);
+        code->old_strs[code->old_str_count-1] = code->strs;
+        code->strs = null;
+        code->str_size = 0;
+    }
+    l.first_const = code->const_count;
+    // the repl appends each input to the same code. globals keep their index so their values stay valid
+    bool repl = c->repl_globals.data != null;
+    if (repl) {
+        cs_hm_free(&l.globals);
+        l.globals = c->repl_globals;
+        code->global_count = c->repl_global_count;
+    }
+
+    // number the variants first, so calls can reference functions that are lowered later
+    cs_LoweredFn* jobs = null; u32 job_count = 0, job_cap = 0;
+    for (u32 id = first_fn_id; id < c->cur_fn_id; id++) {
+        cs_Function* fn = cs_get_fn(c, id);
+        for (int v = 0; v < fn->variant_count; v++) {
+            cs_FunctionBody* fb = &fn->variants[v];
+            if (fb->arg_count < 0 || fb->entry == null) continue;
+            fb->code_id = code->fn_count++;
+            if (id == entry_fn_id && v == 0) code->entry_fn = fb->code_id;
+            job_count += 1;
+            cs_ensure_cap((void**)&jobs, sizeof(cs_LoweredFn), &job_cap, job_count);
+            jobs[job_count-1] = (cs_LoweredFn) { .fb = fb, .title = fn->title, .code_id = fb->code_id };
+        }
+    }
+    cs_ensure_cap((void**)&code->fns, sizeof(cs_CodeFn), &l.fn_cap, code->fn_count);
+    memset(&code->fns[first_code_fn], 0, sizeof(cs_CodeFn) * (code->fn_count - first_code_fn));
+
+    // variables that are used outside of the function they were defined in become globals
+    mark = cs_stats_begin(c);
+    for (u32 i = 0; i < job_count; i++) {
+        collect_blocks(&l, jobs[i].fb);
+        define_vars(&l, jobs[i].fb);
+        for_each_use(&l, jobs[i].fb, mark_global_if_free);
+        for (u32 b = 0; b < l.block_count; b++) l.block_index[l.blocks[b]->id] = 0;
+    }
+    cs_stats_end(c, CS_PHASE_GLOBALS, mark);
+    if (repl) {
+        c->repl_globals = l.globals;
+        c->repl_global_count = code->global_count;
+    }
+
+    // clones can ask for more clones
+    u32 clones_done = 0;
+    while (job_count > 0) {
+        lower_parallel(&l, jobs, job_count);
+        mark = cs_stats_begin(c);
+        for (u32 i = 0; i < job_count; i++) append_lowered(&l, &jobs[i]);
+        cs_stats_end(c, CS_PHASE_LINK, mark);
+        job_count = 0;
+        for (; clones_done < l.clone_count; clones_done++) {
+            cs_Clone clone = l.clones[clones_done];
+            job_count += 1;
+            cs_ensure_cap((void**)&jobs, sizeof(cs_LoweredFn), &job_cap, job_count);
+            jobs[job_count-1] = (cs_LoweredFn) {
+                .fb = clone.fb, .title = cs_get_fn(c, clone.fb->fn_id)->title,
+                .clone = clone, .is_clone = true, .code_id = clone.code_id,
+            };
+        }
+    }
+
+    free(jobs);
+    code->const_cap = l.const_cap; code->fn_cap = l.fn_cap; code->ins_cap = l.ins_cap;
+    code->arg_cap = l.arg_cap; code->line_cap = l.line_cap; code->block_cap = l.code_block_cap;
+    if (repl) l.globals = cs_hm_init(sizeof(u32));
+    lowering_free(&l);
+    mark = cs_stats_begin(c);
+    cs_code_insert_rc(code, c->memory, first_code_fn);
+    cs_stats_end(c, CS_PHASE_RC, mark);
+    cs_stats_end(c, CS_PHASE_LOWER, lower_mark);
+    if (c->counts != null) {
+        code->flags |= CS_CODE_COUNTED;
+        cs_counts_reserve(c->counts, c->cur_bb_id);
+    }
+    if (c->stats != null) {
+        c->stats->code_fn_count = code->fn_count;
+        c->stats->code_ins_count = code->ins_count;
+    }
+    cs_count_allocs(counter);
+}
+
+// flattens the ssa of every function into a cs_Code
+cs_Code* cs_lower(cs_Context* c, u32 entry_fn_id)
+{
+    cs_Code* code = cs_calloc(1, sizeof(cs_Code));
+    lower_into(c, code, 0, entry_fn_id);
+    return code;
+}
+
+// the old definition's code stays, but the calls of the code before first_ins now go to the new one.
+// repl_redefined can chain, when a form defines a function more than once
+static void repoint_redefined(cs_Context* c, cs_Code* code, u32 first_ins)
+{
+    for (u32 i = 0; i < first_ins; i++) {
+        cs_CodeIns* ins = &code->ins[i];
+        if (ins->op != CS_CALL) continue;
+        u32 fn_id = code->fns[ins->aux].fn_id;
+        i8 arg_count = code->fns[ins->aux].arg_count;
+        for (u32 r = 0; r < c->repl_redefined_count; r += 2) {
+            if (c->repl_redefined[r] != fn_id) continue;
+            cs_FunctionBody* fb = cs_fn_get_variant(cs_get_fn(c, c->repl_redefined[r+1]), arg_count);
+            if (fb == null || fb->arg_count < 0 || fb->entry == null) continue;
+            ins->aux = fb->code_id;
+            fn_id = fb->fn_id;
+        }
+    }
+    c->repl_redefined_count = 0;
+}
+
+// appends the functions compiled since the last input to the code of the repl, so only they are lowered
+void cs_repl_lower(cs_Context* c, u32 entry_fn_id)
+{
+    if (c->repl_code == null) c->repl_code = cs_calloc(1, sizeof(cs_Code));
+    cs_Code* code = c->repl_code;
+    u32 first_ins = code->ins_count;
+    lower_into(c, code, c->repl_lowered_fns, entry_fn_id);
+    c->repl_lowered_fns = c->cur_fn_id;
+    if (c->repl_redefined_count > 0) repoint_redefined(c, code, first_ins);
+}
+
+// the binding of a redefined function keeps the global of the old one, so the code that reads it gets the new one
+void cs_repl_share_global(cs_Context* c, cs_SSAVar v, cs_SSAVar old)
+{
+    u32* global = cs_hm_geth(&c->repl_globals, var_key(old));
+    if (global != null) *(u32*)cs_hm_seth(&c->repl_globals, var_key(v)) = *global;
+}
+
+// v gets a global in every later lowering of the repl, so the form defining it stores it for the forms after it
+void cs_repl_keep_global(cs_Context* c, cs_SSAVar v)
+{
+    u32 key = var_key(v);
+    if (cs_hm_geth(&c->repl_globals, key) != null) return;
+    *(u32*)cs_hm_seth(&c->repl_globals, key) = c->repl_global_count++;
+}
+
+void cs_code_free(cs_Code* code)
+{
+    if (code == null) return;
+    if (code->mapping != null) {
+#ifdef _WIN32
+        UnmapViewOfFile(code->mapping);
+#else
+        munmap(code->mapping, code->mapping_size);
+#endif
+    } else {
+        free(code->consts); free(code->fns); free(code->ins);
+        free(code->args); free(code->strs); free(code->lines); free(code->blocks);
+        for (u32 i = 0; i < code->old_str_count; i++) free(code->old_strs[i]);
+        free(code->old_strs);
+    }
+    free(code);
+}
+
+// the source line of the instruction at index ins, 0 if it isn't known
+u32 cs_code_line(cs_Code* code, u32 ins)
+{
+    u32 lo = 0, hi = code->line_count;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        if (code->lines[mid].ins <= ins) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo > 0 ? code->lines[lo-1].line : 0;
+}
+
+// the id of the basic block the instruction at index ins was lowered from, ~0 if it isn't known
+u32 cs_code_block(cs_Code* code, u32 ins)
+{
+    u32 lo = 0, hi = code->block_count;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        if (code->blocks[mid].ins <= ins) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo > 0 ? code->blocks[lo-1].block : ~0u;
+}
+
+/* ==== .cispc FILES ==== */
+// file.cisp => file.cispc
+char* cs_code_path(char* source_path)
+{
+    u32 len = strlen(source_path);
+    char* result = cs_malloc(len + 7);
+    memcpy(result, source_path, len + 1);
+    if (len >= 5 && strcmp(source_path + len - 5, ".cisp") == 0) {
+        strcat(result, "c");
+    } else {
+        strcat(result, ".cispc");
+    }
+    return result;
+}
+
+// fnv-1a continued from hash over data, so the sections can be checksummed one after another
+static u32 checksum(u32 hash, void* data, u64 size)
+{
+    u8* cur = data;
+    for (u64 i = 0; i < size; i++) hash = (hash ^ cur[i]) * 16777619;
+    return hash;
+}
+
+static void write_section(FILE* f, void* data, u32 size, u32* offset, u32* sum)
+{
+    long pos = ftell(f);
+    long aligned = align_up(pos, CODE_ALIGN);
+    while (pos < aligned) { fputc(0, f); pos++; }
+    *offset = (u32)pos;
+    if (size > 0) fwrite(data, 1, size, f);
+    *sum = checksum(*sum, data, size);
+}
+
+// written next to the cache and renamed over it, so a crash or another process never sees half of it
+static char* temp_path(char* path)
+{
+#ifdef _WIN32
+    u32 pid = GetCurrentProcessId();
+#else
+    u32 pid = getpid();
+#endif
+    u32 len = strlen(path) + 16;
+    char* result = cs_malloc(len);
+    snprintf(result, len, "%s.%u.tmp", path, pid);
+    return result;
+}
+
+static bool replace_file(char* from, char* to)
+{
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+bool cs_code_write(cs_Code* code, char* path)
+{
+    char* tmp = temp_path(path);
+    FILE* f = fopen(tmp, "wb");
+    if (f == null) {
+        free(tmp);
+        return false;
+    }
+
+    cs_CodeHeader header = {
+        .magic = CS_CODE_MAGIC,
+        .format_version = CS_CODE_FORMAT_VERSION,
+        .compiler_version = CS_COMPILER_VERSION,
+        .source_hash = code->source_hash, .source_len = code->source_len,
+        .const_count = code->const_count,
+        .fn_count = code->fn_count,
+        .ins_count = code->ins_count,
+        .arg_count = code->arg_count,
+        .str_size = code->str_size,
+        .line_count = code->line_count,
+        .block_count = code->block_count,
+        .global_count = code->global_count,
+        .cache_count = code->cache_count,
+        .entry_fn = code->entry_fn,
+        .flags = code->flags,
+        .checksum = 2166136261,
+    };
+    fwrite(&header, sizeof(header), 1, f);
+
+    // string pointers are stored as offsets into the string section
+    cs_CodeConst* consts = cs_malloc(sizeof(cs_CodeConst) * code->const_count + 1);
+    memcpy(consts, code->consts, sizeof(cs_CodeConst) * code->const_count);
+    for (u32 i = 0; i < code->const_count; i++) {
+        if (consts[i].type == CS_ATOM_STR) consts[i].offset = (u64)consts[i].str_ - (u64)code->strs;
+    }
+    write_section(f, consts, sizeof(cs_CodeConst) * code->const_count, &header.const_offset, &header.checksum);
+    free(consts);
+    write_section(f, code->fns, sizeof(cs_CodeFn) * code->fn_count, &header.fn_offset, &header.checksum);
+    write_section(f, code->ins, sizeof(cs_CodeIns) * code->ins_count, &header.ins_offset, &header.checksum);
+    write_section(f, code->args, sizeof(u16) * code->arg_count, &header.arg_offset, &header.checksum);
+    write_section(f, code->strs, code->str_size, &header.str_offset, &header.checksum);
+    write_section(f, code->lines, sizeof(cs_CodeLine) * code->line_count, &header.line_offset, &header.checksum);
+    write_section(f, code->blocks, sizeof(cs_CodeBlock) * code->block_count, &header.block_offset, &header.checksum);
+
+    // now that the offsets are known
+    fseek(f, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, f);
+    bool ok = ferror(f) == 0;
+    ok = fclose(f) == 0 && ok;
+    ok = ok && replace_file(tmp, path);
+    if (!ok) remove(tmp);
+    free(tmp);
+    return ok;
+}
+
+// maps a file copy-on-write, so it can be relocated in place without touching the file
+static void* map_file(char* path, u64* size)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, null, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, null);
+    if (file == INVALID_HANDLE_VALUE) return null;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return null;
+    }
+    HANDLE mapping = CreateFileMappingA(file, null, PAGE_WRITECOPY, 0, 0, null);
+    CloseHandle(file);
+    if (mapping == null) return null;
+    void* result = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+    *size = file_size.QuadPart;
+    return result;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return null;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return null;
+    }
+    void* result = mmap(null, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (result == MAP_FAILED) return null;
+    *size = st.st_size;
+    return result;
+#endif
+}
+
+static bool section_ok(u64 file_size, u32 offset, u64 size)
+{
+    return (u64)offset + size <= file_size && offset % CODE_ALIGN == 0;
+}
+
+static bool sections_checksum_ok(u8* base, cs_CodeHeader* h)
+{
+    u32 sum = 2166136261;
+    sum = checksum(sum, base + h->const_offset, (u64)sizeof(cs_CodeConst) * h->const_count);
+    sum = checksum(sum, base + h->fn_offset, (u64)sizeof(cs_CodeFn) * h->fn_count);
+    sum = checksum(sum, base + h->ins_offset, (u64)sizeof(cs_CodeIns) * h->ins_count);
+    sum = checksum(sum, base + h->arg_offset, (u64)sizeof(u16) * h->arg_count);
+    sum = checksum(sum, base + h->str_offset, h->str_size);
+    sum = checksum(sum, base + h->line_offset, (u64)sizeof(cs_CodeLine) * h->line_count);
+    sum = checksum(sum, base + h->block_offset, (u64)sizeof(cs_CodeBlock) * h->block_count);
+    return sum == h->checksum;
+}
+
+static bool call_args_ok(cs_Code* code, cs_CodeFn* fn, cs_CodeIns* ins)
+{
+    if (ins->a > FUNCTION_MAX_ARGS || (u64)ins->aux2 + ins->a > code->arg_count) return false;
+    for (u32 i = 0; i < ins->a; i++) {
+        if (code->args[ins->aux2 + i] >= fn->reg_count) return false;
+    }
+    return true;
+}
+
+// false if ins reads or writes outside of the registers of fn and the sections of code, or jumps out of fn
+static bool ins_ok(cs_Code* code, cs_CodeFn* fn, cs_CodeIns* ins)
+{
+    u16 regs = fn->reg_count;
+    u32 end = fn->first_ins + fn->ins_count;
+    switch (ins->op) {
+        case CS_LOADTRUE: case CS_LOADFALSE: case CS_LOADNIL: case CS_LOADFUN:
+            return ins->dest < regs;
+        case CS_LOADI: case CS_LOADF: case CS_LOADK: case CS_LOADSYM:
+            return ins->dest < regs && ins->aux < code->const_count;
+        case CS_LOADS:
+            return ins->dest < regs && ins->aux < code->const_count && code->consts[ins->aux].type == CS_ATOM_STR;
+        case CS_MOV: case CS_NOT: case CS_GETCAR: case CS_GETCDR:
+            return ins->dest < regs && ins->a < regs;
+        case CS_CONS: case CS_SETCAR: case CS_SETCDR:
+            return ins->dest < regs && ins->a < regs && ins->b < regs;
+        case CS_GETGLOBAL:
+            return ins->dest < regs && (ins->aux < code->global_count || ins->aux == ~0u);
+        case CS_SETGLOBAL:
+            return ins->a < regs && ins->aux < code->global_count;
+        case CS_REF_RETAIN: case CS_REF_RELEASE:
+            return ins->a < regs;
+        case CS_CONCAT: case CS_CALLC:
+            return ins->dest < regs && call_args_ok(code, fn, ins);
+        case CS_CALL:
+            return (ins->dest < regs || ins->dest == CS_REG_NONE) && ins->aux < code->fn_count
+                && ins->a <= code->fns[ins->aux].reg_count && call_args_ok(code, fn, ins);
+        case CS_DYNCALL:
+            return ins->dest < regs && ins->b < regs && ins->aux < code->cache_count && call_args_ok(code, fn, ins);
+        case CS_JMP:
+            return ins->aux >= fn->first_ins && ins->aux < end;
+        case CS_BR:
+            return ins->a < regs && ins->aux >= fn->first_ins && ins->aux < end && ins->aux2 >= fn->first_ins && ins->aux2 < end;
+        case CS_RET: case CS_COUNT_BLOCK:
+            return ins->a < regs || ins->a == CS_REG_NONE;
+        default:
+            // the arithmetic and comparisons
+            return ins->op >= CS_ADDI && ins->op <= CS_EQVF && ins->dest < regs && ins->a < regs && ins->b < regs;
+    }
+}
+
+// checks everything the vm indexes with without checking it itself
+static bool code_ok(cs_Code* code)
+{
+    for (u32 i = 0; i < code->const_count; i++) {
+        cs_CodeConst* k = &code->consts[i];
+        if (k->type != CS_ATOM_STR) continue;
+        if (k->offset % CODE_ALIGN != 0 || k->offset + sizeof(cs_Str) > code->str_size) return false;
+        cs_Str* str = (cs_Str*)(code->strs + k->offset);
+        if (k->offset + sizeof(cs_Str) + str->size + 1 > code->str_size || str->data[str->size] != 0) return false;
+    }
+    for (u32 f = 0; f < code->fn_count; f++) {
+        cs_CodeFn* fn = &code->fns[f];
+        if (fn->ins_count == 0 || (u64)fn->first_ins + fn->ins_count > code->ins_count) return false;
+        if (fn->arg_count < 0 || fn->arg_count > fn->reg_count) return false;
+        if (fn->title != ~0u && (fn->title >= code->const_count || code->consts[fn->title].type != CS_ATOM_STR)) return false;
+        for (u32 i = fn->first_ins; i < fn->first_ins + fn->ins_count; i++) {
+            if (!ins_ok(code, fn, &code->ins[i])) return false;
+        }
+        // running off the end would continue in the next function
+        u16 last = code->ins[fn->first_ins + fn->ins_count - 1].op;
+        if (last != CS_RET && last != CS_JMP && last != CS_BR) return false;
+    }
+    return true;
+}
+
+// loads the code cached for source, returns null if there is none, if it is outdated or broken
+cs_Code* cs_code_load(char* path, char* source, u32 source_len)
+{
+    u64 size = 0;
+    u8* base = map_file(path, &size);
+    if (base == null) return null;
+
+    cs_CodeHeader* h = (cs_CodeHeader*)base;
+    bool valid = size >= sizeof(cs_CodeHeader)
+        && h->magic == CS_CODE_MAGIC
+        && h->format_version == CS_CODE_FORMAT_VERSION
+        && h->compiler_version == CS_COMPILER_VERSION
+        && h->source_len == source_len
+        && h->source_hash == fnv1a(source, source + source_len);
+    valid = valid
+        && section_ok(size, h->const_offset, (u64)sizeof(cs_CodeConst) * h->const_count)
+        && section_ok(size, h->fn_offset, (u64)sizeof(cs_CodeFn) * h->fn_count)
+        && section_ok(size, h->ins_offset, (u64)sizeof(cs_CodeIns) * h->ins_count)
+        && section_ok(size, h->arg_offset, (u64)sizeof(u16) * h->arg_count)
+        && section_ok(size, h->str_offset, h->str_size)
+        && section_ok(size, h->line_offset, (u64)sizeof(cs_CodeLine) * h->line_count)
+        && section_ok(size, h->block_offset, (u64)sizeof(cs_CodeBlock) * h->block_count)
+        && h->entry_fn < h->fn_count
+        && sections_checksum_ok(base, h);
+    if (!valid) {
+#ifdef _WIN32
+        UnmapViewOfFile(base);
+#else
+        munmap(base, size);
+#endif
+        return null;
+    }
+
+    cs_Code* code = cs_calloc(1, sizeof(cs_Code));
+    code->mapping = base; code->mapping_size = size;
+    code->consts = (cs_CodeConst*)(base + h->const_offset); code->const_count = h->const_count;
+    code->fns = (cs_CodeFn*)(base + h->fn_offset); code->fn_count = h->fn_count;
+    code->ins = (cs_CodeIns*)(base + h->ins_offset); code->ins_count = h->ins_count;
+    code->args = (u16*)(base + h->arg_offset); code->arg_count = h->arg_count;
+    code->strs = base + h->str_offset; code->str_size = h->str_size;
+    code->lines = (cs_CodeLine*)(base + h->line_offset); code->line_count = h->line_count;
+    code->blocks = (cs_CodeBlock*)(base + h->block_offset); code->block_count = h->block_count;
+    code->global_count = h->global_count;
+    code->cache_count = h->cache_count;
+    code->entry_fn = h->entry_fn;
+    code->flags = h->flags;
+    code->source_hash = h->source_hash; code->source_len = h->source_len;
+
+    if (!code_ok(code)) {
+        cs_code_free(code);
+        return null;
+    }
+    // relocation: string offsets become pointers into the mapping
+    for (u32 i = 0; i < code->const_count; i++) {
+        cs_CodeConst* k = &code->consts[i];
+        if (k->type == CS_ATOM_STR) k->str_ = (cs_Str*)(code->strs + k->offset);
+    }
+    return code;
+}
@@ -17,6 +17,15 @@ typedef unsigned short      u16;
 typedef unsigned int        u32;
 typedef unsigned long long  u64;
 
+// every allocation goes through these. they don't return if there is no memory left and count the allocation
+// into the counter cs_count_allocs gave the calling thread, the one of the context it works for
+void* cs_malloc(u64 size);
+void* cs_calloc(u64 count, u64 size);
+void* cs_realloc(void* ptr, u64 size);
+// the allocations of the calling thread are counted into counter from now on, none if it is null. returns the
+// counter before, which is given back once the thread is done working for the context of counter
+u64* cs_count_allocs(u64* counter);
+
 /* ==== POOL ALLOCATOR ====*/
 #define freelist_next(freelist) (*freelist)
 #define pool_next(start) ((void**)start)[0]
@@ -25,10 +34,12 @@ typedef struct {
     void* mem;
     u32 element_size; // more than 8 (or 4 on 32-bit) bytes
     void** freelist;
+    u32 bucket_count; // a bucket is only added once the others are full, so this is the peak use
 } cs_Pool;
 cs_Pool cs_pool_init(u32 element_size);
 void* cs_pool_alloc(cs_Pool* p);
 void cs_pool_free(cs_Pool* p, void** ptr);
+void cs_pool_clear(cs_Pool* p);
 void cs_pool_release(cs_Pool* p);
 
 /* ==== ARENA ==== */
@@ -40,21 +51,25 @@ typedef struct {
 
 typedef struct {
     cs_ArenaBucket* buckets;
-    u8 buck_count;
+    u32 buck_count;
+    u64 used, peak;  // bytes handed out, for --stats
 } cs_Arena;
 
 cs_Arena arena_init(void);
 void* arena_alloc(cs_Arena* a, u32 size);
+void* arena_get(cs_Arena* a, u32 index, u32 element_size);
 void arena_free_last(cs_Arena* a);
 void arena_clear(cs_Arena* a);
+void arena_free(cs_Arena* a);
 
 /* ==== STR ==== */
 typedef struct {
+    u32 hash; // fnv1a of data, 0 until cs_str_hash needed it
     u32 size;
     u8 data[]; // null terminated string
 } cs_Str;
 
-#define cs_strhead(str) ((cs_Str*) (((u64)(str)) - 4))
+#define cs_strhead(str) ((cs_Str*) (((u64)(str)) - 8))
 #define cstr(str) (char*)(&((str)->data))
 #define strlit(str) cs_make_str(str, sizeof(str))
 
@@ -62,6 +77,7 @@ cs_Str* cs_make_str(char* data, u32 len);
 #define make_str(str) cs_make_str(str, sizeof(str)-1);
 
 cs_Str* cs_str_init(u32 len);
+u32 cs_str_hash(cs_Str* str);
 
 typedef struct {
     u32 len;
@@ -9,7 +9,8 @@
 
 #define null NULL
 
-bool use_color = false;
+// the terminal of the process, only set once by init_console before anything else runs
+static bool use_color = false;
 
 void init_console()
 {   
@@ -0,0 +1,270 @@
+#include "cisp.h"
+#include "console.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_ALIGN(p) (((u64)(p) + CS_CHUNK_SIZE - 1) & ~(u64)(CS_CHUNK_SIZE - 1))
+
+static void gc_push_work(cs_Context* c, cs_Value v)
+{
+    c->gc_work_count += 1;
+    cs_ensure_cap((void**)&c->gc_work, sizeof(cs_Value), &c->gc_work_cap, c->gc_work_count);
+    c->gc_work[c->gc_work_count-1] = v;
+}
+
+// visits every value an object or rope holds
+#define for_each_field(v, field, body) \
+    if (val_is_rope(v)) { \
+        { cs_Value* field = &val_as_rope(v)->left; body } \
+        { cs_Value* field = &val_as_rope(v)->right; body } \
+    } else if (val_is_chunk(v)) { \
+        cs_ListChunk* chunk_ = val_as_chunk(v); \
+        for (u32 i_ = chunk_->front; i_ < CS_CHUNK_SLOTS; i_++) { cs_Value* field = &chunk_->slots[i_]; body } \
+        { cs_Value* field = &chunk_->tail; body } \
+    } else if (!(val_as_obj(v)->flags & CS_OBJ_BOXED_INT)) { \
+        { cs_Value* field = &val_as_obj(v)->car; body } \
+        { cs_Value* field = &val_as_obj(v)->cdr; body } \
+    }
+
+/* ==== NURSERY ==== */
+static void gc_init_nursery(cs_Context* c)
+{
+    u8* mem = cs_malloc(CS_NURSERY_SIZE + CS_CHUNK_SIZE);
+    // aligned for the chunks
+    c->nursery = (u8*)CHUNK_ALIGN(mem);
+    c->nursery_top = c->nursery;
+    c->nursery_end = c->nursery + CS_NURSERY_SIZE;
+    if (c->next_major == 0) c->next_major = CS_GC_MAJOR_MIN;
+}
+
+cs_Object* cs_gc_alloc(cs_Context* c)
+{
+    if (c->nursery == null) gc_init_nursery(c);
+    if (c->nursery_top + sizeof(cs_Object) > c->nursery_end) cs_gc_minor(c);
+    cs_Object* result = (cs_Object*)c->nursery_top;
+    c->nursery_top += sizeof(cs_Object);
+    memset(result, 0, sizeof(cs_Object));
+    return result;
+}
+
+cs_ListChunk* cs_gc_alloc_chunk(cs_Context* c)
+{
+    if (c->nursery == null) gc_init_nursery(c);
+    u8* top = (u8*)CHUNK_ALIGN(c->nursery_top);
+    if (top + CS_CHUNK_SIZE > c->nursery_end) {
+        cs_gc_minor(c);
+        top = c->nursery_top;
+    }
+    c->nursery_top = top + CS_CHUNK_SIZE;
+    return (cs_ListChunk*)top;
+}
+
+// write barrier: an old object that gets a reference into the nursery is remembered,
+// because minor collections don't look at the rest of the old space
+void cs_gc_write(cs_Context* c, cs_Value object, cs_Value v)
+{
+    if (c->memory != CS_MEMORY_GC || !val_is_obj(v) || !cs_in_nursery(c, val_as_ptr(v))) return;
+    if (cs_in_nursery(c, val_as_ptr(object))) return;
+    if (val_is_chunk(object)) {
+        cs_ListChunk* chunk = val_as_chunk(object);
+        if (chunk->flags & CS_OBJ_REMEMBERED) return;
+        chunk->flags |= CS_OBJ_REMEMBERED;
+    } else {
+        cs_Object* obj = val_as_obj(object);
+        if (obj->flags & CS_OBJ_REMEMBERED) return;
+        obj->flags |= CS_OBJ_REMEMBERED;
+    }
+    c->remembered_count += 1;
+    cs_ensure_cap((void**)&c->remembered, sizeof(cs_Value), &c->remembered_cap, c->remembered_count);
+    c->remembered[c->remembered_count-1] = object;
+}
+
+// moves an object out of the nursery, the first visit copies it and leaves the address of the copy behind
+static cs_Value gc_forward(cs_Context* c, cs_Value v)
+{
+    if (!val_is_obj(v) || !cs_in_nursery(c, val_as_ptr(v))) return v;
+    if (val_is_chunk(v)) {
+        cs_ListChunk* chunk = val_as_chunk(v);
+        if (!(chunk->flags & CS_OBJ_FORWARDED)) {
+            cs_ListChunk* copy = cs_chunk_alloc(c);
+            *copy = *chunk;
+            copy->flags = 0;
+            c->old_count += 1;
+            chunk->flags |= CS_OBJ_FORWARDED;
+            chunk->tail = (cs_Value)copy;
+            gc_push_work(c, val_from_chunk(copy, 0));
+        }
+        return val_from_chunk(chunk->tail, val_chunk_slot(v));
+    }
+    cs_Object* obj = val_as_obj(v);
+    if (!(obj->flags & CS_OBJ_FORWARDED)) {
+        cs_Object* copy = cs_pool_alloc(&c->obj_pool);
+        *copy = *obj;
+        copy->flags &= CS_OBJ_BOXED_INT;
+        c->old_count += 1;
+        obj->flags |= CS_OBJ_FORWARDED;
+        obj->car = (cs_Value)copy;
+        gc_push_work(c, val_from_ptr(copy, CS_PTR_LIST));
+    }
+    return val_from_ptr(obj->car, v & CS_PTR_KIND_MASK);
+}
+
+// the values coroutines that don't run now hold on to, c has the registers of the one that does
+#define for_each_co_root(c, root, body) \
+    if ((c)->loop != null) for (u32 co_i = 0; co_i < (c)->loop->co_count; co_i++) { \
+        cs_Coroutine* co = (c)->loop->cos[co_i]; \
+        cs_Value* root; \
+        if (co != (c)->loop->cur && co->state != CS_CO_DONE) \
+            for (u32 co_j = 0; co_j < co->stack_top; co_j++) { root = &co->stack[co_j]; body } \
+        root = &co->fn; body \
+        for (u32 co_j = 0; co_j < co->arg_count; co_j++) { root = &co->args[co_j]; body } \
+        root = &co->result; body \
+    }
+
+// everything that survives is promoted, so the nursery is empty afterwards
+void cs_gc_minor(cs_Context* c)
+{
+    for (u32 i = 0; i < c->stack_top; i++) c->stack[i] = gc_forward(c, c->stack[i]);
+    for (u32 i = 0; i < c->global_count; i++) c->globals[i] = gc_forward(c, c->globals[i]);
+    // the results of futures are unpacked into the nursery, what the tasks read was promoted before
+    for (u32 i = 0; i < c->task_count; i++) c->tasks[i]->value = gc_forward(c, c->tasks[i]->value);
+    for_each_co_root(c, root, *root = gc_forward(c, *root);)
+    for (u32 i = 0; i < c->remembered_count; i++) {
+        cs_Value v = c->remembered[i];
+        if (val_is_chunk(v)) val_as_chunk(v)->flags &= ~CS_OBJ_REMEMBERED;
+        else val_as_obj(v)->flags &= ~CS_OBJ_REMEMBERED;
+        for_each_field(v, field, *field = gc_forward(c, *field);)
+    }
+    c->remembered_count = 0;
+    while (c->gc_work_count > 0) {
+        cs_Value v = c->gc_work[--c->gc_work_count];
+        for_each_field(v, field, *field = gc_forward(c, *field);)
+    }
+    c->nursery_top = c->nursery;
+
+    if (c->old_count >= c->next_major) cs_gc_major(c);
+}
+
+/* ==== OLD SPACE ==== */
+static void gc_mark(cs_Context* c, cs_Value v)
+{
+    if (val_is_future(v)) {
+        cs_Task* task = val_as_task(v);
+        if (task->flags & CS_OBJ_MARKED) return;
+        task->flags |= CS_OBJ_MARKED;
+        v = task->value;
+    }
+    // vectors have no fields to visit
+    if (val_is_vec(v)) val_as_vec(v)->flags |= CS_OBJ_MARKED;
+    if (val_is_rope(v)) {
+        cs_Rope* rope = val_as_rope(v);
+        if (rope->flags & CS_OBJ_MARKED) return;
+        rope->flags |= CS_OBJ_MARKED;
+        // the children are visited from the work list, the chains appending builds are too long to recurse
+        if (rope->left != CS_NIL) gc_push_work(c, v);
+        return;
+    }
+    if (!val_is_obj(v)) return;
+    if (val_is_chunk(v)) {
+        cs_ListChunk* chunk = val_as_chunk(v);
+        if (chunk->flags & CS_OBJ_MARKED) return;
+        chunk->flags |= CS_OBJ_MARKED;
+    } else {
+        cs_Object* obj = val_as_obj(v);
+        if (obj->flags & CS_OBJ_MARKED) return;
+        obj->flags |= CS_OBJ_MARKED;
+    }
+    gc_push_work(c, v);
+}
+
+// only runs right after a minor collection, when every object is in the old space
+void cs_gc_major(cs_Context* c)
+{
+    for (u32 i = 0; i < c->stack_top; i++) gc_mark(c, c->stack[i]);
+    for (u32 i = 0; i < c->global_count; i++) gc_mark(c, c->globals[i]);
+    for_each_co_root(c, root, gc_mark(c, *root);)
+    for (u32 i = 0; i < c->task_count; i++) {
+        cs_Task* task = c->tasks[i];
+        if (__atomic_load_n(&task->state, __ATOMIC_ACQUIRE) == CS_TASK_DONE) continue;
+        // still read by a worker
+        for (u32 j = 0; j < task->arg_count; j++) gc_mark(c, task->args[j]);
+        for (u32 j = 0; j < task->global_count; j++) gc_mark(c, task->globals[j]);
+    }
+    while (c->gc_work_count > 0) {
+        cs_Value v = c->gc_work[--c->gc_work_count];
+        for_each_field(v, field, gc_mark(c, *field);)
+    }
+
+    // cells on the freelist have to be told apart from garbage
+    cs_Pool* pool = &c->obj_pool;
+    for (void** f = pool->freelist; f != null; f = freelist_next(f)) ((cs_Object*)f)->flags = CS_OBJ_FREE;
+    u32 count = (CS_POOL_MEM_SIZE - 8) / pool->element_size;
+    for (void* mem = pool->mem; mem != null; mem = pool_next(mem)) {
+        cs_Object* cell = (cs_Object*)pool_data((char*)mem);
+        for (u32 i = 0; i < count; i++, cell++) {
+            if (cell->flags & CS_OBJ_FREE) continue;
+            if (cell->flags & CS_OBJ_MARKED) {
+                cell->flags &= ~CS_OBJ_MARKED;
+                continue;
+            }
+            cell->flags = CS_OBJ_FREE;
+            cs_pool_free(pool, (void**)cell);
+            c->old_count -= 1;
+        }
+    }
+
+    for (cs_ListChunk* f = c->chunk_freelist; f != null; f = (cs_ListChunk*)f->tail) f->flags = CS_OBJ_FREE;
+    for (void* bucket = c->chunk_buckets; bucket != null; bucket = chunk_bucket_next(bucket)) {
+        cs_ListChunk* chunks = chunk_bucket_data(bucket);
+        for (u32 i = 0; i < CS_CHUNK_BUCKET_COUNT; i++) {
+            cs_ListChunk* chunk = &chunks[i];
+            if (chunk->flags & CS_OBJ_FREE) continue;
+            if (chunk->flags & CS_OBJ_MARKED) {
+                chunk->flags &= ~CS_OBJ_MARKED;
+                continue;
+            }
+            chunk->flags = CS_OBJ_FREE;
+            cs_chunk_free(c, chunk);
+            c->old_count -= 1;
+        }
+    }
+
+    u32 kept = 0;
+    for (u32 i = 0; i < c->vector_count; i++) {
+        cs_Vector* vec = c->vectors[i];
+        if (vec->flags & CS_OBJ_MARKED) {
+            vec->flags &= ~CS_OBJ_MARKED;
+            c->vectors[kept++] = vec;
+            continue;
+        }
+        cs_vec_free(c, vec);
+    }
+    c->vector_count = kept;
+
+    kept = 0;
+    for (u32 i = 0; i < c->text_count; i++) {
+        cs_Rope* rope = c->texts[i];
+        if (rope->flags & CS_OBJ_MARKED) {
+            rope->flags &= ~CS_OBJ_MARKED;
+            c->texts[kept++] = rope;
+            continue;
+        }
+        cs_text_free(c, rope);
+    }
+    c->text_count = kept;
+
+    kept = 0;
+    for (u32 i = 0; i < c->task_count; i++) {
+        cs_Task* task = c->tasks[i];
+        if ((task->flags & CS_OBJ_MARKED) || __atomic_load_n(&task->state, __ATOMIC_ACQUIRE) != CS_TASK_DONE) {
+            task->flags &= ~CS_OBJ_MARKED;
+            c->tasks[kept++] = task;
+            continue;
+        }
+        cs_future_release(c, task);
+    }
+    c->task_count = kept;
+
+    c->next_major = c->old_count * 2;
+    if (c->next_major < CS_GC_MAJOR_MIN) c->next_major = CS_GC_MAJOR_MIN;
+}
@@ -0,0 +1,1057 @@
+#include "cisp.h"
+#include "console.h"
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// text format of the ssa, one statement per line, ';' starts a comment:
+//
+//  fns 2 blocks 4 entry 0
+//  fn 0 "entry"
+//    variant 0 entry b0 return b3 val %4:var calls 1
+//  fn 1 -
+//    variant 1 entry b1 return b2 val %0:var calls 1 args n
+//  b1 "fn_1.entry" preds b0
+//    phi n.0:var = %1:int
+//    %2:var = ADDVI n.0:var 1
+//    br %2:var b2 b3
+//
+// vars are written as name.version:type, temps as %version:type and the invalid var as _.
+// symbols without a known name are written as #hash. blocks are b<id>, functions @<id>.
+// ids are the ones of the context that was dumped, they are offset when loading into a non-empty context.
+// native functions are written as variants without a body. when loading, a function with only those is bound
+// by name to the function of the natives registered in the context, so loading makes no new function for it.
+
+#define WRITER_FLUSH_SIZE (64 * 1024)
+
+/* ==== WRITER ==== */
+cs_Writer cs_writer_init(void* file)
+{
+    cs_Writer result = {0};
+    result.file = file;
+    result.cap = file != null ? WRITER_FLUSH_SIZE : 4096;
+    result.data = cs_malloc(result.cap);
+    return result;
+}
+
+void cs_writer_flush(cs_Writer* w)
+{
+    if (w->file == null || w->len == 0) return;
+    fwrite(w->data, 1, w->len, w->file);
+    w->len = 0;
+}
+
+void cs_writer_free(cs_Writer* w)
+{
+    cs_writer_flush(w);
+    free(w->data);
+    w->data = null;
+    w->len = 0; w->cap = 0;
+}
+
+// makes room for size more bytes. writers into a file flush instead of growing if they can
+static void writer_reserve(cs_Writer* w, u32 size)
+{
+    if (w->len + size <= w->cap) return;
+    if (w->file != null) {
+        cs_writer_flush(w);
+        if (size <= w->cap) return;
+    }
+    while (w->len + size > w->cap) w->cap *= 2;
+    w->data = cs_realloc(w->data, w->cap);
+}
+
+void cs_write(cs_Writer* w, char* data, u32 len)
+{
+    writer_reserve(w, len);
+    memcpy(w->data + w->len, data, len);
+    w->len += len;
+}
+
+void cs_writef(cs_Writer* w, char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    u32 avail = w->cap - w->len;
+    i32 len = vsnprintf(w->data + w->len, avail, fmt, args);
+    va_end(args);
+    if (len < 0) return;
+    if ((u32)len >= avail) {
+        // +1, since vsnprintf always writes the zero terminator
+        writer_reserve(w, len + 1);
+        va_start(args, fmt);
+        vsnprintf(w->data + w->len, w->cap - w->len, fmt, args);
+        va_end(args);
+    }
+    w->len += len;
+}
+
+static void write_char(cs_Writer* w, char c)
+{
+    writer_reserve(w, 1);
+    w->data[w->len++] = c;
+}
+
+static void write_cstr(cs_Writer* w, char* str)
+{
+    cs_write(w, str, strlen(str));
+}
+
+// numbers are written by hand, since they make up most of the output
+static void write_u64(cs_Writer* w, u64 val)
+{
+    char tmp[20];
+    u32 len = 0;
+    do {
+        tmp[len++] = '0' + val % 10;
+        val /= 10;
+    } while (val != 0);
+    writer_reserve(w, len);
+    for (u32 i = 0; i < len; i++) {
+        w->data[w->len++] = tmp[len - 1 - i];
+    }
+}
+
+static void write_i64(cs_Writer* w, i64 val)
+{
+    if (val < 0) {
+        write_char(w, '-');
+        write_u64(w, -(u64)val);
+    } else write_u64(w, val);
+}
+
+/* ==== FORMAT ==== */
+typedef enum {
+    IR_NONE,
+    IR_VAR,
+    IR_INT,
+    IR_FLOAT,
+    IR_STR,
+    IR_HASH,    // symbols and keywords, written by name
+    IR_FN,      // function id
+    IR_CALL,    // a: variant, b: arguments
+    IR_DYNCALL, // a: callee, b: arguments
+} cs_IROperand;
+
+static const char* ir_type_names[CS_TYPECOUNT + 1] = {
+    [_CS_INVALID]    = "inv",
+    [_CS_CALL]       = "call",
+    [_CS_RETURN]     = "ret",
+    [CS_ATOM_INT]    = "int",
+    [CS_ATOM_FLOAT]  = "float",
+    [CS_ATOM_STR]    = "str",
+    [CS_ATOM_TRUE]   = "true",
+    [CS_ATOM_FALSE]  = "false",
+    [CS_ATOM_NIL]    = "nil",
+    [CS_ATOM_VAR]    = "var",
+    [CS_ATOM_SYMBOL] = "sym",
+    [CS_ATOM_KEYWORD]= "kw",
+    [CS_LIST]        = "list",
+    [CS_VECTOR]      = "vec",
+    [CS_FUNC]        = "fn",
+    [CS_ANON_FUNC]   = "anonfn",
+    [CS_CFUNC]       = "cfn",
+    [CS_FUTURE]      = "future",
+    [CS_REG]         = "reg",
+    [CS_BLOCK]       = "block",
+    [CS_TYPECOUNT]   = "any", // type is not known yet
+};
+
+// operand kinds of every op, shared by the dumper and the parser so that both agree on the format
+static void ir_operands(cs_OpKind op, cs_IROperand* a, cs_IROperand* b)
+{
+    *a = IR_NONE; *b = IR_NONE;
+    switch (op) {
+        case CS_SET_LOCAL:
+            *a = IR_INT; *b = IR_INT; break;
+
+        // the typed forms only differ in the types they expect their operands to have
+        case CS_ADDI: case CS_SUBI: case CS_MULI: case CS_DIVI: case CS_MODI:
+        case CS_ANDI: case CS_ORI: case CS_LSHIFTI: case CS_RSHIFTI:
+        case CS_GTI: case CS_LTI: case CS_GEQI: case CS_LEQI: case CS_EQI:
+        case CS_ADDV: case CS_SUBV: case CS_MULV: case CS_DIVV: case CS_MODV:
+        case CS_ANDV: case CS_ORV: case CS_LSHIFTV: case CS_RSHIFTV:
+        case CS_GTV: case CS_LTV: case CS_GEQV: case CS_LEQV: case CS_EQV:
+        case CS_ADDVI: case CS_SUBVI: case CS_MULVI: case CS_DIVVI: case CS_MODVI:
+        case CS_ANDVI: case CS_ORVI: case CS_LSHIFTVI: case CS_RSHIFTVI:
+        case CS_GTVI: case CS_LTVI: case CS_GEQVI: case CS_LEQVI: case CS_EQVI:
+        case CS_ADDF: case CS_SUBF: case CS_MULF: case CS_DIVF:
+        case CS_GTF: case CS_LTF: case CS_GEQF: case CS_LEQF: case CS_EQF:
+        case CS_ADDVF: case CS_SUBVF: case CS_MULVF: case CS_DIVVF:
+        case CS_GTVF: case CS_LTVF: case CS_GEQVF: case CS_LEQVF: case CS_EQVF:
+        case CS_ADDS: case CS_ADDVS:
+        case CS_CONS: case CS_SETCAR: case CS_SETCDR:
+            *a = IR_VAR; *b = IR_VAR; break;
+
+        case CS_NOT: case CS_MOV: case CS_REF_RETAIN: case CS_REF_RELEASE:
+        case CS_GETCAR: case CS_GETCDR:
+            *a = IR_VAR; break;
+
+        case CS_LOADI: case CS_GET_LOCAL: *a = IR_INT; break;
+        case CS_LOADF:   *a = IR_FLOAT; break;
+        case CS_LOADS:   *a = IR_STR; break;
+        case CS_LOADK: case CS_LOADSYM: *a = IR_HASH; break;
+        case CS_LOADFUN: *a = IR_FN; break;
+        case CS_CALL: case CS_CALLC: *a = IR_CALL; break;
+        case CS_DYNCALL: *a = IR_DYNCALL; break;
+        default: break;
+    }
+}
+
+/* ==== DUMP ==== */
+typedef struct {
+    cs_Context* c;
+    cs_Writer* w;
+} cs_IRDump;
+
+// names that could be mistaken for something else are written as #hash
+static cs_Str* ir_name(cs_Context* c, u32 hash)
+{
+    cs_Str** name = cs_hm_geth(&c->symbol_names, hash);
+    if (name == null) return null;
+    cs_Str* str = *name;
+    if (str->size == 0) return null;
+    switch (str->data[0]) {
+        case '%': case '#': case '@': case '"': return null;
+    }
+    return str;
+}
+
+static void dump_hash(cs_IRDump* d, u32 hash)
+{
+    cs_Str* name = ir_name(d->c, hash);
+    if (name != null) {
+        cs_write(d->w, cstr(name), name->size);
+    } else {
+        write_char(d->w, '#');
+        write_u64(d->w, hash);
+    }
+}
+
+static void dump_var(cs_IRDump* d, cs_SSAVar v)
+{
+    if (ssa_invalid(v)) {
+        write_char(d->w, '_');
+        return;
+    }
+    if (v.hash == tempvar_hash) {
+        write_char(d->w, '%');
+    } else {
+        dump_hash(d, v.hash);
+        write_char(d->w, '.');
+    }
+    write_u64(d->w, v.version);
+    write_char(d->w, ':');
+    if (v.type <= CS_TYPECOUNT && ir_type_names[v.type] != null) {
+        write_cstr(d->w, (char*)ir_type_names[v.type]);
+    } else write_u64(d->w, v.type);
+}
+
+static void dump_bb_ref(cs_IRDump* d, cs_BasicBlock* bb)
+{
+    if (bb == null) {
+        write_char(d->w, '_');
+        return;
+    }
+    write_char(d->w, 'b');
+    write_u64(d->w, bb->id);
+}
+
+static void dump_str(cs_IRDump* d, cs_Str* str)
+{
+    if (str == null) {
+        write_char(d->w, '-');
+        return;
+    }
+    write_char(d->w, '"');
+    for (u32 i = 0; i < str->size; i++) {
+        u8 ch = str->data[i];
+        switch (ch) {
+            case '"':  cs_write(d->w, "\\\"", 2); break;
+            case '\\': cs_write(d->w, "\\\\", 2); break;
+            case '\n': cs_write(d->w, "\\n", 2); break;
+            case '\r': cs_write(d->w, "\\r", 2); break;
+            case '\t': cs_write(d->w, "\\t", 2); break;
+            default: {
+                if (ch < 0x20 || ch == 0x7f) cs_writef(d->w, "\\x%02x", ch);
+                else write_char(d->w, ch);
+            } break;
+        }
+    }
+    write_char(d->w, '"');
+}
+
+static void dump_operand(cs_IRDump* d, cs_IROperand kind, union ins_arg arg)
+{
+    write_char(d->w, ' ');
+    switch (kind) {
+        case IR_VAR:   dump_var(d, arg.var); break;
+        case IR_INT:   write_i64(d->w, arg.int_); break;
+        // 17 significant digits are enough to read back the exact same double
+        case IR_FLOAT: cs_writef(d->w, "%.17g", arg.double_); break;
+        case IR_STR:   dump_str(d, arg.str_); break;
+        case IR_HASH:  dump_hash(d, (u32)arg.int_); break;
+        case IR_FN: {
+            write_char(d->w, '@');
+            write_u64(d->w, (u32)arg.int_);
+        } break;
+        default: break;
+    }
+}
+
+static void dump_fn(cs_IRDump* d, cs_Function* fn)
+{
+    cs_Writer* w = d->w;
+    write_cstr(w, "fn ");
+    write_u64(w, fn->id);
+    write_char(w, ' ');
+    dump_str(d, fn->title);
+    write_char(w, '\n');
+    for (u32 i = 0; i < fn->variant_count; i++) {
+        cs_FunctionBody* fb = &fn->variants[i];
+        write_cstr(w, "  variant ");
+        write_i64(w, fb->arg_count);
+        if (fb->arg_count < 0) {
+            // native functions can't be written, they have to be registered again before loading
+            write_cstr(w, " native\n");
+            continue;
+        }
+        write_cstr(w, " entry ");
+        dump_bb_ref(d, fb->entry);
+        write_cstr(w, " return ");
+        dump_bb_ref(d, fb->return_bb);
+        write_cstr(w, " val ");
+        dump_var(d, fb->return_val);
+        write_cstr(w, " calls ");
+        write_u64(w, fb->calls);
+        if (fb->arg_count > 0) {
+            write_cstr(w, " args");
+            for (i32 a = 0; a < fb->arg_count; a++) {
+                write_char(w, ' ');
+                dump_hash(d, fb->args[a]);
+            }
+        }
+        write_char(w, '\n');
+    }
+}
+
+static void dump_bb(cs_IRDump* d, cs_BasicBlock* bb)
+{
+    cs_Writer* w = d->w;
+    dump_bb_ref(d, bb);
+    write_char(w, ' ');
+    dump_str(d, bb->label);
+    if (bb->preds_start != null) {
+        write_cstr(w, " preds");
+        for (cs_BasicBlockNode* n = bb->preds_start; n != null; n = n->tail) {
+            write_char(w, ' ');
+            dump_bb_ref(d, n->head);
+        }
+    }
+    write_char(w, '\n');
+
+    for (cs_SSAPhi* phi = &bb->phis_head; !ssa_invalid(phi->dest); phi = phi->next) {
+        write_cstr(w, "  phi ");
+        dump_var(d, phi->dest);
+        write_cstr(w, " =");
+        for (u32 i = 0; i < phi->option_count; i++) {
+            write_char(w, ' ');
+            dump_var(d, phi->options[i]);
+        }
+        write_char(w, '\n');
+    }
+
+    for (u32 i = 0; i < bb->instr_count; i++) {
+        cs_SSAIns* ins = &bb->instrs[i];
+        write_cstr(w, "  ");
+        dump_var(d, ins->dest);
+        write_cstr(w, " = ");
+        // skip the CS_ prefix
+        write_cstr(w, (char*)cs_OpKindStrings[ins->op] + 3);
+
+        cs_IROperand a, b;
+        ir_operands(ins->op, &a, &b);
+        if (a == IR_CALL || a == IR_DYNCALL) {
+            if (a == IR_CALL) {
+                cs_FunctionBody* callee = ins->a_as.fn_;
+                cs_writef(w, " @%u/%d", callee->fn_id, cs_fb_arity(callee));
+            } else {
+                write_char(w, ' ');
+                dump_var(d, ins->a_as.var);
+            }
+            for (u32 arg = 0; arg < ins->b_as.args_->count; arg++) {
+                write_char(w, ' ');
+                dump_var(d, ins->b_as.args_->vars[arg]);
+            }
+        } else {
+            if (a != IR_NONE) dump_operand(d, a, ins->a_as);
+            if (b != IR_NONE) dump_operand(d, b, ins->b_as);
+        }
+        write_char(w, '\n');
+    }
+
+    if (ssa_eq(bb->jump_cond, ssavar_return)) {
+        write_cstr(w, "  ret\n");
+    } else if (ssa_eq(bb->jump_cond, ssavar_call)) {
+        write_cstr(w, "  call ");
+        dump_bb_ref(d, bb->a);
+        write_char(w, ' ');
+        dump_bb_ref(d, bb->b);
+        write_cstr(w, " -> ");
+        dump_bb_ref(d, bb->return_address);
+        write_char(w, '\n');
+    } else if (ssa_invalid(bb->jump_cond)) {
+        write_cstr(w, "  jmp ");
+        dump_bb_ref(d, bb->a);
+        write_char(w, '\n');
+    } else {
+        write_cstr(w, "  br ");
+        dump_var(d, bb->jump_cond);
+        write_char(w, ' ');
+        dump_bb_ref(d, bb->a);
+        write_char(w, ' ');
+        dump_bb_ref(d, bb->b);
+        write_char(w, '\n');
+    }
+}
+
+// writes every function and block of the context
+void cs_ir_dump(cs_Context* c, cs_Writer* w)
+{
+    cs_IRDump d = { .c = c, .w = w };
+    cs_writef(w, "; cisp ir %d\nfns %u blocks %u entry %u\n", CS_IR_VERSION, c->cur_fn_id, c->cur_bb_id, c->entry_fn_id);
+    for (u32 i = 0; i < c->cur_fn_id; i++) {
+        dump_fn(&d, cs_get_fn(c, i));
+    }
+    for (u32 i = 0; i < c->cur_bb_id; i++) {
+        write_char(w, '\n');
+        dump_bb(&d, arena_get(&c->bbs, i, sizeof(cs_BasicBlock)));
+    }
+    cs_writer_flush(w);
+}
+
+// writes a range of blocks, e.g. the ones of a single repl form. the output can't be loaded on its own
+void cs_ir_dump_blocks(cs_Context* c, cs_Writer* w, u32 first_bb, u32 count)
+{
+    cs_IRDump d = { .c = c, .w = w };
+    for (u32 i = first_bb; i < first_bb + count; i++) {
+        dump_bb(&d, arena_get(&c->bbs, i, sizeof(cs_BasicBlock)));
+    }
+    cs_writer_flush(w);
+}
+
+/* ==== LOAD ==== */
+typedef struct {
+    cs_Context* c;
+    char* end;
+    u32 fn_count;
+    u32* fn_ids; // dumped id => id in the context, ~0u until the function is seen
+    u32 bb_base, bb_count;
+    cs_HMap ops; // hash of the op name => u32 op
+    cs_Function* cur_fn;
+    cs_BasicBlock* cur_bb;
+} cs_IRParser;
+
+#define ir_check(cond) if (!(cond)) { return ir_fail(p); }
+
+static bool ir_fail(cs_IRParser* p)
+{
+    cs_error(p->c, CS_MALFORMED_IR);
+    return false;
+}
+
+// skips spaces and comments, but not newlines
+static void ir_skip_space(cs_IRParser* p)
+{
+    cs_Context* c = p->c;
+    while (c->cur < p->end) {
+        char ch = *c->cur;
+        if (ch == ' ' || ch == '\t' || ch == '\r') {
+            c->cur++;
+        } else if (ch == ';') {
+            while (c->cur < p->end && *c->cur != '\n') c->cur++;
+        } else break;
+    }
+}
+
+static void ir_skip_lines(cs_IRParser* p)
+{
+    cs_Context* c = p->c;
+    while (true) {
+        ir_skip_space(p);
+        if (c->cur < p->end && *c->cur == '\n') c->cur++;
+        else break;
+    }
+}
+
+static bool ir_at_eol(cs_IRParser* p)
+{
+    ir_skip_space(p);
+    return p->c->cur >= p->end || *p->c->cur == '\n';
+}
+
+// returns the next whitespace separated token, len is 0 at the end of the line
+static char* ir_token(cs_IRParser* p, u32* len)
+{
+    cs_Context* c = p->c;
+    ir_skip_space(p);
+    char* start = c->cur;
+    while (c->cur < p->end) {
+        char ch = *c->cur;
+        if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n') break;
+        c->cur++;
+    }
+    *len = (u32)(c->cur - start);
+    return start;
+}
+
+static bool ir_token_is(char* tok, u32 len, char* word)
+{
+    return strlen(word) == len && memcmp(tok, word, len) == 0;
+}
+
+static bool ir_expect(cs_IRParser* p, char* word)
+{
+    u32 len;
+    char* tok = ir_token(p, &len);
+    if (!ir_token_is(tok, len, word)) {
+        p->c->cur = tok;
+        return ir_fail(p);
+    }
+    return true;
+}
+
+// parses a decimal number that has to fill the whole token
+static bool ir_parse_num(char* tok, u32 len, i64* out)
+{
+    if (len == 0 || len > 20) return false;
+    bool neg = tok[0] == '-';
+    u32 i = neg ? 1 : 0;
+    if (i == len) return false;
+    u64 val = 0;
+    for (; i < len; i++) {
+        if (tok[i] < '0' || tok[i] > '9') return false;
+        val = val * 10 + (tok[i] - '0');
+    }
+    *out = neg ? -(i64)val : (i64)val;
+    return true;
+}
+
+static bool ir_int(cs_IRParser* p, i64* out)
+{
+    u32 len;
+    char* tok = ir_token(p, &len);
+    if (!ir_parse_num(tok, len, out)) {
+        p->c->cur = tok;
+        return ir_fail(p);
+    }
+    return true;
+}
+
+static bool ir_float(cs_IRParser* p, double* out)
+{
+    u32 len;
+    char* tok = ir_token(p, &len);
+    char tmp[64];
+    ir_check(len > 0 && len < sizeof(tmp));
+    memcpy(tmp, tok, len);
+    tmp[len] = 0;
+    char* end;
+    *out = strtod(tmp, &end);
+    ir_check(end == tmp + len);
+    return true;
+}
+
+// names are hashed like the front end does, and remembered so that they survive another dump
+static bool ir_hash(cs_IRParser* p, char* tok, u32 len, u32* out)
+{
+    if (len == 0) return false;
+    if (tok[0] == '#') {
+        i64 val;
+        if (!ir_parse_num(tok + 1, len - 1, &val)) return false;
+        *out = (u32)val;
+        return true;
+    }
+    u32 hash = fnv1a(tok, tok + len);
+    if (cs_hm_geth(&p->c->symbol_names, hash) == null) {
+        *(cs_Str**)cs_hm_seth(&p->c->symbol_names, hash) = cs_make_str(tok, len);
+    }
+    *out = hash;
+    return true;
+}
+
+static bool ir_var(cs_IRParser* p, cs_SSAVar* out)
+{
+    cs_Context* c = p->c;
+    u32 len;
+    char* tok = ir_token(p, &len);
+    c->cur = tok;
+    ir_check(len > 0);
+    if (ir_token_is(tok, len, "_")) {
+        *out = ssavar_invalid;
+        c->cur = tok + len;
+        return true;
+    }
+
+    // split from the right, since names may contain '.'
+    char* colon = tok + len - 1;
+    while (colon > tok && *colon != ':') colon--;
+    ir_check(*colon == ':');
+    char* type_start = colon + 1;
+    u32 type_len = (u32)(tok + len - type_start);
+    i64 type = -1;
+    for (u32 i = 0; i <= CS_TYPECOUNT; i++) {
+        if (ir_type_names[i] != null && ir_token_is(type_start, type_len, (char*)ir_type_names[i])) {
+            type = i;
+            break;
+        }
+    }
+    if (type < 0) ir_check(ir_parse_num(type_start, type_len, &type));
+
+    i64 version;
+    u32 hash;
+    if (tok[0] == '%') {
+        ir_check(ir_parse_num(tok + 1, (u32)(colon - tok - 1), &version));
+        hash = tempvar_hash;
+        if ((u64)version >= c->cur_temp_id) c->cur_temp_id = version + 1;
+    } else {
+        char* dot = colon - 1;
+        while (dot > tok && *dot != '.') dot--;
+        ir_check(*dot == '.');
+        ir_check(ir_parse_num(dot + 1, (u32)(colon - dot - 1), &version));
+        ir_check(ir_hash(p, tok, (u32)(dot - tok), &hash));
+    }
+    *out = ssavar(hash, (u16)type, (u16)version);
+    c->cur = tok + len;
+    return true;
+}
+
+static bool ir_bb(cs_IRParser* p, cs_BasicBlock** out)
+{
+    u32 len;
+    char* tok = ir_token(p, &len);
+    p->c->cur = tok;
+    if (ir_token_is(tok, len, "_")) {
+        *out = null;
+        p->c->cur = tok + len;
+        return true;
+    }
+    i64 id;
+    ir_check(len > 1 && tok[0] == 'b' && ir_parse_num(tok + 1, len - 1, &id));
+    ir_check(id >= 0 && id < p->bb_count);
+    *out = arena_get(&p->c->bbs, p->bb_base + (u32)id, sizeof(cs_BasicBlock));
+    p->c->cur = tok + len;
+    return true;
+}
+
+// parses a quoted string, or '-' for null
+static bool ir_str(cs_IRParser* p, cs_Str** out)
+{
+    cs_Context* c = p->c;
+    ir_skip_space(p);
+    ir_check(c->cur < p->end);
+    if (*c->cur == '-') {
+        c->cur++;
+        *out = null;
+        return true;
+    }
+    ir_check(*c->cur == '"');
+    c->cur++;
+    cs_StrBuilder sb = cs_strbuilder_init(16);
+    while (true) {
+        if (c->cur >= p->end || *c->cur == '\n') {
+            free(sb.data);
+            return ir_fail(p);
+        }
+        char ch = *c->cur++;
+        if (ch == '"') break;
+        if (ch == '\\' && c->cur < p->end) {
+            char esc = *c->cur++;
+            switch (esc) {
+                case 'n': ch = '\n'; break;
+                case 'r': ch = '\r'; break;
+                case 't': ch = '\t'; break;
+                case 'x': {
+                    i64 val = 0;
+                    for (u32 i = 0; i < 2; i++) {
+                        char h = c->cur < p->end ? *c->cur++ : 0;
+                        if (h >= '0' && h <= '9') val = val * 16 + (h - '0');
+                        else if (h >= 'a' && h <= 'f') val = val * 16 + (h - 'a' + 10);
+                        else {
+                            free(sb.data);
+                            return ir_fail(p);
+                        }
+                    }
+                    ch = (char)val;
+                } break;
+                default: ch = esc; break;
+            }
+        }
+        cs_strbuilder_appendc(&sb, ch);
+    }
+    *out = cs_strbuilder_finish(&sb);
+    return true;
+}
+
+// the function of a dumped id, made the first time the id is seen
+static cs_Function* ir_fn(cs_IRParser* p, u32 id)
+{
+    if (p->fn_ids[id] == ~0u) cs_make_fn(p->c, &p->fn_ids[id]);
+    return cs_get_fn(p->c, p->fn_ids[id]);
+}
+
+static bool ir_fn_ref(cs_IRParser* p, char* tok, u32 len, u32* out)
+{
+    i64 id;
+    if (len < 2 || tok[0] != '@' || !ir_parse_num(tok + 1, len - 1, &id)) return false;
+    if (id < 0 || id >= p->fn_count) return false;
+    *out = ir_fn(p, (u32)id)->id;
+    return true;
+}
+
+static bool ir_operand(cs_IRParser* p, cs_IROperand kind, union ins_arg* out)
+{
+    switch (kind) {
+        case IR_VAR: return ir_var(p, &out->var);
+        case IR_INT: return ir_int(p, &out->int_);
+        case IR_FLOAT: return ir_float(p, &out->double_);
+        case IR_STR: {
+            ir_check(ir_str(p, &out->str_));
+            ir_check(out->str_ != null);
+            return true;
+        }
+        case IR_HASH: {
+            u32 len; u32 hash;
+            char* tok = ir_token(p, &len);
+            p->c->cur = tok;
+            ir_check(ir_hash(p, tok, len, &hash));
+            p->c->cur = tok + len;
+            out->int_ = hash;
+            return true;
+        }
+        case IR_FN: {
+            u32 len; u32 fn_id;
+            char* tok = ir_token(p, &len);
+            p->c->cur = tok;
+            ir_check(ir_fn_ref(p, tok, len, &fn_id));
+            p->c->cur = tok + len;
+            out->int_ = fn_id;
+            return true;
+        }
+        default: return true;
+    }
+}
+
+// the arguments of a call until the end of the line
+static bool ir_call_args(cs_IRParser* p, cs_SSAIns* ins)
+{
+    cs_SSAVar args[FUNCTION_MAX_ARGS];
+    u32 arg_count = 0;
+    while (!ir_at_eol(p)) {
+        ir_check(arg_count < FUNCTION_MAX_ARGS);
+        ir_check(ir_var(p, &args[arg_count]));
+        arg_count++;
+    }
+    cs_CallArgs* call_args = cs_malloc(sizeof(cs_CallArgs) + sizeof(cs_SSAVar) * arg_count);
+    call_args->count = arg_count;
+    memcpy(call_args->vars, args, sizeof(cs_SSAVar) * arg_count);
+    ins->b_as.args_ = call_args;
+    return true;
+}
+
+// @fn/arity args...
+static bool ir_call(cs_IRParser* p, cs_SSAIns* ins)
+{
+    cs_Context* c = p->c;
+    u32 len;
+    char* tok = ir_token(p, &len);
+    c->cur = tok;
+    char* slash = memchr(tok, '/', len);
+    ir_check(slash != null);
+    u32 fn_id; i64 arity;
+    ir_check(ir_fn_ref(p, tok, (u32)(slash - tok), &fn_id));
+    ir_check(ir_parse_num(slash + 1, (u32)(tok + len - slash - 1), &arity));
+    ins->a_as.fn_ = cs_fn_get_variant(cs_get_fn(c, fn_id), (u8)arity);
+    ir_check(ins->a_as.fn_ != null);
+    c->cur = tok + len;
+    return ir_call_args(p, ins);
+}
+
+// <callee var> args...
+static bool ir_dyncall(cs_IRParser* p, cs_SSAIns* ins)
+{
+    ir_check(ir_var(p, &ins->a_as.var));
+    return ir_call_args(p, ins);
+}
+
+// whether the next line is a native variant, nothing is consumed
+static bool ir_native_next(cs_IRParser* p)
+{
+    char* line_end = p->c->cur;
+    ir_skip_lines(p);
+    u32 len;
+    char* tok = ir_token(p, &len);
+    bool native = ir_token_is(tok, len, "variant");
+    if (native) {
+        ir_token(p, &len);
+        tok = ir_token(p, &len);
+        native = ir_token_is(tok, len, "native");
+    }
+    p->c->cur = line_end;
+    return native;
+}
+
+// fn <id> <title>
+static bool ir_fn_decl(cs_IRParser* p)
+{
+    i64 id;
+    cs_Str* title;
+    ir_check(ir_int(p, &id) && id >= 0 && id < p->fn_count);
+    ir_check(ir_str(p, &title));
+    if (p->fn_ids[id] == ~0u && ir_native_next(p)) {
+        // the function has to be registered under the same name
+        ir_check(title != null);
+        cs_Native* native = cs_native_find(p->c, fnv1a(cstr(title), cstr(title) + title->size));
+        free(title);
+        ir_check(native != null);
+        p->fn_ids[id] = native->fn_id;
+        p->cur_fn = cs_get_fn(p->c, native->fn_id);
+        return true;
+    }
+    p->cur_fn = ir_fn(p, (u32)id);
+    p->cur_fn->title = title;
+    return true;
+}
+
+// variant <arg_count> (native | entry <bb> return <bb> val <var> calls <n> [args <name>...])
+static bool ir_variant(cs_IRParser* p)
+{
+    ir_check(p->cur_fn != null);
+    i64 arg_count;
+    ir_check(ir_int(p, &arg_count));
+    ir_check(arg_count >= INT8_MIN && arg_count <= INT8_MAX);
+    if (arg_count < 0) {
+        ir_check(ir_expect(p, "native"));
+        // the natives of a name with every arity are variants of the function it was bound to
+        cs_FunctionBody* variant = cs_fn_get_variant(p->cur_fn, (u8)(-1 - arg_count));
+        ir_check(variant != null && variant->arg_count == arg_count);
+        return true;
+    }
+    cs_FunctionBody* fb = cs_fn_add_variant(p->c, p->cur_fn, (i8)arg_count);
+
+    i64 calls;
+    ir_check(ir_expect(p, "entry") && ir_bb(p, &fb->entry));
+    ir_check(ir_expect(p, "return") && ir_bb(p, &fb->return_bb));
+    ir_check(ir_expect(p, "val") && ir_var(p, &fb->return_val));
+    ir_check(ir_expect(p, "calls") && ir_int(p, &calls));
+    fb->calls = (u8)calls;
+    if (arg_count > 0) {
+        ir_check(ir_expect(p, "args"));
+        fb->args = cs_malloc(sizeof(u32) * arg_count);
+        for (i32 i = 0; i < arg_count; i++) {
+            u32 len;
+            char* tok = ir_token(p, &len);
+            p->c->cur = tok;
+            ir_check(ir_hash(p, tok, len, &fb->args[i]));
+            p->c->cur = tok + len;
+        }
+    }
+    return true;
+}
+
+// b<id> <label> [preds <bb>...]
+static bool ir_block(cs_IRParser* p)
+{
+    cs_Context* c = p->c;
+    cs_BasicBlock* bb;
+    ir_check(ir_bb(p, &bb));
+    ir_check(bb != null);
+    ir_check(ir_str(p, &bb->label));
+    if (!ir_at_eol(p)) {
+        ir_check(ir_expect(p, "preds"));
+        while (!ir_at_eol(p)) {
+            cs_BasicBlock* pred;
+            ir_check(ir_bb(p, &pred));
+            ir_check(pred != null);
+            cs_bb_add_pred(bb, pred);
+        }
+    }
+    p->cur_bb = bb;
+    c->cur_bb = bb;
+    return true;
+}
+
+// phi <var> = <var>...
+static bool ir_phi(cs_IRParser* p)
+{
+    cs_BasicBlock* bb = p->cur_bb;
+    ir_check(bb != null && bb->instr_count == 0);
+
+    u32 index = 0;
+    cs_SSAPhi* phi = &bb->phis_head;
+    while (!ssa_invalid(phi->dest)) {
+        phi = phi->next;
+        index++;
+    }
+    ir_check(ir_var(p, &phi->dest) && !ssa_invalid(phi->dest));
+    ir_check(ir_expect(p, "="));
+    phi->options = null; phi->option_count = 0;
+    phi->next = cs_malloc(sizeof(cs_SSAPhi));
+    phi->next->dest = ssavar_invalid;
+    phi->next->options = null; phi->next->option_count = 0;
+    ssa_def_var(p->c, phi->dest, index);
+
+    while (!ir_at_eol(p)) {
+        cs_SSAVar option;
+        ir_check(ir_var(p, &option));
+        phi->option_count += 1;
+        phi->options = cs_realloc(phi->options, phi->option_count * sizeof(cs_SSAVar));
+        phi->options[phi->option_count-1] = option;
+    }
+    return true;
+}
+
+static bool ir_op(cs_IRParser* p, cs_OpKind* out)
+{
+    u32 len;
+    char* tok = ir_token(p, &len);
+    p->c->cur = tok;
+    u32* op = cs_hm_geth(&p->ops, fnv1a(tok, tok + len));
+    ir_check(op != null);
+    char* name = (char*)cs_OpKindStrings[*op] + 3;
+    ir_check(ir_token_is(tok, len, name));
+    *out = *op;
+    p->c->cur = tok + len;
+    return true;
+}
+
+// <var> = <OP> <operands>
+static bool ir_ins(cs_IRParser* p)
+{
+    cs_Context* c = p->c;
+    ir_check(p->cur_bb != null);
+    cs_SSAIns ins = {0};
+    ir_check(ir_var(p, &ins.dest));
+    ir_check(ir_expect(p, "="));
+    ir_check(ir_op(p, &ins.op));
+
+    cs_IROperand a, b;
+    ir_operands(ins.op, &a, &b);
+    if (a == IR_CALL) {
+        ir_check(ir_call(p, &ins));
+    } else if (a == IR_DYNCALL) {
+        ir_check(ir_dyncall(p, &ins));
+    } else {
+        ir_check(ir_operand(p, a, &ins.a_as));
+        ir_check(ir_operand(p, b, &ins.b_as));
+    }
+    if (!ssa_invalid(ins.dest)) ssa_def_var(c, ins.dest, -1);
+
+    cs_BasicBlock* bb = p->cur_bb;
+    bb->instr_count += 1;
+    cs_ensure_cap((void**)&bb->instrs, sizeof(cs_SSAIns), &bb->instr_cap, bb->instr_count);
+    bb->instrs[bb->instr_count-1] = ins;
+    return true;
+}
+
+// jmp <bb> | br <var> <bb> <bb> | call <entry> <return> -> <bb> | ret
+static bool ir_terminator(cs_IRParser* p, char* tok, u32 len)
+{
+    cs_BasicBlock* bb = p->cur_bb;
+    ir_check(bb != null);
+    if (ir_token_is(tok, len, "ret")) {
+        bb->jump_cond = ssavar_return;
+    } else if (ir_token_is(tok, len, "jmp")) {
+        bb->jump_cond = ssavar_invalid;
+        ir_check(ir_bb(p, &bb->a));
+    } else if (ir_token_is(tok, len, "br")) {
+        ir_check(ir_var(p, &bb->jump_cond) && !ssa_invalid(bb->jump_cond));
+        ir_check(ir_bb(p, &bb->a) && ir_bb(p, &bb->b));
+    } else {
+        bb->jump_cond = ssavar_call;
+        ir_check(ir_bb(p, &bb->a) && ir_bb(p, &bb->b));
+        ir_check(ir_expect(p, "->") && ir_bb(p, &bb->return_address));
+    }
+    // nothing may follow the terminator of a block
+    p->cur_bb = null;
+    return true;
+}
+
+// loads ir written by cs_ir_dump into the context, next to everything that is already in it.
+// on failure the error is reported like a compile error, and the context may contain partially loaded blocks
+static bool ir_load(cs_Context* c, char* src, u32 len)
+{
+    if (len == 0) len = strlen(src);
+    c->start = src;
+    c->cur = src; c->len = len;
+    c->err = CS_OK;
+    c->error_count = 0;
+    c->form_had_error = false;
+    cs_index_lines(c);
+
+    cs_IRParser parser = { .c = c, .end = src + len };
+    cs_IRParser* p = &parser;
+    i64 fn_count, bb_count, entry;
+    ir_skip_lines(p);
+    ir_check(ir_expect(p, "fns") && ir_int(p, &fn_count) && fn_count >= 0);
+    ir_check(ir_expect(p, "blocks") && ir_int(p, &bb_count) && bb_count >= 0);
+    ir_check(ir_expect(p, "entry") && ir_int(p, &entry) && entry >= 0 && (entry < fn_count || fn_count == 0));
+
+    // blocks are allocated up front, so that they can be referenced before they are defined.
+    // functions are made when they are first seen, the natives among them aren't made at all
+    p->fn_count = (u32)fn_count;
+    p->fn_ids = cs_malloc(sizeof(u32) * (fn_count + 1));
+    memset(p->fn_ids, 0xFF, sizeof(u32) * fn_count);
+    p->bb_base = c->cur_bb_id; p->bb_count = (u32)bb_count;
+    // the ir has no source positions
+    for (u32 i = 0; i < p->bb_count; i++) cs_make_bb(c)->line = 0;
+
+    p->ops = cs_hm_init(sizeof(u32));
+    for (u32 op = 0; op < CS_OPKIND_COUNT; op++) {
+        char* name = (char*)cs_OpKindStrings[op] + 3;
+        *(u32*)cs_hm_seth(&p->ops, fnv1a(name, name + strlen(name))) = op;
+    }
+
+    bool ok = true;
+    while (ok) {
+        ir_skip_lines(p);
+        if (c->cur >= p->end) break;
+
+        char* line = c->cur;
+        u32 tok_len;
+        char* tok = ir_token(p, &tok_len);
+        i64 id;
+        if (ir_token_is(tok, tok_len, "fn")) {
+            ok = ir_fn_decl(p);
+        } else if (ir_token_is(tok, tok_len, "variant")) {
+            ok = ir_variant(p);
+        } else if (ir_token_is(tok, tok_len, "phi")) {
+            ok = ir_phi(p);
+        } else if (ir_token_is(tok, tok_len, "ret") || ir_token_is(tok, tok_len, "jmp")
+                || ir_token_is(tok, tok_len, "br") || ir_token_is(tok, tok_len, "call")) {
+            ok = ir_terminator(p, tok, tok_len);
+        } else if (tok_len > 1 && tok[0] == 'b' && ir_parse_num(tok + 1, tok_len - 1, &id)) {
+            c->cur = line;
+            ok = ir_block(p);
+        } else {
+            c->cur = line;
+            ok = ir_ins(p);
+        }
+        if (ok && !ir_at_eol(p)) ok = ir_fail(p);
+    }
+    c->entry_fn_id = p->fn_count > 0 ? ir_fn(p, (u32)entry)->id : c->cur_fn_id;
+    free(p->fn_ids);
+    cs_hm_free(&p->ops);
+    c->form_had_error = false;
+    return ok;
+}
+
+bool cs_ir_load(cs_Context* c, char* src, u32 len)
+{
+    u64* counter = cs_count_allocs(&c->alloc_count);
+    bool ok = ir_load(c, src, len);
+    cs_count_allocs(counter);
+    return ok;
+}
@@ -0,0 +1,987 @@
+#include "lib.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "console.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CS_VEC_SIMD
+#include <immintrin.h>
+#include <cpuid.h>
+#define TARGET_SSE2
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static i64 lib_strlen(cs_Str* str)
+{
+    return str->size;
+}
+
+/* ==== VECTOR KERNELS ==== */
+// the loops over vectors. on x86-64 every kernel exists for sse2, which every cpu there has, and for avx2,
+// which is picked at startup if the cpu and the os support it. 64 bit integers can't be multiplied or
+// divided by either, those are scalar everywhere.
+// b_step is 0 if b is a single number used for every element
+
+#define VEC_ADD 0
+#define VEC_SUB 1
+#define VEC_MUL 2
+#define VEC_DIV 3
+
+typedef void (*cs_FloatKernel)(double* out, double* a, double* b, u32 b_step, u32 n);
+typedef bool (*cs_IntKernel)(i64* out, i64* a, i64* b, u32 b_step, u32 n); // false on overflow
+
+typedef struct {
+    cs_FloatKernel float_op[4];
+    cs_IntKernel int_op[4];
+    double (*float_sum)(double* a, u32 n);
+    double (*float_dot)(double* a, double* b, u32 n);
+    double (*float_min)(double* a, u32 n);  // n > 0
+    double (*float_max)(double* a, u32 n);
+    bool (*int_sum)(i64* a, u32 n, i64* out); // false on overflow
+    i64 (*int_min)(i64* a, u32 n);
+    i64 (*int_max)(i64* a, u32 n);
+} cs_VecKernels;
+
+static cs_VecKernels kernels;
+
+#define min_of(x, y) ((y) < (x) ? (y) : (x))
+#define max_of(x, y) ((y) > (x) ? (y) : (x))
+
+// scalar, for the ops no isa has and for cpus that are not x86-64
+#define SCALAR_FLOAT_OP(name, op) \
+    static void name(double* out, double* a, double* b, u32 b_step, u32 n) \
+    { \
+        for (u32 i = 0; i < n; i++) out[i] = a[i] op b[i * b_step]; \
+    }
+
+SCALAR_FLOAT_OP(scalar_add_f, +)
+SCALAR_FLOAT_OP(scalar_sub_f, -)
+SCALAR_FLOAT_OP(scalar_mul_f, *)
+SCALAR_FLOAT_OP(scalar_div_f, /)
+
+#define SCALAR_INT_OP(name, builtin) \
+    static bool name(i64* out, i64* a, i64* b, u32 b_step, u32 n) \
+    { \
+        for (u32 i = 0; i < n; i++) if (builtin(a[i], b[i * b_step], &out[i])) return false; \
+        return true; \
+    }
+
+SCALAR_INT_OP(scalar_add_i, __builtin_add_overflow)
+SCALAR_INT_OP(scalar_sub_i, __builtin_sub_overflow)
+SCALAR_INT_OP(scalar_mul_i, __builtin_mul_overflow)
+
+// the divisors were checked for zeros before
+static bool scalar_div_i(i64* out, i64* a, i64* b, u32 b_step, u32 n)
+{
+    for (u32 i = 0; i < n; i++) {
+        i64 y = b[i * b_step];
+        if (a[i] == INT64_MIN && y == -1) return false;
+        out[i] = a[i] / y;
+    }
+    return true;
+}
+
+static double scalar_sum_f(double* a, u32 n)
+{
+    double sum = 0;
+    for (u32 i = 0; i < n; i++) sum += a[i];
+    return sum;
+}
+
+static double scalar_dot_f(double* a, double* b, u32 n)
+{
+    double sum = 0;
+    for (u32 i = 0; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+static double scalar_min_f(double* a, u32 n)
+{
+    double r = a[0];
+    for (u32 i = 1; i < n; i++) r = min_of(r, a[i]);
+    return r;
+}
+
+static double scalar_max_f(double* a, u32 n)
+{
+    double r = a[0];
+    for (u32 i = 1; i < n; i++) r = max_of(r, a[i]);
+    return r;
+}
+
+static bool scalar_sum_i(i64* a, u32 n, i64* out)
+{
+    i64 sum = 0;
+    for (u32 i = 0; i < n; i++) if (__builtin_add_overflow(sum, a[i], &sum)) return false;
+    *out = sum;
+    return true;
+}
+
+static i64 scalar_min_i(i64* a, u32 n)
+{
+    i64 r = a[0];
+    for (u32 i = 1; i < n; i++) r = min_of(r, a[i]);
+    return r;
+}
+
+static i64 scalar_max_i(i64* a, u32 n)
+{
+    i64 r = a[0];
+    for (u32 i = 1; i < n; i++) r = max_of(r, a[i]);
+    return r;
+}
+
+#ifdef CS_VEC_SIMD
+// T is the register type holding width elements, the rest are the intrinsics of the isa.
+// a + b overflowed if the result has another sign than both a and b,
+// a - b overflowed if a and b have different signs and the result has another sign than a
+#define SIMD_FLOAT_OP(name, target, T, width, load, store, set1, vop, op) \
+    static target void name(double* out, double* a, double* b, u32 b_step, u32 n) \
+    { \
+        T splat = set1(n ? b[0] : 0); \
+        u32 i = 0; \
+        for (; i + width <= n; i += width) store(out + i, vop(load(a + i), b_step ? load(b + i) : splat)); \
+        for (; i < n; i++) out[i] = a[i] op b[i * b_step]; \
+    }
+
+#define SIMD_INT_OP(name, target, T, width, load, store, set1, vop, vxor, vand, vor, zero, signs, sub, builtin) \
+    static target bool name(i64* out, i64* a, i64* b, u32 b_step, u32 n) \
+    { \
+        T splat = set1(n ? b[0] : 0); \
+        T overflow = zero(); \
+        u32 i = 0; \
+        for (; i + width <= n; i += width) { \
+            T x = load(a + i); T y = b_step ? load(b + i) : splat; \
+            T r = vop(x, y); \
+            overflow = vor(overflow, vand(vxor(x, r), sub ? vxor(x, y) : vxor(y, r))); \
+            store(out + i, r); \
+        } \
+        if (signs(overflow)) return false; \
+        for (; i < n; i++) if (builtin(a[i], b[i * b_step], &out[i])) return false; \
+        return true; \
+    }
+
+#define SIMD_SUM_F(name, target, T, width, load, store, zero, vadd) \
+    static target double name(double* a, u32 n) \
+    { \
+        T acc = zero(); \
+        u32 i = 0; \
+        for (; i + width <= n; i += width) acc = vadd(acc, load(a + i)); \
+        double lanes[width]; store(lanes, acc); \
+        double sum = 0; \
+        for (u32 l = 0; l < width; l++) sum += lanes[l]; \
+        for (; i < n; i++) sum += a[i]; \
+        return sum; \
+    }
+
+#define SIMD_DOT_F(name, target, T, width, load, store, zero, vadd, vmul) \
+    static target double name(double* a, double* b, u32 n) \
+    { \
+        T acc = zero(); \
+        u32 i = 0; \
+        for (; i + width <= n; i += width) acc = vadd(acc, vmul(load(a + i), load(b + i))); \
+        double lanes[width]; store(lanes, acc); \
+        double sum = 0; \
+        for (u32 l = 0; l < width; l++) sum += lanes[l]; \
+        for (; i < n; i++) sum += a[i] * b[i]; \
+        return sum; \
+    }
+
+#define SIMD_FOLD_F(name, target, T, width, load, store, set1, vop, pick) \
+    static target double name(double* a, u32 n) \
+    { \
+        T acc = set1(a[0]); \
+        u32 i = 0; \
+        for (; i + width <= n; i += width) acc = vop(acc, load(a + i)); \
+        double lanes[width]; store(lanes, acc); \
+        double r = lanes[0]; \
+        for (u32 l = 1; l < width; l++) r = pick(r, lanes[l]); \
+        for (; i < n; i++) r = pick(r, a[i]); \
+        return r; \
+    }
+
+// the lanes can overflow where adding one after another wouldn't, the caller starts over then
+#define SIMD_SUM_I(name, target, T, width, load, store, zero, vadd, vxor, vand, vor, signs) \
+    static target bool name(i64* a, u32 n, i64* out) \
+    { \
+        T acc = zero(); T overflow = zero(); \
+        u32 i = 0; \
+        for (; i + width <= n; i += width) { \
+            T x = load(a + i); T r = vadd(acc, x); \
+            overflow = vor(overflow, vand(vxor(acc, r), vxor(x, r))); \
+            acc = r; \
+        } \
+        if (signs(overflow)) return false; \
+        i64 lanes[width]; store(lanes, acc); \
+        i64 sum = 0; \
+        for (u32 l = 0; l < width; l++) if (__builtin_add_overflow(sum, lanes[l], &sum)) return false; \
+        for (; i < n; i++) if (__builtin_add_overflow(sum, a[i], &sum)) return false; \
+        *out = sum; \
+        return true; \
+    }
+
+#define sse2_loadi(p) _mm_loadu_si128((__m128i*)(p))
+#define sse2_storei(p, v) _mm_storeu_si128((__m128i*)(p), v)
+#define sse2_signs(v) _mm_movemask_pd(_mm_castsi128_pd(v))
+#define avx2_loadi(p) _mm256_loadu_si256((__m256i*)(p))
+#define avx2_storei(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+#define avx2_signs(v) _mm256_movemask_pd(_mm256_castsi256_pd(v))
+
+SIMD_FLOAT_OP(sse2_add_f, TARGET_SSE2, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_add_pd, +)
+SIMD_FLOAT_OP(sse2_sub_f, TARGET_SSE2, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_sub_pd, -)
+SIMD_FLOAT_OP(sse2_mul_f, TARGET_SSE2, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_mul_pd, *)
+SIMD_FLOAT_OP(sse2_div_f, TARGET_SSE2, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_div_pd, /)
+SIMD_INT_OP(sse2_add_i, TARGET_SSE2, __m128i, 2, sse2_loadi, sse2_storei, _mm_set1_epi64x, _mm_add_epi64,
+    _mm_xor_si128, _mm_and_si128, _mm_or_si128, _mm_setzero_si128, sse2_signs, false, __builtin_add_overflow)
+SIMD_INT_OP(sse2_sub_i, TARGET_SSE2, __m128i, 2, sse2_loadi, sse2_storei, _mm_set1_epi64x, _mm_sub_epi64,
+    _mm_xor_si128, _mm_and_si128, _mm_or_si128, _mm_setzero_si128, sse2_signs, true, __builtin_sub_overflow)
+SIMD_SUM_F(sse2_sum_f, TARGET_SSE2, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_setzero_pd, _mm_add_pd)
+SIMD_DOT_F(sse2_dot_f, TARGET_SSE2, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_setzero_pd, _mm_add_pd, _mm_mul_pd)
+SIMD_FOLD_F(sse2_min_f, TARGET_SSE2, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_min_pd, min_of)
+SIMD_FOLD_F(sse2_max_f, TARGET_SSE2, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_max_pd, max_of)
+SIMD_SUM_I(sse2_sum_i, TARGET_SSE2, __m128i, 2, sse2_loadi, sse2_storei, _mm_setzero_si128, _mm_add_epi64,
+    _mm_xor_si128, _mm_and_si128, _mm_or_si128, sse2_signs)
+
+SIMD_FLOAT_OP(avx2_add_f, TARGET_AVX2, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, _mm256_add_pd, +)
+SIMD_FLOAT_OP(avx2_sub_f, TARGET_AVX2, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, _mm256_sub_pd, -)
+SIMD_FLOAT_OP(avx2_mul_f, TARGET_AVX2, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, _mm256_mul_pd, *)
+SIMD_FLOAT_OP(avx2_div_f, TARGET_AVX2, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, _mm256_div_pd, /)
+SIMD_INT_OP(avx2_add_i, TARGET_AVX2, __m256i, 4, avx2_loadi, avx2_storei, _mm256_set1_epi64x, _mm256_add_epi64,
+    _mm256_xor_si256, _mm256_and_si256, _mm256_or_si256, _mm256_setzero_si256, avx2_signs, false, __builtin_add_overflow)
+SIMD_INT_OP(avx2_sub_i, TARGET_AVX2, __m256i, 4, avx2_loadi, avx2_storei, _mm256_set1_epi64x, _mm256_sub_epi64,
+    _mm256_xor_si256, _mm256_and_si256, _mm256_or_si256, _mm256_setzero_si256, avx2_signs, true, __builtin_sub_overflow)
+SIMD_SUM_F(avx2_sum_f, TARGET_AVX2, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_setzero_pd, _mm256_add_pd)
+SIMD_DOT_F(avx2_dot_f, TARGET_AVX2, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_setzero_pd, _mm256_add_pd, _mm256_mul_pd)
+SIMD_FOLD_F(avx2_min_f, TARGET_AVX2, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, _mm256_min_pd, min_of)
+SIMD_FOLD_F(avx2_max_f, TARGET_AVX2, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, _mm256_max_pd, max_of)
+SIMD_SUM_I(avx2_sum_i, TARGET_AVX2, __m256i, 4, avx2_loadi, avx2_storei, _mm256_setzero_si256, _mm256_add_epi64,
+    _mm256_xor_si256, _mm256_and_si256, _mm256_or_si256, avx2_signs)
+
+// sse2 can't compare 64 bit integers
+static TARGET_AVX2 i64 avx2_min_i(i64* a, u32 n)
+{
+    __m256i acc = _mm256_set1_epi64x(a[0]);
+    u32 i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = avx2_loadi(a + i);
+        acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(acc, x));
+    }
+    i64 lanes[4]; avx2_storei(lanes, acc);
+    i64 r = lanes[0];
+    for (u32 l = 1; l < 4; l++) r = min_of(r, lanes[l]);
+    for (; i < n; i++) r = min_of(r, a[i]);
+    return r;
+}
+
+static TARGET_AVX2 i64 avx2_max_i(i64* a, u32 n)
+{
+    __m256i acc = _mm256_set1_epi64x(a[0]);
+    u32 i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = avx2_loadi(a + i);
+        acc = _mm256_blendv_epi8(acc, x, _mm256_cmpgt_epi64(x, acc));
+    }
+    i64 lanes[4]; avx2_storei(lanes, acc);
+    i64 r = lanes[0];
+    for (u32 l = 1; l < 4; l++) r = max_of(r, lanes[l]);
+    for (; i < n; i++) r = max_of(r, a[i]);
+    return r;
+}
+
+// the cpu has to have avx2 and the os has to save the ymm registers on context switches
+static bool cpu_has_avx2(void)
+{
+    u32 a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE) || !(c & bit_AVX)) return false;
+    u32 xcr0, xcr0_high;
+    __asm__ volatile ("xgetbv" : "=a"(xcr0), "=d"(xcr0_high) : "c"(0));
+    if ((xcr0 & 6) != 6) return false;
+    if (!__get_cpuid_count(7, 0, &a, &b, &c, &d)) return false;
+    return (b & bit_AVX2) != 0;
+}
+#endif
+
+static void vec_init_kernels(void)
+{
+    // every context opening the library asks again, they are only picked once
+    if (kernels.float_sum != null) return;
+#ifdef CS_VEC_SIMD
+    if (cpu_has_avx2()) {
+        kernels = (cs_VecKernels) {
+            { avx2_add_f, avx2_sub_f, avx2_mul_f, avx2_div_f }, { avx2_add_i, avx2_sub_i, scalar_mul_i, scalar_div_i },
+            avx2_sum_f, avx2_dot_f, avx2_min_f, avx2_max_f, avx2_sum_i, avx2_min_i, avx2_max_i,
+        };
+    } else {
+        kernels = (cs_VecKernels) {
+            { sse2_add_f, sse2_sub_f, sse2_mul_f, sse2_div_f }, { sse2_add_i, sse2_sub_i, scalar_mul_i, scalar_div_i },
+            sse2_sum_f, sse2_dot_f, sse2_min_f, sse2_max_f, sse2_sum_i, scalar_min_i, scalar_max_i,
+        };
+    }
+#else
+    kernels = (cs_VecKernels) {
+        { scalar_add_f, scalar_sub_f, scalar_mul_f, scalar_div_f }, { scalar_add_i, scalar_sub_i, scalar_mul_i, scalar_div_i },
+        scalar_sum_f, scalar_dot_f, scalar_min_f, scalar_max_f, scalar_sum_i, scalar_min_i, scalar_max_i,
+    };
+#endif
+}
+
+/* ==== VECTORS ==== */
+// vectors hold only ints or only floats. ints overflowing 64 bits continue as floats, for the whole vector
+
+#define vec_value(vec) val_from_ptr(vec, CS_PTR_VEC)
+
+static bool lib_number(cs_Value v, bool* is_int, i64* i, double* d)
+{
+    if (cs_val_to_i64(v, i)) {
+        *is_int = true;
+        *d = (double)*i;
+        return true;
+    }
+    if (!val_is_double(v)) return false;
+    *is_int = false;
+    *d = cs_val_as_double(v);
+    return true;
+}
+
+// the elements of vec as floats, a copy that has to be freed if it isn't vec_floats(vec)
+static double* vec_as_floats(cs_Vector* vec)
+{
+    if (vec->kind == CS_VEC_FLOAT) return vec_floats(vec);
+    double* floats = cs_malloc(sizeof(double) * (vec->count + 1));
+    for (u32 i = 0; i < vec->count; i++) floats[i] = (double)vec_ints(vec)[i];
+    return floats;
+}
+
+static void vec_free_floats(cs_Vector* vec, double* floats)
+{
+    if (floats != vec_floats(vec)) free(floats);
+}
+
+// (vec list), the numbers of a list
+static cs_Value lib_vec(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    cs_Value list = args[0];
+    u32 count = 0;
+    bool ints = true;
+    for (cs_Value v = list; v != CS_NIL; v = cs_list_cdr(v), count++) {
+        if (!val_is_list(v)) return cs_runtime_error(c, CS_TYPE_ERROR);
+        cs_Value x = cs_list_car(v);
+        i64 i;
+        if (!cs_val_to_i64(x, &i) && !val_is_double(x)) return cs_runtime_error(c, CS_TYPE_ERROR);
+        ints = ints && !val_is_double(x);
+    }
+    // the list can move once the vector is allocated
+    u64* data = cs_malloc(sizeof(u64) * (count + 1));
+    u32 n = 0;
+    for (cs_Value v = list; v != CS_NIL; v = cs_list_cdr(v)) {
+        bool is_int; i64 i; double d;
+        lib_number(cs_list_car(v), &is_int, &i, &d);
+        if (ints) ((i64*)data)[n++] = i;
+        else ((double*)data)[n++] = d;
+    }
+    cs_Vector* vec = cs_vec_make(c, ints ? CS_VEC_INT : CS_VEC_FLOAT, count);
+    memcpy(vec->data, data, sizeof(u64) * count);
+    free(data);
+    return vec_value(vec);
+}
+
+// (make-vec n x), n times x
+static cs_Value lib_make_vec(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    i64 count; bool is_int; i64 i; double d;
+    if (!cs_val_to_i64(args[0], &count) || !lib_number(args[1], &is_int, &i, &d)) return cs_runtime_error(c, CS_TYPE_ERROR);
+    if (count < 0 || count > UINT32_MAX) return cs_runtime_error(c, CS_INDEX_OUT_OF_RANGE);
+    cs_Vector* vec = cs_vec_make(c, is_int ? CS_VEC_INT : CS_VEC_FLOAT, (u32)count);
+    for (u32 k = 0; k < vec->count; k++) {
+        if (is_int) vec_ints(vec)[k] = i;
+        else vec_floats(vec)[k] = d;
+    }
+    return vec_value(vec);
+}
+
+static cs_Value lib_vec_len(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    if (!val_is_vec(args[0])) return cs_runtime_error(c, CS_TYPE_ERROR);
+    return val_from_int(val_as_vec(args[0])->count);
+}
+
+static cs_Value lib_vec_ref(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    i64 i;
+    if (!val_is_vec(args[0]) || !cs_val_to_i64(args[1], &i)) return cs_runtime_error(c, CS_TYPE_ERROR);
+    cs_Vector* vec = val_as_vec(args[0]);
+    if (i < 0 || i >= vec->count) return cs_runtime_error(c, CS_INDEX_OUT_OF_RANGE);
+    if (vec->kind == CS_VEC_INT) return cs_val_int(c, vec_ints(vec)[i]);
+    return cs_val_double(vec_floats(vec)[i]);
+}
+
+// (vec-slice v start end), a copy of the elements from start up to end
+static cs_Value lib_vec_slice(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    i64 start, end;
+    if (!val_is_vec(args[0]) || !cs_val_to_i64(args[1], &start) || !cs_val_to_i64(args[2], &end)) {
+        return cs_runtime_error(c, CS_TYPE_ERROR);
+    }
+    cs_Vector* vec = val_as_vec(args[0]);
+    if (start < 0 || start > end || end > vec->count) return cs_runtime_error(c, CS_INDEX_OUT_OF_RANGE);
+    cs_Vector* slice = cs_vec_make(c, vec->kind, (u32)(end - start));
+    memcpy(slice->data, &vec->data[start], sizeof(u64) * slice->count);
+    return vec_value(slice);
+}
+
+// a vector and another one of the same length or a number
+static cs_Value vec_arith(cs_Context* c, cs_Value* args, u32 op)
+{
+    if (!val_is_vec(args[0])) return cs_runtime_error(c, CS_TYPE_ERROR);
+    cs_Vector* a = val_as_vec(args[0]);
+    cs_Vector* b = null;
+    bool b_int; i64 bi; double bd;
+    if (val_is_vec(args[1])) {
+        b = val_as_vec(args[1]);
+        b_int = b->kind == CS_VEC_INT;
+        if (b->count != a->count) return cs_runtime_error(c, CS_INDEX_OUT_OF_RANGE);
+    } else if (!lib_number(args[1], &b_int, &bi, &bd)) {
+        return cs_runtime_error(c, CS_TYPE_ERROR);
+    }
+    u32 n = a->count;
+    u32 b_step = b != null;
+    i64* b_ints = b != null ? vec_ints(b) : &bi;
+    bool ints = a->kind == CS_VEC_INT && b_int;
+    if (ints && op == VEC_DIV) {
+        for (u32 i = 0; i < (b != null ? n : 1); i++) {
+            if (b_ints[i] == 0) return cs_runtime_error(c, CS_DIV_BY_ZERO);
+        }
+    }
+
+    cs_Vector* result = cs_vec_make(c, CS_VEC_INT, n);
+    if (ints && kernels.int_op[op](vec_ints(result), vec_ints(a), b_ints, b_step, n)) return vec_value(result);
+    result->kind = CS_VEC_FLOAT;
+    double* x = vec_as_floats(a);
+    double* y = b != null ? vec_as_floats(b) : &bd;
+    kernels.float_op[op](vec_floats(result), x, y, b_step, n);
+    vec_free_floats(a, x);
+    if (b != null) vec_free_floats(b, y);
+    return vec_value(result);
+}
+
+static cs_Value lib_vec_add(cs_Context* c, cs_Value* args, u32 arg_count) { return vec_arith(c, args, VEC_ADD); }
+static cs_Value lib_vec_sub(cs_Context* c, cs_Value* args, u32 arg_count) { return vec_arith(c, args, VEC_SUB); }
+static cs_Value lib_vec_mul(cs_Context* c, cs_Value* args, u32 arg_count) { return vec_arith(c, args, VEC_MUL); }
+static cs_Value lib_vec_div(cs_Context* c, cs_Value* args, u32 arg_count) { return vec_arith(c, args, VEC_DIV); }
+
+static cs_Value lib_vec_sum(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    if (!val_is_vec(args[0])) return cs_runtime_error(c, CS_TYPE_ERROR);
+    cs_Vector* vec = val_as_vec(args[0]);
+    if (vec->kind == CS_VEC_FLOAT) return cs_val_double(kernels.float_sum(vec_floats(vec), vec->count));
+    i64 sum;
+    if (kernels.int_sum(vec_ints(vec), vec->count, &sum)) return cs_val_int(c, sum);
+    // one after another like a loop would, continuing as a float once it overflows
+    sum = 0;
+    u32 i = 0;
+    for (i64 next; i < vec->count; i++, sum = next) {
+        if (__builtin_add_overflow(sum, vec_ints(vec)[i], &next)) break;
+    }
+    if (i == vec->count) return cs_val_int(c, sum);
+    double d = (double)sum + (double)vec_ints(vec)[i];
+    for (i++; i < vec->count; i++) d += (double)vec_ints(vec)[i];
+    return cs_val_double(d);
+}
+
+static cs_Value lib_vec_dot(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    if (!val_is_vec(args[0]) || !val_is_vec(args[1])) return cs_runtime_error(c, CS_TYPE_ERROR);
+    cs_Vector* a = val_as_vec(args[0]); cs_Vector* b = val_as_vec(args[1]);
+    if (a->count != b->count) return cs_runtime_error(c, CS_INDEX_OUT_OF_RANGE);
+    if (a->kind == CS_VEC_INT && b->kind == CS_VEC_INT) {
+        i64 sum = 0, product;
+        bool overflow = false;
+        for (u32 i = 0; i < a->count && !overflow; i++) {
+            overflow = __builtin_mul_overflow(vec_ints(a)[i], vec_ints(b)[i], &product)
+                || __builtin_add_overflow(sum, product, &sum);
+        }
+        if (!overflow) return cs_val_int(c, sum);
+    }
+    double* x = vec_as_floats(a);
+    double* y = vec_as_floats(b);
+    double dot = kernels.float_dot(x, y, a->count);
+    vec_free_floats(a, x);
+    vec_free_floats(b, y);
+    return cs_val_double(dot);
+}
+
+// nil for an empty vector
+static cs_Value vec_fold(cs_Context* c, cs_Value* args, bool max)
+{
+    if (!val_is_vec(args[0])) return cs_runtime_error(c, CS_TYPE_ERROR);
+    cs_Vector* vec = val_as_vec(args[0]);
+    if (vec->count == 0) return CS_NIL;
+    if (vec->kind == CS_VEC_INT) {
+        return cs_val_int(c, (max ? kernels.int_max : kernels.int_min)(vec_ints(vec), vec->count));
+    }
+    return cs_val_double((max ? kernels.float_max : kernels.float_min)(vec_floats(vec), vec->count));
+}
+
+static cs_Value lib_vec_min(cs_Context* c, cs_Value* args, u32 arg_count) { return vec_fold(c, args, false); }
+static cs_Value lib_vec_max(cs_Context* c, cs_Value* args, u32 arg_count) { return vec_fold(c, args, true); }
+
+/* ==== LISTS ==== */
+// in gc mode everything a native allocates or calls can move objects, so the values these hold on to
+// across that live in registers from cs_native_regs
+
+#define lib_retain(c, v) if ((c)->rc) cs_val_retain(v)
+#define lib_release(c, v) if ((c)->rc) cs_val_release(c, v)
+
+// -1 if list isn't one
+static i64 list_length(cs_Value list)
+{
+    i64 n = 0;
+    for (; list != CS_NIL; list = cs_list_cdr(list), n++) {
+        if (!val_is_list(list)) return -1;
+    }
+    return n;
+}
+
+// drops the references held by count registers from first on
+static cs_Value list_unwind(cs_Context* c, u32 first, u32 count)
+{
+    for (u32 i = 0; i < count; i++) lib_release(c, c->stack[first + i]);
+    cs_native_regs_pop(c, first);
+    return CS_NIL;
+}
+
+// the elements of list in count registers from first on, each holding a reference
+static void list_to_regs(cs_Context* c, cs_Value list, u32 first, u32 count)
+{
+    for (u32 i = 0; i < count; i++, list = cs_list_cdr(list)) {
+        cs_Value x = cs_list_car(list);
+        lib_retain(c, x);
+        c->stack[first + i] = x;
+    }
+}
+
+static cs_Value lib_length(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    i64 n = list_length(args[0]);
+    if (n < 0) return cs_runtime_error(c, CS_TYPE_ERROR);
+    return val_from_int(n);
+}
+
+// (nth list n), nil past the end like car of nil
+static cs_Value lib_nth(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    i64 i;
+    if (!cs_val_to_i64(args[1], &i)) return cs_runtime_error(c, CS_TYPE_ERROR);
+    if (i < 0) return cs_runtime_error(c, CS_INDEX_OUT_OF_RANGE);
+    cs_Value list = args[0];
+    for (; list != CS_NIL; list = cs_list_cdr(list), i--) {
+        if (!val_is_list(list)) return cs_runtime_error(c, CS_TYPE_ERROR);
+        if (i == 0) {
+            cs_Value x = cs_list_car(list);
+            lib_retain(c, x);
+            return x;
+        }
+    }
+    return CS_NIL;
+}
+
+static cs_Value lib_reverse(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    i64 n = list_length(args[0]);
+    if (n < 0) return cs_runtime_error(c, CS_TYPE_ERROR);
+    u32 first = cs_native_regs(c, (u32)n);
+    list_to_regs(c, args[0], first, (u32)n);
+    for (u32 i = 0, j = (u32)n - 1; i < j && n > 0; i++, j--) {
+        cs_Value x = c->stack[first + i];
+        c->stack[first + i] = c->stack[first + j];
+        c->stack[first + j] = x;
+    }
+    cs_Value result = cs_list_from_regs(c, first, (u32)n, CS_NIL);
+    cs_native_regs_pop(c, first);
+    return result;
+}
+
+// (append a b), a copy of a in front of b
+static cs_Value lib_append(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    i64 n = list_length(args[0]);
+    if (n < 0) return cs_runtime_error(c, CS_TYPE_ERROR);
+    cs_Value tail = args[1];
+    lib_retain(c, tail);
+    u32 first = cs_native_regs(c, (u32)n);
+    list_to_regs(c, args[0], first, (u32)n);
+    cs_Value result = cs_list_from_regs(c, first, (u32)n, tail);
+    cs_native_regs_pop(c, first);
+    return result;
+}
+
+// (map f list)
+static cs_Value lib_map(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    cs_Value fn = args[0];
+    i64 n = list_length(args[1]);
+    if (n < 0) return cs_runtime_error(c, CS_TYPE_ERROR);
+    u32 first = cs_native_regs(c, (u32)n + 1);
+    u32 cursor = first + (u32)n;
+    c->stack[cursor] = args[1];
+    u32 count = 0;
+    // f can change the list while it runs
+    for (; count < n && val_is_list(c->stack[cursor]); count++) {
+        cs_Value x = cs_list_car(c->stack[cursor]);
+        cs_Value y = cs_call(c, fn, &x, 1);
+        if (c->err != CS_OK) return list_unwind(c, first, count);
+        c->stack[first + count] = y;
+        c->stack[cursor] = cs_list_cdr(c->stack[cursor]);
+    }
+    cs_Value result = cs_list_from_regs(c, first, count, CS_NIL);
+    cs_native_regs_pop(c, first);
+    return result;
+}
+
+// (filter f list), the elements f is truthy for
+static cs_Value lib_filter(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    cs_Value fn = args[0];
+    i64 n = list_length(args[1]);
+    if (n < 0) return cs_runtime_error(c, CS_TYPE_ERROR);
+    u32 first = cs_native_regs(c, (u32)n + 1);
+    u32 cursor = first + (u32)n;
+    c->stack[cursor] = args[1];
+    u32 count = 0;
+    for (i64 i = 0; i < n && val_is_list(c->stack[cursor]); i++) {
+        cs_Value x = cs_list_car(c->stack[cursor]);
+        cs_Value keep = cs_call(c, fn, &x, 1);
+        if (c->err != CS_OK) return list_unwind(c, first, count);
+        lib_release(c, keep);
+        // the call can have moved x
+        x = cs_list_car(c->stack[cursor]);
+        if (val_truthy(keep)) {
+            lib_retain(c, x);
+            c->stack[first + count++] = x;
+        }
+        c->stack[cursor] = cs_list_cdr(c->stack[cursor]);
+    }
+    cs_Value result = cs_list_from_regs(c, first, count, CS_NIL);
+    cs_native_regs_pop(c, first);
+    return result;
+}
+
+// (reduce f init list), (f (f init x0) x1) ...
+static cs_Value lib_reduce(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    cs_Value fn = args[0];
+    if (list_length(args[2]) < 0) return cs_runtime_error(c, CS_TYPE_ERROR);
+    u32 acc = cs_native_regs(c, 2);
+    u32 cursor = acc + 1;
+    c->stack[acc] = args[1];
+    c->stack[cursor] = args[2];
+    lib_retain(c, args[1]);
+    while (val_is_list(c->stack[cursor])) {
+        cs_Value pair[2] = { c->stack[acc], cs_list_car(c->stack[cursor]) };
+        cs_Value y = cs_call(c, fn, pair, 2);
+        if (c->err != CS_OK) return list_unwind(c, acc, 1);
+        lib_release(c, c->stack[acc]);
+        c->stack[acc] = y;
+        c->stack[cursor] = cs_list_cdr(c->stack[cursor]);
+    }
+    cs_Value result = c->stack[acc];
+    cs_native_regs_pop(c, acc);
+    return result;
+}
+
+// numbers and strings are ordered among themselves, CS_TYPE_ERROR for anything else
+static i32 lib_compare(cs_Context* c, cs_Value a, cs_Value b)
+{
+    i64 x, y;
+    bool a_int = cs_val_to_i64(a, &x);
+    bool b_int = cs_val_to_i64(b, &y);
+    if (a_int && b_int) return (x > y) - (x < y);
+    if ((a_int || val_is_double(a)) && (b_int || val_is_double(b))) {
+        double dx = a_int ? (double)x : cs_val_as_double(a);
+        double dy = b_int ? (double)y : cs_val_as_double(b);
+        return (dx > dy) - (dx < dy);
+    }
+    if (val_is_text(a) && val_is_text(b)) {
+        cs_Str* sa = cs_val_as_str(a);
+        cs_Str* sb = cs_val_as_str(b);
+        i32 r = memcmp(sa->data, sb->data, sa->size < sb->size ? sa->size : sb->size);
+        if (r != 0) return r;
+        return (sa->size > sb->size) - (sa->size < sb->size);
+    }
+    cs_runtime_error(c, CS_TYPE_ERROR);
+    return 0;
+}
+
+// (sort list), ascending and stable. merges runs of doubling length, nothing allocates objects
+// in between so the values can be sorted in the registers
+static cs_Value lib_sort(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    i64 n = list_length(args[0]);
+    if (n < 0) return cs_runtime_error(c, CS_TYPE_ERROR);
+    u32 first = cs_native_regs(c, (u32)n);
+    list_to_regs(c, args[0], first, (u32)n);
+    cs_Value* from = &c->stack[first];
+    cs_Value* to = cs_malloc(sizeof(cs_Value) * (n + 1));
+    cs_Value* tmp = to;
+    for (u32 width = 1; width < n && c->err == CS_OK; width *= 2) {
+        for (u32 lo = 0; lo < n; lo += 2 * width) {
+            u32 mid = lo + width < n ? lo + width : (u32)n;
+            u32 hi = lo + 2 * width < n ? lo + 2 * width : (u32)n;
+            u32 i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) to[k++] = lib_compare(c, from[j], from[i]) < 0 ? from[j++] : from[i++];
+            while (i < mid) to[k++] = from[i++];
+            while (j < hi) to[k++] = from[j++];
+        }
+        cs_Value* swap = from; from = to; to = swap;
+    }
+    if (from != &c->stack[first]) memcpy(&c->stack[first], from, sizeof(cs_Value) * n);
+    free(tmp);
+    if (c->err != CS_OK) return list_unwind(c, first, (u32)n);
+    cs_Value result = cs_list_from_regs(c, first, (u32)n, CS_NIL);
+    cs_native_regs_pop(c, first);
+    return result;
+}
+
+/* ==== CHANNELS ==== */
+// isolates of the same cs_Isolates send each other values through channels named by keywords,
+// the first use of a name opens it. function values only mean the same in isolates running the same code
+
+static cs_Channel* lib_channel(cs_Context* c, cs_Value name)
+{
+    if (c->isolates == null) {
+        cs_runtime_error(c, CS_NO_ISOLATE);
+        return null;
+    }
+    if (val_tag(name) != CS_VAL_TAG_KW) {
+        cs_runtime_error(c, CS_TYPE_ERROR);
+        return null;
+    }
+    cs_Channel* ch = cs_isolates_channel(c->isolates, (u32)val_payload(name));
+    if (ch == null) cs_runtime_error(c, CS_OUT_OF_MEM);
+    return ch;
+}
+
+// an isolate gives its worker up instead of waiting at a channel, the worker continues it with the call made again
+// once it can go on. only the code cs_run started can be suspended, a native called from a native, a coroutine or
+// a future waits in place
+static bool lib_chan_suspend(cs_Context* c, cs_Channel* ch, bool send)
+{
+    if (c->call_depth != 0 || c->loop != null || c->worker != null) return false;
+    c->blocked = ch;
+    c->blocked_send = send;
+    c->err = CS_SUSPENDED;
+    return true;
+}
+
+// waits while the channel is full
+static cs_Value lib_chan_send(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    cs_Channel* ch = lib_channel(c, args[0]);
+    if (ch == null) return CS_NIL;
+    cs_Message* m = cs_message_pack(c, args[1]);
+    if (cs_channel_try_send(ch, m)) return CS_TRUE;
+    if (lib_chan_suspend(c, ch, true)) {
+        cs_message_free(m);
+        return CS_NIL;
+    }
+    cs_channel_send(ch, m);
+    return CS_TRUE;
+}
+
+// false if the channel is full
+static cs_Value lib_chan_try_send(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    cs_Channel* ch = lib_channel(c, args[0]);
+    if (ch == null) return CS_NIL;
+    cs_Message* m = cs_message_pack(c, args[1]);
+    if (cs_channel_try_send(ch, m)) return CS_TRUE;
+    cs_message_free(m);
+    return CS_FALSE;
+}
+
+// waits while the channel is empty
+static cs_Value lib_chan_recv(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    cs_Channel* ch = lib_channel(c, args[0]);
+    if (ch == null) return CS_NIL;
+    cs_Message* m = cs_channel_try_recv(ch);
+    if (m == null && lib_chan_suspend(c, ch, false)) return CS_NIL;
+    return cs_message_unpack(c, m != null ? m : cs_channel_recv(ch));
+}
+
+// nil if the channel is empty
+static cs_Value lib_chan_try_recv(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    cs_Channel* ch = lib_channel(c, args[0]);
+    if (ch == null) return CS_NIL;
+    cs_Message* m = cs_channel_try_recv(ch);
+    return m != null ? cs_message_unpack(c, m) : CS_NIL;
+}
+
+/* ==== FUTURES ==== */
+// there are no closures, so a future gets the function to call and its arguments instead of an expression
+
+// (future f args..) calls f on another thread
+static cs_Value lib_future(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    return cs_future(c, args[0], args + 1, arg_count - 1);
+}
+
+// waits for the result of a future
+static cs_Value lib_deref(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    if (!val_is_future(args[0])) return cs_runtime_error(c, CS_TYPE_ERROR);
+    return cs_future_deref(c, args[0]);
+}
+
+// (pmap f list), map on every worker
+static cs_Value lib_pmap(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    return cs_pmap(c, args[0], args[1]);
+}
+
+/* ==== COROUTINES ==== */
+static bool lib_int_args(cs_Context* c, cs_Value* args, u32 count)
+{
+    for (u32 i = 0; i < count; i++) if (!val_is_int(args[i])) {
+        cs_runtime_error(c, CS_TYPE_ERROR);
+        return false;
+    }
+    return true;
+}
+
+// (spawn f args..) returns the id of the coroutine to join
+static cs_Value lib_spawn(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    u32 id = cs_co_spawn(c, args[0], args + 1, arg_count - 1);
+    return id == 0 ? CS_NIL : val_from_int(id);
+}
+
+static cs_Value lib_join(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    if (!lib_int_args(c, args, 1)) return CS_NIL;
+    return cs_co_join(c, (u32)val_as_int(args[0]));
+}
+
+static cs_Value lib_yield(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    return cs_co_yield(c);
+}
+
+static cs_Value lib_sleep(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    if (!lib_int_args(c, args, 1)) return CS_NIL;
+    return cs_co_sleep(c, val_as_int(args[0]));
+}
+
+// (read fd max)
+static cs_Value lib_read(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    if (!lib_int_args(c, args, 2)) return CS_NIL;
+    return cs_io_read(c, val_as_int(args[0]), val_as_int(args[1]));
+}
+
+// (write fd str)
+static cs_Value lib_write(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    if (!lib_int_args(c, args, 1)) return CS_NIL;
+    if (!val_is_text(args[1])) return cs_runtime_error(c, CS_TYPE_ERROR);
+    return cs_io_write(c, val_as_int(args[0]), cs_val_as_str(args[1]));
+}
+
+static cs_Value lib_close(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    if (!lib_int_args(c, args, 1)) return CS_NIL;
+    return cs_io_close(c, val_as_int(args[0]));
+}
+
+static cs_Value lib_pipe(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    return cs_io_pipe(c);
+}
+
+// (listen host port)
+static cs_Value lib_listen(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    if (!val_is_text(args[0])) return cs_runtime_error(c, CS_TYPE_ERROR);
+    if (!lib_int_args(c, args + 1, 1)) return CS_NIL;
+    return cs_io_listen(c, cs_val_as_str(args[0]), val_as_int(args[1]));
+}
+
+static cs_Value lib_accept(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    if (!lib_int_args(c, args, 1)) return CS_NIL;
+    return cs_io_accept(c, val_as_int(args[0]));
+}
+
+// (connect host port)
+static cs_Value lib_connect(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    if (!val_is_text(args[0])) return cs_runtime_error(c, CS_TYPE_ERROR);
+    if (!lib_int_args(c, args + 1, 1)) return CS_NIL;
+    return cs_io_connect(c, cs_val_as_str(args[0]), val_as_int(args[1]));
+}
+
+static cs_Value lib_socket_port(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    if (!lib_int_args(c, args, 1)) return CS_NIL;
+    return cs_io_port(c, val_as_int(args[0]));
+}
+
+// registers the natives every context starts with, before anything is compiled
+void cs_lib_open(cs_Context* c)
+{
+    cs_cfunc(c, "sqrt", sqrt, "d:d");
+    cs_cfunc(c, "floor", floor, "d:d");
+    cs_cfunc(c, "ceil", ceil, "d:d");
+    cs_cfunc(c, "pow", pow, "dd:d");
+    cs_cfunc(c, "strlen", lib_strlen, "s:i");
+
+    vec_init_kernels();
+    cs_cfunc_boxed(c, "vec", lib_vec, 1);
+    cs_cfunc_boxed(c, "make-vec", lib_make_vec, 2);
+    cs_cfunc_boxed(c, "vec-len", lib_vec_len, 1);
+    cs_cfunc_boxed(c, "vec-ref", lib_vec_ref, 2);
+    cs_cfunc_boxed(c, "vec-slice", lib_vec_slice, 3);
+    cs_cfunc_boxed(c, "vec-add", lib_vec_add, 2);
+    cs_cfunc_boxed(c, "vec-sub", lib_vec_sub, 2);
+    cs_cfunc_boxed(c, "vec-mul", lib_vec_mul, 2);
+    cs_cfunc_boxed(c, "vec-div", lib_vec_div, 2);
+    cs_cfunc_boxed(c, "vec-dot", lib_vec_dot, 2);
+    cs_cfunc_boxed(c, "vec-sum", lib_vec_sum, 1);
+    cs_cfunc_boxed(c, "vec-min", lib_vec_min, 1);
+    cs_cfunc_boxed(c, "vec-max", lib_vec_max, 1);
+
+    cs_cfunc_boxed(c, "length", lib_length, 1);
+    cs_cfunc_boxed(c, "nth", lib_nth, 2);
+    cs_cfunc_boxed(c, "reverse", lib_reverse, 1);
+    cs_cfunc_boxed(c, "append", lib_append, 2);
+    cs_cfunc_boxed(c, "map", lib_map, 2);
+    cs_cfunc_boxed(c, "filter", lib_filter, 2);
+    cs_cfunc_boxed(c, "reduce", lib_reduce, 3);
+    cs_cfunc_boxed(c, "sort", lib_sort, 1);
+
+    cs_cfunc_boxed(c, "chan-send", lib_chan_send, 2);
+    cs_cfunc_boxed(c, "chan-try-send", lib_chan_try_send, 2);
+    cs_cfunc_boxed(c, "chan-recv", lib_chan_recv, 1);
+    cs_cfunc_boxed(c, "chan-try-recv", lib_chan_try_recv, 1);
+
+    for (u8 i = 1; i <= CS_TASK_MAX_ARGS + 1; i++) cs_cfunc_boxed(c, "future", lib_future, i);
+    cs_cfunc_boxed(c, "deref", lib_deref, 1);
+    cs_cfunc_boxed(c, "pmap", lib_pmap, 2);
+
+    for (u8 i = 1; i <= CS_CO_MAX_ARGS + 1; i++) cs_cfunc_boxed(c, "spawn", lib_spawn, i);
+    cs_cfunc_boxed(c, "join", lib_join, 1);
+    cs_cfunc_boxed(c, "yield", lib_yield, 0);
+    cs_cfunc_boxed(c, "sleep", lib_sleep, 1);
+    cs_cfunc_boxed(c, "read", lib_read, 2);
+    cs_cfunc_boxed(c, "write", lib_write, 2);
+    cs_cfunc_boxed(c, "close", lib_close, 1);
+    cs_cfunc_boxed(c, "pipe", lib_pipe, 0);
+    cs_cfunc_boxed(c, "listen", lib_listen, 2);
+    cs_cfunc_boxed(c, "accept", lib_accept, 1);
+    cs_cfunc_boxed(c, "connect", lib_connect, 2);
+    cs_cfunc_boxed(c, "socket-port", lib_socket_port, 1);
+}
@@ -1,3 +1,6 @@
 #pragma once
 
 // standart library for cisp
+#include "cisp.h"
+
+void cs_lib_open(cs_Context* c);
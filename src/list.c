@@ -0,0 +1,217 @@
+#include "cisp.h"
+#include "console.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* ==== CHUNKS ==== */
+static void chunk_add_bucket(cs_Context* c)
+{
+    // malloc doesn't align to the chunk size, the space in front of the first aligned chunk is lost
+    u8* mem = cs_malloc(CS_CHUNK_BUCKET_SIZE + CS_CHUNK_SIZE);
+    void* bucket = (void*)(((u64)mem + CS_CHUNK_SIZE - 1) & ~(u64)(CS_CHUNK_SIZE - 1));
+    chunk_bucket_next(bucket) = c->chunk_buckets;
+    c->chunk_buckets = bucket;
+
+    cs_ListChunk* chunks = chunk_bucket_data(bucket);
+    for (u32 i = 0; i < CS_CHUNK_BUCKET_COUNT; i++) {
+        chunks[i].tail = (cs_Value)(i + 1 < CS_CHUNK_BUCKET_COUNT ? &chunks[i + 1] : c->chunk_freelist);
+    }
+    c->chunk_freelist = chunks;
+}
+
+// takes a chunk from the buckets, uninitialized
+cs_ListChunk* cs_chunk_alloc(cs_Context* c)
+{
+    if (c->chunk_freelist == null) chunk_add_bucket(c);
+    cs_ListChunk* chunk = c->chunk_freelist;
+    c->chunk_freelist = (cs_ListChunk*)chunk->tail;
+    return chunk;
+}
+
+// a chunk with nothing in it yet
+cs_ListChunk* cs_make_chunk(cs_Context* c)
+{
+    cs_ListChunk* chunk = c->memory == CS_MEMORY_GC ? cs_gc_alloc_chunk(c) : cs_chunk_alloc(c);
+    chunk->rc = 1; chunk->flags = 0;
+    chunk->front = CS_CHUNK_SLOTS;
+    chunk->tail = CS_NIL;
+    return chunk;
+}
+
+void cs_chunk_free(cs_Context* c, cs_ListChunk* chunk)
+{
+    chunk->tail = (cs_Value)c->chunk_freelist;
+    c->chunk_freelist = chunk;
+}
+
+// frees every chunk at once
+void cs_chunk_clear(cs_Context* c)
+{
+    c->chunk_freelist = null;
+    for (void* bucket = c->chunk_buckets; bucket != null; bucket = chunk_bucket_next(bucket)) {
+        cs_ListChunk* chunks = chunk_bucket_data(bucket);
+        for (u32 i = 0; i < CS_CHUNK_BUCKET_COUNT; i++) cs_chunk_free(c, &chunks[i]);
+    }
+}
+
+/* ==== LISTS ==== */
+// everything here expects val_is_list(list)
+
+cs_Value cs_list_car(cs_Value list)
+{
+    if (val_is_cell(list)) return val_as_obj(list)->car;
+    cs_Value slot = val_as_chunk(list)->slots[val_chunk_slot(list)];
+    if (val_is_kind(slot, CS_PTR_FWD)) return val_as_obj(slot)->car;
+    return slot;
+}
+
+cs_Value cs_list_cdr(cs_Value list)
+{
+    if (val_is_cell(list)) return val_as_obj(list)->cdr;
+    cs_ListChunk* chunk = val_as_chunk(list);
+    u32 i = val_chunk_slot(list);
+    if (val_is_kind(chunk->slots[i], CS_PTR_FWD)) return val_as_obj(chunk->slots[i])->cdr;
+    if (i + 1 < CS_CHUNK_SLOTS) return val_from_chunk(chunk, i + 1);
+    return chunk->tail;
+}
+
+// takes over the references of car and cdr. both are read after allocating,
+// so in gc mode they have to point at roots
+cs_Value cs_list_cons(cs_Context* c, cs_Value* car, cs_Value* cdr)
+{
+    // nothing has been consed onto cdr yet, so it can grow in place. a worker might not own the chunk
+    if (val_is_chunk(*cdr) && c->worker == null) {
+        cs_ListChunk* chunk = val_as_chunk(*cdr);
+        u32 i = val_chunk_slot(*cdr);
+        if (i == chunk->front && i > 0) {
+            chunk->front = i - 1;
+            chunk->slots[i - 1] = *car;
+            cs_gc_write(c, *cdr, *car);
+            if (c->reuse_chunk != null) {
+                cs_chunk_free(c, c->reuse_chunk);
+                c->reuse_chunk = null;
+            }
+            return val_from_chunk(chunk, i - 1);
+        }
+    }
+
+    cs_ListChunk* chunk = c->reuse_chunk;
+    if (chunk != null) {
+        c->reuse_chunk = null;
+        chunk->rc = 1; chunk->flags = 0;
+    } else {
+        chunk = cs_make_chunk(c);
+    }
+    chunk->front = CS_CHUNK_SLOTS - 1;
+    chunk->slots[CS_CHUNK_SLOTS - 1] = *car;
+    chunk->tail = *cdr;
+    return val_from_chunk(chunk, CS_CHUNK_SLOTS - 1);
+}
+
+// returns the old car, whose reference the caller now holds
+cs_Value cs_list_setcar(cs_Context* c, cs_Value list, cs_Value v)
+{
+    cs_Value* field;
+    if (val_is_cell(list)) {
+        field = &val_as_obj(list)->car;
+    } else {
+        cs_Value* slot = &val_as_chunk(list)->slots[val_chunk_slot(list)];
+        if (val_is_kind(*slot, CS_PTR_FWD)) {
+            list = *slot;
+            field = &val_as_obj(list)->car;
+        } else {
+            field = slot;
+        }
+    }
+    cs_Value old = *field;
+    *field = v;
+    cs_gc_write(c, list, v);
+    return old;
+}
+
+// the cdr of a slot can't change, so the slot is replaced by a real cons cell that everyone referencing it
+// sees through the CS_PTR_FWD. returns the old cdr if the caller now holds its reference, nil otherwise
+cs_Value cs_list_setcdr(cs_Context* c, cs_Value* list, cs_Value* v)
+{
+    if (val_is_chunk(*list)) {
+        cs_Value slot = val_as_chunk(*list)->slots[val_chunk_slot(*list)];
+        if (!val_is_kind(slot, CS_PTR_FWD)) {
+            cs_Object* cell = cs_make_object(c);
+            cs_Value* field = &val_as_chunk(*list)->slots[val_chunk_slot(*list)];
+            cell->car = *field;
+            cell->cdr = *v;
+            *field = val_from_ptr(cell, CS_PTR_FWD);
+            cs_gc_write(c, *list, *field);
+            // the rest of the chunk still belongs to it
+            return CS_NIL;
+        }
+        cs_Object* cell = val_as_obj(slot);
+        cs_Value old = cell->cdr;
+        cell->cdr = *v;
+        cs_gc_write(c, slot, *v);
+        return old;
+    }
+    cs_Object* cell = val_as_obj(*list);
+    cs_Value old = cell->cdr;
+    cell->cdr = *v;
+    cs_gc_write(c, *list, *v);
+    return old;
+}
+
+// the values of count registers from first on followed by tail, taking over all of their references.
+// the chunks are filled back to front, whole ones at a time, instead of growing one cons after another
+cs_Value cs_list_from_regs(cs_Context* c, u32 first, u32 count, cs_Value tail)
+{
+    u32 result = cs_native_regs(c, 1);
+    c->stack[result] = tail;
+    while (count > 0) {
+        u32 n = count < CS_CHUNK_SLOTS ? count : CS_CHUNK_SLOTS;
+        cs_ListChunk* chunk = cs_make_chunk(c);
+        count -= n;
+        chunk->front = CS_CHUNK_SLOTS - n;
+        memcpy(&chunk->slots[chunk->front], &c->stack[first + count], sizeof(cs_Value) * n);
+        chunk->tail = c->stack[result];
+        c->stack[result] = val_from_chunk(chunk, chunk->front);
+    }
+    cs_Value list = c->stack[result];
+    cs_native_regs_pop(c, result);
+    return list;
+}
+
+/* ==== VECTORS ==== */
+// what a vector counts as in cs_Context.old_count, in cells of the same size
+#define vec_weight(count) (1 + (count) * sizeof(u64) / sizeof(cs_Object))
+
+// elements are left uninitialized. in gc mode this can run a collection, so arguments have to be read before
+cs_Vector* cs_vec_make(cs_Context* c, u8 kind, u32 count)
+{
+    cs_Vector* vec = cs_malloc(sizeof(cs_Vector) + sizeof(u64) * count);
+    *vec = (cs_Vector) { .kind = kind, .count = count };
+    return cs_vec_adopt(c, vec);
+}
+
+// makes a malloced vector one of the context's, e.g. one copied out of another context
+cs_Vector* cs_vec_adopt(cs_Context* c, cs_Vector* vec)
+{
+    if (c->memory == CS_MEMORY_GC) {
+        if (c->next_major == 0) c->next_major = CS_GC_MAJOR_MIN;
+        if (c->old_count >= c->next_major) cs_gc_minor(c);
+        c->vector_count += 1;
+        cs_ensure_cap((void**)&c->vectors, sizeof(cs_Vector*), &c->vector_cap, c->vector_count);
+        c->vectors[c->vector_count-1] = vec;
+        c->old_count += vec_weight(vec->count);
+    } else if (c->worker != null) {
+        // workers don't count references, their vectors are freed with the rest of their heap
+        c->vector_count += 1;
+        cs_ensure_cap((void**)&c->vectors, sizeof(cs_Vector*), &c->vector_cap, c->vector_count);
+        c->vectors[c->vector_count-1] = vec;
+    }
+    vec->rc = 1; vec->flags = 0;
+    return vec;
+}
+
+void cs_vec_free(cs_Context* c, cs_Vector* vec)
+{
+    if (c->memory == CS_MEMORY_GC) c->old_count -= vec_weight(vec->count);
+    free(vec);
+}
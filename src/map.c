@@ -3,6 +3,42 @@
 #include <stdlib.h>
 #include <string.h>
 
+// the counter of the context the thread allocates for, here so everything that links the maps has it
+static _Thread_local u64* alloc_counter;
+
+u64* cs_count_allocs(u64* counter)
+{
+    u64* prev = alloc_counter;
+    alloc_counter = counter;
+    return prev;
+}
+
+static void* alloc_checked(void* ptr, u64 size)
+{
+    if (ptr == null && size > 0) {
+        log_fatal("OUT OF MEMORY!");
+        exit(-1);
+    }
+    if (alloc_counter != null) *alloc_counter += 1;
+    return ptr;
+}
+
+void* cs_malloc(u64 size)
+{
+    return alloc_checked(malloc(size), size);
+}
+
+void* cs_calloc(u64 count, u64 size)
+{
+    return alloc_checked(calloc(count, size), count * size);
+}
+
+void* cs_realloc(void* ptr, u64 size)
+{
+    return alloc_checked(realloc(ptr, size), size);
+}
+
+
 u32 fnv1a(char* start, char* end)
 {
     u64 magic_prime = 16777619;
@@ -15,17 +51,26 @@ u32 fnv1a(char* start, char* end)
     return hash;
 }
 
+// strings don't change once they are built, so the hash is only computed once.
+// a string that really hashes to 0 just doesn't profit from the cache
+u32 cs_str_hash(cs_Str* str)
+{
+    // workers can hash a string of the context they work for at the same time, they get the same
+    u32 hash = __atomic_load_n(&str->hash, __ATOMIC_RELAXED);
+    if (hash == 0) {
+        hash = fnv1a((char*)str->data, (char*)str->data + str->size);
+        __atomic_store_n(&str->hash, hash, __ATOMIC_RELAXED);
+    }
+    return hash;
+}
+
 cs_HMap cs_hm_init(u8 element_size)
 {
     cs_HMap result;
     result.element_size = sizeof(cs_HMap_bucket) + element_size;
     result.data_cap = 16;
     result.data_used = 0;
-    result.data = malloc(result.element_size * result.data_cap);
-    if (result.data == null) {
-        log_fatal("OUT OF MEMORY");
-        exit(-1);
-    }
+    result.data = cs_malloc(result.element_size * result.data_cap);
     cs_HMap_bucket* buck = result.data;
     for (int i = 0; i < result.data_cap; i++) {
         buck->psl = 255;
@@ -46,10 +91,9 @@ void* cs_hm_geth(cs_HMap* hm, u32 hash)
         if (buck >= end) {
             buck = hm->data;
         }
-        if (buck->hash == hash) return buck->data; // found bucket
-        
         // if bucket is empty or if we hit a bucket with a psl lower than the distance from the starting location 
         if (buck->psl == 255 || buck->psl < psl) return null;
+        if (buck->hash == hash) return buck->data; // found bucket
         buck = advance_ptr(buck, hm->element_size);
         psl++;
     }
@@ -57,30 +101,43 @@ void* cs_hm_geth(cs_HMap* hm, u32 hash)
 
 void* cs_hm_gets(cs_HMap* hm, cs_Str* key)
 {
-    u32 hash = fnv1a((char*)key->data, (char*)key->data + key->size);
+    u32 hash = cs_str_hash(key);
     return cs_hm_geth(hm, hash);
 }
 
-static cs_HMap_bucket* place_bucket(cs_HMap_bucket* cur, u8 psl, u32 hash, u32 element_size, cs_HMap_bucket* end, cs_HMap_bucket* start)
+// inserts hash with robin hood hashing and returns the bucket it ended up in. 
+// *inserted is set to false if the hash already was in the map
+static cs_HMap_bucket* place_bucket(cs_HMap* hm, cs_HMap_bucket* data, u32 cap, u32 hash, bool* inserted)
 {
-    while (psl <= cur->psl) {
-        if (cur >= end) {
-            cur = start;
-        }
-        if (cur->psl == 255 || cur->hash == hash) {
+    u8 carry[sizeof(cs_HMap_bucket) + 256];
+    u8 swap[sizeof(cs_HMap_bucket) + 256];
+    cs_HMap_bucket* carried = (cs_HMap_bucket*)carry;
+    carried->psl = 0; carried->hash = hash;
+
+    cs_HMap_bucket* result = null;
+    u32 slot = hash & (cap - 1);
+    *inserted = true;
+    while (true) {
+        cs_HMap_bucket* cur = advance_ptr(data, hm->element_size * slot);
+        if (cur->psl == 255) {
             // empty bucket found, finished
-            cur->psl = psl;
-            cur->hash = hash;
+            memcpy(cur, carried, hm->element_size);
+            return result != null ? result : cur;
+        }
+        if (result == null && cur->hash == hash) {
+            *inserted = false;
             return cur;
         }
-        cur = advance_ptr(cur, element_size);
-        psl++;
+        if (cur->psl < carried->psl) {
+            // take the slot from the richer bucket and carry that one further
+            memcpy(swap, cur, hm->element_size);
+            memcpy(cur, carried, hm->element_size);
+            memcpy(carried, swap, hm->element_size);
+            if (result == null) result = cur;
+        }
+        slot = (slot + 1) & (cap - 1);
+        carried->psl++;
     }
-    // found bucket to replace
-    cs_HMap_bucket* next = place_bucket(advance_ptr(cur, element_size), cur->psl+1, cur->hash, element_size, end, start);
-    memcpy_s(next, element_size, cur, element_size);
-    cur->psl = psl; cur->hash = hash;
-    return cur;
 }
 
 static void resize_hm(cs_HMap* hm)
@@ -88,7 +145,7 @@ static void resize_hm(cs_HMap* hm)
     u32 old_cap = hm->data_cap;
     hm->data_cap <<= 1;
                                                         // next power of 2
-    cs_HMap_bucket* new = malloc(hm->element_size * (hm->data_cap));
+    cs_HMap_bucket* new = cs_malloc(hm->element_size * (hm->data_cap));
     
     // init new data
     cs_HMap_bucket* new_end = advance_ptr(new, hm->element_size * (hm->data_cap));
@@ -105,10 +162,9 @@ static void resize_hm(cs_HMap* hm)
         // if bucket is not empty
         if (cur->psl != 255) {
             // transfer bucket from old to new position
-            u32 new_slot = cur->hash & (hm->data_cap - 1);
-            cs_HMap_bucket* buck = advance_ptr(new, hm->element_size * new_slot);
-            cs_HMap_bucket* result = place_bucket(buck, 0, cur->hash, hm->element_size, new_end, new);
-            memcpy_s(result->data, hm->element_size - sizeof(cs_HMap_bucket), buck->data, hm->element_size - sizeof(cs_HMap_bucket));
+            bool inserted;
+            cs_HMap_bucket* result = place_bucket(hm, new, hm->data_cap, cur->hash, &inserted);
+            memcpy_s(result->data, hm->element_size - sizeof(cs_HMap_bucket), cur->data, hm->element_size - sizeof(cs_HMap_bucket));
         } 
         cur = advance_ptr(cur, hm->element_size);
     }
@@ -122,16 +178,15 @@ void* cs_hm_seth(cs_HMap* hm, u32 hash)
         resize_hm(hm);
     }
     hash = hash ^ (hash >> 16);
-    u32 slot = hash & (hm->data_cap - 1);
-    cs_HMap_bucket* buck = advance_ptr(hm->data, hm->element_size * slot);
-    hm->data_used++;
-    cs_HMap_bucket* result = place_bucket(buck, 0, hash, hm->element_size, advance_ptr(hm->data, hm->element_size * hm->data_cap), hm->data);
+    bool inserted;
+    cs_HMap_bucket* result = place_bucket(hm, hm->data, hm->data_cap, hash, &inserted);
+    if (inserted) hm->data_used++;
     return result->data;
 }
 
 void* cs_hm_sets(cs_HMap* hm, cs_Str* key)
 {
-    u32 hash = fnv1a((char*)key->data, (char*)key->data + key->size);
+    u32 hash = cs_str_hash(key);
     return cs_hm_seth(hm, hash);
 }
 
@@ -0,0 +1,169 @@
+#include "cisp.h"
+#include "console.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* ==== REGISTRATION ==== */
+static bool native_type_ok(char t)
+{
+    return t == 'i' || t == 'd' || t == 's' || t == 'v';
+}
+
+// binds name to a new function with a single native variant. natives of the same name but another arity
+// are more variants of that function
+static cs_Native* native_add(cs_Context* c, char* name, void* fn, u8 arg_count)
+{
+    u32 len = strlen(name);
+    u32 hash = fnv1a(name, name + len);
+    u32* existing = cs_hm_geth(&c->native_names, hash);
+    u32 fn_id;
+    cs_Function* f;
+    if (existing != null) {
+        fn_id = c->natives[*existing].fn_id;
+        f = cs_get_fn(c, fn_id);
+        if (cs_fn_get_variant(f, arg_count) != null) {
+            log_error("Native function \"%s\" is already registered.", name);
+            return null;
+        }
+    } else {
+        f = cs_make_fn(c, &fn_id);
+        f->title = cs_make_str(name, len);
+    }
+    cs_FunctionBody* fb = cs_fn_add_variant(c, f, -1 - (i8)arg_count);
+    fb->native_func = fn;
+    fb->code_id = c->native_count;
+    if (cs_hm_geth(&c->symbol_names, hash) == null) {
+        *(cs_Str**)cs_hm_seth(&c->symbol_names, hash) = cs_make_str(name, len);
+    }
+
+    c->native_count += 1;
+    cs_ensure_cap((void**)&c->natives, sizeof(cs_Native), &c->native_cap, c->native_count);
+    if (existing == null) *(u32*)cs_hm_seth(&c->native_names, hash) = c->native_count-1;
+    cs_Native* native = &c->natives[c->native_count-1];
+    *native = (cs_Native) { .fn = fn, .fn_id = fn_id, .arg_count = arg_count };
+    return native;
+}
+
+// registers a c function with a typed signature, see cisp.h
+bool cs_cfunc(cs_Context* c, char* name, void* fn, char* signature)
+{
+    char* colon = strchr(signature, ':');
+    u32 arg_count = colon != null ? (u32)(colon - signature) : 0;
+    bool ok = colon != null && arg_count <= CS_NATIVE_MAX_ARGS && native_type_ok(colon[1]) && colon[2] == 0;
+    for (u32 i = 0; ok && i < arg_count; i++) ok = native_type_ok(signature[i]);
+    if (!ok) {
+        log_error("Invalid signature \"%s\" for native function \"%s\".", signature, name);
+        return false;
+    }
+    cs_Native* native = native_add(c, name, fn, (u8)arg_count);
+    if (native == null) return false;
+    memcpy(native->args, signature, arg_count);
+    native->result = colon[1];
+    return true;
+}
+
+// registers a c function that takes its arguments as values, for everything a typed signature can't express
+bool cs_cfunc_boxed(cs_Context* c, char* name, cs_NativeFn fn, u8 arg_count)
+{
+    if (arg_count > FUNCTION_MAX_ARGS) {
+        log_error("Native function \"%s\" takes too many arguments.", name);
+        return false;
+    }
+    cs_Native* native = native_add(c, name, (void*)fn, arg_count);
+    if (native == null) return false;
+    native->boxed = true;
+    return true;
+}
+
+cs_Native* cs_native_find(cs_Context* c, u32 hash)
+{
+    u32* index = cs_hm_geth(&c->native_names, hash);
+    return index != null ? &c->natives[*index] : null;
+}
+
+/* ==== CALLS ==== */
+// every argument is passed either as a 64 bit integer (i64, cs_Str*, cs_Value) or as a double, which go
+// into different registers. the key of a shape is the arg count in the high nibble and a bit per double
+typedef u64 W;
+typedef double D;
+#define NATIVE_SHAPES(R) \
+    case 0x00: r = ((R (*)(void))fn)(); break; \
+    case 0x10: r = ((R (*)(W))fn)(w[0]); break; \
+    case 0x11: r = ((R (*)(D))fn)(d[0]); break; \
+    case 0x20: r = ((R (*)(W, W))fn)(w[0], w[1]); break; \
+    case 0x21: r = ((R (*)(D, W))fn)(d[0], w[1]); break; \
+    case 0x22: r = ((R (*)(W, D))fn)(w[0], d[1]); break; \
+    case 0x23: r = ((R (*)(D, D))fn)(d[0], d[1]); break; \
+    case 0x30: r = ((R (*)(W, W, W))fn)(w[0], w[1], w[2]); break; \
+    case 0x31: r = ((R (*)(D, W, W))fn)(d[0], w[1], w[2]); break; \
+    case 0x32: r = ((R (*)(W, D, W))fn)(w[0], d[1], w[2]); break; \
+    case 0x33: r = ((R (*)(D, D, W))fn)(d[0], d[1], w[2]); break; \
+    case 0x34: r = ((R (*)(W, W, D))fn)(w[0], w[1], d[2]); break; \
+    case 0x35: r = ((R (*)(D, W, D))fn)(d[0], w[1], d[2]); break; \
+    case 0x36: r = ((R (*)(W, D, D))fn)(w[0], d[1], d[2]); break; \
+    case 0x37: r = ((R (*)(D, D, D))fn)(d[0], d[1], d[2]); break; \
+    case 0x40: r = ((R (*)(W, W, W, W))fn)(w[0], w[1], w[2], w[3]); break; \
+    case 0x41: r = ((R (*)(D, W, W, W))fn)(d[0], w[1], w[2], w[3]); break; \
+    case 0x42: r = ((R (*)(W, D, W, W))fn)(w[0], d[1], w[2], w[3]); break; \
+    case 0x43: r = ((R (*)(D, D, W, W))fn)(d[0], d[1], w[2], w[3]); break; \
+    case 0x44: r = ((R (*)(W, W, D, W))fn)(w[0], w[1], d[2], w[3]); break; \
+    case 0x45: r = ((R (*)(D, W, D, W))fn)(d[0], w[1], d[2], w[3]); break; \
+    case 0x46: r = ((R (*)(W, D, D, W))fn)(w[0], d[1], d[2], w[3]); break; \
+    case 0x47: r = ((R (*)(D, D, D, W))fn)(d[0], d[1], d[2], w[3]); break; \
+    case 0x48: r = ((R (*)(W, W, W, D))fn)(w[0], w[1], w[2], d[3]); break; \
+    case 0x49: r = ((R (*)(D, W, W, D))fn)(d[0], w[1], w[2], d[3]); break; \
+    case 0x4a: r = ((R (*)(W, D, W, D))fn)(w[0], d[1], w[2], d[3]); break; \
+    case 0x4b: r = ((R (*)(D, D, W, D))fn)(d[0], d[1], w[2], d[3]); break; \
+    case 0x4c: r = ((R (*)(W, W, D, D))fn)(w[0], w[1], d[2], d[3]); break; \
+    case 0x4d: r = ((R (*)(D, W, D, D))fn)(d[0], w[1], d[2], d[3]); break; \
+    case 0x4e: r = ((R (*)(W, D, D, D))fn)(w[0], d[1], d[2], d[3]); break; \
+    case 0x4f: r = ((R (*)(D, D, D, D))fn)(d[0], d[1], d[2], d[3]); break;
+
+static bool native_arg(char type, cs_Value v, W* w, D* d)
+{
+    i64 i;
+    switch (type) {
+        case 'i': {
+            if (!cs_val_to_i64(v, &i)) return false;
+            *w = (W)i;
+        } break;
+        case 'd': {
+            if (cs_val_to_i64(v, &i)) *d = (D)i;
+            else if (val_is_double(v)) *d = cs_val_as_double(v);
+            else return false;
+        } break;
+        case 's': {
+            if (!val_is_text(v)) return false;
+            *w = (W)cs_val_as_str(v);
+        } break;
+        default: *w = v; break;
+    }
+    return true;
+}
+
+// calls native with the values in args, which are borrowed
+cs_Value cs_native_call(cs_Context* c, cs_Native* native, cs_Value* args)
+{
+    if (native->boxed) return ((cs_NativeFn)native->fn)(c, args, native->arg_count);
+
+    W w[CS_NATIVE_MAX_ARGS]; D d[CS_NATIVE_MAX_ARGS];
+    u32 key = native->arg_count << 4;
+    for (u32 i = 0; i < native->arg_count; i++) {
+        if (!native_arg(native->args[i], args[i], &w[i], &d[i])) return cs_runtime_error(c, CS_TYPE_ERROR);
+        if (native->args[i] == 'd') key |= 1 << i;
+    }
+
+    void* fn = native->fn;
+    if (native->result == 'd') {
+        D r = 0;
+        switch (key) { NATIVE_SHAPES(D) }
+        return cs_val_double(r);
+    }
+    W r = 0;
+    switch (key) { NATIVE_SHAPES(W) }
+    switch (native->result) {
+        case 'i': return cs_val_int(c, (i64)r);
+        case 's': return r != 0 ? val_from_ptr(cs_text_adopt(c, (cs_Str*)r), CS_PTR_ROPE) : CS_NIL;
+        default: return (cs_Value)r;
+    }
+}
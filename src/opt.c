@@ -0,0 +1,313 @@
+#include "cisp.h"
+#include "console.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// control flow analysis of one function at a time: its blocks in reverse postorder, their dominators
+// and the natural loops. the lowering uses it to move code out of loops, see code.c
+
+/* ==== FLOW GRAPH ==== */
+static void flow_order(cs_Context* c, cs_FunctionBody* fb, cs_FlowGraph* g)
+{
+    // forget the previous function
+    for (u32 i = 0; i < g->block_count; i++) g->order[g->blocks[i]->id] = 0;
+    if (g->order_cap < c->cur_bb_id + 1) {
+        g->order = cs_realloc(g->order, sizeof(u32) * (c->cur_bb_id + 1));
+        memset(g->order + g->order_cap, 0, sizeof(u32) * (c->cur_bb_id + 1 - g->order_cap));
+        g->order_cap = c->cur_bb_id + 1;
+    }
+
+    // depth first, a block is done once all of its successors are
+    typedef struct { cs_BasicBlock* bb; u32 next; } Frame;
+    Frame* stack = null; u32 stack_cap = 0; u32 len = 0;
+    cs_BasicBlock** post = null; u32 post_cap = 0; u32 count = 0;
+    len += 1;
+    cs_ensure_cap((void**)&stack, sizeof(Frame), &stack_cap, len);
+    stack[0] = (Frame) { fb->entry, 0 };
+    g->order[fb->entry->id] = ~0u;
+    while (len > 0) {
+        Frame* top = &stack[len-1];
+        cs_BasicBlock* succs[2];
+        u32 succ_count = cs_bb_successors(top->bb, succs);
+        if (top->next < succ_count) {
+            cs_BasicBlock* s = succs[top->next++];
+            if (s == null || g->order[s->id] != 0) continue;
+            g->order[s->id] = ~0u;
+            len += 1;
+            cs_ensure_cap((void**)&stack, sizeof(Frame), &stack_cap, len);
+            stack[len-1] = (Frame) { s, 0 };
+        } else {
+            count += 1;
+            cs_ensure_cap((void**)&post, sizeof(cs_BasicBlock*), &post_cap, count);
+            post[count-1] = top->bb;
+            len -= 1;
+        }
+    }
+    free(stack);
+
+    g->block_count = count;
+    g->blocks = cs_realloc(g->blocks, sizeof(cs_BasicBlock*) * count);
+    for (u32 i = 0; i < count; i++) {
+        g->blocks[i] = post[count - 1 - i];
+        g->order[g->blocks[i]->id] = i + 1;
+    }
+    free(post);
+}
+
+static void flow_preds(cs_FlowGraph* g)
+{
+    u32 n = g->block_count;
+    g->pred_start = cs_realloc(g->pred_start, sizeof(u32) * (n + 1));
+    memset(g->pred_start, 0, sizeof(u32) * (n + 1));
+    for (u32 i = 0; i < n; i++) {
+        cs_BasicBlock* succs[2];
+        u32 succ_count = cs_bb_successors(g->blocks[i], succs);
+        for (u32 s = 0; s < succ_count; s++) {
+            if (succs[s] != null) g->pred_start[g->order[succs[s]->id]] += 1;
+        }
+    }
+    // pred_start[i + 1] counted the preds of i, now it becomes where the ones of i + 1 start
+    for (u32 i = 1; i <= n; i++) g->pred_start[i] += g->pred_start[i-1];
+    g->preds = cs_realloc(g->preds, sizeof(u32) * (g->pred_start[n] + 1));
+    u32* fill = cs_calloc(n + 1, sizeof(u32));
+    for (u32 i = 0; i < n; i++) {
+        cs_BasicBlock* succs[2];
+        u32 succ_count = cs_bb_successors(g->blocks[i], succs);
+        for (u32 s = 0; s < succ_count; s++) {
+            if (succs[s] == null) continue;
+            u32 to = g->order[succs[s]->id] - 1;
+            g->preds[g->pred_start[to] + fill[to]++] = i;
+        }
+    }
+    free(fill);
+}
+
+static u32 intersect(u32* idom, u32 a, u32 b)
+{
+    while (a != b) {
+        while (a > b) a = idom[a];
+        while (b > a) b = idom[b];
+    }
+    return a;
+}
+
+// the iterative algorithm of cooper, harvey and kennedy, which converges after a few passes in reverse postorder
+static void flow_dominators(cs_FlowGraph* g)
+{
+    u32 n = g->block_count;
+    g->idom = cs_realloc(g->idom, sizeof(u32) * (n + 1));
+    g->idom[0] = 0;
+    for (u32 i = 1; i < n; i++) g->idom[i] = ~0u;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (u32 b = 1; b < n; b++) {
+            u32 new_idom = ~0u;
+            for (u32 p = g->pred_start[b]; p < g->pred_start[b+1]; p++) {
+                u32 pred = g->preds[p];
+                if (g->idom[pred] == ~0u) continue;
+                new_idom = new_idom == ~0u ? pred : intersect(g->idom, new_idom, pred);
+            }
+            if (g->idom[b] != new_idom) {
+                g->idom[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+}
+
+static bool index_dominates(cs_FlowGraph* g, u32 a, u32 b)
+{
+    while (b != a && b != 0) b = g->idom[b];
+    return b == a;
+}
+
+// every back edge, a jump to a block that dominates the jumping one, makes a loop of everything that reaches
+// the jump without passing the header. back edges to the same header share the loop
+static void flow_loops(cs_FlowGraph* g)
+{
+    u32 n = g->block_count;
+    g->loop_count = 0;
+    g->member_count = 0;
+    u32* mark = cs_calloc(n + 1, sizeof(u32));
+    u32* work = cs_malloc(sizeof(u32) * (n + 1));
+    for (u32 h = 0; h < n; h++) {
+        u32 latches = 0; u32 latch = 0;
+        for (u32 p = g->pred_start[h]; p < g->pred_start[h+1]; p++) {
+            if (!index_dominates(g, h, g->preds[p])) continue;
+            latches++;
+            latch = g->preds[p];
+        }
+        if (latches == 0) continue;
+
+        g->loop_count += 1;
+        cs_ensure_cap((void**)&g->loops, sizeof(cs_Loop), &g->loop_cap, g->loop_count);
+        cs_Loop* loop = &g->loops[g->loop_count-1];
+        *loop = (cs_Loop) {
+            .header = g->blocks[h],
+            .latch = latches == 1 ? g->blocks[latch] : null,
+            .blocks = (u32*)(u64)g->member_count, // an offset until members stops moving
+        };
+
+        u32 gen = g->loop_count;
+        u32 work_len = 0;
+        mark[h] = gen;
+        for (u32 p = g->pred_start[h]; p < g->pred_start[h+1]; p++) {
+            u32 pred = g->preds[p];
+            if (index_dominates(g, h, pred) && mark[pred] != gen) {
+                mark[pred] = gen;
+                work[work_len++] = pred;
+            }
+        }
+        g->member_count += 1;
+        cs_ensure_cap((void**)&g->members, sizeof(u32), &g->member_cap, g->member_count);
+        g->members[g->member_count-1] = h;
+        while (work_len > 0) {
+            u32 b = work[--work_len];
+            g->member_count += 1;
+            cs_ensure_cap((void**)&g->members, sizeof(u32), &g->member_cap, g->member_count);
+            g->members[g->member_count-1] = b;
+            for (u32 p = g->pred_start[b]; p < g->pred_start[b+1]; p++) {
+                u32 pred = g->preds[p];
+                if (mark[pred] == gen) continue;
+                mark[pred] = gen;
+                work[work_len++] = pred;
+            }
+        }
+        loop->block_count = g->member_count - (u32)(u64)loop->blocks;
+    }
+    free(mark); free(work);
+    for (u32 i = 0; i < g->loop_count; i++) g->loops[i].blocks = g->members + (u64)g->loops[i].blocks;
+
+    // natural loops either nest or don't share any block, so the smaller ones are the inner ones
+    for (u32 i = 1; i < g->loop_count; i++) {
+        cs_Loop loop = g->loops[i];
+        u32 j = i;
+        for (; j > 0 && g->loops[j-1].block_count > loop.block_count; j--) g->loops[j] = g->loops[j-1];
+        g->loops[j] = loop;
+    }
+    g->loop_of = cs_realloc(g->loop_of, sizeof(cs_Loop*) * (n + 1));
+    memset(g->loop_of, 0, sizeof(cs_Loop*) * (n + 1));
+    for (u32 i = 0; i < g->loop_count; i++) {
+        cs_Loop* loop = &g->loops[i];
+        for (u32 m = 0; m < loop->block_count; m++) {
+            u32 b = loop->blocks[m];
+            if (g->loop_of[b] == null) {
+                g->loop_of[b] = loop;
+                continue;
+            }
+            cs_Loop* outer = g->loop_of[b];
+            while (outer->parent != null) outer = outer->parent;
+            if (outer != loop) outer->parent = loop;
+        }
+    }
+
+    // the preheader is the only way into the loop and doesn't go anywhere else
+    for (u32 i = 0; i < g->loop_count; i++) {
+        cs_Loop* loop = &g->loops[i];
+        u32 h = g->order[loop->header->id] - 1;
+        u32 outside = 0; u32 entering = 0;
+        for (u32 p = g->pred_start[h]; p < g->pred_start[h+1]; p++) {
+            if (cs_loop_contains(g, loop, g->blocks[g->preds[p]])) continue;
+            outside++;
+            entering = g->preds[p];
+        }
+        // the entry is also entered by every call of the function
+        if (h != 0 && outside == 1 && ssa_invalid(g->blocks[entering]->jump_cond)) {
+            loop->preheader = g->blocks[entering];
+        }
+    }
+}
+
+// analyzes the blocks of fb. g keeps its memory for the next function, it has to be zeroed before the first use
+void cs_flow_build(cs_Context* c, cs_FunctionBody* fb, cs_FlowGraph* g)
+{
+    flow_order(c, fb, g);
+    flow_preds(g);
+    flow_dominators(g);
+    flow_loops(g);
+}
+
+void cs_flow_free(cs_FlowGraph* g)
+{
+    free(g->blocks); free(g->order); free(g->pred_start); free(g->preds);
+    free(g->idom); free(g->loops); free(g->loop_of); free(g->members);
+    memset(g, 0, sizeof(cs_FlowGraph));
+}
+
+bool cs_flow_dominates(cs_FlowGraph* g, cs_BasicBlock* a, cs_BasicBlock* b)
+{
+    u32 ia = g->order[a->id], ib = g->order[b->id];
+    if (ia == 0 || ib == 0) return false;
+    return index_dominates(g, ia - 1, ib - 1);
+}
+
+cs_BasicBlock* cs_flow_idom(cs_FlowGraph* g, cs_BasicBlock* bb)
+{
+    return g->blocks[g->idom[g->order[bb->id] - 1]];
+}
+
+// the closest block dominating both a and b
+cs_BasicBlock* cs_flow_common_dominator(cs_FlowGraph* g, cs_BasicBlock* a, cs_BasicBlock* b)
+{
+    return g->blocks[intersect(g->idom, g->order[a->id] - 1, g->order[b->id] - 1)];
+}
+
+// null if bb isn't in any loop
+cs_Loop* cs_loop_of(cs_FlowGraph* g, cs_BasicBlock* bb)
+{
+    u32 i = g->order[bb->id];
+    return i != 0 ? g->loop_of[i-1] : null;
+}
+
+bool cs_loop_contains(cs_FlowGraph* g, cs_Loop* loop, cs_BasicBlock* bb)
+{
+    for (cs_Loop* l = cs_loop_of(g, bb); l != null; l = l->parent) {
+        if (l == loop) return true;
+    }
+    return false;
+}
+
+// the number of loops around bb, which is all there is to tell how often it runs
+u32 cs_loop_depth(cs_FlowGraph* g, cs_BasicBlock* bb)
+{
+    u32 depth = 0;
+    for (cs_Loop* l = cs_loop_of(g, bb); l != null; l = l->parent) depth++;
+    return depth;
+}
+
+// gives every loop that is only entered by a branch a block of its own in front of it, which code can be
+// moved into. loops that are entered from more than one place are left alone
+void cs_insert_preheaders(cs_Context* c, cs_FunctionBody* fb)
+{
+    cs_FlowGraph g = {0};
+    cs_flow_build(c, fb, &g);
+    for (u32 i = 0; i < g.loop_count; i++) {
+        cs_Loop* loop = &g.loops[i];
+        u32 h = g.order[loop->header->id] - 1;
+        if (loop->preheader != null || h == 0) continue;
+        u32 outside = 0; cs_BasicBlock* entering = null;
+        for (u32 p = g.pred_start[h]; p < g.pred_start[h+1]; p++) {
+            if (cs_loop_contains(&g, loop, g.blocks[g.preds[p]])) continue;
+            outside++;
+            entering = g.blocks[g.preds[p]];
+        }
+        if (outside != 1 || ssa_eq(entering->jump_cond, ssavar_call)) continue;
+
+        cs_BasicBlock* pre = cs_make_bb(c);
+        char label[256];
+        u32 len = snprintf(label, 256, "%s.preheader#%d", loop->header->label->data, pre->id);
+        pre->label = cs_make_str(label, len);
+        pre->line = loop->header->line;
+        if (entering->a == loop->header) entering->a = pre;
+        if (entering->b == loop->header) entering->b = pre;
+        cs_bb_add_pred(pre, entering);
+        pre->a = loop->header;
+        pre->jump_cond = ssavar_invalid;
+        for (cs_BasicBlockNode* node = loop->header->preds_start; node != null; node = node->tail) {
+            if (node->head == entering) node->head = pre;
+        }
+    }
+    cs_flow_free(&g);
+}
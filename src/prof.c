@@ -0,0 +1,251 @@
+#include "cisp.h"
+#include "console.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+volatile i32 cs_profile_pending = 0;
+
+/* ==== TIMER ==== */
+#ifdef _WIN32
+// wall time instead of the cpu time of SIGPROF, waiting counts too
+static void profile_timer(void* arg)
+{
+    cs_Profile* profile = arg;
+    while (__atomic_load_n(&profile->running, __ATOMIC_ACQUIRE)) {
+        Sleep(CS_PROFILE_INTERVAL_US / 1000);
+        __atomic_store_n(&cs_profile_pending, 1, __ATOMIC_RELAXED);
+    }
+}
+#else
+static struct sigaction old_action;
+
+static void profile_signal(int sig)
+{
+    (void)sig;
+    __atomic_store_n(&cs_profile_pending, 1, __ATOMIC_RELAXED);
+}
+#endif
+
+// samples the code c runs until cs_profile_stop. only one context can be profiled at a time
+void cs_profile_start(cs_Context* c, cs_Profile* profile)
+{
+    *profile = (cs_Profile) { .stacks_by_hash = cs_hm_init(sizeof(u32)), .running = true };
+    c->profile = profile;
+    __atomic_store_n(&cs_profile_pending, 0, __ATOMIC_RELAXED);
+#ifdef _WIN32
+    if (!cs_thread_start(&profile->timer, profile_timer, profile)) {
+        log_warn("The profiler could not start its timer.");
+        profile->running = false;
+    }
+#else
+    struct sigaction action = {0};
+    action.sa_handler = profile_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &old_action);
+    struct itimerval timer = {
+        .it_interval = { .tv_sec = 0, .tv_usec = CS_PROFILE_INTERVAL_US },
+        .it_value = { .tv_sec = 0, .tv_usec = CS_PROFILE_INTERVAL_US },
+    };
+    setitimer(ITIMER_PROF, &timer, null);
+#endif
+}
+
+void cs_profile_stop(cs_Context* c)
+{
+    cs_Profile* profile = c->profile;
+    if (profile == null) return;
+    c->profile = null;
+#ifdef _WIN32
+    if (profile->running) {
+        __atomic_store_n(&profile->running, false, __ATOMIC_RELEASE);
+        cs_thread_join(profile->timer);
+    }
+#else
+    struct itimerval timer = {0};
+    setitimer(ITIMER_PROF, &timer, null);
+    sigaction(SIGPROF, &old_action, null);
+    profile->running = false;
+#endif
+    __atomic_store_n(&cs_profile_pending, 0, __ATOMIC_RELAXED);
+}
+
+/* ==== SAMPLES ==== */
+static bool stack_equal(cs_Profile* profile, cs_ProfileStack* stack, cs_ProfileFrame* frames, u32 depth)
+{
+    if (stack->depth != depth) return false;
+    return memcmp(&profile->frames[stack->first], frames, sizeof(cs_ProfileFrame) * depth) == 0;
+}
+
+// fn runs ins, its callers are frames[0 .. frame_count) of c
+void cs_profile_sample(cs_Context* c, cs_Code* code, cs_CodeFn* fn, cs_CodeIns* ins, u32 frame_count)
+{
+    __atomic_store_n(&cs_profile_pending, 0, __ATOMIC_RELAXED);
+    cs_Profile* profile = c->profile;
+    if (profile->code == null) profile->code = code;
+    // natives can only call back into the code c runs, anything else can't be labeled
+    if (profile->code != code) return;
+
+    u32 first = frame_count + 1 > CS_PROFILE_MAX_DEPTH ? frame_count + 1 - CS_PROFILE_MAX_DEPTH : 0;
+    cs_ProfileFrame frames[CS_PROFILE_MAX_DEPTH];
+    u32 depth = 0;
+    for (u32 i = first; i < frame_count; i++) {
+        cs_VMFrame* frame = &c->frames[i];
+        u32 call = frame->call - code->ins;
+        frames[depth++] = (cs_ProfileFrame) {
+            .fn = frame->fn - code->fns, .line = cs_code_line(code, call), .block = cs_code_block(code, call),
+        };
+    }
+    u32 at = ins - code->ins;
+    frames[depth++] = (cs_ProfileFrame) { .fn = fn - code->fns, .line = cs_code_line(code, at), .block = cs_code_block(code, at) };
+    profile->sample_count += 1;
+
+    u32 hash = fnv1a((char*)frames, (char*)(frames + depth));
+    u32* head = cs_hm_geth(&profile->stacks_by_hash, hash);
+    for (u32 i = head != null ? *head : ~0u; i != ~0u; i = profile->stacks[i].next) {
+        if (stack_equal(profile, &profile->stacks[i], frames, depth)) {
+            profile->stacks[i].count += 1;
+            return;
+        }
+    }
+
+    cs_ensure_cap((void**)&profile->frames, sizeof(cs_ProfileFrame), &profile->frame_cap, profile->frame_count + depth);
+    memcpy(&profile->frames[profile->frame_count], frames, sizeof(cs_ProfileFrame) * depth);
+    cs_ensure_cap((void**)&profile->stacks, sizeof(cs_ProfileStack), &profile->stack_cap, profile->stack_count + 1);
+    u32 index = profile->stack_count++;
+    profile->stacks[index] = (cs_ProfileStack) {
+        .hash = hash, .first = profile->frame_count, .depth = depth, .count = 1, .next = head != null ? *head : ~0u,
+    };
+    profile->frame_count += depth;
+    *(u32*)cs_hm_seth(&profile->stacks_by_hash, hash) = index;
+}
+
+/* ==== OUTPUT ==== */
+static void write_frame(cs_Writer* w, cs_Code* code, cs_ProfileFrame frame)
+{
+    cs_CodeFn* fn = &code->fns[frame.fn];
+    if (fn->title != ~0u) cs_writef(w, "%s", cstr(code->consts[fn->title].str_));
+    else cs_writef(w, "fn_%u", fn->fn_id);
+    if (frame.line != 0) cs_writef(w, ":%u", frame.line);
+    if (frame.block != ~0u) cs_writef(w, ":b%u", frame.block);
+}
+
+// one line per stack: the frames from the outermost on, separated by ';', and how often it was sampled.
+// that's the input of flamegraph.pl and the tools that read its format
+void cs_profile_write(cs_Profile* profile, cs_Writer* w)
+{
+    for (u32 i = 0; i < profile->stack_count; i++) {
+        cs_ProfileStack* stack = &profile->stacks[i];
+        for (u32 j = 0; j < stack->depth; j++) {
+            if (j > 0) cs_write(w, ";", 1);
+            write_frame(w, profile->code, profile->frames[stack->first + j]);
+        }
+        cs_writef(w, " %u\n", stack->count);
+    }
+}
+
+void cs_profile_free(cs_Profile* profile)
+{
+    cs_hm_free(&profile->stacks_by_hash);
+    free(profile->stacks);
+    free(profile->frames);
+    *profile = (cs_Profile) {0};
+}
+
+static char* with_extension(char* source_path, char* ext)
+{
+    u32 len = strlen(source_path);
+    char* result = cs_malloc(len + strlen(ext) + 1);
+    memcpy(result, source_path, len + 1);
+    if (len >= 5 && strcmp(source_path + len - 5, ".cisp") == 0) result[len - 5] = 0;
+    strcat(result, ext);
+    return result;
+}
+
+// file.cisp => file.folded
+char* cs_profile_path(char* source_path)
+{
+    return with_extension(source_path, ".folded");
+}
+
+/* ==== BLOCK COUNTS ==== */
+#define CS_COUNTS_VERSION 1
+
+void cs_counts_reserve(cs_BlockCounts* counts, u32 bb_count)
+{
+    if (bb_count <= counts->bb_count) return;
+    counts->blocks = cs_realloc(counts->blocks, sizeof(u64) * bb_count);
+    counts->taken = cs_realloc(counts->taken, sizeof(u64) * bb_count);
+    u32 added = bb_count - counts->bb_count;
+    memset(counts->blocks + counts->bb_count, 0, sizeof(u64) * added);
+    memset(counts->taken + counts->bb_count, 0, sizeof(u64) * added);
+    counts->bb_count = bb_count;
+}
+
+// "pgo <version> <source hash> <bb count>", then "<bb id> <runs> <taken>" for every block that ran
+void cs_counts_write(cs_BlockCounts* counts, cs_Writer* w)
+{
+    cs_writef(w, "pgo %u %u %u\n", CS_COUNTS_VERSION, counts->source_hash, counts->bb_count);
+    for (u32 i = 0; i < counts->bb_count; i++) {
+        if (counts->blocks[i] == 0) continue;
+        cs_writef(w, "%u %llu %llu\n", i, counts->blocks[i], counts->taken[i]);
+    }
+}
+
+static bool counts_u64(char** cur, u64* out)
+{
+    char* end;
+    while (**cur == ' ' || **cur == '\t' || **cur == '\r' || **cur == '\n') *cur += 1;
+    if (**cur < '0' || **cur > '9') return false;
+    *out = strtoull(*cur, &end, 10);
+    *cur = end;
+    return true;
+}
+
+// data is null terminated. false if it isn't what cs_counts_write wrote for a source with source_hash
+bool cs_counts_read(cs_BlockCounts* counts, char* data, u32 source_hash)
+{
+    *counts = (cs_BlockCounts) {0};
+    char* cur = data;
+    u64 version, hash, bb_count;
+    if (strncmp(cur, "pgo", 3) != 0) return false;
+    cur += 3;
+    if (!counts_u64(&cur, &version) || version != CS_COUNTS_VERSION) return false;
+    if (!counts_u64(&cur, &hash) || hash != source_hash) return false;
+    if (!counts_u64(&cur, &bb_count) || bb_count > UINT32_MAX) return false;
+    counts->source_hash = source_hash;
+    cs_counts_reserve(counts, (u32)bb_count);
+
+    u64 id, runs, taken;
+    while (counts_u64(&cur, &id)) {
+        if (id >= bb_count || !counts_u64(&cur, &runs) || !counts_u64(&cur, &taken) || taken > runs) {
+            cs_counts_free(counts);
+            return false;
+        }
+        counts->blocks[id] = runs;
+        counts->taken[id] = taken;
+    }
+    return true;
+}
+
+void cs_counts_free(cs_BlockCounts* counts)
+{
+    free(counts->blocks);
+    free(counts->taken);
+    *counts = (cs_BlockCounts) {0};
+}
+
+// file.cisp => file.pgo
+char* cs_counts_path(char* source_path)
+{
+    return with_extension(source_path, ".pgo");
+}
@@ -0,0 +1,545 @@
+#include "cisp.h"
+#include "console.h"
+#include <stdlib.h>
+#include <string.h>
+
+// reference counting for cs_Code. it runs after lowering, where every phi already is a move
+// in its predecessor, so the ownership of a register can be read off its liveness:
+//  - every definition owns one reference, which a consuming use (cons, the value of setcar/setcdr,
+//    setglobal, mov, ret) takes over. after the last use the reference is released instead
+//  - a register is only retained if it is consumed and still needed afterwards
+//  - arguments are borrowed: the caller keeps its reference and the callee never releases them
+//  - fields and globals are loaded without a reference and only retained if they are kept around
+// afterwards retains that are released again before anything could free the object are dropped,
+// and a release that is followed by a cons hands the freed cell to it.
+
+#define bit_get(set, i) (((set)[(i) >> 6] >> ((i) & 63)) & 1)
+#define bit_set(set, i) ((set)[(i) >> 6] |= 1ull << ((i) & 63))
+#define bit_clear(set, i) ((set)[(i) >> 6] &= ~(1ull << ((i) & 63)))
+
+#define RC_REMOVED CS_OPKIND_COUNT
+
+typedef struct {
+    u16 regs[FUNCTION_MAX_ARGS + 2];
+    bool consumed[FUNCTION_MAX_ARGS + 2];
+    u32 count;
+} rc_Uses;
+
+typedef struct {
+    cs_Code* code;
+    cs_CodeFn* fn;
+    bool gc;                // only clear dead registers
+    cs_CodeIns* ins;        // instructions of fn in the old code
+    cs_CodeIns* src; u32 src_start; // copy of the old code from instruction src_start on
+    u32 words;              // u64's per register set
+
+    u32* block_of;          // instruction => block
+    u32* starts; u32 block_count;   // block => first instruction, followed by the end
+    u32 (*succs)[2]; u8* succ_count;
+    u32* pred_count; u32* pred; // pred is the last predecessor found
+    u64* gen; u64* kill;    // registers used before they are defined / defined in a block
+    u64* live_in; u64* live_out;
+    bool* managed;          // register => may hold a counted object
+
+    // output
+    cs_CodeIns* out; u32 out_count, out_cap;
+    cs_CodeIns* tmp; u32 tmp_count, tmp_cap; // the current block, backwards
+    u32* new_start;         // block => first instruction in out
+    u32* term;              // block => its terminator in out
+    cs_CodeLine* old_lines; // code->lines from first_line on, before instructions moved
+    u32 first_line;
+    cs_CodeBlock* old_blocks; // code->blocks from first_block on
+    u32 first_block;
+} cs_RcPass;
+
+static void ins_uses(cs_Code* code, cs_CodeIns* ins, rc_Uses* u)
+{
+    u->count = 0;
+#define use(reg, consume) if ((reg) != CS_REG_NONE) { u->regs[u->count] = (reg); u->consumed[u->count++] = (consume); }
+    switch (ins->op) {
+        case CS_LOADI: case CS_LOADF: case CS_LOADS: case CS_LOADK: case CS_LOADSYM:
+        case CS_LOADFUN: case CS_LOADTRUE: case CS_LOADFALSE: case CS_LOADNIL:
+        case CS_GETGLOBAL: case CS_JMP:
+            break;
+        case CS_MOV: case CS_SETGLOBAL: case CS_RET: use(ins->a, true); break;
+        case CS_CONS: use(ins->a, true); use(ins->b, true); break;
+        case CS_SETCAR:
+        case CS_SETCDR: use(ins->a, false); use(ins->b, true); break;
+        case CS_BR: case CS_REF_RETAIN: case CS_REF_RELEASE: use(ins->a, false); break;
+        // an induction variable updated in place, the old value is released by the instruction
+        case CS_ADDI: case CS_SUBI: use(ins->a, ins->a == ins->dest); use(ins->b, false); break;
+        case CS_DYNCALL: use(ins->b, false); // fallthrough
+        case CS_CALL:
+        case CS_CALLC:
+        case CS_CONCAT: {
+            for (u32 i = 0; i < ins->a; i++) use(code->args[ins->aux2 + i], false);
+        } break;
+        default: use(ins->a, false); use(ins->b, false); break;
+    }
+#undef use
+}
+
+// the result aliases a reference that is owned by something else
+static bool is_borrowed_load(cs_OpKind op)
+{
+    return op == CS_GETCAR || op == CS_GETCDR || op == CS_GETGLOBAL || op == CS_SETCAR || op == CS_SETCDR;
+}
+
+static bool is_terminator(cs_OpKind op)
+{
+    return op == CS_JMP || op == CS_BR || op == CS_RET;
+}
+
+// instructions that can drop the last reference of some object
+static bool may_free(cs_OpKind op)
+{
+    return op == CS_CALL || op == CS_CALLC || op == CS_DYNCALL || op == CS_REF_RELEASE || op == CS_SETCAR || op == CS_SETCDR
+        || op == CS_SETGLOBAL || is_terminator(op);
+}
+
+static bool defines_uncounted(cs_Code* code, cs_CodeIns* ins)
+{
+    switch (ins->op) {
+        case CS_LOADI: {
+            i64 i = code->consts[ins->aux].int_;
+            return i >= CS_INT_MIN && i <= CS_INT_MAX;
+        }
+        // strings are never freed
+        case CS_LOADF: case CS_LOADS: case CS_LOADK: case CS_LOADSYM: case CS_LOADFUN:
+        case CS_LOADTRUE: case CS_LOADFALSE: case CS_LOADNIL:
+        case CS_NOT: case CS_EQV: case CS_LTV: case CS_GTV: case CS_LEQV: case CS_GEQV:
+        case CS_EQI: case CS_LTI: case CS_GTI: case CS_LEQI: case CS_GEQI:
+        case CS_EQVI: case CS_LTVI: case CS_GTVI: case CS_LEQVI: case CS_GEQVI:
+        case CS_EQF: case CS_LTF: case CS_GTF: case CS_LEQF: case CS_GEQF:
+        case CS_EQVF: case CS_LTVF: case CS_GTVF: case CS_LEQVF: case CS_GEQVF:
+            return true;
+        default: return false;
+    }
+}
+
+static bool is_param(cs_RcPass* p, u16 reg)
+{
+    return (i32)reg < p->fn->arg_count;
+}
+
+// registers that only ever hold immediates, strings or bools don't need reference counting
+static void find_managed(cs_RcPass* p)
+{
+    for (u32 r = 0; r < p->fn->reg_count; r++) p->managed[r] = is_param(p, r);
+    for (u32 i = 0; i < p->fn->ins_count; i++) {
+        cs_CodeIns* ins = &p->ins[i];
+        if (ins->dest == CS_REG_NONE || ins->op == CS_MOV) continue;
+        if (!defines_uncounted(p->code, ins)) p->managed[ins->dest] = true;
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (u32 i = 0; i < p->fn->ins_count; i++) {
+            cs_CodeIns* ins = &p->ins[i];
+            if (ins->op != CS_MOV || p->managed[ins->dest] || !p->managed[ins->a]) continue;
+            p->managed[ins->dest] = true;
+            changed = true;
+        }
+    }
+}
+
+static void find_blocks(cs_RcPass* p)
+{
+    u32 n = p->fn->ins_count;
+    u32 first = p->fn->first_ins;
+    bool* leader = cs_calloc(n + 1, sizeof(bool));
+    leader[0] = true;
+    for (u32 i = 0; i < n; i++) {
+        cs_CodeIns* ins = &p->ins[i];
+        if (ins->op == CS_JMP) leader[ins->aux - first] = true;
+        if (ins->op == CS_BR) {
+            leader[ins->aux - first] = true;
+            leader[ins->aux2 - first] = true;
+        }
+        if (is_terminator(ins->op)) leader[i + 1] = true;
+    }
+
+    p->block_count = 0;
+    for (u32 i = 0; i < n; i++) {
+        if (leader[i]) p->starts[p->block_count++] = i;
+        p->block_of[i] = p->block_count - 1;
+    }
+    p->starts[p->block_count] = n;
+    free(leader);
+
+    memset(p->pred_count, 0, sizeof(u32) * p->block_count);
+    p->pred_count[0] = 1; // the call
+    for (u32 b = 0; b < p->block_count; b++) {
+        cs_CodeIns* last = &p->ins[p->starts[b+1] - 1];
+        u8 count = 0;
+        if (last->op == CS_JMP) p->succs[b][count++] = p->block_of[last->aux - first];
+        else if (last->op == CS_BR) {
+            p->succs[b][count++] = p->block_of[last->aux - first];
+            p->succs[b][count++] = p->block_of[last->aux2 - first];
+        } else if (last->op != CS_RET && b + 1 < p->block_count) {
+            p->succs[b][count++] = b + 1;
+        }
+        p->succ_count[b] = count;
+        for (u8 s = 0; s < count; s++) {
+            p->pred_count[p->succs[b][s]] += 1;
+            p->pred[p->succs[b][s]] = b;
+        }
+    }
+}
+
+static void find_liveness(cs_RcPass* p)
+{
+    u32 w = p->words;
+    u32 size = sizeof(u64) * w * p->block_count;
+    memset(p->gen, 0, size); memset(p->kill, 0, size);
+    memset(p->live_in, 0, size); memset(p->live_out, 0, size);
+
+    rc_Uses u;
+    for (u32 b = 0; b < p->block_count; b++) {
+        u64* gen = &p->gen[b * w]; u64* kill = &p->kill[b * w];
+        for (u32 i = p->starts[b]; i < p->starts[b+1]; i++) {
+            cs_CodeIns* ins = &p->ins[i];
+            ins_uses(p->code, ins, &u);
+            for (u32 k = 0; k < u.count; k++) {
+                if (!bit_get(kill, u.regs[k])) bit_set(gen, u.regs[k]);
+            }
+            if (ins->dest != CS_REG_NONE) bit_set(kill, ins->dest);
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (u32 b = p->block_count; b-- > 0;) {
+            u64* out = &p->live_out[b * w]; u64* in = &p->live_in[b * w];
+            u64* gen = &p->gen[b * w]; u64* kill = &p->kill[b * w];
+            for (u32 k = 0; k < w; k++) {
+                u64 o = 0;
+                for (u8 s = 0; s < p->succ_count[b]; s++) o |= p->live_in[p->succs[b][s] * w + k];
+                u64 i = gen[k] | (o & ~kill[k]);
+                if (o != out[k] || i != in[k]) changed = true;
+                out[k] = o; in[k] = i;
+            }
+        }
+    }
+}
+
+static void push_tmp(cs_RcPass* p, cs_CodeIns ins)
+{
+    p->tmp_count += 1;
+    cs_ensure_cap((void**)&p->tmp, sizeof(cs_CodeIns), &p->tmp_cap, p->tmp_count);
+    p->tmp[p->tmp_count-1] = ins;
+}
+
+static void push_out(cs_RcPass* p, cs_CodeIns ins)
+{
+    p->out_count += 1;
+    cs_ensure_cap((void**)&p->out, sizeof(cs_CodeIns), &p->out_cap, p->out_count);
+    p->out[p->out_count-1] = ins;
+}
+
+static cs_CodeIns rc_ins(cs_OpKind op, u16 reg)
+{
+    return (cs_CodeIns) { .op = op, .dest = CS_REG_NONE, .a = reg, .b = 0 };
+}
+
+// with a tracing gc there is nothing to count, but a dead register is still cleared,
+// so that the roots only keep live values around
+static cs_CodeIns release_ins(cs_RcPass* p, u16 reg)
+{
+    if (p->gc) return (cs_CodeIns) { .op = CS_LOADNIL, .dest = reg };
+    return rc_ins(CS_REF_RELEASE, reg);
+}
+
+// registers that are still owned at the end of pred but dead in succ
+static void edge_releases(cs_RcPass* p, u32 pred, u32 succ, void (*push)(cs_RcPass* p, cs_CodeIns ins))
+{
+    u32 w = p->words;
+    for (u32 k = 0; k < w; k++) {
+        u64 dead = p->live_out[pred * w + k] & ~p->live_in[succ * w + k];
+        while (dead != 0) {
+            u16 reg = (u16)(k * 64 + __builtin_ctzll(dead));
+            dead &= dead - 1;
+            if (p->managed[reg] && !is_param(p, reg)) push(p, release_ins(p, reg));
+        }
+    }
+}
+
+// places the retains and releases of block b, walking backwards from the registers live at its end
+static void place_block(cs_RcPass* p, u32 b, u64* live)
+{
+    u32 w = p->words;
+    memcpy(live, &p->live_out[b * w], sizeof(u64) * w);
+    p->tmp_count = 0;
+
+    rc_Uses u;
+    cs_CodeIns before[FUNCTION_MAX_ARGS + 4]; u32 before_count;
+    cs_CodeIns after[FUNCTION_MAX_ARGS + 4]; u32 after_count;
+    for (u32 i = p->starts[b+1]; i-- > p->starts[b];) {
+        cs_CodeIns* ins = &p->ins[i];
+        ins_uses(p->code, ins, &u);
+        before_count = 0; after_count = 0;
+
+        u16 dest = ins->dest;
+        if (ins->op == CS_MOV && !bit_get(live, dest)) {
+            // a phi that is never read, its move doesn't take a reference
+            u.consumed[0] = false;
+            dest = CS_REG_NONE;
+        }
+        if (dest != CS_REG_NONE && p->managed[dest]) {
+            bool dest_live = bit_get(live, dest);
+            if (is_borrowed_load(ins->op)) {
+                if (dest_live && !p->gc) after[after_count++] = rc_ins(CS_REF_RETAIN, dest);
+            } else if (!dest_live) {
+                after[after_count++] = release_ins(p, dest);
+            }
+        }
+        for (u32 k = 0; k < u.count; k++) {
+            u16 reg = u.regs[k];
+            bool seen = false;
+            for (u32 j = 0; j < k; j++) seen |= u.regs[j] == reg;
+            if (seen || !p->managed[reg]) continue;
+            u32 consumes = 0;
+            for (u32 j = k; j < u.count; j++) consumes += u.regs[j] == reg && u.consumed[j];
+
+            if (is_param(p, reg)) {
+                for (u32 j = 0; j < consumes && !p->gc; j++) before[before_count++] = rc_ins(CS_REF_RETAIN, reg);
+                continue;
+            }
+            u32 needed = consumes + (bit_get(live, reg) && reg != dest);
+            if (needed == 0) {
+                if (reg != dest) after[after_count++] = release_ins(p, reg);
+            }
+            for (u32 j = 1; j < needed && !p->gc; j++) before[before_count++] = rc_ins(CS_REF_RETAIN, reg);
+        }
+
+        if (ins->dest != CS_REG_NONE) bit_clear(live, ins->dest);
+        for (u32 k = 0; k < u.count; k++) bit_set(live, u.regs[k]);
+
+        // the block ends with its terminator, so whatever comes after it is done before
+        if (is_terminator(ins->op)) {
+            push_tmp(p, *ins);
+            for (u32 k = after_count; k-- > 0;) push_tmp(p, after[k]);
+        } else {
+            for (u32 k = after_count; k-- > 0;) push_tmp(p, after[k]);
+            push_tmp(p, *ins);
+        }
+        for (u32 k = before_count; k-- > 0;) push_tmp(p, before[k]);
+    }
+    if (b != 0 && p->pred_count[b] == 1) edge_releases(p, p->pred[b], b, push_tmp);
+}
+
+// retain r ... release r cancel out, as long as nothing in between can free the object
+static void fuse_pairs(cs_RcPass* p, u32 start)
+{
+    cs_CodeIns* out = p->out;
+    rc_Uses u;
+    for (u32 i = start; i < p->out_count; i++) {
+        if (out[i].op != CS_REF_RETAIN) continue;
+        u16 reg = out[i].a;
+        for (u32 j = i + 1; j < p->out_count; j++) {
+            cs_CodeIns* ins = &out[j];
+            if (ins->op == RC_REMOVED) continue;
+            if (ins->op == CS_REF_RELEASE && ins->a == reg) {
+                out[i].op = RC_REMOVED;
+                ins->op = RC_REMOVED;
+                break;
+            }
+            if (may_free(ins->op) || ins->dest == reg) break;
+            ins_uses(p->code, ins, &u);
+            bool consumed = false;
+            for (u32 k = 0; k < u.count; k++) consumed |= u.regs[k] == reg && u.consumed[k];
+            if (consumed) break;
+        }
+    }
+    u32 count = start;
+    for (u32 i = start; i < p->out_count; i++) {
+        if (out[i].op != RC_REMOVED) out[count++] = out[i];
+    }
+    p->out_count = count;
+}
+
+// a cell that dies right before a cons is reused by it, unless a call in between could take it first
+static void pair_reuse(cs_RcPass* p, u32 start)
+{
+    u32 pending = ~0u;
+    for (u32 i = start; i < p->out_count; i++) {
+        cs_CodeIns* ins = &p->out[i];
+        if (ins->op == CS_REF_RELEASE) pending = i;
+        else if (ins->op == CS_CALL || ins->op == CS_CALLC || ins->op == CS_DYNCALL) pending = ~0u;
+        else if (ins->op == CS_CONS && pending != ~0u) {
+            p->out[pending].b = 1;
+            ins->aux = 1;
+            pending = ~0u;
+        }
+    }
+}
+
+// the lines of fn move to the starts of the blocks they are in
+static void rc_lines(cs_RcPass* p, u32 first, u32 n)
+{
+    cs_CodeLine* old = p->old_lines;
+    u32 count = p->code->line_count - p->first_line;
+    u32 lo = 0, hi = count;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        if (old[mid].ins < first) lo = mid + 1;
+        else hi = mid;
+    }
+    for (u32 i = lo; i < count && old[i].ins < first + n; i++) {
+        p->code->lines[p->first_line + i].ins = p->new_start[p->block_of[old[i].ins - first]];
+    }
+}
+
+// the blocks of fn move to the starts of the blocks of the pass they are in. a block the one before falls
+// through into shares the pass's block with it and keeps the first start, the later one is dropped in
+// cs_code_insert_rc. new_start grows with the block, so the entries stay sorted
+static void rc_blocks(cs_RcPass* p, u32 first, u32 n)
+{
+    cs_CodeBlock* old = p->old_blocks;
+    u32 count = p->code->block_count - p->first_block;
+    u32 lo = 0, hi = count;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        if (old[mid].ins < first) lo = mid + 1;
+        else hi = mid;
+    }
+    for (u32 i = lo; i < count && old[i].ins < first + n; i++) {
+        p->code->blocks[p->first_block + i].ins = p->new_start[p->block_of[old[i].ins - first]];
+    }
+}
+
+static int line_cmp(const void* a, const void* b)
+{
+    u32 x = ((cs_CodeLine*)a)->ins, y = ((cs_CodeLine*)b)->ins;
+    return x < y ? -1 : x > y;
+}
+
+static void rc_fn(cs_RcPass* p)
+{
+    cs_CodeFn* fn = p->fn;
+    u32 n = fn->ins_count;
+    u32 first = fn->first_ins;
+    u32 fn_start = p->out_count;
+    if (n == 0) {
+        fn->first_ins = fn_start;
+        return;
+    }
+
+    p->ins = &p->src[first - p->src_start];
+    p->words = (fn->reg_count + 63) / 64;
+    if (p->words == 0) p->words = 1;
+    p->block_of = cs_malloc(sizeof(u32) * n);
+    p->starts = cs_malloc(sizeof(u32) * (n + 1));
+    p->succs = cs_malloc(sizeof(u32[2]) * n);
+    p->succ_count = cs_malloc(n);
+    p->pred_count = cs_malloc(sizeof(u32) * n);
+    p->pred = cs_malloc(sizeof(u32) * n);
+    p->managed = cs_malloc(fn->reg_count + 1);
+    find_managed(p);
+    find_blocks(p);
+
+    u32 w = p->words;
+    u32 sets = w * p->block_count;
+    p->gen = cs_malloc(sizeof(u64) * sets); p->kill = cs_malloc(sizeof(u64) * sets);
+    p->live_in = cs_malloc(sizeof(u64) * sets); p->live_out = cs_malloc(sizeof(u64) * sets);
+    find_liveness(p);
+
+    p->new_start = cs_malloc(sizeof(u32) * p->block_count);
+    p->term = cs_malloc(sizeof(u32) * p->block_count);
+    u64* live = cs_malloc(sizeof(u64) * w);
+    for (u32 b = 0; b < p->block_count; b++) {
+        place_block(p, b, live);
+        u32 start = p->out_count;
+        p->new_start[b] = start;
+        for (u32 k = p->tmp_count; k-- > 0;) push_out(p, p->tmp[k]);
+        fuse_pairs(p, start);
+        pair_reuse(p, start);
+        p->term[b] = p->out_count - 1;
+    }
+    free(live);
+
+    // jumps still hold old instruction indices, the edges that release something get a block of their own
+    u32 stubs_start = p->out_count;
+    for (u32 i = fn_start; i < stubs_start; i++) {
+        cs_CodeIns* ins = &p->out[i];
+        if (ins->op == CS_JMP) ins->aux = p->new_start[p->block_of[ins->aux - first]];
+        else if (ins->op == CS_BR) {
+            ins->aux = p->new_start[p->block_of[ins->aux - first]];
+            ins->aux2 = p->new_start[p->block_of[ins->aux2 - first]];
+        }
+    }
+    for (u32 b = 0; b < p->block_count; b++) {
+        cs_CodeIns* br = &p->out[p->term[b]];
+        if (br->op != CS_BR) continue;
+        for (u8 s = 0; s < p->succ_count[b]; s++) {
+            u32 succ = p->succs[b][s];
+            if (p->pred_count[succ] == 1) continue;
+            u32 stub = p->out_count;
+            edge_releases(p, b, succ, push_out);
+            if (p->out_count == stub) continue;
+            cs_CodeIns jmp = { .op = CS_JMP, .dest = CS_REG_NONE, .aux = p->new_start[succ] };
+            push_out(p, jmp);
+            br = &p->out[p->term[b]];
+            if (s == 0) br->aux = stub;
+            else br->aux2 = stub;
+        }
+    }
+
+    fn->first_ins = fn_start;
+    fn->ins_count = p->out_count - fn_start;
+    rc_lines(p, first, n);
+    rc_blocks(p, first, n);
+
+    free(p->block_of); free(p->starts); free(p->succs); free(p->succ_count);
+    free(p->pred_count); free(p->pred); free(p->managed);
+    free(p->gen); free(p->kill); free(p->live_in); free(p->live_out);
+    free(p->new_start); free(p->term);
+}
+
+// the functions from first_fn on, whose instructions and lines come after those of the ones before.
+// the repl only passes the functions it just appended, the code before them already has its ops
+void cs_code_insert_rc(cs_Code* code, cs_Memory memory, u32 first_fn)
+{
+    cs_RcPass p = {0};
+    p.code = code;
+    p.gc = memory == CS_MEMORY_GC;
+    u32 first_ins = first_fn < code->fn_count ? code->fns[first_fn].first_ins : code->ins_count;
+    u32 count = code->ins_count - first_ins;
+    p.src = cs_malloc(sizeof(cs_CodeIns) * count + 1);
+    if (count > 0) memcpy(p.src, &code->ins[first_ins], sizeof(cs_CodeIns) * count);
+    p.src_start = first_ins;
+    // the instructions are rewritten in place, after the ones that stay
+    p.out = code->ins;
+    p.out_count = first_ins;
+    p.out_cap = code->ins_count;
+    if (p.out_cap < 4) p.out_cap = 4;
+    p.out = cs_realloc(p.out, sizeof(cs_CodeIns) * p.out_cap);
+
+    p.first_line = 0;
+    while (p.first_line < code->line_count && code->lines[p.first_line].ins < first_ins) p.first_line++;
+    u32 line_count = code->line_count - p.first_line;
+    p.old_lines = cs_malloc(sizeof(cs_CodeLine) * line_count + 1);
+    if (line_count > 0) memcpy(p.old_lines, &code->lines[p.first_line], sizeof(cs_CodeLine) * line_count);
+    p.first_block = 0;
+    while (p.first_block < code->block_count && code->blocks[p.first_block].ins < first_ins) p.first_block++;
+    u32 block_count = code->block_count - p.first_block;
+    p.old_blocks = cs_malloc(sizeof(cs_CodeBlock) * block_count + 1);
+    if (block_count > 0) memcpy(p.old_blocks, &code->blocks[p.first_block], sizeof(cs_CodeBlock) * block_count);
+    for (u32 f = first_fn; f < code->fn_count; f++) {
+        p.fn = &code->fns[f];
+        rc_fn(&p);
+    }
+    qsort(&code->lines[p.first_line], line_count, sizeof(cs_CodeLine), line_cmp);
+    u32 kept = p.first_block;
+    for (u32 i = p.first_block; i < code->block_count; i++) {
+        if (kept > 0 && code->blocks[kept-1].ins == code->blocks[i].ins) continue;
+        code->blocks[kept++] = code->blocks[i];
+    }
+    code->block_count = kept;
+    free(p.src); free(p.tmp); free(p.old_lines); free(p.old_blocks);
+    code->ins = p.out;
+    code->ins_count = p.out_count;
+    code->ins_cap = p.out_cap;
+    if (!p.gc) code->flags |= CS_CODE_RC;
+}
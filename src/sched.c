@@ -0,0 +1,920 @@
+#include "cisp.h"
+#include "console.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+/* ==== THREADS ==== */
+typedef struct {
+    cs_ThreadFn fn;
+    void* arg;
+} cs_ThreadStart;
+
+#ifdef _WIN32
+static DWORD WINAPI thread_main(void* p)
+#else
+static void* thread_main(void* p)
+#endif
+{
+    cs_ThreadStart start = *(cs_ThreadStart*)p;
+    free(p);
+    start.fn(start.arg);
+#ifdef _WIN32
+    return 0;
+#else
+    return null;
+#endif
+}
+
+bool cs_thread_start(cs_Thread* thread, cs_ThreadFn fn, void* arg)
+{
+    cs_ThreadStart* start = cs_malloc(sizeof(cs_ThreadStart));
+    *start = (cs_ThreadStart) { .fn = fn, .arg = arg };
+#ifdef _WIN32
+    HANDLE handle = CreateThread(null, 0, thread_main, start, 0, null);
+    if (handle == null) {
+        free(start);
+        return false;
+    }
+    *thread = (cs_Thread)handle;
+#else
+    pthread_t handle;
+    if (pthread_create(&handle, null, thread_main, start) != 0) {
+        free(start);
+        return false;
+    }
+    *thread = (cs_Thread)handle;
+#endif
+    return true;
+}
+
+void cs_thread_join(cs_Thread thread)
+{
+#ifdef _WIN32
+    WaitForSingleObject((HANDLE)thread, INFINITE);
+    CloseHandle((HANDLE)thread);
+#else
+    pthread_join((pthread_t)thread, null);
+#endif
+}
+
+u32 cs_core_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (u32)count : 1;
+#endif
+}
+
+// for threads waiting on each other: the first calls with the same counter return right away,
+// then the thread gives up its time slice and at last it sleeps a little every time
+void cs_backoff(u32* spins)
+{
+    *spins += 1;
+    if (*spins < 64) return;
+#ifdef _WIN32
+    Sleep(*spins < 256 ? 0 : 1);
+#else
+    if (*spins < 256) {
+        sched_yield();
+        return;
+    }
+    struct timespec t = { .tv_sec = 0, .tv_nsec = 50 * 1000 };
+    nanosleep(&t, null);
+#endif
+}
+
+/* ==== CHANNELS ==== */
+cs_Channel* cs_channel_make(u32 cap)
+{
+    u32 count = 2;
+    while (count < cap) count *= 2;
+    cs_Channel* ch = cs_calloc(1, sizeof(cs_Channel));
+    ch->slots = cs_malloc(sizeof(cs_ChannelSlot) * count);
+    ch->mask = count - 1;
+    for (u32 i = 0; i < count; i++) ch->slots[i] = (cs_ChannelSlot) { .seq = i };
+    return ch;
+}
+
+// only once no thread uses it anymore, the data still in it is lost
+void cs_channel_free(cs_Channel* ch)
+{
+    if (ch == null) return;
+    free(ch->slots);
+    free(ch);
+}
+
+// false if the channel is full. data can't be null
+bool cs_channel_try_send(cs_Channel* ch, void* data)
+{
+    u64 pos = __atomic_load_n(&ch->tail, __ATOMIC_RELAXED);
+    while (true) {
+        cs_ChannelSlot* slot = &ch->slots[pos & ch->mask];
+        u64 seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        i64 diff = (i64)(seq - pos);
+        if (diff == 0) {
+            // a failed exchange loads the tail another sender moved on to
+            if (__atomic_compare_exchange_n(&ch->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->data = data;
+                __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (diff < 0) {
+            // the receiver of the last round didn't take the slot yet
+            return false;
+        } else {
+            pos = __atomic_load_n(&ch->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// null if the channel is empty
+void* cs_channel_try_recv(cs_Channel* ch)
+{
+    u64 pos = __atomic_load_n(&ch->head, __ATOMIC_RELAXED);
+    while (true) {
+        cs_ChannelSlot* slot = &ch->slots[pos & ch->mask];
+        u64 seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        i64 diff = (i64)(seq - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ch->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                void* data = slot->data;
+                // the slot comes around again one lap later
+                __atomic_store_n(&slot->seq, pos + ch->mask + 1, __ATOMIC_RELEASE);
+                return data;
+            }
+        } else if (diff < 0) {
+            return null;
+        } else {
+            pos = __atomic_load_n(&ch->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// waits while the channel is full
+void cs_channel_send(cs_Channel* ch, void* data)
+{
+    u32 spins = 0;
+    while (!cs_channel_try_send(ch, data)) cs_backoff(&spins);
+}
+
+// waits while the channel is empty
+void* cs_channel_recv(cs_Channel* ch)
+{
+    u32 spins = 0;
+    void* data;
+    while ((data = cs_channel_try_recv(ch)) == null) cs_backoff(&spins);
+    return data;
+}
+
+/* ==== MESSAGES ==== */
+// copying a value walks its objects once, shared ones and cycles are found by their address
+
+#define message_ref(index, kind) val_from_ptr((u64)(index) << 3, (kind))
+#define message_index(v) ((u32)((u64)val_as_ptr(v) >> 3))
+
+typedef struct {
+    u64* keys;      // 0 is free, no heap reference is 0
+    u32* indices;
+    u32 count, cap;
+} cs_CopyMap;
+
+static u32* copymap_slot(cs_CopyMap* map, u64 key)
+{
+    if ((map->count + 1) * 2 > map->cap) {
+        cs_CopyMap grown = { .cap = map->cap < 64 ? 64 : map->cap * 2, .count = map->count };
+        grown.keys = cs_calloc(grown.cap, sizeof(u64));
+        grown.indices = cs_malloc(sizeof(u32) * grown.cap);
+        for (u32 i = 0; i < map->cap; i++) {
+            if (map->keys[i] == 0) continue;
+            u32 j = (u32)((map->keys[i] * 0x9E3779B97F4A7C15ull) >> 32) & (grown.cap - 1);
+            while (grown.keys[j] != 0) j = (j + 1) & (grown.cap - 1);
+            grown.keys[j] = map->keys[i];
+            grown.indices[j] = map->indices[i];
+        }
+        free(map->keys); free(map->indices);
+        *map = grown;
+    }
+    u32 i = (u32)((key * 0x9E3779B97F4A7C15ull) >> 32) & (map->cap - 1);
+    while (map->keys[i] != 0 && map->keys[i] != key) i = (i + 1) & (map->cap - 1);
+    if (map->keys[i] == 0) {
+        map->keys[i] = key;
+        map->indices[i] = ~0u;
+        map->count += 1;
+    }
+    return &map->indices[i];
+}
+
+static u32 message_add(cs_Message* m, cs_MessageNode node)
+{
+    m->node_count += 1;
+    cs_ensure_cap((void**)&m->nodes, sizeof(cs_MessageNode), &m->node_cap, m->node_count);
+    m->nodes[m->node_count-1] = node;
+    return m->node_count - 1;
+}
+
+// v as it is referred to inside of m. lists get their node now, their fields are copied later
+static cs_Value message_copy(cs_Message* m, cs_CopyMap* seen, cs_Value v)
+{
+    // a future belongs to the context that made it
+    if (val_is_future(v)) return CS_NIL;
+    if (!val_is_ptr(v)) return v;
+    u32* index = copymap_slot(seen, v);
+    if (*index != ~0u) return message_ref(*index, m->nodes[*index].kind);
+
+    cs_MessageNode node = { .car = CS_NIL, .cdr = CS_NIL };
+    if (val_is_text(v)) {
+        // strings and ropes arrive as flat strings
+        cs_Str* str = cs_val_as_str(v);
+        node.kind = CS_PTR_STR;
+        node.data = cs_make_str(cstr(str), str->size);
+    } else if (val_is_vec(v)) {
+        cs_Vector* vec = val_as_vec(v);
+        u64 size = sizeof(cs_Vector) + sizeof(u64) * vec->count;
+        node.kind = CS_PTR_VEC;
+        node.data = cs_malloc(size);
+        memcpy(node.data, vec, size);
+    } else if (val_is_kind(v, CS_PTR_INT)) {
+        i64 i;
+        cs_val_to_i64(v, &i);
+        node.kind = CS_PTR_INT;
+        node.car = (cs_Value)i;
+    } else {
+        node.kind = CS_PTR_LIST;
+        node.car = v; // the original until the fields are copied
+    }
+    *index = message_add(m, node);
+    return message_ref(*index, node.kind);
+}
+
+// copies everything reachable from v, without allocating in the context
+cs_Message* cs_message_pack(cs_Context* c, cs_Value v)
+{
+    cs_Message* m = cs_calloc(1, sizeof(cs_Message));
+    cs_CopyMap seen = {0};
+    m->root = message_copy(m, &seen, v);
+    for (u32 i = 0; i < m->node_count; i++) {
+        if (m->nodes[i].kind != CS_PTR_LIST) continue;
+        cs_Value list = m->nodes[i].car;
+        cs_Value car = message_copy(m, &seen, cs_list_car(list));
+        cs_Value cdr = message_copy(m, &seen, cs_list_cdr(list));
+        m->nodes[i].car = car;
+        m->nodes[i].cdr = cdr;
+    }
+    free(seen.keys); free(seen.indices);
+    return m;
+}
+
+// makes the value of m in the heap of c, the result owns a reference. m keeps its strings and vectors
+// if copy is set, otherwise they are taken over. every object is made first and kept in registers,
+// so the collector can move them until the fields are set
+static cs_Value message_unpack(cs_Context* c, cs_Message* m, bool copy)
+{
+    u32 first = cs_native_regs(c, m->node_count);
+    for (u32 i = 0; i < m->node_count; i++) {
+        cs_MessageNode* node = &m->nodes[i];
+        cs_Value v = CS_NIL;
+        switch (node->kind) {
+            case CS_PTR_LIST: {
+                cs_Object* cell = cs_make_object(c);
+                cell->car = CS_NIL; cell->cdr = CS_NIL;
+                cell->rc = 1;
+                v = val_from_ptr(cell, CS_PTR_LIST);
+            } break;
+            case CS_PTR_STR: {
+                cs_Str* str = node->data;
+                v = val_from_ptr(cs_text_adopt(c, copy ? cs_make_str(cstr(str), str->size) : str), CS_PTR_ROPE);
+            } break;
+            case CS_PTR_INT: v = cs_val_int(c, (i64)node->car); break;
+            case CS_PTR_VEC: {
+                cs_Vector* vec = node->data;
+                if (copy) {
+                    vec = cs_vec_make(c, vec->kind, vec->count);
+                    memcpy(vec->data, ((cs_Vector*)node->data)->data, sizeof(u64) * vec->count);
+                } else {
+                    cs_vec_adopt(c, vec);
+                }
+                v = val_from_ptr(vec, CS_PTR_VEC);
+            } break;
+        }
+        if (!copy) node->data = null;
+        c->stack[first + i] = v;
+    }
+
+    // nothing is allocated from here on
+    cs_Value* objects = &c->stack[first];
+    #define unpack_ref(v) (val_is_ptr(v) ? objects[message_index(v)] : (v))
+    for (u32 i = 0; i < m->node_count; i++) {
+        if (m->nodes[i].kind != CS_PTR_LIST) continue;
+        cs_Object* cell = val_as_obj(objects[i]);
+        cell->car = unpack_ref(m->nodes[i].car);
+        cell->cdr = unpack_ref(m->nodes[i].cdr);
+        if (c->rc) {
+            cs_val_retain(cell->car);
+            cs_val_retain(cell->cdr);
+        }
+        cs_gc_write(c, objects[i], cell->car);
+        cs_gc_write(c, objects[i], cell->cdr);
+    }
+    cs_Value result = unpack_ref(m->root);
+    #undef unpack_ref
+    if (c->rc) {
+        cs_val_retain(result);
+        for (u32 i = 0; i < m->node_count; i++) cs_val_release(c, c->stack[first + i]);
+    }
+    cs_native_regs_pop(c, first);
+    return result;
+}
+
+// like message_unpack, but frees m
+cs_Value cs_message_unpack(cs_Context* c, cs_Message* m)
+{
+    cs_Value result = message_unpack(c, m, false);
+    cs_message_free(m);
+    return result;
+}
+
+// for messages nobody received, frees the copies too
+void cs_message_free(cs_Message* m)
+{
+    for (u32 i = 0; i < m->node_count; i++) free(m->nodes[i].data);
+    free(m->nodes);
+    free(m);
+}
+
+/* ==== ISOLATES ==== */
+// an isolate suspended at a channel goes back into the queue and the worker takes the next one. it only runs again
+// once a send or receive would go through, so isolates waiting for each other don't need a worker each
+
+// whether a send or receive would go through right now, it may not anymore once it is made
+static bool channel_ready(cs_Channel* ch, bool send)
+{
+    u64 pos = __atomic_load_n(send ? &ch->tail : &ch->head, __ATOMIC_RELAXED);
+    u64 seq = __atomic_load_n(&ch->slots[pos & ch->mask].seq, __ATOMIC_ACQUIRE);
+    return seq == (send ? pos : pos + 1);
+}
+
+// held keeps the waiting isolates the queue has no room for, spawning may fill it
+static void isolate_requeue(cs_Isolates* pool, cs_Isolate* iso, cs_Isolate*** held, u32* held_count, u32* held_cap)
+{
+    if (cs_channel_try_send(pool->queue, iso)) return;
+    cs_ensure_cap((void**)held, sizeof(cs_Isolate*), held_cap, *held_count);
+    (*held)[(*held_count)++] = iso;
+}
+
+static void isolate_worker(void* arg)
+{
+    cs_Isolates* pool = arg;
+    u32 spins = 0;
+    cs_Isolate** held = null; u32 held_count = 0, held_cap = 0;
+    while (true) {
+        while (held_count > 0 && cs_channel_try_send(pool->queue, held[held_count - 1])) held_count -= 1;
+        cs_Isolate* iso = cs_channel_try_recv(pool->queue);
+        if (iso == null && held_count > 0) iso = held[--held_count];
+        if (iso == null) {
+            if (__atomic_load_n(&pool->closing, __ATOMIC_ACQUIRE)) {
+                free(held);
+                return;
+            }
+            cs_backoff(&spins);
+            continue;
+        }
+
+        cs_Context* c = iso->c;
+        if (iso->suspended && !channel_ready(c->blocked, c->blocked_send)) {
+            // only isolates waiting for each other are left if the queue comes around to it again too soon
+            isolate_requeue(pool, iso, &held, &held_count, &held_cap);
+            cs_backoff(&spins);
+            continue;
+        }
+        spins = 0;
+        iso->result = iso->suspended ? cs_run_resume(c) : cs_run(c, iso->code);
+        iso->suspended = c->err == CS_SUSPENDED;
+        if (iso->suspended) {
+            isolate_requeue(pool, iso, &held, &held_count, &held_cap);
+            continue;
+        }
+        __atomic_store_n(&iso->done, true, __ATOMIC_RELEASE);
+        __atomic_fetch_sub(&pool->pending, 1, __ATOMIC_ACQ_REL);
+    }
+}
+
+// worker_count threads, one per core if it is 0
+cs_Isolates* cs_isolates_init(u32 worker_count)
+{
+    if (worker_count == 0) worker_count = cs_core_count();
+    cs_Isolates* pool = cs_calloc(1, sizeof(cs_Isolates));
+    pool->workers = cs_malloc(sizeof(cs_Thread) * worker_count);
+    pool->queue = cs_channel_make(1024);
+    for (u32 i = 0; i < worker_count; i++) {
+        if (!cs_thread_start(&pool->workers[pool->worker_count], isolate_worker, pool)) break;
+        pool->worker_count += 1;
+    }
+    if (pool->worker_count == 0) log_fatal("No worker thread could be started.");
+    return pool;
+}
+
+// runs iso->code in iso->c on one of the workers. neither may be used until iso->done is set,
+// the code can be shared with other isolates
+void cs_isolate_spawn(cs_Isolates* pool, cs_Isolate* iso)
+{
+    iso->c->isolates = pool;
+    iso->result = CS_NIL;
+    iso->suspended = false;
+    iso->done = false;
+    __atomic_fetch_add(&pool->pending, 1, __ATOMIC_ACQ_REL);
+    cs_channel_send(pool->queue, iso);
+}
+
+// until every spawned isolate is done
+void cs_isolates_wait(cs_Isolates* pool)
+{
+    u32 spins = 0;
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) != 0) cs_backoff(&spins);
+}
+
+void cs_isolates_free(cs_Isolates* pool)
+{
+    cs_isolates_wait(pool);
+    __atomic_store_n(&pool->closing, true, __ATOMIC_RELEASE);
+    for (u32 i = 0; i < pool->worker_count; i++) cs_thread_join(pool->workers[i]);
+    for (u32 i = 0; i < CS_CHANNEL_TABLE; i++) {
+        cs_Channel* ch = pool->channels[i];
+        if (ch == null) continue;
+        cs_Message* m;
+        while ((m = cs_channel_try_recv(ch)) != null) cs_message_free(m);
+        cs_channel_free(ch);
+    }
+    cs_channel_free(pool->queue);
+    free(pool->workers);
+    free(pool);
+}
+
+// the channel of a name, opened by whoever asks for it first. null once the table is full
+cs_Channel* cs_isolates_channel(cs_Isolates* pool, u32 name)
+{
+    // 0 marks a free entry
+    if (name == 0) name = 1;
+    for (u32 n = 0; n < CS_CHANNEL_TABLE; n++) {
+        u32 i = (name + n) & (CS_CHANNEL_TABLE - 1);
+        u32 cur = __atomic_load_n(&pool->channel_names[i], __ATOMIC_ACQUIRE);
+        if (cur == 0) {
+            if (__atomic_compare_exchange_n(&pool->channel_names[i], &cur, name, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                cs_Channel* ch = cs_channel_make(CS_CHANNEL_CAP);
+                __atomic_store_n(&pool->channels[i], ch, __ATOMIC_RELEASE);
+                return ch;
+            }
+            // someone else took the entry, cur is its name now
+        }
+        if (cur != name) continue;
+        // the one who set the name is still making the channel
+        u32 spins = 0;
+        cs_Channel* ch;
+        while ((ch = __atomic_load_n(&pool->channels[i], __ATOMIC_ACQUIRE)) == null) cs_backoff(&spins);
+        return ch;
+    }
+    return null;
+}
+
+/* ==== FUTURES ==== */
+#define DEQUE_MIN_CAP 64
+
+static cs_DequeArray* deque_array_make(i64 cap)
+{
+    cs_DequeArray* a = cs_malloc(sizeof(cs_DequeArray) + sizeof(cs_Task*) * cap);
+    a->cap = cap;
+    a->retired = null;
+    return a;
+}
+
+// only by the thread of the deque
+static void deque_push(cs_Deque* d, cs_Task* task)
+{
+    i64 b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    i64 t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    cs_DequeArray* a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+    if (b - t >= a->cap) {
+        // thieves may still read the old array, so it is kept until the deque is freed
+        cs_DequeArray* grown = deque_array_make(a->cap * 2);
+        for (i64 i = t; i < b; i++) {
+            grown->tasks[i & (grown->cap - 1)] = __atomic_load_n(&a->tasks[i & (a->cap - 1)], __ATOMIC_RELAXED);
+        }
+        grown->retired = a;
+        __atomic_store_n(&d->array, grown, __ATOMIC_RELEASE);
+        a = grown;
+    }
+    __atomic_store_n(&a->tasks[b & (a->cap - 1)], task, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+// the task pushed last, only by the thread of the deque
+static cs_Task* deque_take(cs_Deque* d)
+{
+    i64 b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    cs_DequeArray* a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+    // claims the bottom before looking at the top, a thief does it the other way around
+    __atomic_store_n(&d->bottom, b, __ATOMIC_SEQ_CST);
+    i64 t = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+    if (t > b) {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return null;
+    }
+    cs_Task* task = __atomic_load_n(&a->tasks[b & (a->cap - 1)], __ATOMIC_RELAXED);
+    if (t == b) {
+        // the last one, a thief might take it at the same time
+        if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) task = null;
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+// the task pushed first, by any other thread. null if it is empty or another thread was faster
+static cs_Task* deque_steal(cs_Deque* d)
+{
+    i64 t = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+    i64 b = __atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST);
+    if (t >= b) return null;
+    cs_DequeArray* a = __atomic_load_n(&d->array, __ATOMIC_ACQUIRE);
+    cs_Task* task = __atomic_load_n(&a->tasks[t & (a->cap - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return null;
+    return task;
+}
+
+static void deque_free(cs_Deque* d)
+{
+    cs_DequeArray* a = d->array;
+    while (a != null) {
+        cs_DequeArray* retired = a->retired;
+        free(a);
+        a = retired;
+    }
+}
+
+// the worker the thread of c runs tasks in, the owner of the pool uses the first one
+static cs_Worker* futures_self(cs_Context* c)
+{
+    return c->worker != null ? c->worker : c->futures->workers[0];
+}
+
+// the thread's own tasks come first, then those of the others starting at a random one
+static cs_Task* futures_find(cs_Worker* w)
+{
+    cs_Task* task = deque_take(&w->deque);
+    if (task != null) return task;
+    cs_Futures* pool = w->pool;
+    w->seed = w->seed * 1664525 + 1013904223;
+    u32 start = (w->seed >> 16) % pool->worker_count;
+    for (u32 i = 0; i < pool->worker_count; i++) {
+        cs_Worker* victim = pool->workers[(start + i) % pool->worker_count];
+        if (victim == w) continue;
+        task = deque_steal(&victim->deque);
+        if (task != null) return task;
+    }
+    return null;
+}
+
+static void task_run(cs_Worker* w, cs_Task* task);
+
+// runs other tasks on the thread until task is done
+static void task_wait(cs_Context* c, cs_Task* task)
+{
+    if (__atomic_load_n(&task->state, __ATOMIC_ACQUIRE) == CS_TASK_DONE) return;
+    cs_Worker* w = futures_self(c);
+    u32 spins = 0;
+    while (__atomic_load_n(&task->state, __ATOMIC_ACQUIRE) != CS_TASK_DONE) {
+        cs_Task* other = futures_find(w);
+        if (other == null) {
+            cs_backoff(&spins);
+            continue;
+        }
+        spins = 0;
+        task_run(w, other);
+    }
+}
+
+// only once it is done
+static void task_free(cs_Context* c, cs_Task* task)
+{
+    if (task->counted) {
+        for (u32 i = 0; i < task->arg_count; i++) cs_val_release(c, task->args[i]);
+        for (u32 i = 0; i < task->global_count; i++) cs_val_release(c, task->globals[i]);
+        if (task->unpacked) cs_val_release(c, task->value);
+    }
+    if (task->result != null) cs_message_free(task->result);
+    free(task->globals);
+    free(task);
+}
+
+// waits for the tasks c made from first on and frees them, they are the last ones in c->tasks
+static void tasks_finish(cs_Context* c, u32 first)
+{
+    while (c->task_count > first) {
+        cs_Task* task = c->tasks[c->task_count-1];
+        // tasks run meanwhile finish their own before returning, so this one is still the last
+        task_wait(c, task);
+        c->task_count -= 1;
+        task_free(c, task);
+    }
+}
+
+// everything the worker allocated, once nothing it ran can still refer to it
+static void worker_reset(cs_Context* c)
+{
+    cs_pool_clear(&c->obj_pool);
+    cs_chunk_clear(c);
+    for (u32 i = 0; i < c->vector_count; i++) cs_vec_free(c, c->vectors[i]);
+    c->vector_count = 0;
+    for (u32 i = 0; i < c->text_count; i++) cs_text_free(c, c->texts[i]);
+    c->text_count = 0;
+}
+
+// fn over the part of the list a pmap task got
+static cs_Value task_map(cs_Context* c, cs_Task* task)
+{
+    u32 first = cs_native_regs(c, task->map_count);
+    cs_Value list = task->args[0];
+    for (u32 i = 0; i < task->map_count && c->err == CS_OK; i++, list = cs_list_cdr(list)) {
+        cs_Value x = cs_list_car(list);
+        // the call can grow the stack
+        cs_Value y = cs_call(c, task->fn, &x, 1);
+        c->stack[first + i] = y;
+    }
+    cs_Value result = cs_list_from_regs(c, first, task->map_count, CS_NIL);
+    cs_native_regs_pop(c, first);
+    return result;
+}
+
+// the task can be one of the tasks the thread is already running wanted, it runs on top of them
+static void task_run(cs_Worker* w, cs_Task* task)
+{
+    cs_Context* c = &w->c;
+    cs_Value* globals = c->globals; u32 global_count = c->global_count;
+    cs_Error err = c->err; u32 error_count = c->error_count;
+    c->globals = task->globals; c->global_count = task->global_count;
+    c->err = CS_OK;
+    u32 first_task = c->task_count;
+    w->depth += 1;
+
+    cs_Value result = task->map_count > 0 ? task_map(c, task) : cs_call(c, task->fn, task->args, task->arg_count);
+    if (c->err == CS_OK) task->result = cs_message_pack(c, result);
+    else task->err = c->err;
+    // the tasks it made may read what it allocated
+    tasks_finish(c, first_task);
+    if (w->depth == 1) worker_reset(c);
+
+    w->depth -= 1;
+    c->globals = globals; c->global_count = global_count;
+    c->err = err; c->error_count = error_count;
+    __atomic_store_n(&task->state, CS_TASK_DONE, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&w->pool->pending, 1, __ATOMIC_ACQ_REL);
+}
+
+static void futures_worker(void* arg)
+{
+    cs_Worker* w = arg;
+    cs_Futures* pool = w->pool;
+    u32 spins = 0;
+    while (!__atomic_load_n(&pool->closing, __ATOMIC_ACQUIRE)) {
+        cs_Task* task = futures_find(w);
+        if (task == null) {
+            cs_backoff(&spins);
+            continue;
+        }
+        spins = 0;
+        task_run(w, task);
+    }
+}
+
+// one worker per job, the first one has no thread of its own
+static void futures_start(cs_Context* c)
+{
+    u32 count = c->jobs != 0 ? c->jobs : cs_core_count();
+    cs_Futures* pool = cs_calloc(1, sizeof(cs_Futures));
+    pool->workers = cs_malloc(sizeof(cs_Worker*) * count);
+    pool->threads = cs_malloc(sizeof(cs_Thread) * count);
+    pool->worker_count = count;
+    for (u32 i = 0; i < count; i++) {
+        cs_Worker* w = cs_calloc(1, sizeof(cs_Worker));
+        w->pool = pool;
+        w->seed = i + 1;
+        w->deque.array = deque_array_make(DEQUE_MIN_CAP);
+        w->c.obj_pool = cs_pool_init(sizeof(cs_Object));
+        w->c.memory = CS_MEMORY_RC;
+        w->c.futures = pool;
+        w->c.worker = w;
+        w->c.isolates = c->isolates;
+        pool->workers[i] = w;
+    }
+    c->futures = pool;
+    cs_futures_sync(c);
+    for (u32 i = 1; i < count; i++) {
+        // a worker without a thread only runs what the owner's thread pushes onto it, which is nothing
+        if (!cs_thread_start(&pool->threads[i], futures_worker, pool->workers[i])) pool->threads[i] = 0;
+    }
+}
+
+// gives the workers what c runs, before they get anything to do
+void cs_futures_sync(cs_Context* c)
+{
+    cs_Futures* pool = c->futures;
+    cs_Code* code = c->code;
+    for (u32 i = 0; i < pool->worker_count; i++) {
+        cs_Context* wc = &pool->workers[i]->c;
+        wc->functions = c->functions;
+        wc->cur_fn_id = c->cur_fn_id;
+        wc->symbol_names = c->symbol_names;
+        wc->natives = c->natives; wc->native_count = c->native_count;
+        wc->native_names = c->native_names;
+        wc->code = code;
+        wc->counts = c->counts;
+        wc->rc = false;
+        if (code == null) continue;
+        if (wc->cache_cap < code->cache_count) {
+            wc->cache_cap = code->cache_count;
+            wc->caches = cs_realloc(wc->caches, sizeof(cs_CallCache) * wc->cache_cap);
+        }
+        if (code->cache_count > 0) memset(wc->caches, 0, sizeof(cs_CallCache) * code->cache_count);
+        if (wc->megamorphic != null) memset(wc->megamorphic, 0xFF, sizeof(cs_CallTarget) * CS_IC_SHARED_SIZE);
+    }
+}
+
+// a task calling fn with the values of c as they are now
+static cs_Task* task_make(cs_Context* c, cs_Value fn, cs_Value* args, u32 arg_count)
+{
+    cs_Task* task = cs_calloc(1, sizeof(cs_Task));
+    if (c->global_count > 0) task->globals = cs_malloc(sizeof(cs_Value) * c->global_count);
+    task->owner = c;
+    task->fn = fn;
+    task->arg_count = (u8)arg_count;
+    memcpy(task->args, args, sizeof(cs_Value) * arg_count);
+    task->global_count = c->global_count;
+    if (c->global_count > 0) memcpy(task->globals, c->globals, sizeof(cs_Value) * c->global_count);
+    task->state = CS_TASK_PENDING;
+    task->rc = 1;
+    task->value = CS_NIL;
+    task->counted = c->rc;
+    if (task->counted) {
+        for (u32 i = 0; i < arg_count; i++) cs_val_retain(args[i]);
+        for (u32 i = 0; i < task->global_count; i++) cs_val_retain(task->globals[i]);
+    }
+    return task;
+}
+
+static void task_push(cs_Context* c, cs_Task* task)
+{
+    __atomic_fetch_add(&c->futures->pending, 1, __ATOMIC_ACQ_REL);
+    deque_push(&futures_self(c)->deque, task);
+}
+
+// tasks that aren't counted are freed by a major collection or when the worker that made them is done
+static void task_track(cs_Context* c, cs_Task* task)
+{
+    c->task_count += 1;
+    cs_ensure_cap((void**)&c->tasks, sizeof(cs_Task*), &c->task_cap, c->task_count);
+    c->tasks[c->task_count-1] = task;
+}
+
+// starts calling fn with the arguments, which are borrowed, on some thread
+cs_Value cs_future(cs_Context* c, cs_Value fn, cs_Value* args, u32 arg_count)
+{
+    if (!val_is_fn(fn)) return cs_runtime_error(c, CS_VAL_NOT_CALLABLE);
+    if (c->futures == null) futures_start(c);
+    u32 first = cs_native_regs(c, arg_count);
+    memcpy(&c->stack[first], args, sizeof(cs_Value) * arg_count);
+    // in gc mode what the worker reads mustn't move, so everything reachable is promoted first
+    if (c->memory == CS_MEMORY_GC) cs_gc_minor(c);
+    cs_Task* task = task_make(c, fn, &c->stack[first], arg_count);
+    cs_native_regs_pop(c, first);
+    if (!task->counted) task_track(c, task);
+    task_push(c, task);
+    return val_from_ptr(task, CS_PTR_FUTURE);
+}
+
+// the result of the future, waiting for it if it isn't done yet
+cs_Value cs_future_deref(cs_Context* c, cs_Value future)
+{
+    cs_Task* task = val_as_task(future);
+    task_wait(c, task);
+    if (task->err != CS_OK) return cs_runtime_error(c, task->err);
+    // the futures of other contexts were passed into a task, it gets a copy in its own heap
+    if (task->owner != c) return message_unpack(c, task->result, true);
+    if (!task->unpacked) {
+        task->value = message_unpack(c, task->result, true);
+        task->unpacked = true;
+    }
+    if (c->rc) cs_val_retain(task->value);
+    return task->value;
+}
+
+// the last reference to a counted future is gone, or a major collection found it unreachable
+void cs_future_release(cs_Context* c, cs_Task* task)
+{
+    task_wait(c, task);
+    task_free(c, task);
+}
+
+// (pmap f list) with the list split into a few parts per worker, f must not change the list
+cs_Value cs_pmap(cs_Context* c, cs_Value fn, cs_Value list)
+{
+    if (!val_is_fn(fn)) return cs_runtime_error(c, CS_VAL_NOT_CALLABLE);
+    u32 count = 0;
+    for (cs_Value cur = list; cur != CS_NIL; cur = cs_list_cdr(cur), count++) {
+        if (!val_is_list(cur)) return cs_runtime_error(c, CS_TYPE_ERROR);
+    }
+    if (count == 0) return CS_NIL;
+    if (c->futures == null) futures_start(c);
+
+    // the list, then the result built from the back
+    u32 regs = cs_native_regs(c, 2);
+    c->stack[regs] = list;
+    if (c->memory == CS_MEMORY_GC) cs_gc_minor(c);
+    u32 part_count = c->futures->worker_count * 4;
+    if (part_count > count) part_count = count;
+    cs_Task** parts = cs_malloc(sizeof(cs_Task*) * part_count);
+    cs_Value cur = c->stack[regs];
+    for (u32 i = 0; i < part_count; i++) {
+        cs_Task* task = task_make(c, fn, &cur, 1);
+        task->map_count = count / part_count + (i < count % part_count);
+        for (u32 j = 0; j < task->map_count; j++) cur = cs_list_cdr(cur);
+        parts[i] = task;
+        task_push(c, task);
+    }
+
+    cs_Error err = CS_OK;
+    for (u32 i = 0; i < part_count; i++) {
+        task_wait(c, parts[i]);
+        if (err == CS_OK) err = parts[i]->err;
+    }
+    for (u32 i = part_count; i-- > 0 && err == CS_OK;) {
+        cs_Value part = cs_message_unpack(c, parts[i]->result);
+        parts[i]->result = null;
+        // the parts are fresh cells, linking them doesn't allocate
+        cs_Value last = part;
+        while (cs_list_cdr(last) != CS_NIL) last = cs_list_cdr(last);
+        cs_list_setcdr(c, &last, &c->stack[regs + 1]);
+        c->stack[regs + 1] = part;
+    }
+    cs_Value result = c->stack[regs + 1];
+    cs_native_regs_pop(c, regs);
+    for (u32 i = 0; i < part_count; i++) task_free(c, parts[i]);
+    free(parts);
+    if (err != CS_OK) return cs_runtime_error(c, err);
+    return result;
+}
+
+// until every task is done, helping with them
+void cs_futures_wait(cs_Context* c)
+{
+    cs_Futures* pool = c->futures;
+    cs_Worker* w = futures_self(c);
+    u32 spins = 0;
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) != 0) {
+        cs_Task* task = futures_find(w);
+        if (task == null) {
+            cs_backoff(&spins);
+            continue;
+        }
+        spins = 0;
+        task_run(w, task);
+    }
+}
+
+// stops the threads, the futures c still holds keep their results
+void cs_futures_free(cs_Context* c)
+{
+    cs_Futures* pool = c->futures;
+    if (pool == null) return;
+    cs_futures_wait(c);
+    __atomic_store_n(&pool->closing, true, __ATOMIC_RELEASE);
+    for (u32 i = 1; i < pool->worker_count; i++) {
+        if (pool->threads[i] != 0) cs_thread_join(pool->threads[i]);
+    }
+    for (u32 i = 0; i < pool->worker_count; i++) {
+        cs_Worker* w = pool->workers[i];
+        deque_free(&w->deque);
+        cs_loop_free(&w->c);
+        // chunk buckets can't be given back, like those of any context
+        cs_pool_release(&w->c.obj_pool);
+        free(w->c.stack); free(w->c.frames); free(w->c.errors);
+        free(w->c.caches); free(w->c.megamorphic);
+        free(w->c.vectors); free(w->c.texts); free(w->c.tasks);
+        free(w);
+    }
+    free(pool->workers);
+    free(pool->threads);
+    free(pool);
+    c->futures = null;
+}
@@ -0,0 +1,131 @@
+#include "cisp.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define CS_STATS_TSC
+#endif
+
+static char* phase_names[CS_PHASE_COUNT] = {
+    [CS_PHASE_PARSE] = "parse",
+    [CS_PHASE_PREHEADERS] = "preheaders",
+    [CS_PHASE_GLOBALS] = "globals",
+    [CS_PHASE_BLOCKS] = "blocks",
+    [CS_PHASE_TYPES] = "types",
+    [CS_PHASE_FLOW] = "flow",
+    [CS_PHASE_PIN] = "pin",
+    [CS_PHASE_GVN] = "gvn",
+    [CS_PHASE_CELLS] = "cells",
+    [CS_PHASE_LICM] = "licm",
+    [CS_PHASE_IV] = "iv",
+    [CS_PHASE_SINK] = "sink",
+    [CS_PHASE_CODEGEN] = "codegen",
+    [CS_PHASE_LINK] = "link",
+    [CS_PHASE_RC] = "rc",
+    [CS_PHASE_LOWER] = "lower",
+};
+
+/* ==== TIMING ==== */
+static u64 stats_now(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (u64)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+#endif
+}
+
+static u64 stats_cycles(void)
+{
+#ifdef CS_STATS_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+cs_StatsMark cs_stats_begin(cs_Context* c)
+{
+    if (c->stats == null) return (cs_StatsMark) {0};
+    return (cs_StatsMark) { .ns = stats_now(), .cycles = stats_cycles() };
+}
+
+// threads lowering functions end phases at the same time
+void cs_stats_end(cs_Context* c, cs_Phase phase, cs_StatsMark start)
+{
+    if (c->stats == null) return;
+    u64 cycles = stats_cycles() - start.cycles;
+    __atomic_fetch_add(&c->stats->ns[phase], stats_now() - start.ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->stats->cycles[phase], cycles, __ATOMIC_RELAXED);
+}
+
+/* ==== REPORT ==== */
+typedef struct {
+    char* name;
+    u64 peak;   // bytes
+} cs_StatsMemory;
+
+// the arenas and pools of c. a pool only adds a bucket when the others are full
+static u32 stats_memory(cs_Context* c, cs_StatsMemory out[4])
+{
+    out[0] = (cs_StatsMemory) { "functions", c->functions.peak };
+    out[1] = (cs_StatsMemory) { "bbs", c->bbs.peak };
+    out[2] = (cs_StatsMemory) { "comscopes", c->comscopes.peak };
+    out[3] = (cs_StatsMemory) { "obj_pool", (u64)c->obj_pool.bucket_count * CS_POOL_MEM_SIZE };
+    return 4;
+}
+
+void cs_stats_print(cs_Context* c, cs_Writer* w)
+{
+    cs_Stats* s = c->stats;
+    if (s == null) return;
+    cs_writef(w, "%-12s %12s %16s\n", "phase", "ms", "cycles");
+    for (u32 i = 0; i < CS_PHASE_COUNT; i++) {
+        cs_writef(w, "%-12s %12.3f %16llu\n", phase_names[i], (double)s->ns[i] / 1e6, s->cycles[i]);
+    }
+    cs_writef(w, "\nssa: %llu functions, %llu blocks, %llu instructions, %llu phis, %llu edges\n",
+        s->fn_count, s->block_count, s->ins_count, s->phi_count, s->edge_count);
+    cs_writef(w, "bytecode: %u functions, %u instructions\n\n", s->code_fn_count, s->code_ins_count);
+
+    cs_StatsMemory memory[4];
+    u32 count = stats_memory(c, memory);
+    cs_writef(w, "%-12s %12s\n", "memory", "peak bytes");
+    for (u32 i = 0; i < count; i++) cs_writef(w, "%-12s %12llu\n", memory[i].name, memory[i].peak);
+    cs_writef(w, "allocations: %llu\n", c->alloc_count);
+}
+
+void cs_stats_json(cs_Context* c, cs_Writer* w)
+{
+    cs_Stats* s = c->stats;
+    if (s == null) return;
+    cs_writef(w, "{\n  \"phases\": {\n");
+    for (u32 i = 0; i < CS_PHASE_COUNT; i++) {
+        cs_writef(w, "    \"%s\": { \"ns\": %llu, \"cycles\": %llu }%s\n",
+            phase_names[i], s->ns[i], s->cycles[i], i + 1 < CS_PHASE_COUNT ? "," : "");
+    }
+    cs_writef(w, "  },\n  \"ssa\": { \"functions\": %llu, \"blocks\": %llu, \"instructions\": %llu, \"phis\": %llu, "
+        "\"edges\": %llu },\n", s->fn_count, s->block_count, s->ins_count, s->phi_count, s->edge_count);
+    cs_writef(w, "  \"bytecode\": { \"functions\": %u, \"instructions\": %u },\n", s->code_fn_count, s->code_ins_count);
+
+    cs_StatsMemory memory[4];
+    u32 count = stats_memory(c, memory);
+    cs_writef(w, "  \"memory\": {");
+    for (u32 i = 0; i < count; i++) {
+        cs_writef(w, " \"%s\": %llu%s", memory[i].name, memory[i].peak, i + 1 < count ? "," : "");
+    }
+    cs_writef(w, " },\n  \"allocations\": %llu\n}\n", c->alloc_count);
+}
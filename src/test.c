@@ -1,32 +1,760 @@
+#include "cisp.h"
 #include "map.h"
 #include "common.h"
 #include "console.h"
+#include "lib.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+static u32 failed = 0;
+
 // TEST HMAP
 
-int main()
+static void test_hmap()
 {
     cs_HMap hm = cs_hm_init(5);
-    init_console();
     for (int i = 0; i < 1500; i++) {
         u32 hash = rand() % UINT32_MAX;
-        log_debug("%d: %u", i, hash);
         char buf[10];
         snprintf(buf, 10, "%04d", i);
         char* str = cs_hm_seth(&hm, hash);
         memcpy_s(str, 5, buf, 5);
         str[4] = 0;
         char* result = cs_hm_geth(&hm, hash);
-        if (str == result) {
-            log_debug("%d: %s => %s; %s\n", i, str, result, "PASSED");
-        } else {
-            log_error("%d: %s => %s; %s\n", i, str, result, "FAILED");
-            return -1;
+        if (str != result) {
+            log_error("hmap %d: %s => %s; %s\n", i, str, result, "FAILED");
+            failed += 1;
+            break;
         }
-    }    
+    }
     cs_hm_free(&hm);
-}
\ No newline at end of file
+}
+
+// TEST PROGRAMS
+
+// what the program printed as its value, or its errors one per line. open registers more natives if set
+static char* run_source(cs_Memory memory, void (*open)(cs_Context* c), char* src)
+{
+    cs_Context c = cs_init();
+    c.memory = memory;
+    cs_lib_open(&c);
+    if (open != null) open(&c);
+    u32 len = strlen(src);
+    char* content = malloc(len + 1);
+    memcpy(content, src, len + 1);
+
+    cs_Writer w = cs_writer_init(null);
+    cs_Code* code = cs_compile_file(&c, content, len);
+    cs_Value result = code != null && c.error_count == 0 ? cs_run(&c, code) : (cs_Value) {0};
+    if (c.error_count > 0) {
+        for (u32 i = 0; i < c.error_count; i++) cs_writef(&w, "ERROR: %s\n", cs_get_error_string_at(&c, i));
+    } else {
+        cs_print_value(&c, &w, result);
+    }
+    cs_futures_free(&c);
+    cs_loop_free(&c);
+    cs_write(&w, "", 1);
+    char* out = malloc(w.len);
+    memcpy(out, w.data, w.len);
+    cs_writer_free(&w);
+    return out;
+}
+
+// runs src with reference counting and with the gc, both have to print want
+static void expect_with(char* name, void (*open)(cs_Context* c), char* src, char* want)
+{
+    cs_Memory modes[] = { CS_MEMORY_RC, CS_MEMORY_GC };
+    for (u32 m = 0; m < 2; m++) {
+        char* out = run_source(modes[m], open, src);
+        if (strcmp(out, want) != 0) {
+            log_error("%s (%s): \"%s\", expected \"%s\"", name, m == 0 ? "rc" : "gc", out, want);
+            failed += 1;
+        }
+        free(out);
+    }
+}
+
+static void expect(char* name, char* src, char* want)
+{
+    expect_with(name, null, src, want);
+}
+
+// literals are exact: ints up to 64 bits and floats rounded correctly, also where the fast paths can't be used
+static void test_number_literals()
+{
+    expect("int limits", "(cons 9223372036854775807 (cons -9223372036854775808 (cons 12e3 (cons -0 nil))))",
+        "(9223372036854775807 -9223372036854775808 12000 0)");
+    expect("floats", "(cons 1.5e-3 (cons 0.1 (cons 1.23e27 (cons 1.0e400 nil))))", "(0.0015 0.1 1.23e+27 inf)");
+    expect("correct rounding", "(cons (== 0.1 (/ 1.0 10.0)) (cons (== 2.4703282292062328e-324 4.9406564584124654e-324)"
+        " (cons (== 3.0000000000000000000001 3.0) (cons 9007199254740993.0 nil))))", "(true true true 9007199254740992.0)");
+    expect("int overflow", "(+ 1 9223372036854775808)", "ERROR: Integer literal does not fit into 64 bits at 1:6\n");
+    expect("missing exponent", "(+ 1 1e)", "ERROR: Missing digits after exponent at 1:8\n");
+}
+
+// loads of a cell that is never built read its fields, even after numbering merged the fields
+static void test_scalar_replacement()
+{
+    expect("car of a repeated constant", "(+ 5 (car (cons 5 1)))", "10");
+    expect("cdr of a repeated constant", "(+ 7 (cdr (cons 1 7)))", "14");
+    expect("cdr of a repeated sum", "(defn f [x] (+ (+ x 1) (cdr (cons 0 (+ x 1)))))\n(f 4)", "10");
+    expect("escaping cell", "(defn f [c] (car c))\n(let (c (cons 3 4)))\n(+ (f c) (cdr c))", "7");
+}
+
+// strings made at run time are freed once nothing refers to them, the ones still referred to stay intact
+static void test_strings()
+{
+    char* pad = "(let (p \"0123456789012345678901234567890123456789012345678901234567890123\"))\n";
+    char src[1024];
+    snprintf(src, sizeof(src), "%s(defn f [a] (+ p a))\n(let (c (cons (f \"x\") nil)) (s (f \"y\")))\n"
+        "(let (s (+ s s)) (t (+ \"<\" (+ s \">\"))))\n(cons (strlen (car c)) (cons (strlen t) (cons (== s (+ (f \"y\") (f \"y\"))) nil)))", pad);
+    expect("shared strings", src, "(65 132 true)");
+    snprintf(src, sizeof(src), "%s(let (i 0) (s \"\"))\n(while (< i 20000) (let (s (+ (+ s \"ab\") p)) (i (+ i 1))))\n"
+        "(let (t (+ s \"!\")) (s \"\"))\n(strlen t)", pad);
+    expect("rope chain", src, "1320001");
+
+    // in gc mode the strings nobody refers to are swept
+    cs_Context c = cs_init();
+    c.memory = CS_MEMORY_GC;
+    cs_lib_open(&c);
+    char* loop = "(defn f [a] (+ \"a string that is long enough to be a rope when it is concatenated\" (+ a a)))\n"
+        "(let (i 0) (n 0))\n(while (< i 200000) (let (n (+ n (strlen (f \"x\")))) (i (+ i 1))))\nn";
+    u32 len = strlen(loop);
+    char* content = malloc(len + 1);
+    memcpy(content, loop, len + 1);
+    cs_Code* code = cs_compile_file(&c, content, len);
+    cs_Value result = cs_run(&c, code);
+    i64 n = 0;
+    if (!cs_val_to_i64(result, &n) || n != 200000 * 67 || c.text_count > 100000) {
+        log_error("string sweep: %lld characters, %u strings left", n, c.text_count);
+        failed += 1;
+    }
+}
+
+// after a broken form compiling continues with the next top-level one, every error is reported once
+static void test_error_recovery()
+{
+    expect("nested line", "(defn f [x] (bad\n  x)\n(cons 1 2))\n(defn g [] 5)\n(g) (h)",
+        "ERROR: Symbol could not be found at 1:17\nERROR: Symbol could not be found at 5:7\n");
+    expect("line in a string", "(let (x (bad)) (s \"a\n(cons 1 2)\"))\n(h)",
+        "ERROR: Symbol could not be found at 1:13\nERROR: Symbol could not be found at 3:3\n");
+    expect("unclosed form", "(defn f [x] (bad x)\n(defn g [] (also-bad))",
+        "ERROR: Symbol could not be found at 1:17\nERROR: Symbol could not be found at 2:21\n");
+}
+
+static cs_Code* compile_source(cs_Context* c, char* src)
+{
+    *c = cs_init();
+    cs_lib_open(c);
+    u32 len = strlen(src);
+    char* content = malloc(len + 1);
+    memcpy(content, src, len + 1);
+    return cs_compile_file(c, content, len);
+}
+
+// TEST OPTIMIZATIONS
+
+static bool is_mul(u16 op)
+{
+    return op == CS_MULI || op == CS_MULV || op == CS_MULVI || op == CS_MULF || op == CS_MULVF;
+}
+
+// checks every variant and clone of the function named title: how many multiplications it has, and whether
+// they all come before the first loop. a loop starts at the target of a jump back. only clones for numbers
+// can hoist, a generic multiplication could fail in a loop that never runs
+static void check_muls(char* name, cs_Code* code, char* title, u32 want, bool before_loop)
+{
+    u32 checked = 0;
+    for (u32 f = 0; f < code->fn_count; f++) {
+        cs_CodeFn* fn = &code->fns[f];
+        if (fn->title == ~0u || strcmp(cstr(code->consts[fn->title].str_), title) != 0) continue;
+        u32 end = fn->first_ins + fn->ins_count;
+        u32 loop_start = end, count = 0, last = 0;
+        for (u32 i = fn->first_ins; i < end; i++) {
+            cs_CodeIns* ins = &code->ins[i];
+            if (ins->op == CS_JMP && ins->aux <= i && ins->aux < loop_start) loop_start = ins->aux;
+            if (ins->op == CS_BR && ins->aux <= i && ins->aux < loop_start) loop_start = ins->aux;
+            if (ins->op == CS_BR && ins->aux2 <= i && ins->aux2 < loop_start) loop_start = ins->aux2;
+            if (is_mul(ins->op)) {
+                count += 1;
+                last = i;
+            }
+        }
+        if (count != want || (before_loop && fn->clone && count > 0 && last >= loop_start)) {
+            log_error("%s: %u multiplications in %s, the last at %u, the loop starts at %u",
+                name, count, title, last - fn->first_ins, loop_start - fn->first_ins);
+            failed += 1;
+        }
+        checked += 1;
+    }
+    if (checked == 0) {
+        log_error("%s: no code for %s", name, title);
+        failed += 1;
+    }
+}
+
+// invariant expressions leave the loop
+static void test_licm()
+{
+    char* src = "(defn f [k n] (let (i 0) (s 0)) (while (< i n) (let (s (+ s (* k k))) (i (+ i 1)))) s)\n"
+        "(cons (f 3 10) (cons (f 1.5 4) nil))";
+    expect("invariant in a loop", src, "(90 9.0)");
+    cs_Context c;
+    check_muls("licm", compile_source(&c, src), "f", 1, true);
+    // a multiple of the counter becomes an addition, before and after the counter moves on
+    expect("counter times 2", "(defn f [n] (let (i 0) (s 0)) (while (< i n) (let (s (+ s (* i 2)))) (let (i (+ i 1)))) s)\n(f 10)", "90");
+    expect("next counter times 2", "(defn f [n] (let (i 0) (s 0)) (while (< i n) (let (i (+ i 1))) (let (s (+ s (* i 2))))) s)\n(f 10)", "110");
+    expect("top-level counter", "(let (i 0) (s 0))\n(while (< i 10) (let (i (+ i 1))) (let (s (+ s (* i 2)))))\ns", "110");
+}
+
+// an expression a dominating block already computed isn't computed again
+static void test_gvn()
+{
+    char* src = "(defn g [x y] (+ (* x y) (if (> x 0) (+ (* x y) 1) 0)))\n(cons (g 2 5) (cons (g -1 3) nil))";
+    expect("repeated expression", src, "(21 -3)");
+    cs_Context c;
+    check_muls("gvn", compile_source(&c, src), "g", 1, false);
+}
+
+// TEST NATIVES
+
+static i64 native_add3(i64 a, i64 b, i64 c)
+{
+    return a + b + c;
+}
+
+static double native_mul_add(double a, double b)
+{
+    return a * b + 1;
+}
+
+static cs_Str* native_repeat(cs_Str* str, i64 n)
+{
+    cs_Str* result = cs_str_init(str->size * n + 1);
+    result->size = str->size * n;
+    for (i64 i = 0; i < n; i++) memcpy(result->data + str->size * i, str->data, str->size);
+    result->data[result->size] = 0;
+    return result;
+}
+
+static cs_Value native_count(cs_Context* c, cs_Value* args, u32 arg_count)
+{
+    (void)args;
+    return cs_val_int(c, arg_count * 10);
+}
+
+static void open_test_natives(cs_Context* c)
+{
+    cs_cfunc(c, "add3", native_add3, "iii:i");
+    cs_cfunc(c, "mul-add", native_mul_add, "dd:d");
+    cs_cfunc(c, "repeat", native_repeat, "si:s");
+    cs_cfunc_boxed(c, "count", native_count, 1);
+    cs_cfunc_boxed(c, "count", native_count, 3);
+}
+
+// typed natives get their arguments unboxed, a returned string belongs to the context
+static void test_natives()
+{
+    expect_with("typed natives", open_test_natives, "(cons (add3 1 2 3) (cons (mul-add 2 3) (cons (mul-add 2.5 2) nil)))", "(6 7.0 6.0)");
+    expect_with("string natives", open_test_natives,
+        "(let (i 0) (n 0))\n(while (< i 1000) (let (n (+ n (strlen (repeat \"abc\" i)))) (i (+ i 1))))\n(cons n (cons (repeat \"ab\" 3) nil))",
+        "(1498500 \"ababab\")");
+    expect_with("boxed arities", open_test_natives, "(cons (count 1) (cons (count 1 2 3) nil))", "(10 30)");
+    expect_with("argument types", open_test_natives, "(add3 1 \"x\" 2)", "ERROR: Wrong type of value\n");
+    expect_with("unknown arity", open_test_natives, "(count 1 2)", "ERROR: Invalid number of arguments at 1:12\n");
+}
+
+// TEST FUTURES
+
+// futures run on the worker threads and pmap splits a list over them, their results are the same in both modes
+static void test_futures()
+{
+    char* lib = "(defn fib [n] (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))\n(defn sq [x] (* x x))\n(defn add [a b] (+ a b))\n"
+        "(defn mk [n] (if (== n 0) nil (cons n (mk (- n 1)))))\n(defn nest [f] (+ 1 (deref f)))\n";
+    char src[1024];
+    snprintf(src, sizeof(src), "%s(let (f (future fib 20)) (g (future mk 5)))\n"
+        "(cons (deref f) (cons (deref g) (cons (reduce add 0 (pmap sq (mk 1000))) (cons (deref (future nest (future fib 10))) nil))))", lib);
+    expect("futures", src, "(6765 (5 4 3 2 1) 333833500 56)");
+    expect("error in a future", "(defn bad [x] (car x))\n(+ 1 (deref (future bad 5)))", "ERROR: Wrong type of value\n");
+}
+
+// TEST COROUTINES
+
+// coroutines take turns at yield and while they sleep or wait for a file
+static void test_coroutines()
+{
+    expect("yield and sleep", "(defn worker [n acc] (if (== n 0) acc (do (yield) (worker (- n 1) (+ acc n)))))\n"
+        "(defn napper [ms] (do (sleep ms) ms))\n(let (a (spawn worker 100 0)) (b (spawn worker 50 0)) (s (spawn napper 20)))\n"
+        "(cons (join a) (cons (join b) (cons (join s) nil)))", "(5050 1275 20)");
+    expect("error in a coroutine", "(defn bad [x] (do (yield) (car x)))\n(join (spawn bad 5))", "ERROR: Wrong type of value\n");
+    expect("deadlock", "(defn waiter [] (join 2))\n(defn waiter2 [] (join 1))\n(spawn waiter)\n(spawn waiter2)\n(join 1)",
+        "ERROR: Every coroutine is waiting\n");
+#ifdef __linux__
+    expect("pipe", "(defn producer [fd n] (if (== n 0) (close fd) (do (write fd \"xy\") (sleep 1) (producer fd (- n 1)))))\n"
+        "(defn consumer [fd acc] (let (s (read fd 100))) (if (== s nil) acc (consumer fd (+ acc (strlen s)))))\n"
+        "(let (p (pipe)))\n(let (c (spawn consumer (car p) 0)))\n(spawn producer (car (cdr p)) 20)\n(join c)", "40");
+#endif
+}
+
+// TEST ISOLATES
+
+// srcs run as isolates on a single worker, spawned in order. results has what each of them printed
+static void expect_isolates(char* name, char** srcs, char** results, u32 count)
+{
+    cs_Memory modes[] = { CS_MEMORY_RC, CS_MEMORY_GC };
+    for (u32 m = 0; m < 2; m++) {
+        cs_Context contexts[4];
+        cs_Isolate isolates[4] = { 0 };
+        for (u32 i = 0; i < count; i++) {
+            contexts[i] = cs_init();
+            contexts[i].memory = modes[m];
+            cs_lib_open(&contexts[i]);
+            u32 len = strlen(srcs[i]);
+            char* content = malloc(len + 1);
+            memcpy(content, srcs[i], len + 1);
+            isolates[i] = (cs_Isolate) { .c = &contexts[i], .code = cs_compile_file(&contexts[i], content, len) };
+        }
+        cs_Isolates* pool = cs_isolates_init(1);
+        for (u32 i = 0; i < count; i++) cs_isolate_spawn(pool, &isolates[i]);
+        cs_isolates_wait(pool);
+        for (u32 i = 0; i < count; i++) {
+            cs_Writer w = cs_writer_init(null);
+            if (contexts[i].error_count > 0) cs_writef(&w, "ERROR: %s", cs_get_error_string_at(&contexts[i], 0));
+            else cs_print_value(&contexts[i], &w, isolates[i].result);
+            cs_write(&w, "", 1);
+            if (strcmp(w.data, results[i]) != 0) {
+                log_error("%s (%s) isolate %u: \"%s\", expected \"%s\"", name, m == 0 ? "rc" : "gc", i, w.data, results[i]);
+                failed += 1;
+            }
+            cs_writer_free(&w);
+        }
+        cs_isolates_free(pool);
+    }
+}
+
+// an isolate waiting at a channel gives its worker up, so one worker runs both sides
+static void test_isolates()
+{
+    char* pair[] = { "(chan-recv :q)", "(chan-send :q 42)" };
+    char* pair_results[] = { "42", "true" };
+    expect_isolates("receiver first", pair, pair_results, 2);
+    char* flood[] = { "(let (i 0))\n(while (< i 300) (chan-send :r i) (let (i (+ i 1))))\ni",
+        "(defn take [n s] (if (== n 0) s (take (- n 1) (+ s (chan-recv :r)))))\n(take 300 0)" };
+    char* flood_results[] = { "300", "44850" };
+    expect_isolates("sender past the capacity", flood, flood_results, 2);
+}
+
+// every input is evaluated on top of the ones before it, outputs[i] is what input i printed
+static void expect_repl(char* name, char** inputs, char** outputs, u32 count)
+{
+    cs_Memory modes[] = { CS_MEMORY_RC, CS_MEMORY_GC };
+    for (u32 m = 0; m < 2; m++) {
+        cs_Context c = cs_init();
+        c.memory = modes[m];
+        cs_lib_open(&c);
+        cs_repl_init(&c);
+        for (u32 i = 0; i < count; i++) {
+            cs_Value result = cs_repl_eval(&c, inputs[i], strlen(inputs[i]));
+            cs_Writer w = cs_writer_init(null);
+            if (c.error_count > 0) cs_writef(&w, "ERROR: %s", cs_get_error_string_at(&c, 0));
+            else cs_print_value(&c, &w, result);
+            cs_write(&w, "", 1);
+            if (strcmp(w.data, outputs[i]) != 0) {
+                log_error("%s (%s) input %u: \"%s\", expected \"%s\"", name, m == 0 ? "rc" : "gc", i, w.data, outputs[i]);
+                failed += 1;
+            }
+            cs_writer_free(&w);
+        }
+        // each input only lowers what it compiled, the callers of a redefined function aren't lowered again
+        u32 lowered = 0;
+        for (u32 f = 0; f < c.repl_code->fn_count; f++) {
+            cs_CodeFn* fn = &c.repl_code->fns[f];
+            if (fn->title != ~0u && strcmp(cstr(c.repl_code->consts[fn->title].str_), "g") == 0) lowered += 1;
+        }
+        if (lowered != 1) {
+            log_error("%s (%s): g was lowered %u times", name, m == 0 ? "rc" : "gc", lowered);
+            failed += 1;
+        }
+        cs_repl_free(&c);
+    }
+}
+
+static void test_repl()
+{
+    char* inputs[] = {
+        "(defn f [] 1)", "(f)",
+        "(let (x 40))", "(defn g [] (+ (f) x))", "(g)",
+        // callers of a redefined function call the new one
+        "(defn call [h] (h))", "(defn r [] (call f))",
+        "(defn f [] 2)", "(g)", "(r)",
+        "(let (s \"ab\"))", "(let (l (cons s (cons x nil))))", "(defn k [n] (if (== n 0) l (k (- n 1))))", "(k 3)",
+        // the strings of earlier inputs stay valid while later ones add their own
+        "(cons \"cd\" (cons \"ef\" (cons \"gh\" (cons \"ij\" (cons \"kl\" nil)))))", "l",
+        // a broken form leaves nothing behind
+        "(defn h [] (bad))", "(h)",
+        "(+ 1 2) (+ (g) 4)",
+    };
+    char* outputs[] = {
+        "nil", "1",
+        "40", "nil", "41",
+        "nil", "nil",
+        "nil", "42", "2",
+        "ab", "(\"ab\" 40)", "nil", "(\"ab\" 40)",
+        "(\"cd\" \"ef\" \"gh\" \"ij\" \"kl\")", "(\"ab\" 40)",
+        "ERROR: Symbol could not be found at 1:16", "ERROR: Symbol could not be found at 1:3",
+        "46",
+    };
+    expect_repl("repl", inputs, outputs, sizeof(inputs) / sizeof(inputs[0]));
+}
+
+// TEST CODE CACHE
+
+static void expect_cache(char* name, bool loads, char* src, cs_Code* code)
+{
+    char* path = "_test.cispc";
+    if (!cs_code_write(code, path)) {
+        log_error("%s: the code could not be written", name);
+        failed += 1;
+        return;
+    }
+    cs_Code* loaded = cs_code_load(path, src, strlen(src));
+    if ((loaded != null) != loads) {
+        log_error("%s: %s", name, loads ? "the cache was rejected" : "the broken cache was loaded");
+        failed += 1;
+    } else if (loaded != null && (loaded->block_count != code->block_count
+        || memcmp(loaded->blocks, code->blocks, sizeof(cs_CodeBlock) * code->block_count) != 0)) {
+        log_error("%s: the blocks of the loaded code differ", name);
+        failed += 1;
+    }
+    cs_code_free(loaded);
+    remove(path);
+}
+
+static void test_code_cache()
+{
+    char* src = "(defn f [n] (if (== n 0) \"done\" (f (- n 1))))\n(f 10)";
+    cs_Context c;
+    cs_Code* code = compile_source(&c, src);
+    expect_cache("cache", true, src, code);
+
+    cs_Code* loaded = cs_code_load("_missing.cispc", src, strlen(src));
+    if (loaded != null) {
+        log_error("cache: a missing file was loaded");
+        failed += 1;
+    }
+    cs_code_write(code, "_test.cispc");
+    loaded = cs_code_load("_test.cispc", src, strlen(src));
+    cs_Writer w = cs_writer_init(null);
+    cs_print_value(&c, &w, cs_run(&c, loaded));
+    cs_write(&w, "", 1);
+    if (strcmp(w.data, "done") != 0) {
+        log_error("cache: the loaded code returned \"%s\"", w.data);
+        failed += 1;
+    }
+    cs_writer_free(&w);
+    cs_code_free(loaded);
+
+    // a flipped bit anywhere after the header breaks the checksum
+    FILE* f = fopen("_test.cispc", "r+b");
+    fseek(f, sizeof(cs_CodeHeader) + 20, SEEK_SET);
+    u8 byte = fgetc(f);
+    fseek(f, sizeof(cs_CodeHeader) + 20, SEEK_SET);
+    fputc(byte ^ 4, f);
+    fclose(f);
+    loaded = cs_code_load("_test.cispc", src, strlen(src));
+    if (loaded != null) {
+        log_error("cache: a corrupted file was loaded");
+        failed += 1;
+    }
+    cs_code_free(loaded);
+    remove("_test.cispc");
+
+    // with a valid checksum the instructions are still checked
+    cs_CodeIns* ins = &code->ins[code->fns[code->entry_fn].first_ins];
+    cs_CodeIns saved = *ins;
+    ins->dest = code->fns[code->entry_fn].reg_count;
+    expect_cache("register out of range", false, src, code);
+    *ins = saved;
+    cs_CodeIns* last = &code->ins[code->ins_count - 1];
+    saved = *last;
+    *last = (cs_CodeIns) { .op = CS_JMP, .dest = CS_REG_NONE, .aux = code->ins_count };
+    expect_cache("jump out of the function", false, src, code);
+    *last = saved;
+    for (u32 i = 0; i < code->const_count; i++) {
+        if (code->consts[i].type != CS_ATOM_STR) continue;
+        u32 size = code->consts[i].str_->size;
+        code->consts[i].str_->size = code->str_size;
+        expect_cache("string longer than its section", false, src, code);
+        code->consts[i].str_->size = size;
+    }
+    expect_cache("cache after the checks", true, src, code);
+}
+
+// TEST STATS
+
+// what compiling a program took: every phase ran, and the sizes match the code that came out
+static void test_stats()
+{
+    char* src = "(defn f [k n] (let (i 0) (s 0)) (while (< i n) (let (s (+ s (* k k))) (i (+ i 1)))) s)\n(f 3 10)";
+    cs_Context c = cs_init();
+    cs_Stats stats = {0};
+    c.stats = &stats;
+    cs_lib_open(&c);
+    u32 len = strlen(src);
+    char* content = malloc(len + 1);
+    memcpy(content, src, len + 1);
+    cs_Code* code = cs_compile_file(&c, content, len);
+    if (code == null || stats.code_fn_count != code->fn_count || stats.code_ins_count != code->ins_count || stats.fn_count == 0
+            || stats.block_count == 0 || stats.ins_count == 0) {
+        log_error("stats: %llu functions, %u in the code", stats.fn_count, stats.code_fn_count);
+        failed += 1;
+        return;
+    }
+    if (stats.ns[CS_PHASE_PARSE] == 0 || stats.ns[CS_PHASE_LOWER] == 0) {
+        log_error("stats: parsing took %llu ns, lowering %llu ns", stats.ns[CS_PHASE_PARSE], stats.ns[CS_PHASE_LOWER]);
+        failed += 1;
+    }
+    cs_Writer w = cs_writer_init(null);
+    cs_stats_print(&c, &w);
+    cs_stats_json(&c, &w);
+    cs_write(&w, "", 1);
+    if (strstr(w.data, "gvn") == null || strstr(w.data, "\"phases\"") == null || strstr(w.data, "allocations") == null) {
+        log_error("stats: the report is missing phases");
+        failed += 1;
+    }
+    cs_writer_free(&w);
+
+    // allocations are counted for the context they were made for, also on the threads it parses and lowers on
+    u64 allocs = c.alloc_count;
+    cs_Context other = cs_init();
+    other.jobs = 4;
+    cs_lib_open(&other);
+    char* other_content = malloc(len + 1);
+    memcpy(other_content, src, len + 1);
+    cs_compile_file(&other, other_content, len);
+    if (allocs == 0 || c.alloc_count != allocs || other.alloc_count == 0) {
+        log_error("stats: %llu allocations, %llu after another context compiled (%llu)", allocs, c.alloc_count,
+            other.alloc_count);
+        failed += 1;
+    }
+}
+
+// TEST PROFILER
+
+// the samples of a long loop name the function and the block it runs in
+static void test_profiler()
+{
+    char* src = "(defn spin [n] (let (i 0) (s 0)) (while (< i n) (let (s (+ s i)) (i (+ i 1)))) s)\n(spin 20000000)";
+    cs_Context c;
+    cs_Code* code = compile_source(&c, src);
+    cs_Profile profile;
+    cs_profile_start(&c, &profile);
+    cs_run(&c, code);
+    cs_profile_stop(&c);
+
+    cs_Writer w = cs_writer_init(null);
+    cs_profile_write(&profile, &w);
+    cs_write(&w, "", 1);
+    u32 counted = 0;
+    // every line ends in how often its stack was sampled
+    for (char* end = strchr(w.data, '\n'); end != null; end = strchr(end + 1, '\n')) {
+        char* count = end;
+        while (count[-1] != ' ') count -= 1;
+        counted += strtoul(count, null, 10);
+    }
+    if (profile.sample_count == 0 || counted != profile.sample_count || strstr(w.data, "spin:1:b") == null) {
+        log_error("profiler: %u samples, %u written: \"%s\"", profile.sample_count, counted, w.data);
+        failed += 1;
+    }
+    cs_writer_free(&w);
+    cs_profile_free(&profile);
+}
+
+// TEST PGO
+
+static bool counts_rejected(char* data, u32 source_hash)
+{
+    cs_BlockCounts counts;
+    bool ok = cs_counts_read(&counts, data, source_hash);
+    cs_counts_free(&counts);
+    return !ok;
+}
+
+// the counts of a run read back the same, and compiling with them gives code that computes the same
+static void test_pgo()
+{
+    char* src = "(defn f [n] (let (i 0) (s 0)) (while (< i n) (let (s (if (> i 2) (+ s i) s)) (i (+ i 1)))) s)\n(f 10)";
+    cs_Context c = cs_init();
+    u32 len = strlen(src);
+    cs_BlockCounts counts = { .source_hash = fnv1a(src, src + len) };
+    c.counts = &counts;
+    cs_lib_open(&c);
+    char* content = malloc(len + 1);
+    memcpy(content, src, len + 1);
+    cs_Code* code = cs_compile_file(&c, content, len);
+    cs_run(&c, code);
+
+    cs_Writer w = cs_writer_init(null);
+    cs_counts_write(&counts, &w);
+    cs_write(&w, "", 1);
+    cs_BlockCounts read;
+    bool ok = cs_counts_read(&read, w.data, code->source_hash) && read.bb_count == counts.bb_count
+        && memcmp(read.blocks, counts.blocks, sizeof(u64) * counts.bb_count) == 0
+        && memcmp(read.taken, counts.taken, sizeof(u64) * counts.bb_count) == 0;
+    u64 ran = 0;
+    for (u32 i = 0; i < counts.bb_count; i++) ran += counts.blocks[i];
+    if (!ok || ran == 0) {
+        log_error("pgo: the counts don't read back: \"%s\"", w.data);
+        failed += 1;
+    }
+    cs_writer_free(&w);
+
+    cs_Context guided = cs_init();
+    guided.pgo = &read;
+    cs_lib_open(&guided);
+    content = malloc(len + 1);
+    memcpy(content, src, len + 1);
+    cs_Code* guided_code = cs_compile_file(&guided, content, len);
+    w = cs_writer_init(null);
+    if (guided_code != null) cs_print_value(&guided, &w, cs_run(&guided, guided_code));
+    cs_write(&w, "", 1);
+    if (guided.error_count > 0 || strcmp(w.data, "42") != 0) {
+        log_error("pgo: the guided code printed \"%s\"", w.data);
+        failed += 1;
+    }
+    cs_writer_free(&w);
+    cs_counts_free(&read);
+    cs_counts_free(&counts);
+
+    char* broken[] = {
+        "pgo 2 7 4\n",         // another version
+        "pgo 1 8 4\n",         // another source
+        "pgo 1 7 4\n1 3 4\n",  // taken more often than it ran
+        "pgo 1 7 4\n4 1 0\n",  // no such block
+        "pgo 1 7 4\n1 3\n",    // cut off
+    };
+    for (u32 i = 0; i < sizeof(broken) / sizeof(broken[0]); i++) {
+        if (!counts_rejected(broken[i], 7)) {
+            log_error("pgo: read the broken counts \"%s\"", broken[i]);
+            failed += 1;
+        }
+    }
+    if (counts_rejected("pgo 1 7 4\n1 3 2\n", 7)) {
+        log_error("pgo: rejected good counts");
+        failed += 1;
+    }
+}
+
+// TEST IR
+
+static char* dump_ir(cs_Context* c)
+{
+    cs_Writer w = cs_writer_init(null);
+    cs_ir_dump(c, &w);
+    cs_write(&w, "", 1);
+    return w.data;
+}
+
+// loaded ir is dumped the same way again, natives are bound to the registered ones instead of copied
+static void test_ir_round_trip()
+{
+    char* src = "(defn f [x] (sqrt (+ x 0.0)))\n(defn g [n] (if (< n 1) 0 (+ n (g (- n 1)))))\n(+ (f 16) (g 10))";
+    cs_Context c;
+    compile_source(&c, src);
+    char* first = dump_ir(&c);
+
+    cs_Context l = cs_init();
+    cs_lib_open(&l);
+    u32 native_fns = l.cur_fn_id;
+    if (!cs_ir_load(&l, first, strlen(first))) {
+        log_error("ir: the dump could not be loaded: %s", cs_get_error_string_at(&l, 0));
+        failed += 1;
+        free(first);
+        return;
+    }
+    char* second = dump_ir(&l);
+    if (strcmp(first, second) != 0 || l.cur_fn_id != c.cur_fn_id || c.cur_fn_id - native_fns != 3) {
+        log_error("ir: %u functions after loading %u, the dump changed", l.cur_fn_id, c.cur_fn_id);
+        failed += 1;
+    }
+    cs_Writer w = cs_writer_init(null);
+    cs_print_value(&l, &w, cs_run(&l, cs_lower(&l, l.entry_fn_id)));
+    cs_write(&w, "", 1);
+    if (strcmp(w.data, "59.0") != 0) {
+        log_error("ir: the loaded code returned \"%s\"", w.data);
+        failed += 1;
+    }
+    cs_writer_free(&w);
+    free(first); free(second);
+}
+
+// the bodies of defns are parsed on as many threads as there are jobs, into the same ir for any number of them
+static void test_parallel_parse()
+{
+    char* src = "(defn sq [x] (* x x))\n"
+        "(defn sum [n] (let (s 0)) (while (> n 0) (let (s (+ s (sq n))) (n (- n 1)))) s)\n"
+        "(defn fib [n] (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))\n"
+        "(defn twice [f x] (f (f x)))\n"
+        "(defn outer [n] (defn inner [k] (* k 2)) (inner (sq n)))\n"
+        "(let (base 3))\n"
+        "(defn top [n] (+ (+ base (sum n)) (+ (fib n) (+ (twice sq n) (outer n)))))\n"
+        "(top 10)";
+    char* dumps[2];
+    u32 jobs[] = { 1, 4 };
+    for (u32 i = 0; i < 2; i++) {
+        cs_Context c = cs_init();
+        c.jobs = jobs[i];
+        cs_lib_open(&c);
+        u32 len = strlen(src);
+        char* content = malloc(len + 1);
+        memcpy(content, src, len + 1);
+        cs_Code* code = cs_compile_file(&c, content, len);
+        dumps[i] = dump_ir(&c);
+        cs_Writer w = cs_writer_init(null);
+        if (code != null) cs_print_value(&c, &w, cs_run(&c, code));
+        cs_write(&w, "", 1);
+        if (strcmp(w.data, "10643") != 0) {
+            log_error("parallel parse: \"%s\" with %u jobs", w.data, jobs[i]);
+            failed += 1;
+        }
+        cs_writer_free(&w);
+    }
+    if (strcmp(dumps[0], dumps[1]) != 0) {
+        log_error("parallel parse: the ir changed with the number of jobs");
+        failed += 1;
+    }
+    free(dumps[0]); free(dumps[1]);
+    // a defn only sees the ones before it
+    expect("later defn", "(defn a [] (b))\n(defn b [] 1)\n(defn c [] (d 1))\n(a)",
+        "ERROR: Symbol could not be found at 1:14\nERROR: Symbol could not be found at 3:14\n");
+}
+
+int main()
+{
+    init_console();
+    test_hmap();
+    test_number_literals();
+    test_scalar_replacement();
+    test_strings();
+    test_error_recovery();
+    test_licm();
+    test_gvn();
+    test_natives();
+    test_futures();
+    test_coroutines();
+    test_isolates();
+    test_repl();
+    test_code_cache();
+    test_ir_round_trip();
+    test_parallel_parse();
+    test_stats();
+    test_profiler();
+    test_pgo();
+    if (failed > 0) {
+        log_error("%u tests FAILED", failed);
+        return -1;
+    }
+    log_info("all tests PASSED");
+    return 0;
+}
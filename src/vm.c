@@ -0,0 +1,987 @@
+#include "cisp.h"
+#include "console.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ==== VALUE ==== */
+cs_Value cs_val_double(double d)
+{
+    // every nan is stored as the same positive nan, so it can't be mistaken for a tagged value
+    if (d != d) return CS_VAL_CANONICAL_NAN;
+    return reinterpret(d, u64);
+}
+
+double cs_val_as_double(cs_Value v)
+{
+    return reinterpret(v, double);
+}
+
+// ints that don't fit into the 48 bit payload are boxed
+cs_Value cs_val_int(cs_Context* c, i64 i)
+{
+    if (i >= CS_INT_MIN && i <= CS_INT_MAX) return val_from_int(i);
+    cs_Object* box = cs_make_object(c);
+    box->car = (u64)i;
+    box->flags |= CS_OBJ_BOXED_INT;
+    return val_from_ptr(box, CS_PTR_INT);
+}
+
+bool cs_val_to_i64(cs_Value v, i64* out)
+{
+    if (val_is_int(v)) {
+        *out = val_as_int(v);
+        return true;
+    }
+    if (val_is_kind(v, CS_PTR_INT)) {
+        *out = (i64)val_as_obj(v)->car;
+        return true;
+    }
+    return false;
+}
+
+static void vm_release_text(cs_Context* c, cs_Rope* rope);
+
+void cs_val_retain(cs_Value v)
+{
+    if (val_is_chunk(v)) val_as_chunk(v)->rc += 1;
+    else if (val_is_obj(v)) val_as_obj(v)->rc += 1;
+    else if (val_is_vec(v)) val_as_vec(v)->rc += 1;
+    else if (val_is_rope(v)) val_as_rope(v)->rc += 1;
+    else if (val_is_future(v) && val_as_task(v)->counted) val_as_task(v)->rc += 1;
+}
+
+static void vm_release_slots(cs_Context* c, cs_ListChunk* chunk)
+{
+    for (u32 i = chunk->front; i < CS_CHUNK_SLOTS; i++) {
+        cs_Value slot = chunk->slots[i];
+        // the cell of a slot that was replaced by setcdr belongs to the chunk
+        if (val_is_kind(slot, CS_PTR_FWD)) slot = val_from_ptr(val_as_obj(slot), CS_PTR_LIST);
+        cs_val_release(c, slot);
+    }
+}
+
+// frees the objects that become unreachable, following the cdrs in a loop so long lists don't recurse
+void cs_val_release(cs_Context* c, cs_Value v)
+{
+    if (val_is_vec(v)) {
+        if (--val_as_vec(v)->rc == 0) cs_vec_free(c, val_as_vec(v));
+        return;
+    }
+    if (val_is_rope(v)) {
+        vm_release_text(c, val_as_rope(v));
+        return;
+    }
+    if (val_is_future(v)) {
+        cs_Task* task = val_as_task(v);
+        if (task->counted && --task->rc == 0) cs_future_release(c, task);
+        return;
+    }
+    while (val_is_obj(v)) {
+        if (val_is_chunk(v)) {
+            cs_ListChunk* chunk = val_as_chunk(v);
+            if (--chunk->rc > 0) return;
+            vm_release_slots(c, chunk);
+            v = chunk->tail;
+            cs_chunk_free(c, chunk);
+            continue;
+        }
+        cs_Object* obj = val_as_obj(v);
+        if (--obj->rc > 0) return;
+        bool list = val_is_cell(v);
+        cs_Value car = obj->car;
+        v = list ? obj->cdr : CS_NIL;
+        cs_pool_free(&c->obj_pool, (void**)obj);
+        if (list) cs_val_release(c, car);
+    }
+}
+
+// like cs_val_release, but a chunk is kept for the CS_CONS that follows
+static void vm_release_reuse(cs_Context* c, cs_Value v)
+{
+    if (!val_is_chunk(v)) {
+        cs_val_release(c, v);
+        return;
+    }
+    cs_ListChunk* chunk = val_as_chunk(v);
+    if (--chunk->rc > 0) return;
+    vm_release_slots(c, chunk);
+    cs_val_release(c, chunk->tail);
+    if (c->reuse_chunk != null) cs_chunk_free(c, c->reuse_chunk);
+    c->reuse_chunk = chunk;
+}
+
+cs_ObjectType cs_val_type(cs_Value v)
+{
+    if (val_is_double(v)) return CS_ATOM_FLOAT;
+    switch (val_tag(v)) {
+        case CS_VAL_TAG_INT: return CS_ATOM_INT;
+        case CS_VAL_TAG_MISC: {
+            if (v == CS_TRUE) return CS_ATOM_TRUE;
+            if (v == CS_FALSE) return CS_ATOM_FALSE;
+            return CS_ATOM_NIL;
+        }
+        case CS_VAL_TAG_SYM: return CS_ATOM_SYMBOL;
+        case CS_VAL_TAG_KW: return CS_ATOM_KEYWORD;
+        case CS_VAL_TAG_FN: return CS_FUNC;
+        case CS_VAL_TAG_PTR: {
+            switch (v & CS_PTR_KIND_MASK) {
+                case CS_PTR_LIST:
+                case CS_PTR_CHUNK: return CS_LIST;
+                case CS_PTR_STR:
+                case CS_PTR_ROPE: return CS_ATOM_STR;
+                case CS_PTR_INT: return CS_ATOM_INT;
+                case CS_PTR_VEC: return CS_VECTOR;
+                case CS_PTR_FUTURE: return CS_FUTURE;
+            }
+        }
+    }
+    return _CS_INVALID;
+}
+
+static void print_value(cs_Context* c, cs_Writer* w, cs_Value v, bool quote_strings)
+{
+    i64 i;
+    if (val_is_double(v)) {
+        double d = cs_val_as_double(v);
+        char tmp[32];
+        // the shortest of the two that reads back as the same double
+        u32 len = snprintf(tmp, sizeof(tmp), "%.15g", d);
+        if (strtod(tmp, null) != d) len = snprintf(tmp, sizeof(tmp), "%.17g", d);
+        cs_write(w, tmp, len);
+        if (strpbrk(tmp, ".eni") == null) cs_write(w, ".0", 2);
+        return;
+    }
+    if (cs_val_to_i64(v, &i)) {
+        cs_writef(w, "%lld", i);
+        return;
+    }
+    switch (val_tag(v)) {
+        case CS_VAL_TAG_MISC: {
+            if (v == CS_TRUE) cs_write(w, "true", 4);
+            else if (v == CS_FALSE) cs_write(w, "false", 5);
+            else cs_write(w, "nil", 3);
+        } break;
+        case CS_VAL_TAG_SYM:
+        case CS_VAL_TAG_KW: {
+            if (val_tag(v) == CS_VAL_TAG_KW) cs_write(w, ":", 1);
+            cs_Str** name = cs_hm_geth(&c->symbol_names, (u32)val_payload(v));
+            if (name != null) cs_write(w, cstr(*name), (*name)->size);
+            else cs_writef(w, "#%u", (u32)val_payload(v));
+        } break;
+        case CS_VAL_TAG_FN: {
+            u32 fn_id = (u32)val_payload(v);
+            cs_Str* title = fn_id < c->cur_fn_id ? cs_get_fn(c, fn_id)->title : null;
+            if (title != null) cs_writef(w, "<fn %s>", cstr(title));
+            else cs_writef(w, "<fn %u>", fn_id);
+        } break;
+        case CS_VAL_TAG_PTR: {
+            if (val_is_text(v)) {
+                cs_Str* str = cs_val_as_str(v);
+                if (quote_strings) cs_write(w, "\"", 1);
+                cs_write(w, cstr(str), str->size);
+                if (quote_strings) cs_write(w, "\"", 1);
+                break;
+            }
+            if (val_is_vec(v)) {
+                cs_Vector* vec = val_as_vec(v);
+                cs_write(w, "[", 1);
+                for (u32 i = 0; i < vec->count; i++) {
+                    if (i > 0) cs_write(w, " ", 1);
+                    if (vec->kind == CS_VEC_INT) cs_writef(w, "%lld", vec_ints(vec)[i]);
+                    else print_value(c, w, cs_val_double(vec_floats(vec)[i]), true);
+                }
+                cs_write(w, "]", 1);
+                break;
+            }
+            if (val_is_future(v)) {
+                cs_write(w, "<future>", 8);
+                break;
+            }
+            // lists
+            cs_write(w, "(", 1);
+            u32 count = 0;
+            while (true) {
+                print_value(c, w, cs_list_car(v), true);
+                v = cs_list_cdr(v);
+                if (v == CS_NIL) break;
+                if (!val_is_list(v)) {
+                    cs_write(w, " . ", 3);
+                    print_value(c, w, v, true);
+                    break;
+                }
+                // lists made circular with setcdr
+                if (++count == 100000) {
+                    cs_write(w, " ...", 4);
+                    break;
+                }
+                cs_write(w, " ", 1);
+            }
+            cs_write(w, ")", 1);
+        } break;
+    }
+}
+
+void cs_print_value(cs_Context* c, cs_Writer* w, cs_Value v)
+{
+    print_value(c, w, v, false);
+}
+
+/* ==== VM ==== */
+// runtime errors have no source position, they are reported as line 0
+static cs_Value vm_error(cs_Context* c, cs_Error error)
+{
+    if (c->err == CS_OK) {
+        c->err = error;
+        c->err_line = 0; c->err_col = 0;
+    }
+    c->error_count += 1;
+    cs_ensure_cap((void**)&c->errors, sizeof(cs_ErrorInfo), &c->error_cap, c->error_count);
+    c->errors[c->error_count-1] = (cs_ErrorInfo) { .err = error };
+    return CS_NIL;
+}
+
+// for native functions, stops the running code
+cs_Value cs_runtime_error(cs_Context* c, cs_Error error)
+{
+    return vm_error(c, error);
+}
+
+static void vm_ensure_stack(cs_Context* c, u32 size)
+{
+    if (size <= c->stack_cap) return;
+    if (c->stack_cap < 256) c->stack_cap = 256;
+    while (size > c->stack_cap) c->stack_cap *= 2;
+    c->stack = cs_realloc(c->stack, sizeof(cs_Value) * c->stack_cap);
+}
+
+/* ==== STRINGS ==== */
+static u32 text_size(cs_Value v)
+{
+    return val_is_rope(v) ? val_as_rope(v)->size : val_as_str(v)->size;
+}
+
+// the string of a string or rope value. a rope is put together from the back, so the long chain of
+// left children that appending in a loop builds never needs more than one pending value
+cs_Str* cs_val_as_str(cs_Value v)
+{
+    if (val_is_str(v)) return val_as_str(v);
+    cs_Rope* rope = val_as_rope(v);
+    // workers can flatten a rope of the context they work for at the same time
+    cs_Str* flat = __atomic_load_n(&rope->flat, __ATOMIC_ACQUIRE);
+    if (flat != null) return flat;
+
+    cs_Str* result = cs_str_init(rope->size + 1);
+    result->size = rope->size;
+    result->data[result->size] = 0;
+    u32 end = result->size;
+    cs_Value* pending = null; u32 pending_count = 0, pending_cap = 0;
+    cs_Value cur = v;
+    while (true) {
+        if (val_is_rope(cur) && __atomic_load_n(&val_as_rope(cur)->flat, __ATOMIC_ACQUIRE) == null) {
+            pending_count += 1;
+            cs_ensure_cap((void**)&pending, sizeof(cs_Value), &pending_cap, pending_count);
+            pending[pending_count-1] = val_as_rope(cur)->left;
+            cur = val_as_rope(cur)->right;
+            continue;
+        }
+        cs_Str* part = val_is_rope(cur) ? __atomic_load_n(&val_as_rope(cur)->flat, __ATOMIC_ACQUIRE) : val_as_str(cur);
+        end -= part->size;
+        memcpy(result->data + end, part->data, part->size);
+        if (pending_count == 0) break;
+        cur = pending[--pending_count];
+    }
+    free(pending);
+    // the string of whoever was faster is kept
+    if (!__atomic_compare_exchange_n(&rope->flat, &flat, result, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(result);
+        return flat;
+    }
+    return result;
+}
+
+// what a string counts as in cs_Context.old_count. only a flat one holds its characters,
+// the string of a rope is made once it is read
+#define text_weight(rope) (1 + ((rope)->left == CS_NIL ? (rope)->size / sizeof(cs_Object) : 0))
+
+// makes rope one of the strings of the context. this never collects, so the strings a concatenation
+// puts together can't be freed before the result is in a register
+static cs_Rope* vm_text_track(cs_Context* c, cs_Rope* rope)
+{
+    if (c->memory == CS_MEMORY_GC || c->worker != null) {
+        // workers don't count references, their strings are freed with the rest of their heap
+        c->text_count += 1;
+        cs_ensure_cap((void**)&c->texts, sizeof(cs_Rope*), &c->text_cap, c->text_count);
+        c->texts[c->text_count-1] = rope;
+        if (c->memory == CS_MEMORY_GC) c->old_count += text_weight(rope);
+    }
+    rope->rc = 1; rope->flags = 0;
+    return rope;
+}
+
+// runs the collection a string would trigger before anything is made
+static void vm_text_collect(cs_Context* c)
+{
+    if (c->memory != CS_MEMORY_GC) return;
+    if (c->next_major == 0) c->next_major = CS_GC_MAJOR_MIN;
+    if (c->old_count >= c->next_major) cs_gc_minor(c);
+}
+
+static cs_Rope* vm_rope_alloc(u64 size)
+{
+    cs_Rope* rope = cs_malloc(size);
+    return rope;
+}
+
+// a flat string of size characters, they are left uninitialized
+static cs_Rope* vm_text_make(cs_Context* c, u32 size)
+{
+    cs_Rope* rope = vm_rope_alloc(sizeof(cs_Rope) + sizeof(cs_Str) + size + 1);
+    cs_Str* str = (cs_Str*)(rope + 1);
+    str->hash = 0;
+    str->size = size;
+    str->data[size] = 0;
+    *rope = (cs_Rope) { .left = CS_NIL, .right = CS_NIL, .size = size, .flat = str };
+    return vm_text_track(c, rope);
+}
+
+// makes a string allocated with cs_str_init one of the context's, e.g. the result of a native.
+// in gc mode this can run a collection
+cs_Rope* cs_text_adopt(cs_Context* c, cs_Str* str)
+{
+    vm_text_collect(c);
+    cs_Rope* rope = vm_rope_alloc(sizeof(cs_Rope));
+    *rope = (cs_Rope) { .left = CS_NIL, .right = CS_NIL, .size = str->size, .flat = str };
+    return vm_text_track(c, rope);
+}
+
+void cs_text_free(cs_Context* c, cs_Rope* rope)
+{
+    if (c->memory == CS_MEMORY_GC) c->old_count -= text_weight(rope);
+    if (rope->flat != (cs_Str*)(rope + 1)) free(rope->flat);
+    free(rope);
+}
+
+// the children of a rope are released too. the shorter one recurses and the longer one is continued
+// with, so even the long chains appending in a loop builds never recurse deeper than about 32 ropes
+static void vm_release_text(cs_Context* c, cs_Rope* rope)
+{
+    while (--rope->rc == 0) {
+        cs_Value left = rope->left, right = rope->right;
+        cs_text_free(c, rope);
+        if (left == CS_NIL) return;
+        cs_Value shorter = text_size(left) < text_size(right) ? left : right;
+        cs_Value longer = shorter == left ? right : left;
+        // strings of the code aren't counted
+        if (val_is_rope(shorter)) vm_release_text(c, val_as_rope(shorter));
+        if (!val_is_rope(longer)) return;
+        rope = val_as_rope(longer);
+    }
+}
+
+// copies the strings of parts into one
+static cs_Value vm_flat_concat(cs_Context* c, cs_Value* parts, u32 count, u32 size)
+{
+    cs_Rope* rope = vm_text_make(c, size);
+    cs_Str* result = rope->flat;
+    result->size = 0;
+    for (u32 i = 0; i < count; i++) {
+        cs_Str* part = cs_val_as_str(parts[i]);
+        memcpy(result->data + result->size, part->data, part->size);
+        result->size += part->size;
+    }
+    return val_from_ptr(rope, CS_PTR_ROPE);
+}
+
+// the strings of parts one after another. long parts are linked into a rope as they are,
+// only runs of short ones get copied. the parts are borrowed, the result owns a reference
+static cs_Value vm_concat(cs_Context* c, cs_Value* parts, u32 count)
+{
+    // the parts are in registers and strings are never moved, so they are the same afterwards
+    vm_text_collect(c);
+    u32 size = 0;
+    for (u32 i = 0; i < count; i++) size += text_size(parts[i]);
+    if (size < CS_ROPE_MIN) return vm_flat_concat(c, parts, count, size);
+
+    cs_Value result = CS_NIL;
+    u32 result_size = 0;
+    bool result_made = false;
+    for (u32 i = 0; i < count;) {
+        cs_Value part = parts[i];
+        u32 part_size = text_size(part);
+        u32 run = 1;
+        bool made = false;
+        if (part_size < CS_ROPE_MIN) {
+            while (i + run < count && text_size(parts[i + run]) < CS_ROPE_MIN) part_size += text_size(parts[i + run++]);
+            if (run > 1) {
+                part = vm_flat_concat(c, &parts[i], run, part_size);
+                made = true;
+            }
+        }
+        i += run;
+        if (result == CS_NIL) {
+            result = part;
+            result_made = made;
+        } else {
+            // the rope takes over what was made here, the parts still in registers get another reference
+            if (c->rc && !result_made) cs_val_retain(result);
+            if (c->rc && !made) cs_val_retain(part);
+            cs_Rope* rope = vm_rope_alloc(sizeof(cs_Rope));
+            *rope = (cs_Rope) { .left = result, .right = part, .size = result_size + part_size };
+            result = val_from_ptr(vm_text_track(c, rope), CS_PTR_ROPE);
+            result_made = true;
+        }
+        result_size += part_size;
+    }
+    if (c->rc && !result_made) cs_val_retain(result);
+    return result;
+}
+
+static bool vm_str_equal(cs_Value a, cs_Value b)
+{
+    if (text_size(a) != text_size(b)) return false;
+    cs_Str* sa = cs_val_as_str(a); cs_Str* sb = cs_val_as_str(b);
+    // only the hashes that are already known are worth comparing
+    u32 ha = __atomic_load_n(&sa->hash, __ATOMIC_RELAXED), hb = __atomic_load_n(&sb->hash, __ATOMIC_RELAXED);
+    if (ha != 0 && hb != 0 && ha != hb) return false;
+    return memcmp(sa->data, sb->data, sa->size) == 0;
+}
+
+static bool vm_equal(cs_Value a, cs_Value b)
+{
+    if (a == b) return !(val_is_double(a) && cs_val_as_double(a) != cs_val_as_double(a));
+    i64 x, y;
+    bool a_int = cs_val_to_i64(a, &x); bool b_int = cs_val_to_i64(b, &y);
+    if (a_int && b_int) return x == y;
+    if ((a_int || val_is_double(a)) && (b_int || val_is_double(b))) {
+        double da = a_int ? (double)x : cs_val_as_double(a);
+        double db = b_int ? (double)y : cs_val_as_double(b);
+        return da == db;
+    }
+    if (val_is_text(a) && val_is_text(b)) return vm_str_equal(a, b);
+    return false;
+}
+
+static cs_Value vm_arith_double(cs_Context* c, cs_OpKind op, double x, double y)
+{
+    switch (op) {
+        case CS_ADDV: return cs_val_double(x + y);
+        case CS_SUBV: return cs_val_double(x - y);
+        case CS_MULV: return cs_val_double(x * y);
+        case CS_DIVV: return cs_val_double(x / y);
+        case CS_MODV: return cs_val_double(fmod(x, y));
+        case CS_GTV:  return val_from_bool(x > y);
+        case CS_LTV:  return val_from_bool(x < y);
+        case CS_GEQV: return val_from_bool(x >= y);
+        case CS_LEQV: return val_from_bool(x <= y);
+        default: return vm_error(c, CS_TYPE_ERROR);
+    }
+}
+
+// everything the fast paths in cs_run don't handle: boxed ints, floats, overflows, strings and type errors
+static cs_Value vm_arith(cs_Context* c, cs_OpKind op, cs_Value a, cs_Value b)
+{
+    if (op == CS_EQV) return val_from_bool(vm_equal(a, b));
+    if (op == CS_ADDV && val_is_text(a) && val_is_text(b)) {
+        cs_Value parts[2] = { a, b };
+        return vm_concat(c, parts, 2);
+    }
+
+    i64 x, y;
+    bool a_int = cs_val_to_i64(a, &x); bool b_int = cs_val_to_i64(b, &y);
+    if (!(a_int || val_is_double(a)) || !(b_int || val_is_double(b))) {
+        return vm_error(c, CS_TYPE_ERROR);
+    }
+    if (!a_int || !b_int) {
+        return vm_arith_double(c, op, a_int ? (double)x : cs_val_as_double(a), b_int ? (double)y : cs_val_as_double(b));
+    }
+
+    // integers overflowing 64 bits continue as doubles
+    i64 r;
+    switch (op) {
+        case CS_ADDV: {
+            if (__builtin_add_overflow(x, y, &r)) return cs_val_double((double)x + (double)y);
+            return cs_val_int(c, r);
+        }
+        case CS_SUBV: {
+            if (__builtin_sub_overflow(x, y, &r)) return cs_val_double((double)x - (double)y);
+            return cs_val_int(c, r);
+        }
+        case CS_MULV: {
+            if (__builtin_mul_overflow(x, y, &r)) return cs_val_double((double)x * (double)y);
+            return cs_val_int(c, r);
+        }
+        case CS_DIVV:
+        case CS_MODV: {
+            if (y == 0) return vm_error(c, CS_DIV_BY_ZERO);
+            if (x == INT64_MIN && y == -1) {
+                return op == CS_DIVV ? cs_val_double(-(double)x) : val_from_int(0);
+            }
+            return cs_val_int(c, op == CS_DIVV ? x / y : x % y);
+        }
+        case CS_ANDV: return cs_val_int(c, x & y);
+        case CS_ORV:  return cs_val_int(c, x | y);
+        case CS_LSHIFTV: {
+            if (y < 0 || y > 63) return vm_error(c, CS_TYPE_ERROR);
+            return cs_val_int(c, (i64)((u64)x << y));
+        }
+        case CS_RSHIFTV: {
+            if (y < 0 || y > 63) return vm_error(c, CS_TYPE_ERROR);
+            return cs_val_int(c, x >> y);
+        }
+        case CS_GTV:  return val_from_bool(x > y);
+        case CS_LTV:  return val_from_bool(x < y);
+        case CS_GEQV: return val_from_bool(x >= y);
+        case CS_LEQV: return val_from_bool(x <= y);
+        default: return vm_error(c, CS_UNKNOWN_OP);
+    }
+}
+
+// the typed forms of a binop were picked from type hints, anything they don't expect is handled by the generic form
+static cs_OpKind vm_generic_op(cs_OpKind op)
+{
+    switch (op) {
+        case CS_ADDI: case CS_ADDVI: case CS_ADDF: case CS_ADDVF: return CS_ADDV;
+        case CS_SUBI: case CS_SUBVI: case CS_SUBF: case CS_SUBVF: return CS_SUBV;
+        case CS_MULI: case CS_MULVI: case CS_MULF: case CS_MULVF: return CS_MULV;
+        case CS_DIVI: case CS_DIVVI: case CS_DIVF: case CS_DIVVF: return CS_DIVV;
+        case CS_MODI: case CS_MODVI: return CS_MODV;
+        case CS_ANDI: case CS_ANDVI: return CS_ANDV;
+        case CS_ORI: case CS_ORVI: return CS_ORV;
+        case CS_LSHIFTI: case CS_LSHIFTVI: return CS_LSHIFTV;
+        case CS_RSHIFTI: case CS_RSHIFTVI: return CS_RSHIFTV;
+        case CS_GTI: case CS_GTVI: case CS_GTF: case CS_GTVF: return CS_GTV;
+        case CS_LTI: case CS_LTVI: case CS_LTF: case CS_LTVF: return CS_LTV;
+        case CS_GEQI: case CS_GEQVI: case CS_GEQF: case CS_GEQVF: return CS_GEQV;
+        case CS_LEQI: case CS_LEQVI: case CS_LEQF: case CS_LEQVF: return CS_LEQV;
+        case CS_EQI: case CS_EQVI: case CS_EQF: case CS_EQVF: return CS_EQV;
+        default: return op;
+    }
+}
+
+static cs_Value vm_mul_int(cs_Context* c, i64 x, i64 y)
+{
+    i64 r;
+    if (__builtin_mul_overflow(x, y, &r)) return cs_val_double((double)x * (double)y);
+    return cs_val_int(c, r);
+}
+
+// ints in the immediate range can't overflow an i64 when added, subtracted or compared
+#define INT_FAST_PATH(expr) \
+    { \
+        cs_Value a = regs[ins->a]; cs_Value b = regs[ins->b]; \
+        if (val_is_int(a) && val_is_int(b)) { \
+            i64 x = val_as_int(a); i64 y = val_as_int(b); \
+            regs[ins->dest] = expr; \
+        } else { \
+            cs_Value result = vm_arith(c, vm_generic_op(ins->op), a, b); \
+            if (c->err != CS_OK) return CS_NIL; \
+            /* an induction variable updated in place hands its old value to the op, see rc.c */ \
+            if (rc && ins->dest == ins->a && (ins->op == CS_ADDI || ins->op == CS_SUBI)) cs_val_release(c, a); \
+            regs[ins->dest] = result; \
+        } \
+    } break;
+
+#define FLOAT_FAST_PATH(expr) \
+    { \
+        cs_Value a = regs[ins->a]; cs_Value b = regs[ins->b]; \
+        if (val_is_double(a) && val_is_double(b)) { \
+            double x = cs_val_as_double(a); double y = cs_val_as_double(b); \
+            regs[ins->dest] = expr; \
+        } else { \
+            regs[ins->dest] = vm_arith(c, vm_generic_op(ins->op), a, b); \
+            if (c->err != CS_OK) return CS_NIL; \
+        } \
+    } break;
+
+/* ==== CALLS ==== */
+// the variant a function value resolves to when called with arg_count arguments, ~0 if there is none
+static u32 vm_lookup_target(cs_Context* c, cs_Code* code, u32 fn_id, u32 arg_count)
+{
+    // loading ir binds natives to new functions, so they are found through the variants instead of cs_Native.fn_id
+    if (fn_id < c->cur_fn_id) {
+        cs_FunctionBody* fb = cs_fn_get_variant(cs_get_fn(c, fn_id), arg_count);
+        if (fb != null && fb->arg_count < 0) return CS_IC_NATIVE | fb->code_id;
+    }
+    for (u32 i = 0; i < code->fn_count; i++) {
+        cs_CodeFn* fn = &code->fns[i];
+        if (fn->fn_id == fn_id && fn->arg_count == (i32)arg_count && !fn->clone) return i;
+    }
+    return ~0u;
+}
+
+// resolves the callee of a CS_DYNCALL through the inline cache of the call site. only misses do the full lookup:
+// a site keeps up to CS_IC_SIZE targets, then it gives up on its own entries and shares a direct-mapped cache
+static u32 vm_dispatch(cs_Context* c, cs_Code* code, cs_CodeIns* ins, u32 fn_id)
+{
+    cs_CallCache* cache = &c->caches[ins->aux];
+    u32 key = cs_ic_key(fn_id, ins->a);
+    if (cache->count != CS_IC_MEGAMORPHIC) {
+        for (u32 i = 0; i < cache->count; i++) {
+            if (cache->entries[i].key == key) return cache->entries[i].target;
+        }
+        u32 target = vm_lookup_target(c, code, fn_id, ins->a);
+        if (target == ~0u) return target;
+        if (cache->count < CS_IC_SIZE) {
+            cache->entries[cache->count++] = (cs_CallTarget) { .key = key, .target = target };
+            return target;
+        }
+        cache->count = CS_IC_MEGAMORPHIC;
+    }
+
+    if (c->megamorphic == null) {
+        c->megamorphic = cs_malloc(sizeof(cs_CallTarget) * CS_IC_SHARED_SIZE);
+        // no function has every bit of its id set
+        memset(c->megamorphic, 0xFF, sizeof(cs_CallTarget) * CS_IC_SHARED_SIZE);
+    }
+    cs_CallTarget* entry = &c->megamorphic[(fn_id ^ key) & (CS_IC_SHARED_SIZE - 1)];
+    if (entry->key == key) return entry->target;
+    u32 target = vm_lookup_target(c, code, fn_id, ins->a);
+    if (target != ~0u) *entry = (cs_CallTarget) { .key = key, .target = target };
+    return target;
+}
+
+// runs fn from ip on, whose registers start at base and are set up already, until it returns. the frames
+// from frame_floor to c->frame_count are its callers, the ones below belong to the callers of the native
+// that started this
+static cs_Value vm_execute(cs_Context* c, cs_Code* code, cs_CodeFn* fn, u32 base, cs_CodeIns* ip, u32 frame_floor)
+{
+    bool rc = c->rc;
+    cs_CodeConst* consts = code->consts;
+    u32 frame_count = c->frame_count;
+    cs_Value* regs = c->stack + base;
+    cs_CodeFn* callee;
+    cs_Native* native;
+
+    while (true) {
+        cs_CodeIns* ins = ip++;
+        switch (ins->op) {
+            case CS_LOADI: regs[ins->dest] = cs_val_int(c, consts[ins->aux].int_); break;
+            case CS_LOADF: regs[ins->dest] = cs_val_double(consts[ins->aux].double_); break;
+            case CS_LOADS: regs[ins->dest] = val_from_ptr(consts[ins->aux].str_, CS_PTR_STR); break;
+            case CS_LOADK: regs[ins->dest] = val_make(CS_VAL_TAG_KW, consts[ins->aux].hash); break;
+            case CS_LOADSYM: regs[ins->dest] = val_make(CS_VAL_TAG_SYM, consts[ins->aux].hash); break;
+            case CS_LOADFUN: regs[ins->dest] = val_make(CS_VAL_TAG_FN, ins->aux); break;
+            case CS_LOADTRUE: regs[ins->dest] = CS_TRUE; break;
+            case CS_LOADFALSE: regs[ins->dest] = CS_FALSE; break;
+            case CS_LOADNIL: regs[ins->dest] = CS_NIL; break;
+            case CS_MOV: regs[ins->dest] = regs[ins->a]; break;
+            case CS_GETGLOBAL: regs[ins->dest] = ins->aux != ~0u ? c->globals[ins->aux] : CS_NIL; break;
+            case CS_SETGLOBAL: {
+                cs_Value old = c->globals[ins->aux];
+                c->globals[ins->aux] = regs[ins->a];
+                if (rc) cs_val_release(c, old);
+            } break;
+            case CS_NOT: regs[ins->dest] = val_from_bool(!val_truthy(regs[ins->a])); break;
+
+            case CS_ADDV: case CS_ADDI: case CS_ADDVI: INT_FAST_PATH(cs_val_int(c, x + y))
+            case CS_SUBV: case CS_SUBI: case CS_SUBVI: INT_FAST_PATH(cs_val_int(c, x - y))
+            case CS_LTV:  case CS_LTI:  case CS_LTVI:  INT_FAST_PATH(val_from_bool(x < y))
+            case CS_GTV:  case CS_GTI:  case CS_GTVI:  INT_FAST_PATH(val_from_bool(x > y))
+            case CS_LEQV: case CS_LEQI: case CS_LEQVI: INT_FAST_PATH(val_from_bool(x <= y))
+            case CS_GEQV: case CS_GEQI: case CS_GEQVI: INT_FAST_PATH(val_from_bool(x >= y))
+            case CS_EQV:  case CS_EQI:  case CS_EQVI:  INT_FAST_PATH(val_from_bool(x == y))
+            case CS_MULI: case CS_MULVI: INT_FAST_PATH(vm_mul_int(c, x, y))
+            case CS_ANDI: case CS_ANDVI: INT_FAST_PATH(val_from_int(x & y))
+            case CS_ORI:  case CS_ORVI:  INT_FAST_PATH(val_from_int(x | y))
+
+            case CS_ADDF: case CS_ADDVF: FLOAT_FAST_PATH(cs_val_double(x + y))
+            case CS_SUBF: case CS_SUBVF: FLOAT_FAST_PATH(cs_val_double(x - y))
+            case CS_MULF: case CS_MULVF: FLOAT_FAST_PATH(cs_val_double(x * y))
+            case CS_DIVF: case CS_DIVVF: FLOAT_FAST_PATH(cs_val_double(x / y))
+            case CS_LTF:  case CS_LTVF:  FLOAT_FAST_PATH(val_from_bool(x < y))
+            case CS_GTF:  case CS_GTVF:  FLOAT_FAST_PATH(val_from_bool(x > y))
+            case CS_LEQF: case CS_LEQVF: FLOAT_FAST_PATH(val_from_bool(x <= y))
+            case CS_GEQF: case CS_GEQVF: FLOAT_FAST_PATH(val_from_bool(x >= y))
+            case CS_EQF:  case CS_EQVF:  FLOAT_FAST_PATH(val_from_bool(x == y))
+
+            case CS_MULV:
+            case CS_DIVV: case CS_DIVI: case CS_DIVVI:
+            case CS_MODV: case CS_MODI: case CS_MODVI:
+            case CS_ANDV:
+            case CS_ORV:
+            case CS_LSHIFTV: case CS_LSHIFTI: case CS_LSHIFTVI:
+            case CS_RSHIFTV: case CS_RSHIFTI: case CS_RSHIFTVI: {
+                regs[ins->dest] = vm_arith(c, vm_generic_op(ins->op), regs[ins->a], regs[ins->b]);
+                if (c->err != CS_OK) return CS_NIL;
+            } break;
+
+            case CS_CONCAT: {
+                u16* arg_regs = &code->args[ins->aux2];
+                cs_Value parts[FUNCTION_MAX_ARGS];
+                bool text = true;
+                for (u32 i = 0; i < ins->a; i++) {
+                    parts[i] = regs[arg_regs[i]];
+                    text = text && val_is_text(parts[i]);
+                }
+                if (text) {
+                    regs[ins->dest] = vm_concat(c, parts, ins->a);
+                    break;
+                }
+                // not only strings, add them one after another like the additions this was fused from
+                regs[ins->dest] = vm_arith(c, CS_ADDV, parts[0], parts[1]);
+                for (u32 i = 2; i < ins->a && c->err == CS_OK; i++) {
+                    cs_Value sum = vm_arith(c, CS_ADDV, regs[ins->dest], regs[arg_regs[i]]);
+                    if (rc) cs_val_release(c, regs[ins->dest]);
+                    regs[ins->dest] = sum;
+                }
+                if (c->err != CS_OK) return CS_NIL;
+            } break;
+
+            case CS_REF_RETAIN: if (rc) cs_val_retain(regs[ins->a]); break;
+            case CS_REF_RELEASE: {
+                if (!rc) break;
+                if (ins->b) vm_release_reuse(c, regs[ins->a]);
+                else cs_val_release(c, regs[ins->a]);
+            } break;
+
+            case CS_CONS: regs[ins->dest] = cs_list_cons(c, &regs[ins->a], &regs[ins->b]); break;
+            case CS_GETCAR:
+            case CS_GETCDR: {
+                cs_Value list = regs[ins->a];
+                if (list == CS_NIL) {
+                    regs[ins->dest] = CS_NIL;
+                    break;
+                }
+                if (!val_is_list(list)) return vm_error(c, CS_TYPE_ERROR);
+                regs[ins->dest] = ins->op == CS_GETCAR ? cs_list_car(list) : cs_list_cdr(list);
+            } break;
+            case CS_SETCAR:
+            case CS_SETCDR: {
+                if (!val_is_list(regs[ins->a])) return vm_error(c, CS_TYPE_ERROR);
+                cs_Value old = ins->op == CS_SETCAR
+                    ? cs_list_setcar(c, regs[ins->a], regs[ins->b])
+                    : cs_list_setcdr(c, &regs[ins->a], &regs[ins->b]);
+                if (rc) cs_val_release(c, old);
+                regs[ins->dest] = regs[ins->a];
+            } break;
+
+            case CS_JMP: {
+                // every loop jumps back, the profiler samples there and at calls
+                if (cs_profile_due(c)) cs_profile_sample(c, code, fn, ins, frame_count);
+                ip = &code->ins[ins->aux];
+            } break;
+            case CS_BR: ip = &code->ins[val_truthy(regs[ins->a]) ? ins->aux : ins->aux2]; break;
+            case CS_COUNT_BLOCK: {
+                // only in code lowered for --pgo-gen, workers of futures count into the same blocks
+                cs_BlockCounts* counts = c->counts;
+                if (counts == null || ins->aux >= counts->bb_count) break;
+                __atomic_fetch_add(&counts->blocks[ins->aux], 1, __ATOMIC_RELAXED);
+                if (ins->a != CS_REG_NONE && val_truthy(regs[ins->a])) {
+                    __atomic_fetch_add(&counts->taken[ins->aux], 1, __ATOMIC_RELAXED);
+                }
+            } break;
+
+            case CS_DYNCALL: {
+                cs_Value fn_val = regs[ins->b];
+                if (!val_is_fn(fn_val)) return vm_error(c, CS_VAL_NOT_CALLABLE);
+                u32 target = vm_dispatch(c, code, ins, (u32)val_payload(fn_val));
+                if (target == ~0u) return vm_error(c, CS_INVALID_NUMBER_OF_ARGUMENTS);
+                if (target & CS_IC_NATIVE) {
+                    native = &c->natives[target & ~CS_IC_NATIVE];
+                    goto call_native;
+                }
+                callee = &code->fns[target];
+                goto call;
+            }
+            case CS_CALL: {
+                callee = &code->fns[ins->aux];
+            call:
+                if (cs_profile_due(c)) cs_profile_sample(c, code, fn, ins, frame_count);
+                if (frame_count == frame_floor + CS_VM_MAX_FRAMES) return vm_error(c, CS_STACK_OVERFLOW);
+                cs_ensure_cap((void**)&c->frames, sizeof(cs_VMFrame), &c->frame_cap, frame_count + 1);
+                c->frames[frame_count++] = (cs_VMFrame) { .fn = fn, .call = ins, .base = base };
+
+                // the registers of the callee start right after the ones of the caller
+                u32 callee_base = base + fn->reg_count;
+                vm_ensure_stack(c, callee_base + callee->reg_count);
+                regs = c->stack + base;
+                cs_Value* callee_regs = c->stack + callee_base;
+                u16* arg_regs = &code->args[ins->aux2];
+                for (u32 i = 0; i < ins->a; i++) callee_regs[i] = regs[arg_regs[i]];
+                for (u32 i = ins->a; i < callee->reg_count; i++) callee_regs[i] = CS_NIL;
+
+                fn = callee;
+                base = callee_base;
+                regs = callee_regs;
+                c->stack_top = base + fn->reg_count;
+                ip = &code->ins[fn->first_ins];
+            } break;
+            case CS_CALLC: {
+                // loaded code can't know the natives of the context before it runs
+                if (ins->aux >= c->native_count) return vm_error(c, CS_UNKNOWN_OP);
+                native = &c->natives[ins->aux];
+            call_native:;
+                u16* arg_regs = &code->args[ins->aux2];
+                cs_Value args[FUNCTION_MAX_ARGS];
+                for (u32 i = 0; i < ins->a; i++) args[i] = regs[arg_regs[i]];
+                // the caller is on the frames while the native runs, for the profiler and cs_vm_resume
+                cs_ensure_cap((void**)&c->frames, sizeof(cs_VMFrame), &c->frame_cap, frame_count + 1);
+                c->frames[frame_count] = (cs_VMFrame) { .fn = fn, .call = ins, .base = base };
+                c->frame_count = frame_count + 1;
+                cs_Value result = cs_native_call(c, native, args);
+                // a coroutine or isolate waits if suspended, the call is made again when cs_vm_resume continues with this frame
+                if (c->err != CS_OK) return CS_NIL;
+                // the time the native took is counted for its call
+                if (cs_profile_due(c)) cs_profile_sample(c, code, fn, ins, frame_count);
+                // the native may have called back into cisp and grown the stack
+                regs = c->stack + base;
+                regs[ins->dest] = result;
+            } break;
+            case CS_RET: {
+                cs_Value result = ins->a != CS_REG_NONE ? regs[ins->a] : CS_NIL;
+                if (frame_count == frame_floor) return result;
+                cs_VMFrame* frame = &c->frames[--frame_count];
+                fn = frame->fn;
+                base = frame->base;
+                regs = c->stack + base;
+                c->stack_top = base + fn->reg_count;
+                if (frame->call->dest != CS_REG_NONE) regs[frame->call->dest] = result;
+                else if (rc) cs_val_release(c, result);
+                ip = frame->call + 1;
+            } break;
+
+            default: {
+                log_error("unsupported instruction %s", cs_OpKindStrings[ins->op]);
+                return vm_error(c, CS_UNKNOWN_OP);
+            }
+        }
+    }
+}
+
+// the code stays set while it is suspended, see cs_run_resume. counter is the one to count allocations into again
+static cs_Value run_finish(cs_Context* c, cs_Value result, u64* counter)
+{
+    if (c->err == CS_SUSPENDED) {
+        cs_count_allocs(counter);
+        return CS_NIL;
+    }
+    if (c->loop != null) cs_loop_drain(c);
+    if (c->futures != null) cs_futures_wait(c);
+    c->code = null;
+    cs_count_allocs(counter);
+    return result;
+}
+
+// executes the entry function of code and returns its result.
+// errors stop execution and are collected like compile errors
+cs_Value cs_run(cs_Context* c, cs_Code* code)
+{
+    if (code == null || code->fn_count == 0) return CS_NIL;
+    u64* counter = cs_count_allocs(&c->alloc_count);
+    c->err = CS_OK;
+    c->error_count = 0;
+
+    if (c->global_count < code->global_count) {
+        c->globals = cs_realloc(c->globals, sizeof(cs_Value) * code->global_count);
+        for (u32 i = c->global_count; i < code->global_count; i++) c->globals[i] = CS_NIL;
+        c->global_count = code->global_count;
+    }
+
+    if (c->reuse_chunk != null) {
+        cs_chunk_free(c, c->reuse_chunk);
+        c->reuse_chunk = null;
+    }
+
+    // the caches of the last code run don't fit this one
+    if (c->cache_cap < code->cache_count) {
+        c->cache_cap = code->cache_count;
+        c->caches = cs_realloc(c->caches, sizeof(cs_CallCache) * c->cache_cap);
+    }
+    if (code->cache_count > 0) memset(c->caches, 0, sizeof(cs_CallCache) * code->cache_count);
+    if (c->megamorphic != null) memset(c->megamorphic, 0xFF, sizeof(cs_CallTarget) * CS_IC_SHARED_SIZE);
+
+    // code compiled for the other memory mode can still run, it just never frees anything
+    c->rc = (code->flags & CS_CODE_RC) && c->memory == CS_MEMORY_RC;
+    c->code = code;
+    c->frame_count = 0;
+    cs_CodeFn* fn = &code->fns[code->entry_fn];
+    vm_ensure_stack(c, fn->reg_count);
+    for (u32 i = 0; i < fn->reg_count; i++) c->stack[i] = CS_NIL;
+    c->stack_top = fn->reg_count;
+    if (c->futures != null) cs_futures_sync(c);
+    return run_finish(c, vm_execute(c, code, fn, 0, &code->ins[fn->first_ins], 0), counter);
+}
+
+// continues the code of an isolate that cs_run left suspended at a channel, the call it waited in is made again
+cs_Value cs_run_resume(cs_Context* c)
+{
+    u64* counter = cs_count_allocs(&c->alloc_count);
+    c->err = CS_OK;
+    return run_finish(c, cs_vm_resume(c), counter);
+}
+
+/* ==== NATIVE CALLS ==== */
+// count registers after the ones in use, all nil
+u32 cs_native_regs(cs_Context* c, u32 count)
+{
+    u32 first = c->stack_top;
+    vm_ensure_stack(c, first + count);
+    for (u32 i = 0; i < count; i++) c->stack[first + i] = CS_NIL;
+    c->stack_top = first + count;
+    return first;
+}
+
+void cs_native_regs_pop(cs_Context* c, u32 first)
+{
+    c->stack_top = first;
+}
+
+// calls a function value from a native with borrowed arguments, the result owns a reference
+cs_Value cs_call(cs_Context* c, cs_Value fn_val, cs_Value* args, u32 arg_count)
+{
+    if (c->code == null) return vm_error(c, CS_UNKNOWN_OP);
+    if (!val_is_fn(fn_val)) return vm_error(c, CS_VAL_NOT_CALLABLE);
+    u32 target = vm_lookup_target(c, c->code, (u32)val_payload(fn_val), arg_count);
+    if (target == ~0u) return vm_error(c, CS_INVALID_NUMBER_OF_ARGUMENTS);
+    if (target & CS_IC_NATIVE) return cs_native_call(c, &c->natives[target & ~CS_IC_NATIVE], args);
+
+    cs_CodeFn* fn = &c->code->fns[target];
+    u32 top = c->stack_top;
+    vm_ensure_stack(c, top + fn->reg_count);
+    for (u32 i = 0; i < arg_count; i++) c->stack[top + i] = args[i];
+    for (u32 i = arg_count; i < fn->reg_count; i++) c->stack[top + i] = CS_NIL;
+    c->stack_top = top + fn->reg_count;
+    u32 frame_count = c->frame_count;
+    c->call_depth += 1;
+    cs_Value result = vm_execute(c, c->code, fn, top, &c->code->ins[fn->first_ins], frame_count);
+    c->call_depth -= 1;
+    c->frame_count = frame_count;
+    c->stack_top = top;
+    return result;
+}
+
+/* ==== COROUTINES ==== */
+// the registers and frames of c are the coroutine's own and still empty. returns like cs_vm_resume
+cs_Value cs_vm_start(cs_Context* c, cs_Value fn_val, cs_Value* args, u32 arg_count)
+{
+    if (!val_is_fn(fn_val)) return vm_error(c, CS_VAL_NOT_CALLABLE);
+    u32 target = vm_lookup_target(c, c->code, (u32)val_payload(fn_val), arg_count);
+    if (target == ~0u) return vm_error(c, CS_INVALID_NUMBER_OF_ARGUMENTS);
+    if (target & CS_IC_NATIVE) {
+        // there is no frame to continue with, so a native waits in place
+        c->call_depth += 1;
+        cs_Value result = cs_native_call(c, &c->natives[target & ~CS_IC_NATIVE], args);
+        c->call_depth -= 1;
+        return result;
+    }
+
+    cs_CodeFn* fn = &c->code->fns[target];
+    vm_ensure_stack(c, fn->reg_count);
+    for (u32 i = 0; i < arg_count; i++) c->stack[i] = args[i];
+    for (u32 i = arg_count; i < fn->reg_count; i++) c->stack[i] = CS_NIL;
+    c->stack_top = fn->reg_count;
+    c->frame_count = 0;
+    return vm_execute(c, c->code, fn, 0, &c->code->ins[fn->first_ins], 0);
+}
+
+// continues a coroutine that was suspended, whose registers and frames c has again, with the call it waited in.
+// the result once it is done, c->err is CS_SUSPENDED if it waits again
+cs_Value cs_vm_resume(cs_Context* c)
+{
+    cs_VMFrame* frame = &c->frames[--c->frame_count];
+    c->stack_top = frame->base + frame->fn->reg_count;
+    return vm_execute(c, c->code, frame->fn, frame->base, frame->call, 0);
+}
@@ -1,4 +1,4 @@
 @echo off
-clang src/test.c src/map.c src/console.c -o _test.exe -O0 -gfull -g3 -Wall -Wno-switch -Wno-microsoft-enum-forward-reference -Wno-unused-variable -Wno-unused-function
+clang src/test.c src/cisp.c src/map.c src/console.c src/code.c src/opt.c src/ir.c src/vm.c src/rc.c src/gc.c src/list.c src/native.c src/lib.c src/sched.c src/co.c src/stats.c src/prof.c -o _test.exe -O0 -gfull -g3 -Wall -Wno-switch -Wno-microsoft-enum-forward-reference -Wno-unused-variable -Wno-unused-function
 _test.exe
 @echo on
\ No newline at end of file